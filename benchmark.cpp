@@ -0,0 +1,165 @@
+/*
+Copyright (c) 2005-2010 Lode Vandevenne
+All rights reserved.
+
+This file is part of Lode's Programming Interface.
+
+Lode's Programming Interface is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Lode's Programming Interface is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+The benchmark of the drawers (see lpi_benchmark.h), as a program without a GUI of its own. It has
+its own main, so it's only compiled when LPI_BENCHMARK_MAIN is defined, and then without main.cpp:
+
+g++ -O2 -DLPI_BENCHMARK_MAIN benchmark.cpp lpi_*.cpp lodepng.cpp lodewav.cpp stb_image.cpp -lSDL -lGL -lpthread
+
+./a.out                         all scenes with the buffer drawer, the results to bench_*.png
+./a.out -r bench_ -o new_       compare with the PNGs of an earlier run, e.g. before an optimization
+./a.out -gl                     with the OpenGL drawer, this needs a display (a software GL is fine)
+
+Options:
+-w width -h height: size of the screen (1024x768 by default)
+-t seconds: minimum time per scene (1 by default)
+-o prefix: prefix of the written PNGs, "-" to write none
+-r prefix: prefix of the PNGs to compare with
+-threads n: the deferred mode of the buffer drawer with n threads (0 is one per processor)
+-premultiplied: the buffer drawer with premultiplied alpha
+-gl: the OpenGL drawer instead of the buffer drawer, also prints its draw calls and state changes per frame
+-list: print the names of the scenes
+Other arguments are the names of the scenes to run, all scenes if there are none.
+*/
+
+#if defined(LPI_BENCHMARK_MAIN)
+
+#include "lpi_benchmark.h"
+#include "lpi_gui_drawer_gl.h"
+#include "lpi_screen_gl.h"
+
+#include <GL/gl.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace
+{
+
+//draws with Drawer2DGL on the screen, the pixels are read back with glReadPixels
+class BenchmarkTargetGL : public lpi::IBenchmarkTarget
+{
+  private:
+    lpi::ScreenGL screen;
+    lpi::gui::GUIDrawerGL guidrawer;
+    lpi::Drawer2DGL& drawer;
+
+  public:
+    BenchmarkTargetGL(int w, int h)
+    : screen(w, h, false, false, false, "lpi benchmark")
+    , guidrawer(&screen)
+    , drawer(dynamic_cast<lpi::Drawer2DGL&>(guidrawer.getDrawer()))
+    {
+    }
+
+    virtual lpi::gui::IGUIDrawer& getDrawer() { return guidrawer; }
+    virtual void clear() { screen.cls(lpi::ColorRGB(48, 48, 48)); }
+    virtual void finish() { glFinish(); }
+
+    virtual bool getFrameStats(size_t& drawcalls, size_t& statechanges, size_t& skippedstatechanges)
+    {
+      const lpi::GLState::Stats& stats = screen.getGLContext()->getState().getStats();
+      drawcalls = drawer.getNumDrawCalls();
+      statechanges = stats.issued;
+      skippedstatechanges = stats.skipped;
+      return true;
+    }
+
+    virtual void getPixels(std::vector<unsigned char>& rgba, int& w, int& h)
+    {
+      w = screen.screenWidth();
+      h = screen.screenHeight();
+      std::vector<unsigned char> pixels(w * h * 4);
+      glPixelStorei(GL_PACK_ALIGNMENT, 1);
+      glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+      //OpenGL has the bottom row first
+      rgba.resize(w * h * 4);
+      for(int y = 0; y < h; y++) std::copy(&pixels[4 * w * (h - 1 - y)], &pixels[4 * w * (h - y)], &rgba[4 * w * y]);
+    }
+};
+
+} //namespace
+
+int main(int argc, char* argv[])
+{
+  int w = 1024;
+  int h = 768;
+  int threads = -1;
+  bool premultiplied = false;
+  bool gl = false;
+  lpi::BenchmarkOptions options;
+  options.output_prefix = "bench_";
+
+  for(int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    bool hasvalue = i + 1 < argc;
+    if(arg == "-w" && hasvalue) w = std::atoi(argv[++i]);
+    else if(arg == "-h" && hasvalue) h = std::atoi(argv[++i]);
+    else if(arg == "-t" && hasvalue) options.seconds = std::atof(argv[++i]);
+    else if(arg == "-o" && hasvalue) { options.output_prefix = argv[++i]; if(options.output_prefix == "-") options.output_prefix.clear(); }
+    else if(arg == "-r" && hasvalue) options.reference_prefix = argv[++i];
+    else if(arg == "-threads" && hasvalue) threads = std::atoi(argv[++i]);
+    else if(arg == "-premultiplied") premultiplied = true;
+    else if(arg == "-gl") gl = true;
+    else if(arg == "-list")
+    {
+      std::vector<std::string> names;
+      lpi::getBenchmarkSceneNames(names);
+      for(size_t j = 0; j < names.size(); j++) std::cout << names[j] << std::endl;
+      return 0;
+    }
+    else if(!arg.empty() && arg[0] == '-')
+    {
+      std::cout << "unknown option " << arg << ", see benchmark.cpp for the options" << std::endl;
+      return 1;
+    }
+    else options.scenes.push_back(arg);
+  }
+
+  std::vector<lpi::BenchmarkResult> results;
+  if(gl)
+  {
+    BenchmarkTargetGL target(w, h);
+    lpi::runBenchmark(results, target, options);
+    std::cout << "OpenGL drawer, " << w << "x" << h << std::endl;
+  }
+  else
+  {
+    lpi::BenchmarkTargetBuffer target(w, h);
+    lpi::Drawer2DBuffer& drawer = target.getBufferDrawer();
+    drawer.setPremultipliedAlpha(premultiplied);
+    if(threads >= 0) drawer.setDeferred(true, threads);
+    lpi::runBenchmark(results, target, options);
+    std::cout << "buffer drawer, " << w << "x" << h;
+    if(premultiplied) std::cout << ", premultiplied";
+    if(threads >= 0) std::cout << ", deferred with " << threads << " threads";
+    std::cout << std::endl;
+  }
+  std::cout << lpi::formatBenchmarkResults(results);
+
+  return 0;
+}
+
+#endif //LPI_BENCHMARK_MAIN
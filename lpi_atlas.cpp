@@ -0,0 +1,311 @@
+/*
+Copyright (c) 2005-2010 Lode Vandevenne
+All rights reserved.
+
+This file is part of Lode's Programming Interface.
+
+Lode's Programming Interface is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Lode's Programming Interface is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "lpi_atlas.h"
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+
+namespace lpi
+{
+
+////////////////////////////////////////////////////////////////////////////////
+//AtlasPacker///////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+AtlasPacker::AtlasPacker(int width, int height)
+{
+  reset(width, height);
+}
+
+void AtlasPacker::reset(int width, int height)
+{
+  this->width = width;
+  this->height = height;
+  used = 0;
+  skyline.clear();
+  if(width <= 0 || height <= 0) return;
+  Segment s;
+  s.x = 0;
+  s.y = 0;
+  s.w = width;
+  skyline.push_back(s);
+}
+
+int AtlasPacker::fit(size_t index, int w, int h) const
+{
+  if(skyline[index].x + w > width) return -1;
+  //the rectangle rests on the highest segment under it
+  int y = 0;
+  int left = w;
+  for(size_t i = index; left > 0; i++)
+  {
+    if(i >= skyline.size()) return -1;
+    y = std::max(y, skyline[i].y);
+    if(y + h > height) return -1;
+    left -= skyline[i].w;
+  }
+  return y;
+}
+
+bool AtlasPacker::insert(int& x, int& y, int w, int h)
+{
+  if(w <= 0 || h <= 0) return false;
+
+  size_t best = skyline.size();
+  int bestbottom = INT_MAX;
+  int bestwidth = INT_MAX;
+  for(size_t i = 0; i < skyline.size(); i++)
+  {
+    int fy = fit(i, w, h);
+    if(fy < 0) continue;
+    //lowest bottom, and of those the narrowest segment, to leave the wide ones for wide rectangles
+    if(fy + h < bestbottom || (fy + h == bestbottom && skyline[i].w < bestwidth))
+    {
+      best = i;
+      bestbottom = fy + h;
+      bestwidth = skyline[i].w;
+    }
+  }
+  if(best == skyline.size()) return false;
+
+  x = skyline[best].x;
+  y = bestbottom - h;
+
+  Segment s;
+  s.x = x;
+  s.y = bestbottom;
+  s.w = w;
+  skyline.insert(skyline.begin() + best, s);
+
+  //the segments that are now under the rectangle are shortened or removed
+  for(size_t i = best + 1; i < skyline.size();)
+  {
+    int end = skyline[i - 1].x + skyline[i - 1].w;
+    if(skyline[i].x >= end) break;
+    int shrink = end - skyline[i].x;
+    skyline[i].x += shrink;
+    skyline[i].w -= shrink;
+    if(skyline[i].w > 0) break;
+    skyline.erase(skyline.begin() + i);
+  }
+
+  //neighbours at the same height become one segment
+  for(size_t i = 0; i + 1 < skyline.size();)
+  {
+    if(skyline[i].y == skyline[i + 1].y)
+    {
+      skyline[i].w += skyline[i + 1].w;
+      skyline.erase(skyline.begin() + i + 1);
+    }
+    else i++;
+  }
+
+  used += (size_t)w * h;
+  return true;
+}
+
+double AtlasPacker::getOccupancy() const
+{
+  if(width <= 0 || height <= 0) return 0.0;
+  return (double)used / ((double)width * height);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//AtlasTexture//////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+AtlasTexture::AtlasTexture(const TextureAtlas* atlas)
+: atlas(atlas)
+, page(0)
+, x(0)
+, y(0)
+, u(0)
+, v(0)
+{
+}
+
+void AtlasTexture::setSize(size_t u, size_t v)
+{
+  if(page && u == this->u && v == this->v) return;
+  atlas->allocate(this, u, v);
+}
+
+unsigned char* AtlasTexture::getBuffer()
+{
+  return page ? page->getBuffer() + 4 * (y * page->getU2() + x) : 0;
+}
+
+const unsigned char* AtlasTexture::getBuffer() const
+{
+  return page ? page->getBuffer() + 4 * (y * page->getU2() + x) : 0;
+}
+
+void AtlasTexture::extrude()
+{
+  int p = atlas->padding;
+  if(!page || p == 0 || u == 0 || v == 0) return;
+
+  size_t u2 = page->getU2();
+  unsigned char* b = page->getBuffer();
+  int x1 = x + u - 1; //last column and row of the region
+  int y1 = y + v - 1;
+
+  for(int r = y; r <= y1; r++)
+  {
+    unsigned char* row = b + 4 * u2 * r;
+    for(int i = 1; i <= p; i++)
+    {
+      std::memcpy(row + 4 * (x - i), row + 4 * x, 4);
+      std::memcpy(row + 4 * (x1 + i), row + 4 * x1, 4);
+    }
+  }
+
+  //the rows above and below, including the corners
+  size_t length = 4 * (u + 2 * p);
+  for(int i = 1; i <= p; i++)
+  {
+    std::memcpy(b + 4 * (u2 * (y - i) + x - p), b + 4 * (u2 * y + x - p), length);
+    std::memcpy(b + 4 * (u2 * (y1 + i) + x - p), b + 4 * (u2 * y1 + x - p), length);
+  }
+}
+
+void AtlasTexture::update()
+{
+  if(!page) return;
+  int p = atlas->padding;
+  extrude();
+  page->updatePartial(x - p, y - p, x + u + p, y + v + p);
+}
+
+void AtlasTexture::updatePartial(int x0, int y0, int x1, int y1)
+{
+  if(!page) return;
+  int p = atlas->padding;
+  extrude();
+  //a change at the edge also changes the padding
+  page->updatePartial(x0 <= 0 ? x - p : x + x0
+                    , y0 <= 0 ? y - p : y + y0
+                    , x1 >= (int)u ? x + (int)u + p : x + x1
+                    , y1 >= (int)v ? y + (int)v + p : y + y1);
+}
+
+const ITexture* AtlasTexture::getStorage(int& x, int& y) const
+{
+  if(!page) return ITexture::getStorage(x, y);
+  x = this->x;
+  y = this->y;
+  return page;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//TextureAtlas//////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+TextureAtlas::TextureAtlas(const ITextureFactory* factory, int pagesize, int padding)
+: factory(factory)
+, pagesize(pagesize)
+, padding(padding)
+{
+}
+
+TextureAtlas::~TextureAtlas()
+{
+  for(size_t i = 0; i < pages.size(); i++) delete pages[i].texture;
+}
+
+AtlasTexture* TextureAtlas::createNewTexture() const
+{
+  return new AtlasTexture(this);
+}
+
+void TextureAtlas::allocate(AtlasTexture* texture, size_t u, size_t v) const
+{
+  int w = u + 2 * padding;
+  int h = v + 2 * padding;
+  int px = 0, py = 0;
+
+  size_t index = 0;
+  while(index < pages.size() && !pages[index].packer.insert(px, py, w, h)) index++;
+
+  if(index == pages.size())
+  {
+    //a new page, transparent where there are no regions
+    Page page;
+    page.texture = factory->createNewTexture();
+    page.texture->setSize(std::max(pagesize, w), std::max(pagesize, h));
+    std::fill(page.texture->getBuffer(), page.texture->getBuffer() + 4 * page.texture->getU2() * page.texture->getV2(), 0);
+    page.texture->update();
+    page.packer.reset(page.texture->getU(), page.texture->getV());
+    page.packer.insert(px, py, w, h);
+    pages.push_back(page);
+  }
+
+  texture->page = pages[index].texture;
+  texture->x = px + padding;
+  texture->y = py + padding;
+  texture->u = u;
+  texture->v = v;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+const ITexture* getAtlasPage(const ITexture* texture, int& x, int& y)
+{
+  if(texture) return texture->getStorage(x, y);
+  x = 0;
+  y = 0;
+  return 0;
+}
+
+const SpriteInstance* resolveAtlasSprites(std::vector<SpriteInstance>& out, const SpriteInstance* sprites, size_t& n)
+{
+  bool found = false; //out is only used from the first AtlasTexture on
+  for(size_t i = 0; i < n; i++)
+  {
+    const SpriteInstance& s = sprites[i];
+    const AtlasTexture* texture = dynamic_cast<const AtlasTexture*>(s.texture);
+    if(!texture || !texture->getPage())
+    {
+      if(found) out.push_back(s);
+      continue;
+    }
+    if(!found)
+    {
+      out.assign(sprites, sprites + i);
+      found = true;
+    }
+    //after moving it to the page the drawers can't check anymore if the part is inside the texture
+    if(s.u0 < 0 || s.v0 < 0 || s.u1 > (int)texture->getU() || s.v1 > (int)texture->getV() || s.u0 >= s.u1 || s.v0 >= s.v1) continue;
+    out.push_back(s);
+    SpriteInstance& r = out.back();
+    r.texture = texture->getPage();
+    r.u0 += texture->getX();
+    r.v0 += texture->getY();
+    r.u1 += texture->getX();
+    r.v1 += texture->getY();
+  }
+  if(!found) return sprites;
+  n = out.size();
+  return out.empty() ? sprites : &out[0];
+}
+
+} //namespace lpi
@@ -0,0 +1,186 @@
+/*
+Copyright (c) 2005-2010 Lode Vandevenne
+All rights reserved.
+
+This file is part of Lode's Programming Interface.
+
+Lode's Programming Interface is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Lode's Programming Interface is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "lpi_texture.h"
+#include "lpi_draw2d.h"
+
+#include <vector>
+
+/*
+lpi_atlas: many small textures (glyphs, GUI parts, ...) packed in a few large textures.
+
+A TextureAtlas is a texture factory: the textures it creates are AtlasTextures, that get a region
+of a page (a large texture made with another factory, e.g. TextureFactoryGL or the factory of
+TextureBuffer) when their size is set. Their buffer is the region in the buffer of the page, so
+the functions of lpi_texture that load or edit a texture work on them like on any texture, and
+textures loaded with e.g. loadTextures(..., &atlas, ...) end up in the pages.
+
+The drawers draw an AtlasTexture as the part of its page, so drawing many textures of the same
+atlas uses the same texture all the time: in OpenGL there's no bind in between, and drawTextures
+batches them in one vertex array.
+
+The regions are never given back: deleting an AtlasTexture or setting a different size leaves
+its old region unused. An atlas is meant for textures that are loaded once and kept. The atlas
+must outlive its textures.
+*/
+
+namespace lpi
+{
+
+/*
+Skyline bottom-left rectangle packer: the used area is described by its top outline (the
+skyline), each rectangle is placed on the skyline where its bottom is lowest. Fast, and for
+rectangles of similar size (like glyphs and GUI parts) only a few percent of the area is lost.
+*/
+class AtlasPacker
+{
+  private:
+    struct Segment
+    {
+      int x;
+      int y; //the first free row
+      int w;
+    };
+
+    int width;
+    int height;
+    std::vector<Segment> skyline;
+    size_t used; //area of the inserted rectangles
+
+    int fit(size_t index, int w, int h) const; //y where the rectangle fits with its left at the segment, -1 if it doesn't
+
+  public:
+    AtlasPacker(int width = 0, int height = 0);
+
+    void reset(int width, int height); //empty area of the given size
+
+    //finds a place for a rectangle of w * h and sets x and y to its top left, returns false if there's no room
+    bool insert(int& x, int& y, int w, int h);
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    double getOccupancy() const; //the inserted area divided by the total area
+};
+
+class TextureAtlas;
+
+/*
+A texture that is a region of a page of a TextureAtlas. getU2 is the row length of the page, and
+getBuffer points to the top left pixel of the region in the buffer of the page, so the usual
+4 * getU2() * y + 4 * x addressing works. getV2 is the height of the region.
+*/
+class AtlasTexture : public ITexture
+{
+  private:
+    const TextureAtlas* atlas;
+    ITexture* page; //0 until the size is set
+    int x; //position of the region in the page
+    int y;
+    size_t u;
+    size_t v;
+
+    void extrude(); //copies the edges of the region to the padding around it
+
+    friend class TextureAtlas;
+
+  public:
+    AtlasTexture(const TextureAtlas* atlas);
+
+    virtual void setSize(size_t u, size_t v); //gets a new region, unless the size is the same
+    virtual size_t getU() const { return u; }
+    virtual size_t getV() const { return v; }
+
+    virtual size_t getU2() const { return page ? page->getU2() : 0; }
+    virtual size_t getV2() const { return v; }
+
+    virtual unsigned char* getBuffer();
+    virtual const unsigned char* getBuffer() const;
+
+    virtual void update();
+    virtual void updatePartial(int x0, int y0, int x1, int y1);
+
+    virtual const ITexture* getStorage(int& x, int& y) const; //the page and the region in it, once the size is set
+
+    const ITexture* getPage() const { return page; }
+    int getX() const { return x; }
+    int getY() const { return y; }
+};
+
+class TextureAtlas : public ITextureFactory
+{
+  private:
+    struct Page
+    {
+      ITexture* texture;
+      AtlasPacker packer;
+    };
+
+    const ITextureFactory* factory;
+    int pagesize;
+    int padding;
+    //mutable because creating textures is const for a factory, but new regions may need a new page
+    mutable std::vector<Page> pages;
+
+    void allocate(AtlasTexture* texture, size_t u, size_t v) const;
+
+    friend class AtlasTexture;
+
+  public:
+    /*
+    factory: creates the pages. pagesize: width and height of the pages, a texture larger than
+    that gets a page of its own. padding: empty pixels around each region, that the textures
+    fill with their edge pixels, so that bilinear filtering in OpenGL doesn't mix in neighbours.
+    The factory is only used when a texture gets a region, so it only has to exist then: an owner
+    that gets a factory only for loading, can set it with setFactory every time it loads.
+    */
+    TextureAtlas(const ITextureFactory* factory, int pagesize = 512, int padding = 1);
+    ~TextureAtlas();
+    
+    void setFactory(const ITextureFactory* factory) { this->factory = factory; }
+
+    virtual AtlasTexture* createNewTexture() const;
+
+    size_t getNumPages() const { return pages.size(); }
+    const ITexture* getPage(size_t i) const { return pages[i].texture; }
+    double getOccupancy(size_t i) const { return pages[i].packer.getOccupancy(); }
+
+  private:
+    TextureAtlas(const TextureAtlas&); //the pages are owned, don't copy
+    TextureAtlas& operator=(const TextureAtlas&);
+};
+
+/*
+Returns the texture that has the pixels of texture and sets x and y to the position of texture
+in it: for an AtlasTexture its page and region, for other textures the texture itself and 0, 0.
+This is texture->getStorage(x, y).
+*/
+const ITexture* getAtlasPage(const ITexture* texture, int& x, int& y);
+
+/*
+For drawTextures of the drawers: returns the sprites with the AtlasTextures replaced by their page
+and the part moved to the region, so that sprites of the same atlas page are sorted together. If
+there are no AtlasTextures, sprites itself is returned, else the sprites are stored in out. Sprites
+of an AtlasTexture with a part that isn't inside it are left out, n is set to the amount returned.
+*/
+const SpriteInstance* resolveAtlasSprites(std::vector<SpriteInstance>& out, const SpriteInstance* sprites, size_t& n);
+
+} //namespace lpi
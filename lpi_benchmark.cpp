@@ -0,0 +1,633 @@
+/*
+Copyright (c) 2005-2010 Lode Vandevenne
+All rights reserved.
+
+This file is part of Lode's Programming Interface.
+
+Lode's Programming Interface is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Lode's Programming Interface is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "lpi_benchmark.h"
+
+#include "lpi_blend.h"
+#include "lpi_file.h"
+#include "lpi_gui.h"
+#include "lpi_imageformats.h"
+#include "lpi_texture.h"
+#include "lpi_time.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <sstream>
+
+namespace lpi
+{
+
+////////////////////////////////////////////////////////////////////////////////
+
+BenchmarkTargetBuffer::BenchmarkTargetBuffer(int w, int h)
+: drawer(dynamic_cast<Drawer2DBuffer&>(guidrawer.getDrawer()))
+, buffer(w * h * 4)
+, w(w)
+, h(h)
+{
+  drawer.setBuffer(&buffer[0], w, h);
+}
+
+gui::IGUIDrawer& BenchmarkTargetBuffer::getDrawer()
+{
+  return guidrawer;
+}
+
+void BenchmarkTargetBuffer::clear()
+{
+  //opaque dark grey, so that translucent shapes are blended over something
+  for(size_t i = 0; i < buffer.size(); i += 4)
+  {
+    buffer[i + 0] = buffer[i + 1] = buffer[i + 2] = 48;
+    buffer[i + 3] = 255;
+  }
+}
+
+void BenchmarkTargetBuffer::setBlendSettings(bool texture_alpha_as_opacity, bool color_alpha_as_opacity, double extra_opacity)
+{
+  drawer.setTextureAlphaAsOpacity(texture_alpha_as_opacity);
+  drawer.setColorAlphaAsOpacity(color_alpha_as_opacity);
+  drawer.setExtraOpacity(extra_opacity);
+}
+
+void BenchmarkTargetBuffer::getPixels(std::vector<unsigned char>& rgba, int& w, int& h)
+{
+  rgba = buffer;
+  if(drawer.isPremultipliedAlpha()) unpremultiplySpan(&rgba[0], &rgba[0], rgba.size() / 4);
+  w = this->w;
+  h = this->h;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+double BenchmarkResult::getMPixelsPerSecond() const
+{
+  return seconds > 0 ? pixels * repetitions / seconds / 1000000.0 : 0.0;
+}
+
+double BenchmarkResult::getCallsPerSecond() const
+{
+  return seconds > 0 ? (double)calls * repetitions / seconds : 0.0;
+}
+
+double BenchmarkResult::getNanosecondsPerCall() const
+{
+  return calls * repetitions > 0 ? seconds * 1000000000.0 / ((double)calls * repetitions) : 0.0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+//random numbers that are the same on every platform and with every standard library, so the scenes are too
+class BenchmarkRandom
+{
+  private:
+    unsigned long state;
+
+  public:
+    BenchmarkRandom(unsigned long seed) : state(seed) {}
+
+    int get(int n) //0 to n - 1, n at most 65536
+    {
+      state = (state * 1103515245UL + 12345UL) & 0xffffffffUL;
+      return (int)((state >> 16) % n);
+    }
+
+    int get(int lo, int hi) { return lo + get(hi - lo + 1); } //lo to hi, inclusive
+
+    ColorRGB color(bool translucent)
+    {
+      ColorRGB c;
+      c.r = get(256);
+      c.g = get(256);
+      c.b = get(256);
+      c.a = translucent ? get(256) : 255;
+      return c;
+    }
+};
+
+enum CallType
+{
+  CALL_RECTANGLE,
+  CALL_LINE,
+  CALL_TRIANGLE,
+  CALL_CIRCLE,
+  CALL_GRADIENT_RECTANGLE,
+  CALL_GRADIENT_TRIANGLE,
+  CALL_TEXTURE,
+  CALL_TEXTURE_SIZED,
+  CALL_TEXT
+};
+
+struct BenchmarkCall
+{
+  CallType type;
+  int p[6]; //coordinates, sizes or radius, depending on the type
+  ColorRGB color[3];
+  size_t texture;
+  std::string text;
+};
+
+/*
+The textures of the texture scenes: opaque, translucent, with holes (alpha only 0 or 255), and one that
+isn't square. They're generated, not loaded, so the benchmark doesn't need any files.
+*/
+const size_t NUM_BENCHMARK_TEXTURES = 4;
+
+void makeBenchmarkTexture(ITexture* texture, size_t index)
+{
+  static const int sizes[NUM_BENCHMARK_TEXTURES][2] = { { 64, 64 }, { 64, 64 }, { 32, 32 }, { 100, 50 } };
+  int u = sizes[index][0];
+  int v = sizes[index][1];
+  std::vector<unsigned char> buffer(u * v * 4);
+  for(int y = 0; y < v; y++)
+  for(int x = 0; x < u; x++)
+  {
+    unsigned char* p = &buffer[4 * (y * u + x)];
+    p[0] = (x * 255) / u;
+    p[1] = (y * 255) / v;
+    p[2] = ((x ^ y) & 8) ? 255 : 64;
+    if(index == 1) p[3] = ((x + y) * 255) / (u + v - 2);
+    else if(index == 2) p[3] = ((x - 16) * (x - 16) + (y - 16) * (y - 16) < 196) ? 255 : 0;
+    else p[3] = 255;
+  }
+  makeTextureFromBuffer(texture, &buffer[0], u, v);
+}
+
+/*
+The GUI scene: windows with the standard controls, drawn by the MainContainer like a
+program does it every frame.
+*/
+class BenchmarkGUI
+{
+  private:
+    gui::MainContainer c;
+    gui::Window w1;
+    gui::Window w2;
+    gui::Window w3;
+    gui::Button buttons[8];
+    gui::Scrollbar hbar;
+    gui::Scrollbar vbar;
+    gui::Slider slider;
+    gui::Checkbox checkboxes[8];
+    gui::Tabs tabs;
+    gui::Text texts[8];
+
+  public:
+    BenchmarkGUI(gui::IGUIDrawer& drawer)
+    : c(drawer)
+    {
+      int w = drawer.getWidth();
+      int h = drawer.getHeight();
+
+      w1.resize(w / 20, h / 20, w / 2, h * 3 / 4);
+      w1.addTop(drawer);
+      w1.addTitle("Window 1");
+      w1.addCloseButton(drawer);
+      w1.addResizer(drawer);
+      w1.setColorMod(ColorRGB(255, 0, 0, 192));
+      c.pushTop(&w1);
+      for(int i = 0; i < 8; i++)
+      {
+        std::ostringstream ss;
+        ss << "button " << i;
+        buttons[i].makeTextPanel(0, 0, ss.str(), 80, 24);
+        w1.pushTopAt(&buttons[i], 16, 40 + 32 * i);
+        checkboxes[i].make(0, 0, i % 2 == 0);
+        w1.pushTopAt(&checkboxes[i], 112, 44 + 32 * i);
+        texts[i].make(0, 0, ss.str(), FONT_White);
+        w1.pushTopAt(&texts[i], 136, 48 + 32 * i);
+      }
+      hbar.makeHorizontal(0, 0, 200, 100, drawer);
+      w1.pushTopAt(&hbar, 16, 320);
+      vbar.makeVertical(0, 0, 200, 100, drawer);
+      w1.pushTopAt(&vbar, 240, 40);
+      slider.makeHorizontal(0, 0, 200, 100, drawer);
+      w1.pushTopAt(&slider, 16, 350);
+
+      w2.resize(w / 3, h / 5, w * 9 / 10, h * 9 / 10);
+      w2.addTop(drawer);
+      w2.addTitle("Window 2");
+      w2.addCloseButton(drawer);
+      w2.addResizer(drawer);
+      w2.setColorMod(ColorRGB(255, 255, 255, 224));
+      c.pushTop(&w2);
+      tabs.resize(0, 0, w2.getSizeX(), w2.getSizeY() - 32);
+      tabs.addTab("tab 1");
+      tabs.addTab("tab 2");
+      tabs.addTab("tab 3");
+      w2.pushTopAt(&tabs, 0, 0, gui::Sticky(0.0, 0, 0.0, 0, 1.0, 0, 1.0, 0));
+
+      w3.resize(w / 4, h / 2, w * 3 / 5, h - 8);
+      w3.addTop(drawer);
+      w3.addTitle("Window 3");
+      w3.addScrollbars(drawer);
+      c.pushTop(&w3);
+    }
+
+    void draw(gui::IGUIDrawer& drawer) const
+    {
+      c.draw(drawer);
+    }
+};
+
+struct BenchmarkScene
+{
+  std::vector<BenchmarkCall> calls;
+  double pixels;
+  bool texture_alpha_as_opacity;
+  bool color_alpha_as_opacity;
+  double extra_opacity;
+  BenchmarkGUI* gui; //only for the GUI scene
+
+  BenchmarkScene() : pixels(0), texture_alpha_as_opacity(true), color_alpha_as_opacity(true), extra_opacity(1.0), gui(0) {}
+  ~BenchmarkScene() { delete gui; }
+};
+
+//the scenes in the order they're run, the texture scenes come between these two lists
+const char* const SHAPE_SCENES[] = { "rectangles", "lines", "triangles", "circles", "gradients" };
+const char* const OTHER_SCENES[] = { "textures_sized", "text", "gui" };
+
+/*
+The name of texture scene i (0-7), the bits of i are the blend settings of ADrawer2DBuffer that differ
+from the default: texture alpha literal, color alpha literal, extra opacity 0.5.
+*/
+std::string textureSceneName(int i)
+{
+  std::string name = "textures";
+  name += (i & 1) ? "_tliteral" : "_talpha";
+  name += (i & 2) ? "_cliteral" : "_calpha";
+  name += (i & 4) ? "_op50" : "_op100";
+  return name;
+}
+
+//the area of the triangle, for the amount of pixels
+double triangleArea(const int* p)
+{
+  return std::abs((double)(p[2] - p[0]) * (p[5] - p[1]) - (double)(p[4] - p[0]) * (p[3] - p[1])) / 2.0;
+}
+
+//a random triangle that fits in a square with sides of at most size inside the screen
+void randomTriangle(BenchmarkRandom& random, int* p, int w, int h, int size)
+{
+  int x = random.get(w - size);
+  int y = random.get(h - size);
+  for(int i = 0; i < 3; i++)
+  {
+    p[2 * i + 0] = x + random.get(size);
+    p[2 * i + 1] = y + random.get(size);
+  }
+}
+
+//generates the calls of the scene. All shapes are inside the screen, so that the amount of pixels is exact.
+bool makeScene(BenchmarkScene& scene, const std::string& name, gui::IGUIDrawer& drawer)
+{
+  int w = drawer.getWidth();
+  int h = drawer.getHeight();
+  BenchmarkRandom random(1234);
+  BenchmarkCall call;
+  call.texture = 0;
+
+  if(name == "rectangles")
+  {
+    for(int i = 0; i < 2000; i++)
+    {
+      call.type = CALL_RECTANGLE;
+      int sx = random.get(1, 200), sy = random.get(1, 200);
+      call.p[0] = random.get(w - sx);
+      call.p[1] = random.get(h - sy);
+      call.p[2] = call.p[0] + sx;
+      call.p[3] = call.p[1] + sy;
+      call.color[0] = random.color(i % 2 == 1);
+      scene.calls.push_back(call);
+      scene.pixels += (double)sx * sy;
+    }
+  }
+  else if(name == "lines")
+  {
+    for(int i = 0; i < 5000; i++)
+    {
+      call.type = CALL_LINE;
+      for(int j = 0; j < 2; j++)
+      {
+        call.p[2 * j + 0] = random.get(w);
+        call.p[2 * j + 1] = random.get(h);
+      }
+      call.color[0] = random.color(i % 2 == 1);
+      scene.calls.push_back(call);
+      scene.pixels += std::max(std::abs(call.p[2] - call.p[0]), std::abs(call.p[3] - call.p[1])) + 1;
+    }
+  }
+  else if(name == "triangles")
+  {
+    for(int i = 0; i < 2000; i++)
+    {
+      call.type = CALL_TRIANGLE;
+      randomTriangle(random, call.p, w, h, 250);
+      call.color[0] = random.color(i % 2 == 1);
+      scene.calls.push_back(call);
+      scene.pixels += triangleArea(call.p);
+    }
+  }
+  else if(name == "circles")
+  {
+    for(int i = 0; i < 1000; i++)
+    {
+      call.type = CALL_CIRCLE;
+      int r = random.get(1, 100);
+      call.p[0] = r + random.get(w - 2 * r);
+      call.p[1] = r + random.get(h - 2 * r);
+      call.p[2] = r;
+      call.color[0] = random.color(i % 2 == 1);
+      scene.calls.push_back(call);
+      scene.pixels += 3.14159265358979 * r * r;
+    }
+  }
+  else if(name == "gradients")
+  {
+    for(int i = 0; i < 1000; i++)
+    {
+      if(i % 2 == 0)
+      {
+        call.type = CALL_GRADIENT_RECTANGLE;
+        int sx = random.get(1, 200), sy = random.get(1, 200);
+        call.p[0] = random.get(w - sx);
+        call.p[1] = random.get(h - sy);
+        call.p[2] = call.p[0] + sx;
+        call.p[3] = call.p[1] + sy;
+        scene.pixels += (double)sx * sy;
+      }
+      else
+      {
+        call.type = CALL_GRADIENT_TRIANGLE;
+        randomTriangle(random, call.p, w, h, 250);
+        scene.pixels += triangleArea(call.p);
+      }
+      for(int j = 0; j < 3; j++) call.color[j] = random.color(i % 4 >= 2);
+      scene.calls.push_back(call);
+    }
+  }
+  else if(name == "textures_sized")
+  {
+    for(int i = 0; i < 2000; i++)
+    {
+      call.type = CALL_TEXTURE_SIZED;
+      call.texture = random.get(NUM_BENCHMARK_TEXTURES);
+      int sx = random.get(8, 256), sy = random.get(8, 256);
+      call.p[0] = random.get(w - sx);
+      call.p[1] = random.get(h - sy);
+      call.p[2] = sx;
+      call.p[3] = sy;
+      call.color[0] = i % 3 == 0 ? RGB_White : random.color(i % 3 == 2);
+      scene.calls.push_back(call);
+      scene.pixels += (double)sx * sy;
+    }
+  }
+  else if(name == "text")
+  {
+    static const char* const words[] = { "The", "quick", "brown", "fox", "jumps", "over", "the", "lazy", "dog", "0123456789" };
+    static const Font* const fonts[] = { &FONT_Default, &FONT_White, &FONT_Red, &FONT_Shadow };
+    for(int i = 0; i < 1000; i++)
+    {
+      call.type = CALL_TEXT;
+      call.text.clear();
+      int n = random.get(1, 8);
+      for(int j = 0; j < n; j++)
+      {
+        if(j > 0) call.text += " ";
+        call.text += words[random.get(10)];
+      }
+      call.texture = random.get(4); //the index of the font
+      int tw, th;
+      drawer.calcTextRectSize(tw, th, call.text, *fonts[call.texture]);
+      call.p[0] = random.get(std::max(1, w - tw));
+      call.p[1] = random.get(std::max(1, h - th));
+      scene.calls.push_back(call);
+      scene.pixels += (double)tw * th;
+    }
+  }
+  else if(name == "gui")
+  {
+    scene.gui = new BenchmarkGUI(drawer);
+    scene.pixels = (double)w * h;
+  }
+  else
+  {
+    //the texture scenes, one for every combination of blend settings
+    bool found = false;
+    for(int i = 0; i < 8 && !found; i++)
+    {
+      if(name != textureSceneName(i)) continue;
+      found = true;
+      scene.texture_alpha_as_opacity = (i & 1) == 0;
+      scene.color_alpha_as_opacity = (i & 2) == 0;
+      scene.extra_opacity = (i & 4) ? 0.5 : 1.0;
+    }
+    if(!found) return false;
+    for(int i = 0; i < 4000; i++)
+    {
+      call.type = CALL_TEXTURE;
+      call.texture = random.get(NUM_BENCHMARK_TEXTURES);
+      int sx = call.texture == 3 ? 100 : (call.texture == 2 ? 32 : 64);
+      int sy = call.texture == 3 ? 50 : sx;
+      call.p[0] = random.get(w - sx);
+      call.p[1] = random.get(h - sy);
+      call.color[0] = i % 3 == 0 ? RGB_White : random.color(i % 3 == 2);
+      scene.calls.push_back(call);
+      scene.pixels += (double)sx * sy;
+    }
+  }
+
+  return true;
+}
+
+void drawScene(const BenchmarkScene& scene, gui::IGUIDrawer& drawer, const std::vector<ITexture*>& textures)
+{
+  static const Font* const fonts[] = { &FONT_Default, &FONT_White, &FONT_Red, &FONT_Shadow };
+
+  if(scene.gui)
+  {
+    scene.gui->draw(drawer);
+    return;
+  }
+
+  for(size_t i = 0; i < scene.calls.size(); i++)
+  {
+    const BenchmarkCall& c = scene.calls[i];
+    const int* p = c.p;
+    switch(c.type)
+    {
+      case CALL_RECTANGLE: drawer.drawRectangle(p[0], p[1], p[2], p[3], c.color[0], true); break;
+      case CALL_LINE: drawer.drawLine(p[0], p[1], p[2], p[3], c.color[0]); break;
+      case CALL_TRIANGLE: drawer.drawTriangle(p[0], p[1], p[2], p[3], p[4], p[5], c.color[0], true); break;
+      case CALL_CIRCLE: drawer.drawCircle(p[0], p[1], p[2], c.color[0], true); break;
+      case CALL_GRADIENT_RECTANGLE: drawer.drawGradientRectangle(p[0], p[1], p[2], p[3], c.color[0], c.color[1], c.color[2], c.color[0]); break;
+      case CALL_GRADIENT_TRIANGLE: drawer.drawGradientTriangle(p[0], p[1], p[2], p[3], p[4], p[5], c.color[0], c.color[1], c.color[2]); break;
+      case CALL_TEXTURE: drawer.drawTexture(textures[c.texture], p[0], p[1], c.color[0]); break;
+      case CALL_TEXTURE_SIZED: drawer.drawTextureSized(textures[c.texture], p[0], p[1], p[2], p[3], c.color[0]); break;
+      case CALL_TEXT: drawer.drawText(c.text, p[0], p[1], *fonts[c.texture]); break;
+    }
+  }
+}
+
+//the amount of pixels of a that differ from b, or all pixels if they don't have the same size
+int countMismatches(const std::vector<unsigned char>& a, int aw, int ah, const std::vector<unsigned char>& b, int bw, int bh)
+{
+  if(aw != bw || ah != bh) return std::max(aw * ah, bw * bh);
+  int result = 0;
+  for(size_t i = 0; i + 3 < a.size(); i += 4)
+  {
+    if(a[i] != b[i] || a[i + 1] != b[i + 1] || a[i + 2] != b[i + 2] || a[i + 3] != b[i + 3]) result++;
+  }
+  return result;
+}
+
+} //namespace
+
+////////////////////////////////////////////////////////////////////////////////
+
+void getBenchmarkSceneNames(std::vector<std::string>& names)
+{
+  names.clear();
+  for(size_t i = 0; i < sizeof(SHAPE_SCENES) / sizeof(*SHAPE_SCENES); i++) names.push_back(SHAPE_SCENES[i]);
+  for(int i = 0; i < 8; i++) names.push_back(textureSceneName(i));
+  for(size_t i = 0; i < sizeof(OTHER_SCENES) / sizeof(*OTHER_SCENES); i++) names.push_back(OTHER_SCENES[i]);
+}
+
+void runBenchmark(std::vector<BenchmarkResult>& results, IBenchmarkTarget& target, const BenchmarkOptions& options)
+{
+  gui::IGUIDrawer& drawer = target.getDrawer();
+
+  std::vector<std::string> names = options.scenes;
+  if(names.empty()) getBenchmarkSceneNames(names);
+
+  std::vector<ITexture*> textures(NUM_BENCHMARK_TEXTURES);
+  for(size_t i = 0; i < NUM_BENCHMARK_TEXTURES; i++)
+  {
+    textures[i] = drawer.createTexture();
+    makeBenchmarkTexture(textures[i], i);
+  }
+
+  for(size_t i = 0; i < names.size(); i++)
+  {
+    BenchmarkScene scene;
+    if(!makeScene(scene, names[i], drawer)) continue;
+
+    BenchmarkResult result;
+    result.scene = names[i];
+    result.calls = scene.gui ? 1 : scene.calls.size();
+    result.pixels = scene.pixels;
+    result.mismatches = -1;
+    result.drawcalls = result.statechanges = result.skippedstatechanges = -1;
+
+    target.setBlendSettings(scene.texture_alpha_as_opacity, scene.color_alpha_as_opacity, scene.extra_opacity);
+
+    //draw once on a cleared screen for the PNG, this also makes sure the textures are uploaded before the timing
+    target.clear();
+    drawer.frameStart();
+    drawScene(scene, drawer, textures);
+    drawer.frameEnd();
+    target.finish();
+
+    std::vector<unsigned char> pixels;
+    int w, h;
+    target.getPixels(pixels, w, h);
+    if(!options.reference_prefix.empty())
+    {
+      std::vector<unsigned char> file;
+      loadFile(file, options.reference_prefix + names[i] + ".png");
+      std::vector<unsigned char> reference;
+      int rw, rh;
+      std::string error;
+      if(!file.empty() && decodeImageFile(error, reference, rw, rh, &file[0], file.size(), IF_PNG))
+      {
+        result.mismatches = countMismatches(pixels, w, h, reference, rw, rh);
+      }
+    }
+    if(!options.output_prefix.empty())
+    {
+      std::vector<unsigned char> file;
+      std::string error;
+      if(encodeImageFile(error, file, &pixels[0], w, h, IF_PNG)) saveFile(file, options.output_prefix + names[i] + ".png");
+    }
+
+    //the repetitions are drawn over each other, clearing the screen isn't part of the timing
+    result.repetitions = 0;
+    double start = getSeconds();
+    do
+    {
+      drawer.frameStart();
+      drawScene(scene, drawer, textures);
+      drawer.frameEnd();
+      target.finish();
+      result.repetitions++;
+      result.seconds = getSeconds() - start;
+    } while(result.seconds < options.seconds);
+    
+    size_t drawcalls, statechanges, skippedstatechanges;
+    if(target.getFrameStats(drawcalls, statechanges, skippedstatechanges))
+    {
+      result.drawcalls = (int)drawcalls;
+      result.statechanges = (int)statechanges;
+      result.skippedstatechanges = (int)skippedstatechanges;
+    }
+
+    results.push_back(result);
+  }
+
+  target.setBlendSettings(true, true, 1.0);
+  for(size_t i = 0; i < textures.size(); i++) delete textures[i];
+}
+
+std::string formatBenchmarkResults(const std::vector<BenchmarkResult>& results)
+{
+  //the columns of the OpenGL frame stats only if there are any
+  bool framestats = false;
+  for(size_t i = 0; i < results.size(); i++) if(results[i].drawcalls >= 0) framestats = true;
+  
+  std::ostringstream ss;
+  ss << std::left << std::setw(32) << "scene" << std::right
+     << std::setw(8) << "calls" << std::setw(8) << "reps"
+     << std::setw(12) << "Mpixels/s" << std::setw(12) << "calls/s" << std::setw(12) << "ns/call";
+  if(framestats) ss << std::setw(10) << "glcalls" << std::setw(10) << "state" << std::setw(10) << "skipped";
+  ss << "  reference" << std::endl;
+  ss << std::fixed;
+  for(size_t i = 0; i < results.size(); i++)
+  {
+    const BenchmarkResult& r = results[i];
+    ss << std::left << std::setw(32) << r.scene << std::right
+       << std::setw(8) << r.calls << std::setw(8) << r.repetitions
+       << std::setw(12) << std::setprecision(1) << r.getMPixelsPerSecond()
+       << std::setw(12) << std::setprecision(0) << r.getCallsPerSecond()
+       << std::setw(12) << std::setprecision(0) << r.getNanosecondsPerCall();
+    if(framestats && r.drawcalls < 0) ss << std::setw(10) << "-" << std::setw(10) << "-" << std::setw(10) << "-";
+    else if(framestats) ss << std::setw(10) << r.drawcalls << std::setw(10) << r.statechanges << std::setw(10) << r.skippedstatechanges;
+    if(r.mismatches < 0) ss << "  -";
+    else if(r.mismatches == 0) ss << "  identical";
+    else ss << "  " << r.mismatches << " pixels differ";
+    ss << std::endl;
+  }
+  return ss.str();
+}
+
+} //namespace lpi
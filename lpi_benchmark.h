@@ -0,0 +1,116 @@
+/*
+Copyright (c) 2005-2010 Lode Vandevenne
+All rights reserved.
+
+This file is part of Lode's Programming Interface.
+
+Lode's Programming Interface is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Lode's Programming Interface is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "lpi_gui_drawer.h"
+#include "lpi_gui_drawer_buffer.h"
+
+#include <string>
+#include <vector>
+
+/*
+lpi_benchmark: reproducible performance measurement of the drawers.
+
+The benchmark draws a fixed set of scenes (rectangles, triangles, circles, textures with every
+combination of blend settings, text and a full GUI frame) with any IGUIDrawer. The calls of a
+scene are generated with a fixed seed before the timing starts, so every run and every drawer
+draws exactly the same. The result of every scene can be written to a PNG, and compared with the
+PNG of an earlier run, to check that an optimization doesn't change any pixel.
+
+See benchmark.cpp for the executable.
+*/
+
+namespace lpi
+{
+
+/*
+What the benchmark draws on. The GUI drawer gives the 2D drawer, the text drawer and the GUI part
+drawer together, so the GUI scene can be drawn too.
+*/
+class IBenchmarkTarget
+{
+  public:
+    virtual ~IBenchmarkTarget(){}
+
+    virtual gui::IGUIDrawer& getDrawer() = 0;
+    virtual void clear() = 0; //called once per scene, before the untimed frame of which the pixels are compared and written, the timed repetitions are drawn over it
+    virtual void finish() {} //waits until everything is really drawn (e.g. glFinish), called after frameEnd
+    //the OpenGL draw calls and state changes of the last frame, false if the target doesn't draw with OpenGL
+    virtual bool getFrameStats(size_t& drawcalls, size_t& statechanges, size_t& skippedstatechanges) { (void)drawcalls; (void)statechanges; (void)skippedstatechanges; return false; }
+    //the settings of the texture scenes, targets that can't change them ignore them
+    virtual void setBlendSettings(bool texture_alpha_as_opacity, bool color_alpha_as_opacity, double extra_opacity) { (void)texture_alpha_as_opacity; (void)color_alpha_as_opacity; (void)extra_opacity; }
+    virtual void getPixels(std::vector<unsigned char>& rgba, int& w, int& h) = 0; //RGBA with straight alpha, the top row first
+};
+
+//draws with Drawer2DBuffer on an RGBA buffer in memory
+class BenchmarkTargetBuffer : public IBenchmarkTarget
+{
+  private:
+    gui::GUIDrawerBuffer guidrawer;
+    Drawer2DBuffer& drawer;
+    std::vector<unsigned char> buffer;
+    int w;
+    int h;
+
+  public:
+    BenchmarkTargetBuffer(int w, int h);
+
+    Drawer2DBuffer& getBufferDrawer() { return drawer; } //for setDeferred, setPremultipliedAlpha, ...
+
+    virtual gui::IGUIDrawer& getDrawer();
+    virtual void clear();
+    virtual void setBlendSettings(bool texture_alpha_as_opacity, bool color_alpha_as_opacity, double extra_opacity);
+    virtual void getPixels(std::vector<unsigned char>& rgba, int& w, int& h);
+};
+
+struct BenchmarkResult
+{
+  std::string scene;
+  size_t calls; //drawing calls per repetition (for the GUI scene a call is a whole frame)
+  double pixels; //pixels covered by the calls per repetition, overlapping pixels counted for every call
+  size_t repetitions;
+  double seconds; //the time of all repetitions together
+  int mismatches; //pixels that differ from the reference PNG, -1 if there was no reference
+  //of the last repetition, from IBenchmarkTarget::getFrameStats, -1 if the target doesn't have them
+  int drawcalls;
+  int statechanges;
+  int skippedstatechanges;
+
+  double getMPixelsPerSecond() const;
+  double getCallsPerSecond() const;
+  double getNanosecondsPerCall() const;
+};
+
+struct BenchmarkOptions
+{
+  double seconds; //every scene is repeated until it took at least this long
+  std::string output_prefix; //the result of scene "x" is written to output_prefix + "x.png", nothing is written if empty
+  std::string reference_prefix; //the result is compared with reference_prefix + "x.png", if that file exists
+  std::vector<std::string> scenes; //the names of the scenes to run, all if empty
+
+  BenchmarkOptions() : seconds(1.0) {}
+};
+
+void getBenchmarkSceneNames(std::vector<std::string>& names);
+void runBenchmark(std::vector<BenchmarkResult>& results, IBenchmarkTarget& target, const BenchmarkOptions& options);
+std::string formatBenchmarkResults(const std::vector<BenchmarkResult>& results); //a table with one line per scene
+
+} //namespace lpi
@@ -0,0 +1,1260 @@
+/*
+Copyright (c) 2005-2010 Lode Vandevenne
+All rights reserved.
+
+This file is part of Lode's Programming Interface.
+
+Lode's Programming Interface is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Lode's Programming Interface is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "lpi_blend.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if !defined(LPI_NO_SIMD)
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#define LPI_BLEND_SIMD
+#define LPI_TARGET_SSE2 __attribute__((target("sse2")))
+#define LPI_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#define LPI_BLEND_SIMD
+#define LPI_TARGET_SSE2
+#define LPI_TARGET_AVX2
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(LPI_BLEND_SIMD)
+#include <immintrin.h>
+#endif
+
+namespace lpi
+{
+
+BlendMode::BlendMode(const ColorRGB& colorMod, bool texture_alpha_as_opacity, bool color_alpha_as_opacity, double extra_opacity, bool premultiplied)
+: texture_alpha_as_opacity(texture_alpha_as_opacity)
+, color_alpha_as_opacity(color_alpha_as_opacity)
+, use_extra_opacity(extra_opacity != 1.0)
+, premultiplied(premultiplied)
+{
+  r = colorMod.r < 0 ? 0 : (colorMod.r > 255 ? 255 : colorMod.r);
+  g = colorMod.g < 0 ? 0 : (colorMod.g > 255 ? 255 : colorMod.g);
+  b = colorMod.b < 0 ? 0 : (colorMod.b > 255 ? 255 : colorMod.b);
+  a = colorMod.a < 0 ? 0 : (colorMod.a > 255 ? 255 : colorMod.a);
+  int o = (int)(255 * extra_opacity);
+  this->extra_opacity = o < 0 ? 0 : (o > 255 ? 255 : o);
+}
+
+namespace
+{
+
+////////////////////////////////////////////////////////////////////////////////
+//scalar
+
+/*
+out: output buffer (RGBA), in: input buffer (RGBA), this one is blended over out.
+This is the reference implementation, the SIMD versions must give exactly the same result.
+The template parameters are the flags of BlendMode, so that there is no branching on them
+per pixel. WHITE means the colorMod is RGBA 255,255,255,255 so that multiplying with it can
+be skipped.
+*/
+template<bool TA, bool CA, bool EO, bool WHITE>
+void blendSpanScalar(unsigned char* out, const unsigned char* in, size_t n, const BlendMode& mode)
+{
+  for(size_t i = 0; i < n; i++)
+  {
+    const unsigned char* ib = in + 4 * i;
+    unsigned char* ob = out + 4 * i;
+    int r = 0, g = 0, b = 0, a = 0;
+
+    if(CA)
+    {
+      if(TA)
+      {
+        int ri = WHITE ? ib[0] : (ib[0] * mode.r) / 255;
+        int gi = WHITE ? ib[1] : (ib[1] * mode.g) / 255;
+        int bi = WHITE ? ib[2] : (ib[2] * mode.b) / 255;
+        int ai = WHITE ? ib[3] : (ib[3] * mode.a) / 255;
+
+        int ao = ob[3];
+
+        int o = 255 - ((255 - ai) * ao) / 255;
+        if(ai < ao) o = std::min(ai, o); //avoid color of fully transparent foreground leaking through
+        r = (ri * o + ob[0] * (255 - o)) / 255;
+        g = (gi * o + ob[1] * (255 - o)) / 255;
+        b = (bi * o + ob[2] * (255 - o)) / 255;
+        a = ai + ((255 - ai) * ao) / 255;
+      }
+      else
+      {
+        //TODO
+      }
+    }
+    else
+    {
+      if(TA)
+      {
+        int ri = WHITE ? ib[0] : (ib[0] * mode.r) / 255;
+        int gi = WHITE ? ib[1] : (ib[1] * mode.g) / 255;
+        int bi = WHITE ? ib[2] : (ib[2] * mode.b) / 255;
+        int ai = ib[3];
+
+        int ao = ob[3];
+
+        int o = 255 - ((255 - ai) * ao) / 255;
+        if(ai < ao) o = std::min(ai, o); //avoid color of fully transparent foreground leaking through
+        o = (o * ai) / 255;
+        r = (ri * o + ob[0] * (255 - o)) / 255;
+        g = (gi * o + ob[1] * (255 - o)) / 255;
+        b = (bi * o + ob[2] * (255 - o)) / 255;
+        //alpha channel: the intention is: if ia is 0, the alpha channel must become oa. If ia is 255, the alpha channel must become colorMod.a. For values in between: not sure yet, TODO!
+        a = WHITE ? ai + (ao * (255 - ai)) / 255 : (mode.a * ai + ao * (255 - ai)) / 255;
+      }
+      else
+      {
+        r = ib[0];
+        g = ib[1];
+        b = ib[2];
+        a = ib[3];
+      }
+    }
+
+    if(EO)
+    {
+      int o = mode.extra_opacity;
+      ob[0] = (r * o + ob[0] * (255 - o)) / 255;
+      ob[1] = (g * o + ob[1] * (255 - o)) / 255;
+      ob[2] = (b * o + ob[2] * (255 - o)) / 255;
+      ob[3] = (a * o + ob[3] * (255 - o)) / 255;
+    }
+    else
+    {
+      ob[0] = r;
+      ob[1] = g;
+      ob[2] = b;
+      ob[3] = a;
+    }
+  }
+}
+
+//the case where nothing is blended: a literal copy
+void copySpan(unsigned char* out, const unsigned char* in, size_t n, const BlendMode& mode)
+{
+  (void)mode;
+  std::memcpy(out, in, 4 * n);
+}
+
+/*
+The factors (0-255) the input pixels are multiplied with when blending premultiplied alpha: the colorMod,
+the color alpha and the extra opacity combined, so that they cost one multiplication per channel.
+Returns false if they're all 255, then the input is used as is.
+*/
+bool getPremultipliedFactors(int* f, const BlendMode& mode)
+{
+  int k = mode.color_alpha_as_opacity ? mode.a : 255;
+  if(mode.use_extra_opacity) k = (k * mode.extra_opacity) / 255;
+  f[0] = (mode.r * k) / 255;
+  f[1] = (mode.g * k) / 255;
+  f[2] = (mode.b * k) / 255;
+  f[3] = k;
+  return f[0] != 255 || f[1] != 255 || f[2] != 255 || f[3] != 255;
+}
+
+/*
+Premultiplied alpha with the texture alpha as opacity: the same for all 4 channels, with SCALE
+telling whether the input has to be multiplied with the factors of getPremultipliedFactors.
+The result is clamped to 255, which only matters for invalid input with a color above its alpha.
+*/
+template<bool SCALE>
+void blendSpanPremultipliedScalar(unsigned char* out, const unsigned char* in, size_t n, const BlendMode& mode)
+{
+  int f[4];
+  getPremultipliedFactors(f, mode);
+  for(size_t i = 0; i < n; i++)
+  {
+    const unsigned char* ib = in + 4 * i;
+    unsigned char* ob = out + 4 * i;
+    int s[4];
+    for(int c = 0; c < 4; c++) s[c] = SCALE ? (ib[c] * f[c]) / 255 : ib[c];
+    int ia = 255 - s[3];
+    for(int c = 0; c < 4; c++) ob[c] = std::min(255, s[c] + (ob[c] * ia) / 255);
+  }
+}
+
+#if defined(LPI_BLEND_SIMD)
+
+////////////////////////////////////////////////////////////////////////////////
+//SSE2, 2 pixels per register as 8 16-bit values, 4 pixels per iteration
+
+LPI_TARGET_SSE2 inline __m128i div255SSE2(__m128i x)
+{
+  const __m128i one = _mm_set1_epi16(1);
+  return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, one), _mm_srli_epi16(x, 8)), 8);
+}
+
+LPI_TARGET_SSE2 inline __m128i selectSSE2(__m128i mask, __m128i a, __m128i b) //a where mask is set, b elsewhere
+{
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+//the constants, loaded once per span
+struct BlendConstantsSSE2
+{
+  __m128i cm; //colorMod, with 255 as alpha if the color alpha isn't used as opacity
+  __m128i cma; //colorMod alpha in every lane
+  __m128i eo; //extra opacity in every lane
+  __m128i c255;
+  __m128i alphamask; //the lanes of the alpha channels
+
+  LPI_TARGET_SSE2 BlendConstantsSSE2(const BlendMode& mode)
+  {
+    int a = mode.color_alpha_as_opacity ? mode.a : 255;
+    cm = _mm_setr_epi16(mode.r, mode.g, mode.b, a, mode.r, mode.g, mode.b, a);
+    cma = _mm_set1_epi16(mode.a);
+    eo = _mm_set1_epi16(mode.extra_opacity);
+    c255 = _mm_set1_epi16(255);
+    alphamask = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+  }
+};
+
+//blends 2 pixels, s and d contain them as 16-bit values
+template<bool CA, bool EO, bool WHITE>
+LPI_TARGET_SSE2 inline __m128i blendSSE2(__m128i d, __m128i s, const BlendConstantsSSE2& c)
+{
+  if(!WHITE) s = div255SSE2(_mm_mullo_epi16(s, c.cm));
+  __m128i ai = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+  __m128i ao = _mm_shufflehi_epi16(_mm_shufflelo_epi16(d, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+  __m128i iai = _mm_sub_epi16(c.c255, ai);
+  __m128i t = div255SSE2(_mm_mullo_epi16(iai, ao));
+  __m128i o = _mm_sub_epi16(c.c255, t);
+  o = selectSSE2(_mm_cmplt_epi16(ai, ao), ai, o); //avoid color of fully transparent foreground leaking through
+  if(!CA) o = div255SSE2(_mm_mullo_epi16(o, ai));
+  __m128i rgb = div255SSE2(_mm_add_epi16(_mm_mullo_epi16(s, o), _mm_mullo_epi16(d, _mm_sub_epi16(c.c255, o))));
+  __m128i a;
+  if(CA || WHITE) a = _mm_add_epi16(ai, t); //if !CA and WHITE, this is the same as below with colorMod alpha 255
+  else a = div255SSE2(_mm_add_epi16(_mm_mullo_epi16(c.cma, ai), _mm_mullo_epi16(ao, iai)));
+  __m128i result = selectSSE2(c.alphamask, a, rgb);
+  if(EO) result = div255SSE2(_mm_add_epi16(_mm_mullo_epi16(result, c.eo), _mm_mullo_epi16(d, _mm_sub_epi16(c.c255, c.eo))));
+  return result;
+}
+
+//handles the modes where the texture alpha is used as opacity, returns amount of pixels done
+template<bool CA, bool EO, bool WHITE>
+LPI_TARGET_SSE2 size_t blendSpanSSE2Part(unsigned char* out, const unsigned char* in, size_t n, const BlendMode& mode)
+{
+  const BlendConstantsSSE2 c(mode);
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4)
+  {
+    __m128i s = _mm_loadu_si128((const __m128i*)(in + 4 * i));
+    __m128i d = _mm_loadu_si128((const __m128i*)(out + 4 * i));
+    __m128i lo = blendSSE2<CA, EO, WHITE>(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero), c);
+    __m128i hi = blendSSE2<CA, EO, WHITE>(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero), c);
+    _mm_storeu_si128((__m128i*)(out + 4 * i), _mm_packus_epi16(lo, hi));
+  }
+  for(; i + 2 <= n; i += 2)
+  {
+    __m128i s = _mm_loadl_epi64((const __m128i*)(in + 4 * i));
+    __m128i d = _mm_loadl_epi64((const __m128i*)(out + 4 * i));
+    __m128i r = blendSSE2<CA, EO, WHITE>(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero), c);
+    _mm_storel_epi64((__m128i*)(out + 4 * i), _mm_packus_epi16(r, r));
+  }
+  return i;
+}
+
+template<bool CA, bool EO, bool WHITE>
+void blendSpanSSE2(unsigned char* out, const unsigned char* in, size_t n, const BlendMode& mode)
+{
+  size_t done = blendSpanSSE2Part<CA, EO, WHITE>(out, in, n, mode);
+  blendSpanScalar<true, CA, EO, WHITE>(out + 4 * done, in + 4 * done, n - done, mode);
+}
+
+//premultiplied alpha, 2 pixels: no division of the colors by the alpha, every channel gets the same operations
+template<bool SCALE>
+LPI_TARGET_SSE2 inline __m128i blendPremultipliedSSE2(__m128i d, __m128i s, __m128i f, __m128i c255)
+{
+  if(SCALE) s = div255SSE2(_mm_mullo_epi16(s, f));
+  __m128i ia = _mm_sub_epi16(c255, _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3)));
+  return _mm_add_epi16(s, div255SSE2(_mm_mullo_epi16(d, ia))); //the saturation of the pack does the clamping to 255
+}
+
+template<bool SCALE>
+LPI_TARGET_SSE2 size_t blendSpanPremultipliedSSE2Part(unsigned char* out, const unsigned char* in, size_t n, const BlendMode& mode)
+{
+  int fa[4];
+  getPremultipliedFactors(fa, mode);
+  const __m128i f = _mm_setr_epi16(fa[0], fa[1], fa[2], fa[3], fa[0], fa[1], fa[2], fa[3]);
+  const __m128i c255 = _mm_set1_epi16(255);
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4)
+  {
+    __m128i s = _mm_loadu_si128((const __m128i*)(in + 4 * i));
+    __m128i d = _mm_loadu_si128((const __m128i*)(out + 4 * i));
+    __m128i lo = blendPremultipliedSSE2<SCALE>(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero), f, c255);
+    __m128i hi = blendPremultipliedSSE2<SCALE>(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero), f, c255);
+    _mm_storeu_si128((__m128i*)(out + 4 * i), _mm_packus_epi16(lo, hi));
+  }
+  return i;
+}
+
+template<bool SCALE>
+void blendSpanPremultipliedSSE2(unsigned char* out, const unsigned char* in, size_t n, const BlendMode& mode)
+{
+  size_t done = blendSpanPremultipliedSSE2Part<SCALE>(out, in, n, mode);
+  blendSpanPremultipliedScalar<SCALE>(out + 4 * done, in + 4 * done, n - done, mode);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//AVX2, 4 pixels per register as 16 16-bit values, 8 pixels per iteration
+
+LPI_TARGET_AVX2 inline __m256i div255AVX2(__m256i x)
+{
+  const __m256i one = _mm256_set1_epi16(1);
+  return _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(x, one), _mm256_srli_epi16(x, 8)), 8);
+}
+
+LPI_TARGET_AVX2 inline __m256i selectAVX2(__m256i mask, __m256i a, __m256i b) //a where mask is set, b elsewhere
+{
+  return _mm256_or_si256(_mm256_and_si256(mask, a), _mm256_andnot_si256(mask, b));
+}
+
+struct BlendConstantsAVX2
+{
+  __m256i cm;
+  __m256i cma;
+  __m256i eo;
+  __m256i c255;
+  __m256i alphamask;
+
+  LPI_TARGET_AVX2 BlendConstantsAVX2(const BlendMode& mode)
+  {
+    short a = (short)(mode.color_alpha_as_opacity ? mode.a : 255);
+    short r = (short)mode.r, g = (short)mode.g, b = (short)mode.b;
+    cm = _mm256_setr_epi16(r, g, b, a, r, g, b, a, r, g, b, a, r, g, b, a);
+    cma = _mm256_set1_epi16((short)mode.a);
+    eo = _mm256_set1_epi16((short)mode.extra_opacity);
+    c255 = _mm256_set1_epi16(255);
+    alphamask = _mm256_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1);
+  }
+};
+
+//blends 4 pixels, same math as blendSSE2 (the shuffles work per 128-bit lane, which contains 2 pixels)
+template<bool CA, bool EO, bool WHITE>
+LPI_TARGET_AVX2 inline __m256i blendAVX2(__m256i d, __m256i s, const BlendConstantsAVX2& c)
+{
+  if(!WHITE) s = div255AVX2(_mm256_mullo_epi16(s, c.cm));
+  __m256i ai = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+  __m256i ao = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(d, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+  __m256i iai = _mm256_sub_epi16(c.c255, ai);
+  __m256i t = div255AVX2(_mm256_mullo_epi16(iai, ao));
+  __m256i o = _mm256_sub_epi16(c.c255, t);
+  o = selectAVX2(_mm256_cmpgt_epi16(ao, ai), ai, o); //avoid color of fully transparent foreground leaking through
+  if(!CA) o = div255AVX2(_mm256_mullo_epi16(o, ai));
+  __m256i rgb = div255AVX2(_mm256_add_epi16(_mm256_mullo_epi16(s, o), _mm256_mullo_epi16(d, _mm256_sub_epi16(c.c255, o))));
+  __m256i a;
+  if(CA || WHITE) a = _mm256_add_epi16(ai, t);
+  else a = div255AVX2(_mm256_add_epi16(_mm256_mullo_epi16(c.cma, ai), _mm256_mullo_epi16(ao, iai)));
+  __m256i result = selectAVX2(c.alphamask, a, rgb);
+  if(EO) result = div255AVX2(_mm256_add_epi16(_mm256_mullo_epi16(result, c.eo), _mm256_mullo_epi16(d, _mm256_sub_epi16(c.c255, c.eo))));
+  return result;
+}
+
+template<bool CA, bool EO, bool WHITE>
+LPI_TARGET_AVX2 size_t blendSpanAVX2Part(unsigned char* out, const unsigned char* in, size_t n, const BlendMode& mode)
+{
+  const BlendConstantsAVX2 c(mode);
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8)
+  {
+    __m256i s0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(in + 4 * i)));
+    __m256i s1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(in + 4 * i + 16)));
+    __m256i d0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(out + 4 * i)));
+    __m256i d1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(out + 4 * i + 16)));
+    __m256i r0 = blendAVX2<CA, EO, WHITE>(d0, s0, c);
+    __m256i r1 = blendAVX2<CA, EO, WHITE>(d1, s1, c);
+    //packus works per 128-bit lane, the permute puts the 4 groups of 2 pixels back in order
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(r0, r1), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256((__m256i*)(out + 4 * i), packed);
+  }
+  return i + blendSpanSSE2Part<CA, EO, WHITE>(out + 4 * i, in + 4 * i, n - i, mode);
+}
+
+template<bool CA, bool EO, bool WHITE>
+void blendSpanAVX2(unsigned char* out, const unsigned char* in, size_t n, const BlendMode& mode)
+{
+  size_t done = blendSpanAVX2Part<CA, EO, WHITE>(out, in, n, mode);
+  blendSpanScalar<true, CA, EO, WHITE>(out + 4 * done, in + 4 * done, n - done, mode);
+}
+
+template<bool SCALE>
+LPI_TARGET_AVX2 inline __m256i blendPremultipliedAVX2(__m256i d, __m256i s, __m256i f, __m256i c255)
+{
+  if(SCALE) s = div255AVX2(_mm256_mullo_epi16(s, f));
+  __m256i ia = _mm256_sub_epi16(c255, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3)));
+  return _mm256_add_epi16(s, div255AVX2(_mm256_mullo_epi16(d, ia)));
+}
+
+template<bool SCALE>
+LPI_TARGET_AVX2 size_t blendSpanPremultipliedAVX2Part(unsigned char* out, const unsigned char* in, size_t n, const BlendMode& mode)
+{
+  int fa[4];
+  getPremultipliedFactors(fa, mode);
+  short r = (short)fa[0], g = (short)fa[1], b = (short)fa[2], a = (short)fa[3];
+  const __m256i f = _mm256_setr_epi16(r, g, b, a, r, g, b, a, r, g, b, a, r, g, b, a);
+  const __m256i c255 = _mm256_set1_epi16(255);
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8)
+  {
+    __m256i s0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(in + 4 * i)));
+    __m256i s1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(in + 4 * i + 16)));
+    __m256i d0 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(out + 4 * i)));
+    __m256i d1 = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(out + 4 * i + 16)));
+    __m256i r0 = blendPremultipliedAVX2<SCALE>(d0, s0, f, c255);
+    __m256i r1 = blendPremultipliedAVX2<SCALE>(d1, s1, f, c255);
+    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(r0, r1), _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256((__m256i*)(out + 4 * i), packed);
+  }
+  return i + blendSpanPremultipliedSSE2Part<SCALE>(out + 4 * i, in + 4 * i, n - i, mode);
+}
+
+template<bool SCALE>
+void blendSpanPremultipliedAVX2(unsigned char* out, const unsigned char* in, size_t n, const BlendMode& mode)
+{
+  size_t done = blendSpanPremultipliedAVX2Part<SCALE>(out, in, n, mode);
+  blendSpanPremultipliedScalar<SCALE>(out + 4 * done, in + 4 * done, n - done, mode);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//SSE2 filtering, for scaled textures
+
+//returns amount of pixels done
+LPI_TARGET_SSE2 size_t lerpRowsSSE2(unsigned char* out, const unsigned char* row0, const unsigned char* row1, size_t n, int weight)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i w0 = _mm_set1_epi16(256 - weight);
+  const __m128i w1 = _mm_set1_epi16(weight);
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4)
+  {
+    __m128i a = _mm_loadu_si128((const __m128i*)(row0 + 4 * i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(row1 + 4 * i));
+    //the sums are at most 255 * 256, that fits in unsigned 16-bit
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(a, zero), w0), _mm_mullo_epi16(_mm_unpacklo_epi8(b, zero), w1));
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(a, zero), w0), _mm_mullo_epi16(_mm_unpackhi_epi8(b, zero), w1));
+    _mm_storeu_si128((__m128i*)(out + 4 * i), _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+  }
+  return i;
+}
+
+//returns amount of pixels done
+LPI_TARGET_SSE2 size_t gatherBilinearSSE2(unsigned char* out, const unsigned char* in, const int* columns, const unsigned short* weights, size_t n)
+{
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for(; i + 2 <= n; i += 2)
+  {
+    //the two neighbours of each output pixel as 16-bit values, and their weights
+    __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(in + 4 * columns[i + 0])), zero);
+    __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(in + 4 * columns[i + 1])), zero);
+    a = _mm_mullo_epi16(a, _mm_loadu_si128((const __m128i*)(weights + 8 * (i + 0))));
+    b = _mm_mullo_epi16(b, _mm_loadu_si128((const __m128i*)(weights + 8 * (i + 1))));
+    __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b));
+    sum = _mm_srli_epi16(sum, 8);
+    _mm_storel_epi64((__m128i*)(out + 4 * i), _mm_packus_epi16(sum, sum));
+  }
+  return i;
+}
+
+//returns amount of pixels done, 4 per iteration from 8 pixels of each row
+LPI_TARGET_SSE2 size_t downsample2x2SSE2(unsigned char* out, const unsigned char* row0, const unsigned char* row1, size_t n)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i two = _mm_set1_epi16(2);
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4)
+  {
+    __m128i a0 = _mm_loadu_si128((const __m128i*)(row0 + 8 * i));
+    __m128i a1 = _mm_loadu_si128((const __m128i*)(row0 + 8 * i + 16));
+    __m128i b0 = _mm_loadu_si128((const __m128i*)(row1 + 8 * i));
+    __m128i b1 = _mm_loadu_si128((const __m128i*)(row1 + 8 * i + 16));
+    //vertical sums of the pixels 0-1, 2-3, 4-5 and 6-7
+    __m128i s01 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+    __m128i s23 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+    __m128i s45 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+    __m128i s67 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+    //horizontal sums: the even pixels plus the odd pixels
+    __m128i lo = _mm_add_epi16(_mm_unpacklo_epi64(s01, s23), _mm_unpackhi_epi64(s01, s23));
+    __m128i hi = _mm_add_epi16(_mm_unpacklo_epi64(s45, s67), _mm_unpackhi_epi64(s45, s67));
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+    _mm_storeu_si128((__m128i*)(out + 4 * i), _mm_packus_epi16(lo, hi));
+  }
+  return i;
+}
+
+//the weights of downsample2x2StraightSSE2 of 2 pixels as 16-bit values: the alpha for the colors and 1 for the alpha
+LPI_TARGET_SSE2 inline __m128i straightWeightsSSE2(__m128i p)
+{
+  const __m128i rgbmask = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+  const __m128i alphaone = _mm_set_epi16(1, 0, 0, 0, 1, 0, 0, 0);
+  __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(p, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+  return _mm_or_si128(_mm_and_si128(alpha, rgbmask), alphaone);
+}
+
+//the 2x2 block of the pixels a (2 of row0) and b (2 of row1) weighted with straightWeightsSSE2, as 32-bit sums r, g, b, alpha
+LPI_TARGET_SSE2 inline __m128i straightSumSSE2(__m128i a, __m128i b)
+{
+  const __m128i zero = _mm_setzero_si128();
+  a = _mm_mullo_epi16(a, straightWeightsSSE2(a)); //at most 255 * 255, so the low 16 bits are the exact unsigned product
+  b = _mm_mullo_epi16(b, straightWeightsSSE2(b));
+  return _mm_add_epi32(_mm_add_epi32(_mm_unpacklo_epi16(a, zero), _mm_unpackhi_epi16(a, zero))
+                     , _mm_add_epi32(_mm_unpacklo_epi16(b, zero), _mm_unpackhi_epi16(b, zero)));
+}
+
+/*
+(sum + alpha / 2) / alpha of the colors, with the alpha in the last lane of sum. The division is
+done with floats, which gives the exact integer result because the values are below 2^24. It's
+garbage if the alpha is 0, the caller uses the plain average there.
+*/
+LPI_TARGET_SSE2 inline __m128i straightDivideSSE2(__m128i sum)
+{
+  __m128i alpha = _mm_shuffle_epi32(sum, _MM_SHUFFLE(3, 3, 3, 3));
+  __m128 num = _mm_cvtepi32_ps(_mm_add_epi32(sum, _mm_srli_epi32(alpha, 1)));
+  return _mm_cvttps_epi32(_mm_div_ps(num, _mm_cvtepi32_ps(alpha)));
+}
+
+//downsample2x2SSE2 with straight alpha, the colors weighted with the alpha. Returns amount of pixels done, 2 per iteration from 4 pixels of each row.
+LPI_TARGET_SSE2 size_t downsample2x2StraightSSE2(unsigned char* out, const unsigned char* row0, const unsigned char* row1, size_t n)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i two = _mm_set1_epi16(2);
+  const __m128i alphalanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+  size_t i = 0;
+  for(; i + 2 <= n; i += 2)
+  {
+    __m128i a = _mm_loadu_si128((const __m128i*)(row0 + 8 * i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(row1 + 8 * i));
+    __m128i a01 = _mm_unpacklo_epi8(a, zero), a23 = _mm_unpackhi_epi8(a, zero);
+    __m128i b01 = _mm_unpacklo_epi8(b, zero), b23 = _mm_unpackhi_epi8(b, zero);
+    //the plain sums, as in downsample2x2SSE2, for the alpha and for the colors of blocks that are fully transparent
+    __m128i s01 = _mm_add_epi16(a01, b01);
+    __m128i s23 = _mm_add_epi16(a23, b23);
+    __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(s01, s23), _mm_unpackhi_epi64(s01, s23));
+    __m128i plain = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+    __m128i weighted = _mm_packs_epi32(straightDivideSSE2(straightSumSSE2(a01, b01)), straightDivideSSE2(straightSumSSE2(a23, b23)));
+    __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(sum, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    __m128i useplain = _mm_or_si128(_mm_cmpeq_epi16(alpha, zero), alphalanes);
+    __m128i result = selectSSE2(useplain, plain, weighted);
+    _mm_storel_epi64((__m128i*)(out + 4 * i), _mm_packus_epi16(result, result));
+  }
+  return i;
+}
+
+//returns amount of pixels done
+LPI_TARGET_SSE2 size_t setAlphaOfColorKeySSE2(unsigned char* pixels, size_t n, const unsigned char* key, int keyalpha, int otheralpha)
+{
+  const __m128i rgbmask = _mm_set1_epi32(0x00ffffff);
+  const __m128i alphamask = _mm_set1_epi32((int)0xff000000u);
+  //the pixels are little endian 32-bit values, alpha in the highest byte
+  const __m128i k = _mm_set1_epi32(key[0] | (key[1] << 8) | (key[2] << 16));
+  const __m128i ka = _mm_set1_epi32(keyalpha << 24);
+  const __m128i oa = _mm_set1_epi32((otheralpha < 0 ? 0 : otheralpha) << 24);
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)(pixels + 4 * i));
+    __m128i rgb = _mm_and_si128(v, rgbmask);
+    __m128i m = _mm_cmpeq_epi32(rgb, k);
+    __m128i other = otheralpha < 0 ? _mm_and_si128(v, alphamask) : oa;
+    _mm_storeu_si128((__m128i*)(pixels + 4 * i), _mm_or_si128(rgb, selectSSE2(m, ka, other)));
+  }
+  return i;
+}
+
+//returns amount of pixels done
+LPI_TARGET_SSE2 size_t replaceColorKeySSE2(unsigned char* pixels, size_t n, const unsigned char* key, const unsigned char* pixel)
+{
+  const __m128i rgbmask = _mm_set1_epi32(0x00ffffff);
+  const __m128i k = _mm_set1_epi32(key[0] | (key[1] << 8) | (key[2] << 16));
+  const __m128i p = _mm_set1_epi32((int)(pixel[0] | (pixel[1] << 8) | (pixel[2] << 16) | ((unsigned)pixel[3] << 24)));
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4)
+  {
+    __m128i v = _mm_loadu_si128((const __m128i*)(pixels + 4 * i));
+    __m128i m = _mm_cmpeq_epi32(_mm_and_si128(v, rgbmask), k);
+    _mm_storeu_si128((__m128i*)(pixels + 4 * i), selectSSE2(m, p, v));
+  }
+  return i;
+}
+
+//returns amount of pixels done
+LPI_TARGET_SSE2 size_t fillPixelsSSE2(unsigned char* out, size_t n, const unsigned char* pixel)
+{
+  int value;
+  std::memcpy(&value, pixel, 4);
+  const __m128i v = _mm_set1_epi32(value);
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8)
+  {
+    _mm_storeu_si128((__m128i*)(out + 4 * i), v);
+    _mm_storeu_si128((__m128i*)(out + 4 * i + 16), v);
+  }
+  for(; i + 4 <= n; i += 4) _mm_storeu_si128((__m128i*)(out + 4 * i), v);
+  return i;
+}
+
+/*
+SpanFill with a translucent color over pixels with alpha 255: then the blend of blendSSE2 (with
+white colorMod, color alpha as opacity and no extra opacity) becomes
+(color * a + out * (255 - a)) / 255, and alpha stays 255. color * a is the same for every pixel.
+Returns the amount of pixels done, stops at the first group of 4 pixels that has a pixel with
+alpha below 255.
+*/
+LPI_TARGET_SSE2 size_t fillOverOpaqueSSE2(unsigned char* out, size_t n, const unsigned char* pixel)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alphamask = _mm_set1_epi32((int)0xff000000u);
+  const __m128i ones = _mm_set1_epi32(-1);
+  int a = pixel[3];
+  //color * a, and the alpha lane gives 255 * 255 so that its result is 255
+  const __m128i ca = _mm_setr_epi16(pixel[0] * a, pixel[1] * a, pixel[2] * a, 255 * 255 - 255 * (255 - a)
+                                  , pixel[0] * a, pixel[1] * a, pixel[2] * a, 255 * 255 - 255 * (255 - a));
+  const __m128i ia = _mm_set1_epi16(255 - a);
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4)
+  {
+    __m128i d = _mm_loadu_si128((const __m128i*)(out + 4 * i));
+    if(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(d, _mm_andnot_si128(alphamask, ones)), ones)) != 0xffff) break;
+    __m128i lo = div255SSE2(_mm_add_epi16(ca, _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia)));
+    __m128i hi = div255SSE2(_mm_add_epi16(ca, _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia)));
+    _mm_storeu_si128((__m128i*)(out + 4 * i), _mm_packus_epi16(lo, hi));
+  }
+  return i;
+}
+
+//2 pixels of premultiplySpan, color * alpha / 255 rounded to nearest: x / 255 rounded is (x + 128 + ((x + 128) >> 8)) >> 8
+LPI_TARGET_SSE2 inline __m128i premultiplySSE2(__m128i s, __m128i alphamask)
+{
+  const __m128i c128 = _mm_set1_epi16(128);
+  __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+  __m128i x = _mm_add_epi16(_mm_mullo_epi16(s, a), c128);
+  __m128i rgb = _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+  return selectSSE2(alphamask, s, rgb);
+}
+
+LPI_TARGET_SSE2 size_t premultiplySpanSSE2(unsigned char* out, const unsigned char* in, size_t n)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i alphamask = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4)
+  {
+    __m128i s = _mm_loadu_si128((const __m128i*)(in + 4 * i));
+    __m128i lo = premultiplySSE2(_mm_unpacklo_epi8(s, zero), alphamask);
+    __m128i hi = premultiplySSE2(_mm_unpackhi_epi8(s, zero), alphamask);
+    _mm_storeu_si128((__m128i*)(out + 4 * i), _mm_packus_epi16(lo, hi));
+  }
+  return i;
+}
+
+LPI_TARGET_SSE2 size_t swapRedBlueSSE2(unsigned char* out, const unsigned char* in, size_t n)
+{
+  const __m128i greenalpha = _mm_set1_epi32((int)0xFF00FF00u);
+  const __m128i low = _mm_set1_epi32(0xFF);
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4)
+  {
+    __m128i s = _mm_loadu_si128((const __m128i*)(in + 4 * i));
+    __m128i r = _mm_or_si128(_mm_and_si128(s, greenalpha), _mm_and_si128(_mm_srli_epi32(s, 16), low));
+    r = _mm_or_si128(r, _mm_slli_epi32(_mm_and_si128(s, low), 16));
+    _mm_storeu_si128((__m128i*)(out + 4 * i), r);
+  }
+  return i;
+}
+
+LPI_TARGET_SSE2 size_t loadRGB565SSE2(unsigned char* rgba, const unsigned char* in, size_t n)
+{
+  const __m128i mask6 = _mm_set1_epi16(63);
+  const __m128i mask5 = _mm_set1_epi16(31);
+  const __m128i alpha = _mm_set1_epi16((short)0xFF00);
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8)
+  {
+    __m128i p = _mm_loadu_si128((const __m128i*)(in + 2 * i));
+    __m128i r = _mm_srli_epi16(p, 11);
+    __m128i g = _mm_and_si128(_mm_srli_epi16(p, 5), mask6);
+    __m128i b = _mm_and_si128(p, mask5);
+    r = _mm_or_si128(_mm_slli_epi16(r, 3), _mm_srli_epi16(r, 2));
+    g = _mm_or_si128(_mm_slli_epi16(g, 2), _mm_srli_epi16(g, 4));
+    b = _mm_or_si128(_mm_slli_epi16(b, 3), _mm_srli_epi16(b, 2));
+    __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+    __m128i ba = _mm_or_si128(b, alpha);
+    _mm_storeu_si128((__m128i*)(rgba + 4 * i), _mm_unpacklo_epi16(rg, ba));
+    _mm_storeu_si128((__m128i*)(rgba + 4 * i + 16), _mm_unpackhi_epi16(rg, ba));
+  }
+  return i;
+}
+
+//4 RGBA pixels to RGB565 in the low 16 bits of each 32-bit lane, sign extended for packing
+LPI_TARGET_SSE2 inline __m128i toRGB565SSE2(__m128i x)
+{
+  const __m128i low = _mm_set1_epi32(0xFF);
+  const __m128i bias = _mm_set1_epi32(127);
+  //(v * m + 127) / 255 with the exact division of the blend kernels
+  __m128i r = _mm_add_epi32(_mm_mullo_epi16(_mm_and_si128(x, low), _mm_set1_epi32(31)), bias);
+  __m128i g = _mm_add_epi32(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(x, 8), low), _mm_set1_epi32(63)), bias);
+  __m128i b = _mm_add_epi32(_mm_mullo_epi16(_mm_and_si128(_mm_srli_epi32(x, 16), low), _mm_set1_epi32(31)), bias);
+  r = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(r, _mm_set1_epi32(1)), _mm_srli_epi32(r, 8)), 8);
+  g = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(g, _mm_set1_epi32(1)), _mm_srli_epi32(g, 8)), 8);
+  b = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(b, _mm_set1_epi32(1)), _mm_srli_epi32(b, 8)), 8);
+  __m128i p = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 11), _mm_slli_epi32(g, 5)), b);
+  return _mm_srai_epi32(_mm_slli_epi32(p, 16), 16);
+}
+
+LPI_TARGET_SSE2 size_t storeRGB565SSE2(unsigned char* out, const unsigned char* rgba, size_t n)
+{
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8)
+  {
+    __m128i lo = toRGB565SSE2(_mm_loadu_si128((const __m128i*)(rgba + 4 * i)));
+    __m128i hi = toRGB565SSE2(_mm_loadu_si128((const __m128i*)(rgba + 4 * i + 16)));
+    _mm_storeu_si128((__m128i*)(out + 2 * i), _mm_packs_epi32(lo, hi));
+  }
+  return i;
+}
+
+//4 pixels per iteration, every lane of p0-p3 has a channel of one of them
+LPI_TARGET_SSE2 size_t gradientSpanSSE2(unsigned char* out, size_t n, const int* start, const int* step)
+{
+  __m128i d = _mm_loadu_si128((const __m128i*)step);
+  __m128i p0 = _mm_loadu_si128((const __m128i*)start);
+  __m128i p1 = _mm_add_epi32(p0, d);
+  __m128i p2 = _mm_add_epi32(p1, d);
+  __m128i p3 = _mm_add_epi32(p2, d);
+  __m128i d4 = _mm_slli_epi32(d, 2);
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4)
+  {
+    //the saturation of the packs does the clamping
+    __m128i lo = _mm_packs_epi32(_mm_srai_epi32(p0, 16), _mm_srai_epi32(p1, 16));
+    __m128i hi = _mm_packs_epi32(_mm_srai_epi32(p2, 16), _mm_srai_epi32(p3, 16));
+    _mm_storeu_si128((__m128i*)(out + 4 * i), _mm_packus_epi16(lo, hi));
+    p0 = _mm_add_epi32(p0, d4);
+    p1 = _mm_add_epi32(p1, d4);
+    p2 = _mm_add_epi32(p2, d4);
+    p3 = _mm_add_epi32(p3, d4);
+  }
+  return i;
+}
+
+LPI_TARGET_SSE2 size_t modulateSpanSSE2(unsigned char* out, const unsigned char* in, const unsigned char* colors, size_t n)
+{
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for(; i + 4 <= n; i += 4)
+  {
+    __m128i s = _mm_loadu_si128((const __m128i*)(in + 4 * i));
+    __m128i c = _mm_loadu_si128((const __m128i*)(colors + 4 * i));
+    __m128i lo = div255SSE2(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(c, zero)));
+    __m128i hi = div255SSE2(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(c, zero)));
+    _mm_storeu_si128((__m128i*)(out + 4 * i), _mm_packus_epi16(lo, hi));
+  }
+  return i;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+bool cpuSupports(BlendKernel kernel)
+{
+  if(kernel == BK_SCALAR) return true;
+#if defined(__GNUC__)
+  __builtin_cpu_init();
+  if(kernel == BK_SSE2) return __builtin_cpu_supports("sse2");
+  if(kernel == BK_AVX2) return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+  int info[4];
+  __cpuid(info, 0);
+  int maxleaf = info[0];
+  __cpuid(info, 1);
+  if(kernel == BK_SSE2) return (info[3] & (1 << 26)) != 0;
+  if(kernel == BK_AVX2)
+  {
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+    if(!osxsave || !avx || maxleaf < 7) return false;
+    if((_xgetbv(0) & 6) != 6) return false; //the OS must save the YMM registers
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+  }
+#endif
+  return false;
+}
+
+#else //LPI_BLEND_SIMD
+
+bool cpuSupports(BlendKernel kernel)
+{
+  return kernel == BK_SCALAR;
+}
+
+#endif //LPI_BLEND_SIMD
+
+BlendKernel findKernel(BlendKernel wanted)
+{
+  if(wanted == BK_AUTO) wanted = BK_AVX2;
+  if(wanted == BK_AVX2 && !cpuSupports(BK_AVX2)) wanted = BK_SSE2;
+  if(wanted == BK_SSE2 && !cpuSupports(BK_SSE2)) wanted = BK_SCALAR;
+  return wanted;
+}
+
+//resolved once during static initialization, so that getBlendKernel only reads it and can be called from any thread
+BlendKernel currentKernel = findKernel(BK_AUTO);
+
+} //end of anonymous namespace
+
+void setBlendKernel(BlendKernel kernel)
+{
+  currentKernel = findKernel(kernel);
+}
+
+BlendKernel getBlendKernel()
+{
+  return currentKernel;
+}
+
+BlendSpanFunc getBlendSpanFunc(const BlendMode& mode, bool opaque_source)
+{
+  const bool TA = mode.texture_alpha_as_opacity;
+  const bool CA = mode.color_alpha_as_opacity;
+  const bool EO = mode.use_extra_opacity;
+  const bool WHITE = mode.r == 255 && mode.g == 255 && mode.b == 255 && mode.a == 255;
+
+  if(!TA && !CA && !EO) return copySpan; //literal copy
+
+  /*
+  Premultiplied alpha only changes the blending where the texture alpha is used as opacity: the
+  literal copy stays a copy, and the extra opacity without the texture alpha is a linear interpolation,
+  which is the same for premultiplied colors.
+  */
+  if(TA && mode.premultiplied)
+  {
+    int f[4];
+    bool scale = getPremultipliedFactors(f, mode);
+    if(!scale && opaque_source) return copySpan;
+#if defined(LPI_BLEND_SIMD)
+    BlendKernel kernel = getBlendKernel();
+    if(kernel == BK_AVX2) return scale ? blendSpanPremultipliedAVX2<true> : blendSpanPremultipliedAVX2<false>;
+    if(kernel == BK_SSE2) return scale ? blendSpanPremultipliedSSE2<true> : blendSpanPremultipliedSSE2<false>;
+#endif
+    return scale ? blendSpanPremultipliedScalar<true> : blendSpanPremultipliedScalar<false>;
+  }
+  /*
+  When the texture alpha is used as opacity, an opaque source pixel with white colorMod
+  gives o = 255 and alpha 255 in both modes, so the result is exactly the source.
+  */
+  if(TA && WHITE && !EO && opaque_source) return copySpan;
+
+  if(!TA)
+  {
+    if(CA) return EO ? blendSpanScalar<false, true, true, false> : blendSpanScalar<false, true, false, false>;
+    else return blendSpanScalar<false, false, true, false>;
+  }
+
+  //index in the tables below, bit 2: CA, bit 1: EO, bit 0: WHITE
+  int index = (CA ? 4 : 0) + (EO ? 2 : 0) + (WHITE ? 1 : 0);
+
+  static const BlendSpanFunc scalar[8] =
+  {
+    blendSpanScalar<true, false, false, false>, blendSpanScalar<true, false, false, true>,
+    blendSpanScalar<true, false, true, false>, blendSpanScalar<true, false, true, true>,
+    blendSpanScalar<true, true, false, false>, blendSpanScalar<true, true, false, true>,
+    blendSpanScalar<true, true, true, false>, blendSpanScalar<true, true, true, true>
+  };
+#if defined(LPI_BLEND_SIMD)
+  static const BlendSpanFunc sse2[8] =
+  {
+    blendSpanSSE2<false, false, false>, blendSpanSSE2<false, false, true>,
+    blendSpanSSE2<false, true, false>, blendSpanSSE2<false, true, true>,
+    blendSpanSSE2<true, false, false>, blendSpanSSE2<true, false, true>,
+    blendSpanSSE2<true, true, false>, blendSpanSSE2<true, true, true>
+  };
+  static const BlendSpanFunc avx2[8] =
+  {
+    blendSpanAVX2<false, false, false>, blendSpanAVX2<false, false, true>,
+    blendSpanAVX2<false, true, false>, blendSpanAVX2<false, true, true>,
+    blendSpanAVX2<true, false, false>, blendSpanAVX2<true, false, true>,
+    blendSpanAVX2<true, true, false>, blendSpanAVX2<true, true, true>
+  };
+  BlendKernel kernel = getBlendKernel();
+  if(kernel == BK_AVX2) return avx2[index];
+  if(kernel == BK_SSE2) return sse2[index];
+#endif
+  return scalar[index];
+}
+
+void blendSpan(unsigned char* out, const unsigned char* in, size_t n, const BlendMode& mode)
+{
+  getBlendSpanFunc(mode)(out, in, n, mode);
+}
+
+void fillPixels(unsigned char* out, size_t n, const unsigned char* pixel)
+{
+  if(pixel[0] == pixel[1] && pixel[0] == pixel[2] && pixel[0] == pixel[3])
+  {
+    std::memset(out, pixel[0], 4 * n); //e.g. opaque black or white
+    return;
+  }
+  size_t i = 0;
+#if defined(LPI_BLEND_SIMD)
+  if(getBlendKernel() != BK_SCALAR) i = fillPixelsSSE2(out, n, pixel);
+#endif
+  for(; i < n; i++) std::memcpy(out + 4 * i, pixel, 4);
+}
+
+SpanFill::SpanFill(const ColorRGB& color, const BlendMode& mode)
+: mode(mode)
+{
+  unsigned char pixel[4];
+  pixel[0] = color.r < 0 ? 0 : (color.r > 255 ? 255 : color.r);
+  pixel[1] = color.g < 0 ? 0 : (color.g > 255 ? 255 : color.g);
+  pixel[2] = color.b < 0 ? 0 : (color.b > 255 ? 255 : color.b);
+  pixel[3] = color.a < 0 ? 0 : (color.a > 255 ? 255 : color.a);
+  if(mode.premultiplied) premultiplySpan(pixel, pixel, 1);
+  for(size_t i = 0; i < CHUNK; i++) std::memcpy(pixels + 4 * i, pixel, 4);
+
+  blend = getBlendSpanFunc(mode, pixel[3] == 255);
+  blendpartial = getBlendSpanFunc(mode, false);
+  if(blend == copySpan) blend = 0; //the color itself is the result
+
+  bool white = mode.r == 255 && mode.g == 255 && mode.b == 255 && mode.a == 255;
+  overopaque = blend && white && mode.texture_alpha_as_opacity && mode.color_alpha_as_opacity && !mode.use_extra_opacity && !mode.premultiplied;
+#if defined(LPI_BLEND_SIMD)
+  if(getBlendKernel() == BK_SCALAR) overopaque = false;
+#else
+  overopaque = false;
+#endif
+}
+
+void SpanFill::fill(unsigned char* out, size_t n) const
+{
+  if(!blend)
+  {
+    fillPixels(out, n, pixels);
+    return;
+  }
+  size_t i = 0;
+  while(i < n)
+  {
+    size_t m = CHUNK;
+#if defined(LPI_BLEND_SIMD)
+    if(overopaque)
+    {
+      i += fillOverOpaqueSSE2(out + 4 * i, n - i, pixels);
+      m = 4; //the general blend only until the buffer is opaque again
+    }
+#endif
+    m = std::min(m, n - i);
+    blend(out + 4 * i, pixels, m, mode);
+    i += m;
+  }
+}
+
+void SpanFill::fillCoverage(unsigned char* out, size_t n, const unsigned char* coverage) const
+{
+  unsigned char in[4 * CHUNK];
+  std::memcpy(in, pixels, sizeof(in));
+  for(size_t i = 0; i < n; i += CHUNK)
+  {
+    size_t m = std::min<size_t>(CHUNK, n - i);
+    if(mode.premultiplied)
+    {
+      //the color channels are multiplied with the alpha too
+      for(size_t j = 0; j < 4 * m; j++) in[j] = (pixels[j] * coverage[i + j / 4] + 127) / 255;
+    }
+    else
+    {
+      for(size_t j = 0; j < m; j++) in[4 * j + 3] = (pixels[3] * coverage[i + j] + 127) / 255;
+    }
+    blendpartial(out + 4 * i, in, m, mode);
+  }
+}
+
+void SpanFill::fillPixel(unsigned char* out, unsigned char coverage) const
+{
+  if(coverage == 255)
+  {
+    fill(out, 1);
+    return;
+  }
+  unsigned char in[4];
+  if(mode.premultiplied) for(int c = 0; c < 4; c++) in[c] = (pixels[c] * coverage + 127) / 255;
+  else
+  {
+    std::memcpy(in, pixels, 3);
+    in[3] = (pixels[3] * coverage + 127) / 255;
+  }
+  blendpartial(out, in, 1, mode);
+}
+
+void premultiplySpan(unsigned char* out, const unsigned char* in, size_t n)
+{
+  size_t i = 0;
+#if defined(LPI_BLEND_SIMD)
+  if(getBlendKernel() != BK_SCALAR) i = premultiplySpanSSE2(out, in, n);
+#endif
+  for(; i < n; i++)
+  {
+    int a = in[4 * i + 3];
+    for(int c = 0; c < 3; c++) out[4 * i + c] = (in[4 * i + c] * a + 127) / 255;
+    out[4 * i + 3] = a;
+  }
+}
+
+void unpremultiplySpan(unsigned char* out, const unsigned char* in, size_t n)
+{
+  for(size_t i = 0; i < n; i++)
+  {
+    int a = in[4 * i + 3];
+    for(int c = 0; c < 3; c++) out[4 * i + c] = a == 0 ? 0 : std::min(255, (in[4 * i + c] * 255 + a / 2) / a);
+    out[4 * i + 3] = a;
+  }
+}
+
+void setAlphaOfColorKey(unsigned char* pixels, size_t n, const unsigned char* key, int keyalpha, int otheralpha)
+{
+  size_t i = 0;
+#if defined(LPI_BLEND_SIMD)
+  if(getBlendKernel() != BK_SCALAR) i = setAlphaOfColorKeySSE2(pixels, n, key, keyalpha, otheralpha);
+#endif
+  for(; i < n; i++)
+  {
+    unsigned char* p = pixels + 4 * i;
+    if(p[0] == key[0] && p[1] == key[1] && p[2] == key[2]) p[3] = keyalpha;
+    else if(otheralpha >= 0) p[3] = otheralpha;
+  }
+}
+
+void replaceColorKey(unsigned char* pixels, size_t n, const unsigned char* key, const unsigned char* pixel)
+{
+  size_t i = 0;
+#if defined(LPI_BLEND_SIMD)
+  if(getBlendKernel() != BK_SCALAR) i = replaceColorKeySSE2(pixels, n, key, pixel);
+#endif
+  for(; i < n; i++)
+  {
+    unsigned char* p = pixels + 4 * i;
+    if(p[0] == key[0] && p[1] == key[1] && p[2] == key[2]) std::memcpy(p, pixel, 4);
+  }
+}
+
+void swapRedBlue(unsigned char* out, const unsigned char* in, size_t n)
+{
+  size_t i = 0;
+#if defined(LPI_BLEND_SIMD)
+  if(getBlendKernel() != BK_SCALAR) i = swapRedBlueSSE2(out, in, n);
+#endif
+  for(; i < n; i++)
+  {
+    unsigned char r = in[4 * i + 0];
+    out[4 * i + 0] = in[4 * i + 2];
+    out[4 * i + 1] = in[4 * i + 1];
+    out[4 * i + 2] = r;
+    out[4 * i + 3] = in[4 * i + 3];
+  }
+}
+
+void loadRGB565(unsigned char* rgba, const unsigned char* in, size_t n)
+{
+  size_t i = 0;
+#if defined(LPI_BLEND_SIMD)
+  if(getBlendKernel() != BK_SCALAR) i = loadRGB565SSE2(rgba, in, n);
+#endif
+  for(; i < n; i++)
+  {
+    unsigned short p;
+    std::memcpy(&p, in + 2 * i, 2);
+    int r = p >> 11, g = (p >> 5) & 63, b = p & 31;
+    rgba[4 * i + 0] = (r << 3) | (r >> 2);
+    rgba[4 * i + 1] = (g << 2) | (g >> 4);
+    rgba[4 * i + 2] = (b << 3) | (b >> 2);
+    rgba[4 * i + 3] = 255;
+  }
+}
+
+void storeRGB565(unsigned char* out, const unsigned char* rgba, size_t n)
+{
+  size_t i = 0;
+#if defined(LPI_BLEND_SIMD)
+  if(getBlendKernel() != BK_SCALAR) i = storeRGB565SSE2(out, rgba, n);
+#endif
+  for(; i < n; i++)
+  {
+    //rounded to the nearest value, so that loading and storing again doesn't change it
+    int r = (rgba[4 * i + 0] * 31 + 127) / 255;
+    int g = (rgba[4 * i + 1] * 63 + 127) / 255;
+    int b = (rgba[4 * i + 2] * 31 + 127) / 255;
+    unsigned short p = (unsigned short)((r << 11) | (g << 5) | b);
+    std::memcpy(out + 2 * i, &p, 2);
+  }
+}
+
+void loadGrey8(unsigned char* rgba, const unsigned char* in, size_t n)
+{
+  for(size_t i = 0; i < n; i++)
+  {
+    rgba[4 * i + 0] = rgba[4 * i + 1] = rgba[4 * i + 2] = in[i];
+    rgba[4 * i + 3] = 255;
+  }
+}
+
+void storeGrey8(unsigned char* out, const unsigned char* rgba, size_t n)
+{
+  //the luma of Rec. 601, the weights add up to 256 so that grey stays the same
+  for(size_t i = 0; i < n; i++) out[i] = (rgba[4 * i + 0] * 77 + rgba[4 * i + 1] * 150 + rgba[4 * i + 2] * 29 + 128) >> 8;
+}
+
+void loadA8(unsigned char* rgba, const unsigned char* in, size_t n)
+{
+  for(size_t i = 0; i < n; i++)
+  {
+    rgba[4 * i + 0] = rgba[4 * i + 1] = rgba[4 * i + 2] = 255;
+    rgba[4 * i + 3] = in[i];
+  }
+}
+
+void storeA8(unsigned char* out, const unsigned char* rgba, size_t n)
+{
+  for(size_t i = 0; i < n; i++) out[i] = rgba[4 * i + 3];
+}
+
+void gradientSpan(unsigned char* out, size_t n, const int* start, const int* step)
+{
+  size_t i = 0;
+#if defined(LPI_BLEND_SIMD)
+  if(getBlendKernel() != BK_SCALAR) i = gradientSpanSSE2(out, n, start, step);
+#endif
+  for(; i < n; i++)
+  {
+    for(int c = 0; c < 4; c++)
+    {
+      int v = start[c] + (int)i * step[c];
+      out[4 * i + c] = v < 0 ? 0 : std::min(255, v >> 16);
+    }
+  }
+}
+
+void modulateSpan(unsigned char* out, const unsigned char* in, const unsigned char* colors, size_t n)
+{
+  size_t i = 0;
+#if defined(LPI_BLEND_SIMD)
+  if(getBlendKernel() != BK_SCALAR) i = modulateSpanSSE2(out, in, colors, n);
+#endif
+  for(i *= 4; i < 4 * n; i++) out[i] = (in[i] * colors[i]) / 255; //per channel
+}
+
+void lerpRows(unsigned char* out, const unsigned char* row0, const unsigned char* row1, size_t n, int weight)
+{
+  size_t i = 0;
+#if defined(LPI_BLEND_SIMD)
+  if(getBlendKernel() != BK_SCALAR) i = lerpRowsSSE2(out, row0, row1, n, weight);
+#endif
+  for(size_t j = 4 * i; j < 4 * n; j++)
+  {
+    out[j] = (row0[j] * (256 - weight) + row1[j] * weight) >> 8;
+  }
+}
+
+void gatherBilinear(unsigned char* out, const unsigned char* in, const int* columns, const unsigned short* weights, size_t n)
+{
+  size_t i = 0;
+#if defined(LPI_BLEND_SIMD)
+  if(getBlendKernel() != BK_SCALAR) i = gatherBilinearSSE2(out, in, columns, weights, n);
+#endif
+  for(; i < n; i++)
+  {
+    const unsigned char* p = in + 4 * columns[i];
+    int w0 = weights[8 * i];
+    int w1 = weights[8 * i + 4];
+    for(int c = 0; c < 4; c++) out[4 * i + c] = (p[c] * w0 + p[4 + c] * w1) >> 8;
+  }
+}
+
+void gatherNearest(unsigned char* out, const unsigned char* in, const int* columns, size_t n)
+{
+  for(size_t i = 0; i < n; i++)
+  {
+    std::memcpy(out + 4 * i, in + 4 * columns[i], 4);
+  }
+}
+
+namespace
+{
+  /*
+  sRGB approximated with gamma 2.2. Linear values have 12 bits, so that the sum of 4 of them
+  times an alpha of 255 still fits in an int.
+  */
+  struct GammaTables
+  {
+    unsigned short tolinear[256];
+    unsigned char fromlinear[4096];
+
+    GammaTables()
+    {
+      for(int i = 0; i < 256; i++) tolinear[i] = (unsigned short)(std::pow(i / 255.0, 2.2) * 4095.0 + 0.5);
+      for(int i = 0; i < 4096; i++) fromlinear[i] = (unsigned char)(std::pow(i / 4095.0, 1.0 / 2.2) * 255.0 + 0.5);
+    }
+  };
+
+  const GammaTables gammatables;
+}
+
+void downsample2x2(unsigned char* out, const unsigned char* row0, const unsigned char* row1, size_t n, bool straight, bool gamma)
+{
+  size_t i = 0;
+#if defined(LPI_BLEND_SIMD)
+  //the gamma correct average stays scalar: it needs a table lookup per channel, SSE2 has no gather for that
+  if(!gamma && getBlendKernel() != BK_SCALAR) i = straight ? downsample2x2StraightSSE2(out, row0, row1, n) : downsample2x2SSE2(out, row0, row1, n);
+#endif
+  const unsigned short* tolinear = gammatables.tolinear;
+  for(; i < n; i++)
+  {
+    const unsigned char* p[4] = { row0 + 8 * i, row0 + 8 * i + 4, row1 + 8 * i, row1 + 8 * i + 4 };
+    int alpha = p[0][3] + p[1][3] + p[2][3] + p[3][3];
+    out[4 * i + 3] = (alpha + 2) >> 2;
+    for(int c = 0; c < 3; c++)
+    {
+      if(straight && alpha > 0)
+      {
+        //weighted with the alpha, so that the color of transparent pixels doesn't bleed in
+        int sum = 0;
+        for(int j = 0; j < 4; j++) sum += (gamma ? tolinear[p[j][c]] : p[j][c]) * p[j][3];
+        sum = (sum + alpha / 2) / alpha;
+        out[4 * i + c] = gamma ? gammatables.fromlinear[sum] : sum;
+      }
+      else
+      {
+        int sum = 0;
+        for(int j = 0; j < 4; j++) sum += gamma ? tolinear[p[j][c]] : p[j][c];
+        sum = (sum + 2) >> 2;
+        out[4 * i + c] = gamma ? gammatables.fromlinear[sum] : sum;
+      }
+    }
+  }
+}
+
+} //namespace lpi
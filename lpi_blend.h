@@ -0,0 +1,199 @@
+/*
+Copyright (c) 2005-2010 Lode Vandevenne
+All rights reserved.
+
+This file is part of Lode's Programming Interface.
+
+Lode's Programming Interface is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Lode's Programming Interface is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "lpi_color.h"
+
+#include <cstddef>
+
+/*
+lpi_blend: pixel blending kernels for RGBA buffers, used by ADrawer2DBuffer.
+
+The kernels work on horizontal spans of pixels (row-major, 4 bytes per pixel).
+There is a scalar implementation and SSE2 and AVX2 implementations that handle
+4 or 8 pixels at once. Which one is used is decided at runtime depending on
+what the CPU supports. All implementations give bit-identical results: the
+divisions by 255 of the scalar version are done exactly in the SIMD versions
+too, with the trick x / 255 == (x + 1 + (x >> 8)) >> 8 (valid for 0 <= x < 65535).
+
+Define LPI_NO_SIMD to compile only the scalar kernels.
+*/
+
+namespace lpi
+{
+
+/*
+The settings for blending a texture over a buffer. Same meaning as the
+settings of ADrawer2DBuffer with the same name.
+The colorMod components and the extra opacity are clamped to the range 0-255.
+
+premultiplied: the input and the output have premultiplied alpha (the color
+channels are already multiplied with the alpha channel). When the texture alpha
+is used as opacity, blending is then out = in + out * (255 - in alpha) / 255 for
+all 4 channels, after multiplying the input with the colorMod and the opacities.
+This is faster than the straight alpha blending and gives the correct result for
+translucent destination pixels.
+*/
+struct BlendMode
+{
+  int r, g, b, a; //colorMod
+  bool texture_alpha_as_opacity;
+  bool color_alpha_as_opacity;
+  bool use_extra_opacity; //false if extra_opacity is 1.0
+  int extra_opacity; //extra opacity converted to range 0-255
+  bool premultiplied;
+
+  BlendMode(const ColorRGB& colorMod, bool texture_alpha_as_opacity, bool color_alpha_as_opacity, double extra_opacity, bool premultiplied = false);
+};
+
+/*
+blend n pixels of "in" over n pixels of "out". Both are RGBA, 4 bytes per pixel.
+*/
+void blendSpan(unsigned char* out, const unsigned char* in, size_t n, const BlendMode& mode);
+
+/*
+There is a separate blend function for every combination of flags of BlendMode, so
+that the inner loops don't have to test them per pixel. getBlendSpanFunc returns the
+one for the given mode, call it once per draw call instead of using blendSpan for
+every span. The function must be called with the same mode it was chosen for.
+opaque_source: set to true if every source pixel has alpha 255, if the colorMod is
+white too the blending then becomes a plain copy.
+*/
+typedef void (*BlendSpanFunc)(unsigned char* out, const unsigned char* in, size_t n, const BlendMode& mode);
+BlendSpanFunc getBlendSpanFunc(const BlendMode& mode, bool opaque_source = false);
+
+/*
+Filtering, used to draw scaled textures. The weights are in range 0-256.
+lerpRows: linear interpolation between two rows of n pixels, weight is the weight of row1.
+gatherBilinear: out[i] is the interpolation between the pixels columns[i] and columns[i] + 1
+of in, so in must have one pixel more than the largest column. weights has 8 values per output
+pixel: 4 times the weight of the left pixel, then 4 times the weight of the right pixel (this
+layout can be loaded directly by the SIMD kernels).
+gatherNearest: out[i] is pixel columns[i] of in.
+*/
+void lerpRows(unsigned char* out, const unsigned char* row0, const unsigned char* row1, size_t n, int weight);
+void gatherBilinear(unsigned char* out, const unsigned char* in, const int* columns, const unsigned short* weights, size_t n);
+void gatherNearest(unsigned char* out, const unsigned char* in, const int* columns, size_t n);
+
+/*
+Mipmaps: out[i] is the average of the 2x2 block of pixels 2i and 2i + 1 of row0 and row1, so the
+rows have 2n pixels. straight: the pixels have straight alpha, then the colors are weighted with
+the alpha so that the color of transparent pixels doesn't bleed in (not needed for premultiplied
+or opaque pixels). gamma: the colors are averaged as linear light instead of as sRGB values, so
+that e.g. fine black and white patterns don't become too dark. With gamma, it's always done
+without SIMD.
+*/
+void downsample2x2(unsigned char* out, const unsigned char* row0, const unsigned char* row1, size_t n, bool straight = false, bool gamma = false);
+
+/*
+Fills spans with a plain color, blended the same way as blendSpan blends a texture of which all
+pixels have that color. Create it once per draw call: it chooses the blend function and prepares
+a span of the color as its input. Use a mode with a white colorMod and the same value for
+texture_alpha_as_opacity and color_alpha_as_opacity: they decide whether the alpha of the color
+is used as opacity or stored literally.
+If the result is the color itself (literal alpha, or an opaque color), fill only stores it, with
+wide writes.
+The color is given with straight alpha also if the mode is premultiplied, it's converted here.
+*/
+class SpanFill
+{
+  public:
+    SpanFill(const ColorRGB& color, const BlendMode& mode);
+
+    void fill(unsigned char* out, size_t n) const;
+    //like fill, but with the alpha of the color multiplied by the coverage (0-255) of each pixel, for anti-aliasing
+    void fillCoverage(unsigned char* out, size_t n, const unsigned char* coverage) const;
+    //one pixel with the given coverage, for anti-aliased lines that don't have spans
+    void fillPixel(unsigned char* out, unsigned char coverage) const;
+
+  private:
+    enum { CHUNK = 64 }; //amount of pixels blended per call of the blend function
+
+    BlendMode mode;
+    BlendSpanFunc blend; //0 if fill only stores the color
+    BlendSpanFunc blendpartial; //for pixels with less alpha than the color
+    bool overopaque; //use the faster kernel for a translucent color over opaque pixels
+    unsigned char pixels[4 * CHUNK]; //the color repeated
+};
+
+//stores the 4 bytes of pixel in n pixels of out
+void fillPixels(unsigned char* out, size_t n, const unsigned char* pixel);
+
+/*
+Conversion between straight and premultiplied alpha, out and in may be the same buffer.
+premultiplySpan rounds to the nearest value. unpremultiplySpan can't restore the color of
+pixels with alpha 0, those become 0,0,0,0, and the precision of the colors is lower the
+lower the alpha is, so convert textures once when loading them and not back and forth.
+*/
+void premultiplySpan(unsigned char* out, const unsigned char* in, size_t n);
+void unpremultiplySpan(unsigned char* out, const unsigned char* in, size_t n);
+
+/*
+Color keys, for the alpha effects of lpi_texture. setAlphaOfColorKey: the pixels of which the RGB
+is the 3 bytes of key get alpha keyalpha, the other pixels get otheralpha, or keep their alpha if
+otheralpha is negative. replaceColorKey: the pixels of which the RGB is key become the 4 bytes of pixel.
+*/
+void setAlphaOfColorKey(unsigned char* pixels, size_t n, const unsigned char* key, int keyalpha, int otheralpha = -1);
+void replaceColorKey(unsigned char* pixels, size_t n, const unsigned char* key, const unsigned char* pixel);
+
+/*
+Conversion between RGBA and other pixel formats, for drawing on buffers in those formats (see
+Drawer2DBufferFormat). load converts n pixels of the format to RGBA, store converts RGBA back.
+swapRedBlue converts RGBA to BGRA and back (it's the same in both directions).
+RGB565: 16-bit pixels in the byte order of the CPU, the alpha channel is dropped and loaded as 255.
+Grey8: 8-bit luma, loaded as an opaque grey. A8: only the alpha channel, loaded as white.
+*/
+void swapRedBlue(unsigned char* out, const unsigned char* in, size_t n);
+void loadRGB565(unsigned char* rgba, const unsigned char* in, size_t n);
+void storeRGB565(unsigned char* out, const unsigned char* rgba, size_t n);
+void loadGrey8(unsigned char* rgba, const unsigned char* in, size_t n);
+void storeGrey8(unsigned char* out, const unsigned char* rgba, size_t n);
+void loadA8(unsigned char* rgba, const unsigned char* in, size_t n);
+void storeA8(unsigned char* out, const unsigned char* rgba, size_t n);
+
+/*
+Gradients, used by the gradient shapes and the textures drawn with a color per corner.
+gradientSpan: n pixels of which the colors change linearly. start and step have the 4 channels
+(RGBA) in 16.16 fixed point, channel c of pixel i is (start[c] + i * step[c]) >> 16, clamped to 0-255.
+modulateSpan: out = in * colors / 255 for all 4 channels, like the colorMod of the blending does,
+but with another color for every pixel. out and in may be the same buffer.
+*/
+void gradientSpan(unsigned char* out, size_t n, const int* start, const int* step);
+void modulateSpan(unsigned char* out, const unsigned char* in, const unsigned char* colors, size_t n);
+
+//the kernel used by blendSpan. BK_AUTO selects the best one the CPU supports.
+enum BlendKernel
+{
+  BK_AUTO,
+  BK_SCALAR,
+  BK_SSE2,
+  BK_AVX2
+};
+
+/*
+Force a certain kernel, e.g. to compare the output of the SIMD kernels with the scalar one.
+If the CPU doesn't support the given kernel, the best supported one below it is used instead.
+Don't call it while other threads are blending.
+*/
+void setBlendKernel(BlendKernel kernel);
+BlendKernel getBlendKernel(); //returns the kernel that is currently used (never BK_AUTO)
+
+} //namespace lpi
@@ -20,6 +20,11 @@ along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licens
 
 #include "lpi_draw2d.h"
 
+#include "lpi_region.h"
+#include "lpi_scanline.h"
+
+#include <algorithm>
+#include <functional>
 #include <vector>
 #include <cmath>
 #include <iostream>
@@ -27,6 +32,71 @@ along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licens
 namespace lpi
 {
 
+SpriteInstance::SpriteInstance()
+: texture(0)
+, x(0)
+, y(0)
+, sizex(0)
+, sizey(0)
+, u0(0)
+, v0(0)
+, u1(0)
+, v1(0)
+, colorMod(RGB_White)
+{
+}
+
+SpriteInstance::SpriteInstance(const ITexture* texture, int x, int y, const ColorRGB& colorMod)
+: texture(texture)
+, x(x)
+, y(y)
+, sizex(texture ? texture->getU() : 0) //a null texture gives an empty sprite, that is skipped when drawing
+, sizey(texture ? texture->getV() : 0)
+, u0(0)
+, v0(0)
+, u1(texture ? texture->getU() : 0)
+, v1(texture ? texture->getV() : 0)
+, colorMod(colorMod)
+{
+}
+
+void SpriteInstance::setSource(int u0, int v0, int u1, int v1)
+{
+  this->u0 = u0;
+  this->v0 = v0;
+  this->u1 = u1;
+  this->v1 = v1;
+  sizex = u1 - u0;
+  sizey = v1 - v0;
+}
+
+bool SpriteInstance::isWholeTexture() const
+{
+  return u0 == 0 && v0 == 0 && u1 == (int)texture->getU() && v1 == (int)texture->getV();
+}
+
+namespace
+{
+
+struct SpriteTextureLess
+{
+  const SpriteInstance* sprites;
+  SpriteTextureLess(const SpriteInstance* sprites) : sprites(sprites) {}
+  bool operator()(size_t a, size_t b) const { return std::less<const ITexture*>()(sprites[a].texture, sprites[b].texture); }
+};
+
+} //end of anonymous namespace
+
+void sortSpritesByTexture(std::vector<size_t>& order, const SpriteInstance* sprites, size_t n)
+{
+  order.resize(n);
+  for(size_t i = 0; i < n; i++) order[i] = i;
+  //often already sorted, e.g. the glyphs of a text that all use the same atlas page
+  size_t i = 1;
+  while(i < n && !std::less<const ITexture*>()(sprites[i].texture, sprites[i - 1].texture)) i++;
+  if(i < n) std::stable_sort(order.begin(), order.end(), SpriteTextureLess(sprites));
+}
+
 //helper-function for drawing bezier curves (a stop condition)
 bool bezier_nearly_flat(double x0, double y0,
                         double x1, double y1,
@@ -165,6 +235,105 @@ void ADrawer2D::drawCircle(int x, int y, int radius, const ColorRGB& color, bool
   drawEllipseCentered(x, y, radius, radius, color, filled);
 }
 
+namespace
+{
+
+/*
+Draws the spans of a polygon as filled rectangles. Rows below each other that have exactly the
+same spans become one rectangle, so that e.g. the straight parts of a shape are a single call.
+*/
+class RectangleSpanFiller : public ISpanFiller
+{
+  public:
+    RectangleSpanFiller(IDrawer2D& drawer, const ColorRGB& color)
+    : drawer(drawer)
+    , color(color)
+    , y0(0)
+    , y1(0)
+    , rowy(0)
+    {
+    }
+    
+    virtual void fillSpan(int y, int x0, int x1)
+    {
+      if(!row.empty() && y != rowy) endRow();
+      rowy = y;
+      row.push_back(x0);
+      row.push_back(x1);
+    }
+    
+    //only happens with anti-aliasing, which isn't used here
+    virtual void fillCoverage(int y, int x0, int x1, const unsigned char* coverage)
+    {
+      (void)coverage;
+      fillSpan(y, x0, x1);
+    }
+    
+    void finish()
+    {
+      if(!row.empty()) endRow();
+      flush();
+    }
+    
+  private:
+    IDrawer2D& drawer;
+    ColorRGB color;
+    std::vector<int> spans; //x0 and x1 of the spans that all rows from y0 to y1 (not inclusive) have
+    int y0;
+    int y1;
+    std::vector<int> row; //x0 and x1 of the spans of row rowy so far
+    int rowy;
+    
+    void endRow()
+    {
+      if(rowy != y1 || row != spans)
+      {
+        flush();
+        spans.swap(row);
+        y0 = rowy;
+      }
+      y1 = rowy + 1;
+      row.clear();
+    }
+    
+    void flush()
+    {
+      for(size_t i = 0; i < spans.size(); i += 2) drawer.drawRectangle(spans[i], y0, spans[i + 1], y1, color, true);
+      spans.clear();
+    }
+};
+
+} //end of anonymous namespace
+
+void ADrawer2D::drawPolygon(const int* xy, size_t numpoints, const ColorRGB& color, bool filled)
+{
+  if(numpoints == 0) return;
+  
+  //with the rasterizer of the buffer drawer, so that concave and self-intersecting polygons are filled the same way (non-zero rule),
+  //and the border as a closed stroke of width 1, so that its corners aren't drawn twice like with a drawLine per edge
+  int x0 = xy[0], y0 = xy[1], x1 = xy[0], y1 = xy[1]; //bounding box
+  for(size_t i = 1; i < numpoints; i++)
+  {
+    x0 = std::min(x0, xy[2 * i]);
+    y0 = std::min(y0, xy[2 * i + 1]);
+    x1 = std::max(x1, xy[2 * i]);
+    y1 = std::max(y1, xy[2 * i + 1]);
+  }
+  
+  //the rasterizer has the center of pixel (x, y) at (x + 0.5, y + 0.5)
+  std::vector<double> points(2 * numpoints);
+  for(size_t i = 0; i < 2 * numpoints; i++) points[i] = xy[i] + 0.5;
+  
+  ScanlineRasterizer rasterizer;
+  if(filled) rasterizer.addPolygon(&points[0], numpoints);
+  else rasterizer.addStroke(&points[0], numpoints, 1.0, LJ_MITER, LC_BUTT, true);
+  int m = filled ? 0 : (int)std::ceil(0.5 * STROKE_MITER_LIMIT); //how far the miters can stick out
+  
+  RectangleSpanFiller filler(*this, color);
+  rasterizer.render(filler, x0 - m, y0 - m, x1 + 1 + m, y1 + 1 + m);
+  filler.finish();
+}
+
 void ADrawer2D::convertTextureIfNeeded(ITexture*& texture)
 {
   if(!supportsTexture(texture))
@@ -185,6 +354,35 @@ void ADrawer2D::drawTextureSizedCentered(const ITexture* texture, int x, int y,
   drawTextureSized(texture, x - sizex / 2, y - sizey / 2, sizex, sizey, colorMod);
 }
 
+void ADrawer2D::pushScissorRegion(const ClipRegion& region)
+{
+  int x0, y0, x1, y1;
+  region.getBounds(x0, y0, x1, y1);
+  pushSmallestScissor(x0, y0, x1, y1);
+}
+
+void ADrawer2D::drawTextures(const SpriteInstance* sprites, size_t n)
+{
+  for(size_t i = 0; i < n; i++)
+  {
+    const SpriteInstance& s = sprites[i];
+    if(!s.texture || s.u0 >= s.u1 || s.v0 >= s.v1) continue;
+    if(s.isWholeTexture())
+    {
+      drawTextureSized(s.texture, s.x, s.y, s.sizex, s.sizey, s.colorMod);
+      continue;
+    }
+    //the whole texture scaled so that the part has the wanted size, with only the part inside the scissor
+    double zoomx = (double)s.sizex / (s.u1 - s.u0);
+    double zoomy = (double)s.sizey / (s.v1 - s.v0);
+    int x = s.x - (int)std::floor(s.u0 * zoomx + 0.5);
+    int y = s.y - (int)std::floor(s.v0 * zoomy + 0.5);
+    pushSmallestScissor(s.x, s.y, s.x + s.sizex, s.y + s.sizey);
+    drawTextureSized(s.texture, x, y, (size_t)(s.texture->getU() * zoomx + 0.5), (size_t)(s.texture->getV() * zoomy + 0.5), s.colorMod);
+    popScissor();
+  }
+}
+
 //void ADrawer2D::drawTextureTransformedCentered(const ITexture* texture, int x, int y, const double* matrix, const ColorRGB& colorMod)
 //{
 //  double cx = texture.getU() / 2.0;
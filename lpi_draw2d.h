@@ -33,11 +33,41 @@ along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licens
 namespace lpi
 {
 
+class ClipRegion;
+
 //helper functions for 2D graphics
 bool bezier_nearly_flat(double x0, double y0, double x1, double y1, double x2, double y2, double x3, double y3);
 bool clipLine(int& ox0, int& oy0, int& ox1, int& oy1, int ix0, int iy0, int ix1, int iy1, int left, int top, int right, int bottom);
 void clipRect(int& ox0, int& oy0, int& ox1, int& oy1, int ix0, int iy0, int ix1, int iy1, int left, int top, int right, int bottom);
 
+/*
+SpriteInstance: one texture drawn by IDrawer2D::drawTextures. The part (u0, v0)-(u1, v1) of the
+texture (end coordinates not inclusive, must be inside the texture) is drawn with its top left
+corner at (x, y), scaled to sizex * sizey, and with the colorMod.
+The constructor that takes a texture sets the part to the whole texture and the size to that of
+the texture, setSource also sets the size to the size of the part.
+*/
+struct SpriteInstance
+{
+  const ITexture* texture;
+  int x;
+  int y;
+  size_t sizex;
+  size_t sizey;
+  int u0, v0, u1, v1; //the part of the texture
+  ColorRGB colorMod;
+  
+  SpriteInstance();
+  SpriteInstance(const ITexture* texture, int x, int y, const ColorRGB& colorMod = RGB_White);
+  
+  void setSource(int u0, int v0, int u1, int v1);
+  void setSize(size_t sizex, size_t sizey) { this->sizex = sizex; this->sizey = sizey; }
+  bool isWholeTexture() const; //true if the part is the whole texture
+};
+
+//fills order with the indices of the n sprites, sorted on texture, and in the given order for the same texture
+void sortSpritesByTexture(std::vector<size_t>& order, const SpriteInstance* sprites, size_t n);
+
 class IDrawer2D
 {
   public:
@@ -64,6 +94,8 @@ class IDrawer2D
     virtual void pushScissor(int x0, int y0, int x1, int y1) = 0;
     virtual void pushSmallestScissor(int x0, int y0, int x1, int y1) = 0; //the result will be smaller than the given coordinates and the last active scissor
     virtual void popScissor() = 0; //pops the last set scissor, bringing the previous one back (it works like a stack)
+    //like pushSmallestScissor with a region made of rectangles (see lpi_region.h), also popped with popScissor
+    virtual void pushScissorRegion(const ClipRegion& region) = 0;
   
     ///thin shapes
     
@@ -83,7 +115,8 @@ class IDrawer2D
     virtual void drawEllipse(int x0, int y0, int x1, int y1, const ColorRGB& color, bool filled) = 0;
     virtual void drawEllipseCentered(int x, int y, int radiusx, int radiusy, const ColorRGB& color, bool filled) = 0;
     virtual void drawCircle(int x, int y, int radius, const ColorRGB& color, bool filled) = 0;
-    //todo: polygon
+    //drawPolygon: xy contains the x and y coordinate of each point, so it has 2 * numpoints values
+    virtual void drawPolygon(const int* xy, size_t numpoints, const ColorRGB& color, bool filled) = 0;
     //todo: rounded rectangle
     //todo: pie
     //todo: chord (shape is e.g. "D", "|)", ...)
@@ -116,6 +149,15 @@ class IDrawer2D
                                    , const ColorRGB& color00, const ColorRGB& color01, const ColorRGB& color10, const ColorRGB& color11) = 0;
     virtual void drawTextureRepeatedGradient(const ITexture* texture, int x0, int y0, int x1, int y1
                                            , const ColorRGB& color00, const ColorRGB& color01, const ColorRGB& color10, const ColorRGB& color11) = 0;
+    
+    /*
+    drawTextures: draws n sprites with less overhead per sprite than drawTexture and drawTextureSized,
+    for tile maps, particles, text, ... The implementations group the sprites per texture, so sprites
+    with different textures aren't necessarily drawn in the order of the list: if overlapping sprites
+    of different textures have to be drawn in a certain order, give them in separate calls. Sprites
+    with the same texture are drawn in the order of the list.
+    */
+    virtual void drawTextures(const SpriteInstance* sprites, size_t n) = 0;
 
     ////"matrix" is 2x2 matrix given as an array of 4 doubles: topleft element, topright element, bottomleft element, bottomright element. The matrix has column vectors for doing the transformation (the OpenGL convention, not the Direct3D convention).
     //virtual void drawTextureTransformed(const ITexture* texture, int x, int y, const double* matrix, const ColorRGB& colorMod = RGB_White) = 0; //transformed around the top left corner of the texture
@@ -136,11 +178,14 @@ class ADrawer2D : public IDrawer2D //abstract IDrawer2D already implements some
   
     virtual void drawEllipse(int x0, int y0, int x1, int y1, const ColorRGB& color, bool filled);
     virtual void drawCircle(int x, int y, int radius, const ColorRGB& color, bool filled);
+    virtual void drawPolygon(const int* xy, size_t numpoints, const ColorRGB& color, bool filled); //filled, or the border stroked, as rectangles of the spans of a ScanlineRasterizer here
+    virtual void pushScissorRegion(const ClipRegion& region); //clips to the bounding box of the region here
     
     virtual void convertTextureIfNeeded(ITexture*& texture);
 
     virtual void drawTextureCentered(const ITexture* texture, int x, int y, const ColorRGB& colorMod = RGB_White);
     virtual void drawTextureSizedCentered(const ITexture* texture, int x, int y, size_t sizex, size_t sizey, const ColorRGB& colorMod = RGB_White);
+    virtual void drawTextures(const SpriteInstance* sprites, size_t n); //one by one with drawTextureSized, a part of a texture with a scissor
     //virtual void drawTextureTransformedCentered(const ITexture* texture, int x, int y, const double* matrix, const ColorRGB& colorMod);
 };
 
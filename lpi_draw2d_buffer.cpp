@@ -19,11 +19,17 @@ along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licens
 */
 
 #include "lpi_draw2d_buffer.h"
+#include "lpi_atlas.h"
+#include "lpi_blend.h"
 #include "lpi_math2d.h"
+#include "lpi_scanline.h"
 #include "lpi_texture.h"
+#include "lpi_thread.h"
 
-#include <vector>
+#include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <vector>
 
 namespace lpi
 {
@@ -32,251 +38,119 @@ namespace lpi
 namespace
 {
 
-void pset(unsigned char* buffer, size_t bufferpos, const ColorRGB& color)
-{
-  ///Opaque
-  /*buffer[bufferPos + 0] = color.r;
-  buffer[bufferPos + 1] = color.g;
-  buffer[bufferPos + 2] = color.b;
-  buffer[bufferPos + 3] = color.a;*/
-  
-  ///Alpha Channeled
-  const unsigned short ccr = color.r;
-  const unsigned short ccg = color.g;
-  const unsigned short ccb = color.b;
-  const unsigned short cca = color.a;
-  const unsigned short cca1 = 256 - cca;
-    
-  const unsigned short orr = buffer[bufferpos + 0];
-  const unsigned short org = buffer[bufferpos + 1];
-  const unsigned short orb = buffer[bufferpos + 2];
-  const unsigned short ora = buffer[bufferpos + 3];
-  
-  buffer[bufferpos + 0] = ((orr * cca1) + (ccr * cca)) / 256;
-  buffer[bufferpos + 1] = ((org * cca1) + (ccg * cca)) / 256;
-  buffer[bufferpos + 2] = ((orb * cca1) + (ccb * cca)) / 256;
-  buffer[bufferpos + 3] = ora > cca ? ora : cca; //not really correct but good enough for now.
-}
-
-void pset(unsigned char* buffer, int buffer_w, int x, int y, const ColorRGB& color)
-{
-  pset(buffer, 4 * buffer_w * y + 4 * x, color);
-}
-
-void psetClipped(unsigned char* buffer, int buffer_w, const ADrawer2DBuffer::Clip& c, int x, int y, const ColorRGB& color)
-{
-  if(x >= c.x0 && x < c.x1 && y >= c.y0 && y < c.y1) pset(buffer, buffer_w, x, y, color);
-}
-
-//Fast horizontal line from (x1,y) to (x2,y), with rgb color
-void horLine(unsigned char* buffer, int buffer_w, int buffer_h, int y, int x1, int x2, const ColorRGB& color)
+/*
+n pixels of the buffer from (x, y) on, as RGBA to blend into: the pixels themselves if the buffer is
+RGBA, otherwise they're converted into the row of the target, and converted back to the buffer when
+the PixelSpan is destroyed. Meant as a temporary in the statement that blends, like
+fill.fill(PixelSpan(target, x, y, n).rgba, n), only one can exist at a time per target.
+*/
+struct PixelSpan
 {
-  if(x2 < x1) std::swap(x1, x2); //swap x1 and x2 because x1 must be the leftmost endpoint
-  if(x2 < 0 || x1 > buffer_w - 1 || y < 0 || y > buffer_h - 1) return; //no single point of the line is on screen
+  const ADrawer2DBuffer::Target& target;
+  unsigned char* pixels; //the first pixel in the buffer
+  size_t n;
+  unsigned char* rgba;
   
-  int bufferpos = 4 * buffer_w * y;
-  for(int x = x1; x <= x2; x++)
+  PixelSpan(const ADrawer2DBuffer::Target& target, int x, int y, size_t n)
+  : target(target)
+  , pixels(target.buffer + target.pixelbytes * ((size_t)target.w * y + x))
+  , n(n)
   {
-    /*buffer[bufferpos + 0] = color.r;
-    buffer[bufferpos + 1] = color.g;
-    buffer[bufferpos + 2] = color.b;
-    buffer[bufferpos + 3] = color.a;*/
-    pset(buffer, bufferpos, color);
-    bufferpos++;
+    if(!target.load) rgba = pixels;
+    else
+    {
+      if(target.row->size() < 4 * n || target.row->empty()) target.row->resize(4 * n + 4);
+      rgba = &(*target.row)[0];
+      target.load(rgba, pixels, n);
+    }
   }
-}
-
-//Fast vertical line from (x,y1) to (x,y2), with rgb color
-void verLine(unsigned char* buffer, int buffer_w, int buffer_h, int x, int y1, int y2, const ColorRGB& color)
-{
-  if(y2 < y1) std::swap(y1, y2); //swap y1 and y2 because y1 must be the topmost endpoint
-  if(x < 0 || x > buffer_w - 1 || y2 < 0 || y1 > buffer_h - 1) return;
   
-  for(int y = y1; y <= y2; y++)
+  ~PixelSpan()
   {
-    int bufferpos = 4 * buffer_w * y + 4 * x;
-    /*buffer[bufferpos + 0] = color.r;
-    buffer[bufferpos + 1] = color.g;
-    buffer[bufferpos + 2] = color.b;
-    buffer[bufferpos + 3] = color.a;*/
-    pset(buffer, bufferpos, color);
-    bufferpos++;
+    if(target.store) target.store(pixels, rgba, n);
   }
-}
+};
 
-//this one does NOT check if the line is inside the buffer! (hence only width, not height, as parameter)
-void bresenhamLine(unsigned char* buffer, int w, int x0, int y0, int x1, int y1, const ColorRGB& color)
+/*
+One pixel, blended like the spans of the filled shapes (see getFillMode), so that lines, points
+and borders give the same colors as fills.
+*/
+inline void pset(const ADrawer2DBuffer::Target& target, int x, int y, const SpanFill& fill)
 {
-  //draw the line with bresenham
-  int deltax = (int)std::abs((double)(x1 - x0));    // The difference between the x's
-  int deltay = (int)std::abs((double)(y1 - y0));    // The difference between the y's
-  int x = x0;           // Start x off at the first pixel
-  int y = y0;           // Start y off at the first pixel
-  int xinc0, xinc1, yinc0, yinc1, den, num, numadd, numpixels, curpixel;
-
-  if(x1 >= x0)         // The x-values are increasing
-  {
-    xinc0 = 1;
-    xinc1 = 1;
-  }
-  else              // The x-values are decreasing
-  {
-    xinc0 = -1;
-    xinc1 = -1;
-  }
-  if (y1 >= y0)         // The y-values are increasing
-  {
-    yinc0 = 1;
-    yinc1 = 1;
-  }
-  else              // The y-values are decreasing
-  {
-    yinc0 = -1;
-    yinc1 = -1;
-  }
-  if(deltax >= deltay)     // There is at least one x-value for every y-value
-  {
-    xinc0 = 0;          // Don't change the x when numerator >= denominator
-    yinc1 = 0;          // Don't change the y for every iteration
-    den = deltax;
-    num = deltax / 2;
-    numadd = deltay;
-    numpixels = deltax;     // There are more x-values than y-values
-  }
-  else              // There is at least one y-value for every x-value
-  {
-    xinc1 = 0;          // Don't change the x for every iteration
-    yinc0 = 0;          // Don't change the y when numerator >= denominator
-    den = deltay;
-    num = deltay / 2;
-    numadd = deltax;
-    numpixels = deltay;     // There are more y-values than x-values
-  }
-  for(curpixel = 0; curpixel <= numpixels; curpixel++)
-  {
-    pset(buffer, w, x, y, color);  // Draw the current pixel
-    num += numadd;        // Increase the numerator by the top of the fraction
-    if (num >= den)       // Check if numerator >= denominator
-    {
-      num -= den;       // Calculate the new numerator value
-      x += xinc0;       // Change the x as appropriate
-      y += yinc0;       // Change the y as appropriate
-    }
-    x += xinc1;         // Change the x as appropriate
-    y += yinc1;         // Change the y as appropriate
-  }
+  fill.fill(PixelSpan(target, x, y, 1).rgba, 1);
 }
 
-void drawLine(unsigned char* buffer, int w, const ADrawer2DBuffer::Clip& clip, int x0, int y0, int x1, int y1, const ColorRGB& color)
+inline void psetClipped(const ADrawer2DBuffer::Target& target, const ADrawer2DBuffer::Clip& c, int x, int y, const SpanFill& fill)
 {
-  //clip if some point is outside the clipping area
-  if(x0 < clip.x0 || x0 >= clip.x1 || x1 < clip.x0 || x1 >= clip.x1 || y0 < clip.y0 || y0 >= clip.y1 || y1 < clip.y0 || y1 >= clip.y1)
-  {
-    int x2, y2, x3, y3;
-    if(!clipLine(x2, y2, x3, y3, x0, y0, x1, y1, clip.x0, clip.y0, clip.x1, clip.y1)) return;
-    x0 = x2;
-    y0 = y2;
-    x1 = x3;
-    y1 = y3;
-  }
-  
-  bresenhamLine(buffer, w, x0, y0, x1, y1, color);
+  if(x >= c.x0 && x < c.x1 && y >= c.y0 && y < c.y1) pset(target, x, y, fill);
 }
 
-void recursive_bezier(unsigned char* buffer, int w, const ADrawer2DBuffer::Clip& clip,
-                                       double x0, double y0, //endpoint
-                                       double x1, double y1, //handle
-                                       double x2, double y2, //handle
-                                       double x3, double y3, //endpoint
-                                       const ColorRGB& color,
-                                       int n) //extra recursion test for safety
+/*
+Bresenham line from (x0,y0) to (x1,y1), both end points included unless last is false, with only
+the pixels inside the clip area drawn. Without its last point, the segments of a polyline don't
+draw the points they share twice. The end points are not moved to the border of the clip area, instead the
+steps of the algorithm outside of it are skipped, so that a line goes through the same pixels
+whatever the clip area is.
+*/
+void drawLine(const ADrawer2DBuffer::Target& target, const ADrawer2DBuffer::Clip& clip, int x0, int y0, int x1, int y1, const SpanFill& fill, bool last = true)
 {
-  if(bezier_nearly_flat(x0, y0, x1, y1, x2, y2, x3, y3) || n > 20)
-  {
-    drawLine(buffer, w, clip, (int)x0, (int)y0, (int)x3, (int)y3, color);
-  }
-  else
+  int deltax = std::abs(x1 - x0);
+  int deltay = std::abs(y1 - y0);
+  
+  //the major axis is the one that changes by one every step
+  bool xmajor = deltax >= deltay;
+  int den = xmajor ? deltax : deltay;
+  int numadd = xmajor ? deltay : deltax;
+  int major = xmajor ? x0 : y0;
+  int minor = xmajor ? y0 : x0;
+  int majorinc = (xmajor ? x1 >= x0 : y1 >= y0) ? 1 : -1;
+  int minorinc = (xmajor ? y1 >= y0 : x1 >= x0) ? 1 : -1;
+  int majorclip0 = xmajor ? clip.x0 : clip.y0;
+  int majorclip1 = xmajor ? clip.x1 : clip.y1;
+  int minorclip0 = xmajor ? clip.y0 : clip.x0;
+  int minorclip1 = xmajor ? clip.y1 : clip.x1;
+  
+  //the range of steps where the major coordinate is inside the clip area
+  int kstart = majorinc > 0 ? majorclip0 - major : major - (majorclip1 - 1);
+  int kend = majorinc > 0 ? majorclip1 - 1 - major : major - majorclip0;
+  if(kstart < 0) kstart = 0;
+  if(kend > den) kend = den;
+  if(!last && kend == den) kend--;
+  if(kstart > kend) return;
+  
+  //the state after kstart steps. Doubles are used to avoid int overflow, the values are exact integers.
+  int num = den / 2;
+  if(kstart > 0)
   {
-    double x01   = (x0 + x1) / 2;
-    double y01   = (y0 + y1) / 2;
-    double x12   = (x1 + x2) / 2;
-    double y12   = (y1 + y2) / 2;
-    double x23   = (x2 + x3) / 2;
-    double y23   = (y2 + y3) / 2;
-    double x012  = (x01 + x12) / 2;
-    double y012  = (y01 + y12) / 2;
-    double x123  = (x12 + x23) / 2;
-    double y123  = (y12 + y23) / 2;
-    double x0123 = (x012 + x123) / 2;
-    double y0123 = (y012 + y123) / 2;
-    
-    recursive_bezier(buffer, w, clip, x0, y0, x01, y01, x012, y012, x0123, y0123, color, n + 1); 
-    recursive_bezier(buffer, w, clip, x0123, y0123, x123, y123, x23, y23, x3, y3, color, n + 1);
+    double total = den / 2 + (double)kstart * numadd;
+    double q = std::floor(total / den);
+    double r = total - q * den;
+    if(r < 0) { q--; r += den; }
+    if(r >= den) { q++; r -= den; }
+    num = (int)r;
+    minor += minorinc * (int)q;
+    major += majorinc * kstart;
   }
-}
-
-void drawEllipseBorder(unsigned char* buffer, int w, const ADrawer2DBuffer::Clip& clip, int cx, int cy, int radiusx, int radiusy, const ColorRGB& color)
-{
-  int twoASquare = 2 * radiusx * radiusx;
-  int twoBSquare = 2 * radiusy * radiusy;
-  int x = radiusx;
-  int y = 0;
-  int xchange = radiusy * radiusy * (1 - 2 * radiusx);
-  int ychange = radiusx * radiusx;
-  int ellipseError = 0;
-  int stoppingx = twoBSquare * radiusx;
-  int stoppingy = 0;
-
-  while(stoppingx >= stoppingy)
+  
+  for(int k = kstart; k <= kend; k++)
   {
-    psetClipped(buffer, w, clip, cx + x, cy + y, color);
-    psetClipped(buffer, w, clip, cx - x, cy + y, color);
-    psetClipped(buffer, w, clip, cx - x, cy - y, color);
-    psetClipped(buffer, w, clip, cx + x, cy - y, color);
-
-    y++;
-    stoppingy += twoASquare;
-    ellipseError += ychange;
-    ychange += twoASquare;
-    if((2 * ellipseError + xchange) > 0)
+    if(minorinc > 0 ? minor >= minorclip1 : minor < minorclip0) break; //the rest of the line is outside the clip area
+    if(minor >= minorclip0 && minor < minorclip1)
     {
-      x--;
-      stoppingx -= twoBSquare;
-      ellipseError += xchange;
-      xchange += twoBSquare;
+      if(xmajor) pset(target, major, minor, fill);
+      else pset(target, minor, major, fill);
     }
-  }
-        
-  x = 0;
-  y = radiusy;
-  xchange = radiusy * radiusy;
-  ychange = radiusx * radiusx * (1 - 2 * radiusy);
-  ellipseError = 0;
-  stoppingx = 0;
-  stoppingy = twoASquare * radiusy;
-  
-  while(stoppingx <= stoppingy)
-  {
-    psetClipped(buffer, w, clip, cx + x, cy + y, color);
-    psetClipped(buffer, w, clip, cx - x, cy + y, color);
-    psetClipped(buffer, w, clip, cx - x, cy - y, color);
-    psetClipped(buffer, w, clip, cx + x, cy - y, color);
-    
-    x++;
-    stoppingx += twoBSquare;
-    ellipseError += xchange;
-    xchange += twoBSquare;
-    if ((2*ellipseError + ychange) > 0 )
+    num += numadd;
+    if(num >= den)
     {
-      y--;
-      stoppingy -= twoASquare;
-      ellipseError += ychange;
-      ychange += twoASquare;
+      num -= den;
+      minor += minorinc;
     }
+    major += majorinc;
   }
 }
 
-void drawFilledEllipse(unsigned char* buffer, int w, int h, int cx, int cy, int radiusx, int radiusy, const ColorRGB& color)
+void drawEllipseBorder(const ADrawer2DBuffer::Target& target, const ADrawer2DBuffer::Clip& clip, int cx, int cy, int radiusx, int radiusy, const SpanFill& fill)
 {
   int twoASquare = 2 * radiusx * radiusx;
   int twoBSquare = 2 * radiusy * radiusy;
@@ -290,9 +164,10 @@ void drawFilledEllipse(unsigned char* buffer, int w, int h, int cx, int cy, int
 
   while(stoppingx >= stoppingy)
   {
-    //TODO: use clip!
-    horLine(buffer, w, h, cy - y, cx - x, cx + x, color);
-    horLine(buffer, w, h, cy + y, cx - x, cx + x, color);
+    psetClipped(target, clip, cx + x, cy + y, fill);
+    psetClipped(target, clip, cx - x, cy + y, fill);
+    psetClipped(target, clip, cx - x, cy - y, fill);
+    psetClipped(target, clip, cx + x, cy - y, fill);
 
     y++;
     stoppingy += twoASquare;
@@ -310,16 +185,18 @@ void drawFilledEllipse(unsigned char* buffer, int w, int h, int cx, int cy, int
   x = 0;
   y = radiusy;
   xchange = radiusy * radiusy;
-  ychange = radiusx * radiusx*(1 - 2 * radiusy);
+  ychange = radiusx * radiusx * (1 - 2 * radiusy);
   ellipseError = 0;
   stoppingx = 0;
   stoppingy = twoASquare * radiusy;
-  while ( stoppingx <= stoppingy )
+  
+  while(stoppingx <= stoppingy)
   {
-    //TODO: use clip!
-    horLine(buffer, w, h, cy - y, cx - x, cx + x, color);
-    horLine(buffer, w, h, cy + y, cx - x, cx + x, color);
-
+    psetClipped(target, clip, cx + x, cy + y, fill);
+    psetClipped(target, clip, cx - x, cy + y, fill);
+    psetClipped(target, clip, cx - x, cy - y, fill);
+    psetClipped(target, clip, cx + x, cy - y, fill);
+    
     x++;
     stoppingx += twoBSquare;
     ellipseError += xchange;
@@ -334,7 +211,7 @@ void drawFilledEllipse(unsigned char* buffer, int w, int h, int cx, int cy, int
   }
 }
 
-void drawCircleBorder(unsigned char* buffer, int w, const ADrawer2DBuffer::Clip& clip, int cx, int cy, int radius, const ColorRGB& color)
+void drawCircleBorder(const ADrawer2DBuffer::Target& target, const ADrawer2DBuffer::Clip& clip, int cx, int cy, int radius, const SpanFill& fill)
 {
   int x = radius;
   int y = 0;
@@ -343,14 +220,14 @@ void drawCircleBorder(unsigned char* buffer, int w, const ADrawer2DBuffer::Clip&
   int radiuserror = 0;
   while(x >= y)
   {
-    psetClipped(buffer, w, clip, cx + x, cy + y, color);
-    psetClipped(buffer, w, clip, cx - x, cy + y, color);
-    psetClipped(buffer, w, clip, cx - x, cy - y, color);
-    psetClipped(buffer, w, clip, cx + x, cy - y, color);
-    psetClipped(buffer, w, clip, cx + y, cy + x, color);
-    psetClipped(buffer, w, clip, cx - y, cy + x, color);
-    psetClipped(buffer, w, clip, cx - y, cy - x, color);
-    psetClipped(buffer, w, clip, cx + y, cy - x, color);
+    psetClipped(target, clip, cx + x, cy + y, fill);
+    psetClipped(target, clip, cx - x, cy + y, fill);
+    psetClipped(target, clip, cx - x, cy - y, fill);
+    psetClipped(target, clip, cx + x, cy - y, fill);
+    psetClipped(target, clip, cx + y, cy + x, fill);
+    psetClipped(target, clip, cx - y, cy + x, fill);
+    psetClipped(target, clip, cx - y, cy - x, fill);
+    psetClipped(target, clip, cx + y, cy - x, fill);
     y++;
     radiuserror += ychange;
     ychange += 2;
@@ -363,327 +240,1343 @@ void drawCircleBorder(unsigned char* buffer, int w, const ADrawer2DBuffer::Clip&
   }
 }
 
-//Filled bresenham circle with center at (xc,yc) with radius and RGB color
-void drawDisk(unsigned char* buffer, int buffer_w, int buffer_h, int xc, int yc, int radius, const ColorRGB& color)
-{
-  if(xc + radius < 0 || xc - radius >= buffer_w || yc + radius < 0 || yc - radius >= buffer_h) return; //every single pixel outside screen, so don't waste time on it
-  int x = 0;
-  int y = radius;
-  int p = 3 - (radius << 1);
-  int a, b, c, d, e, f, g, h;
-  int pb = xc - radius, pd = xc - radius; //previous values: to avoid drawing horizontal lines multiple times    
-  while (x <= y)
-  {
-    // write data
-    a = xc + x;
-    b = yc + y;
-    c = xc - x;
-    d = yc - y;
-    e = xc + y;
-    f = yc + x;
-    g = xc - y;
-    h = yc - x;
-    //TODO: use the clipping!
-    if(b != pb) horLine(buffer, buffer_w, buffer_h, b, a, c, color);
-    if(d != pd) horLine(buffer, buffer_w, buffer_h, d, a, c, color);
-    if(f != b)  horLine(buffer, buffer_w, buffer_h, f, e, g, color);
-    if(h != d && h != f) horLine(buffer, buffer_w, buffer_h, h, e, g, color);
-    pb = b;
-    pd = d;
-    if(p < 0) p += (x++ << 2) + 6;
-    else p += ((x++ - y--) << 2) + 10;
-  }
-}
-
-}
-
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////
-
-
-ADrawer2DBuffer::ADrawer2DBuffer()
-: buffer(0)
-, w(0)
-, h(0)
-, texture_alpha_as_opacity(true)
-, color_alpha_as_opacity(true)
-, extra_opacity(1.0)
-{
-  TextureFactory<TextureBuffer> factory;
-}
-
-ADrawer2DBuffer::~ADrawer2DBuffer()
-{
-}
-
-void ADrawer2DBuffer::setTextureAlphaAsOpacity(bool set)
-{
-  texture_alpha_as_opacity = set;
-}
-
-void ADrawer2DBuffer::setColorAlphaAsOpacity(bool set)
+inline void plotClipped(const ADrawer2DBuffer::Target& target, const ADrawer2DBuffer::Clip& clip, int x, int y, int coverage, const SpanFill& fill)
 {
-  color_alpha_as_opacity = set;
+  if(coverage > 0 && x >= clip.x0 && x < clip.x1 && y >= clip.y0 && y < clip.y1) fill.fillPixel(PixelSpan(target, x, y, 1).rgba, coverage);
 }
 
-void ADrawer2DBuffer::setExtraOpacity(double opacity)
+/*
+Anti-aliased line from the center of pixel (x0, y0) to the center of pixel (x1, y1), with Wu's
+algorithm: at every step along the major axis, the two pixels nearest to the line share the color,
+weighted by how near to the line they are. Only the steps inside the clip area are done.
+*/
+void drawLineWu(const ADrawer2DBuffer::Target& target, const ADrawer2DBuffer::Clip& clip, int x0, int y0, int x1, int y1, const SpanFill& fill)
 {
-  extra_opacity = opacity;
+  bool xmajor = std::abs(x1 - x0) >= std::abs(y1 - y0);
+  if(!xmajor)
+  {
+    std::swap(x0, y0);
+    std::swap(x1, y1);
+  }
+  if(x0 > x1)
+  {
+    std::swap(x0, x1);
+    std::swap(y0, y1);
+  }
+  double gradient = x1 == x0 ? 0.0 : (double)(y1 - y0) / (x1 - x0);
+  int start = std::max(x0, xmajor ? clip.x0 : clip.y0);
+  int end = std::min(x1, (xmajor ? clip.x1 : clip.y1) - 1);
+  for(int x = start; x <= end; x++)
+  {
+    double y = y0 + gradient * (x - x0);
+    int yi = (int)std::floor(y);
+    int coverage = (int)((y - yi) * 255 + 0.5); //of the second pixel
+    if(xmajor)
+    {
+      plotClipped(target, clip, x, yi, 255 - coverage, fill);
+      plotClipped(target, clip, x, yi + 1, coverage, fill);
+    }
+    else
+    {
+      plotClipped(target, clip, yi, x, 255 - coverage, fill);
+      plotClipped(target, clip, yi + 1, x, coverage, fill);
+    }
+  }
 }
 
-
-
-void ADrawer2DBuffer::pushScissor(int x0, int y0, int x1, int y1)
+//the pixel (x, y) relative to the center mirrored in the 4 quadrants, pixels on the axes only once
+inline void plotQuadrants(const ADrawer2DBuffer::Target& target, const ADrawer2DBuffer::Clip& clip, int cx, int cy, int x, int y, int coverage, const SpanFill& fill)
 {
-  clipstack.push_back(clip);
-  clip.x0 = x0;
-  clip.y0 = y0;
-  clip.x1 = x1;
-  clip.y1 = y1;
-  clip.fit(w, h);
+  plotClipped(target, clip, cx + x, cy + y, coverage, fill);
+  if(x != 0) plotClipped(target, clip, cx - x, cy + y, coverage, fill);
+  if(y != 0) plotClipped(target, clip, cx + x, cy - y, coverage, fill);
+  if(x != 0 && y != 0) plotClipped(target, clip, cx - x, cy - y, coverage, fill);
 }
 
-void ADrawer2DBuffer::pushSmallestScissor(int x0, int y0, int x1, int y1)
+/*
+Anti-aliased ellipse border through the centers of the pixels at radiusx and radiusy from pixel (cx, cy), with Wu's
+algorithm. Where the border is more horizontal, there are two pixels per column, up to column "last", and
+where it's more vertical two pixels per row, in the columns after last, so that no pixel is drawn twice.
+*/
+void drawEllipseWu(const ADrawer2DBuffer::Target& target, const ADrawer2DBuffer::Clip& clip, int cx, int cy, int radiusx, int radiusy, const SpanFill& fill)
 {
-  int sx0 = x0;
-  int sy0 = y0;
-  int sx1 = x1;
-  int sy1 = y1;
-  
-  if(clip.x0 > sx0) sx0 = clip.x0;
-  if(clip.y0 >  sy0)  sy0 = clip.y0; 
-  if(clip.x1 < sx1) sx1 = clip.x1;
-  if(clip.y1 < sy1) sy1 = clip.y1;
+  radiusx = std::abs(radiusx);
+  radiusy = std::abs(radiusy);
+  if(radiusx == 0 || radiusy == 0)
+  {
+    drawLineWu(target, clip, cx - radiusx, cy - radiusy, cx + radiusx, cy + radiusy, fill);
+    return;
+  }
+  double rx2 = (double)radiusx * radiusx;
+  double ry2 = (double)radiusy * radiusy;
+  int last = (int)std::floor(rx2 / std::sqrt(rx2 + ry2)); //the slope is -1 there
   
-  pushScissor(sx0,  sy0, sx1, sy1);
+  for(int x = 0; x <= last; x++)
+  {
+    double y = radiusy * std::sqrt(std::max(0.0, 1.0 - x * x / rx2));
+    int yi = (int)std::floor(y);
+    int coverage = (int)((y - yi) * 255 + 0.5);
+    plotQuadrants(target, clip, cx, cy, x, yi, 255 - coverage, fill);
+    plotQuadrants(target, clip, cx, cy, x, yi + 1, coverage, fill);
+  }
+  for(int y = 0; y <= radiusy; y++)
+  {
+    double x = radiusx * std::sqrt(std::max(0.0, 1.0 - y * y / ry2));
+    int xi = (int)std::floor(x);
+    if(xi + 1 <= last) break;
+    int coverage = (int)((x - xi) * 255 + 0.5);
+    if(xi > last) plotQuadrants(target, clip, cx, cy, xi, y, 255 - coverage, fill);
+    plotQuadrants(target, clip, cx, cy, xi + 1, y, coverage, fill);
+  }
 }
 
-void ADrawer2DBuffer::popScissor()
+//how far the pixels of a line can be outside the rectangle of its coordinates
+int getStrokeMargin(double linewidth, LineJoin join, LineCap cap, bool antialiasing)
 {
-  clip = clipstack.back();
-  clip.fit(w, h);
-  clipstack.pop_back();
+  if(linewidth == 1.0) return antialiasing ? 1 : 0;
+  double f = join == LJ_MITER ? STROKE_MITER_LIMIT : 1.0;
+  if(cap == LC_SQUARE) f = std::max(f, std::sqrt(2.0));
+  return (int)std::ceil(linewidth / 2 * f) + 1;
 }
 
-void ADrawer2DBuffer::drawPoint(int x, int y, const ColorRGB& color)
+//twice the signed area of the triangle (x0,y0), (x1,y1), (x,y). Doubles to avoid int overflow, the result is an exact integer.
+inline double edgeFunction(int x0, int y0, int x1, int y1, int x, int y)
 {
-  psetClipped(buffer, w, clip, x, y, color);
+  return (double)(x1 - x0) * (y - y0) - (double)(y1 - y0) * (x - x0);
 }
 
-void ADrawer2DBuffer::drawLine(int x0, int y0, int x1, int y1, const ColorRGB& color)
+//fills the spans of a shape with a plain color
+class ColorSpanFiller : public ISpanFiller
 {
-  lpi::drawLine(buffer, w, clip, x0, y0, x1, y1, color);
-}
+  private:
+    ADrawer2DBuffer::Target target;
+    SpanFill fill;
+    
+  public:
+    ColorSpanFiller(const ADrawer2DBuffer::Target& target, const ColorRGB& color, const BlendMode& mode) : target(target), fill(color, mode) {}
+    
+    virtual void fillSpan(int y, int x0, int x1)
+    {
+      fill.fill(PixelSpan(target, x0, y, x1 - x0).rgba, x1 - x0);
+    }
+    
+    virtual void fillCoverage(int y, int x0, int x1, const unsigned char* coverage)
+    {
+      fill.fillCoverage(PixelSpan(target, x0, y, x1 - x0).rgba, x1 - x0, coverage);
+    }
+};
 
-void ADrawer2DBuffer::drawBezier(int x0, int y0, int x1, int y1, int x2, int y2, int x3, int y3, const ColorRGB& color)
+//gives the spans to another filler, cut to the spans of a clip region
+class RegionSpanFiller : public ISpanFiller
 {
-  recursive_bezier(buffer, w, clip, x0, y0, x1, y1, x2, y2, x3, y3, color, 0);
-}
-
+  private:
+    ISpanFiller& filler;
+    const ClipRegion& region;
+    size_t band; //the band of the last row, the rows come from top to bottom
     
-void ADrawer2DBuffer::drawRectangle(int x0, int y0, int x1, int y1, const ColorRGB& color, bool filled)
-{
-  if(filled)
-  {
-    int sx0 = x0;
-    int sy0 = y0;
-    int sx1 = x1;
-    int sy1 = y1;
+  public:
+    RegionSpanFiller(ISpanFiller& filler, const ClipRegion& region) : filler(filler), region(region), band(0) {}
     
-    if(clip.x0 > sx0) sx0 = clip.x0;
-    if(clip.y0 >  sy0)  sy0 = clip.y0; 
-    if(clip.x1 < sx1) sx1 = clip.x1;
-    if(clip.y1 < sy1) sy1 = clip.y1;
+    virtual void fillSpan(int y, int x0, int x1)
+    {
+      fillCoverage(y, x0, x1, 0);
+    }
     
-    for(int x = sx0; x < sx1; x++)
-    for(int y = sy0; y < sy1; y++)
+    //with coverage 0 the spans are completely inside
+    virtual void fillCoverage(int y, int x0, int x1, const unsigned char* coverage)
     {
-      pset(buffer, w, x, y, color);
+      band = region.findBand(y, band);
+      if(band >= region.getNumBands() || region.getBand(band).y0 > y) return;
+      const ClipRegion::Band& b = region.getBand(band);
+      const int* s = region.getSpans(b);
+      for(size_t i = 0; i < b.count && s[2 * i] < x1; i++)
+      {
+        int sx0 = std::max(x0, s[2 * i]);
+        int sx1 = std::min(x1, s[2 * i + 1]);
+        if(sx0 >= sx1) continue;
+        if(coverage) filler.fillCoverage(y, sx0, sx1, coverage + (sx0 - x0));
+        else filler.fillSpan(y, sx0, sx1);
+      }
     }
-  }
-  else
-  {
-    drawLine(x0, y0, x1, y0, color);
-    drawLine(x0, y1 - 1, x1, y1 - 1, color);
-    drawLine(x0, y0, x0, y1, color);
-    drawLine(x1 - 1, y0, x1 - 1, y1, color);
-  }
-}
+};
 
-void ADrawer2DBuffer::drawGradientRectangle(int x0, int y0, int x1, int y1, const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2, const ColorRGB& color3)
+//a color in 16.16 fixed point, for gradientSpan
+inline int toFixed(double v)
 {
-  drawGradientQuad(x0, y0, x0, y1, x1, y1, x1, y0, color0, color1, color2, color3);
+  return (int)std::floor(v * 65536.0 + 0.5);
 }
 
-void ADrawer2DBuffer::drawGradientTriangle(int x0, int y0, int x1, int y1, int x2, int y2, const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2)
+/*
+The start of a gradient span at column x, for a row in which the color channel is value0 at column 0.
+The step is added to the rounded value0 in whole steps, so that a pixel gets the same color no matter
+at which column its span starts (the tiles of the deferred mode split spans).
+*/
+inline int spanStart(double value0, int step, int x)
 {
-  Vector2 a(x0, y0);
-  Vector2 b(x1, y1);
-  Vector2 c(x2, y2);
-
-  ColorRGB colora = color0;
-  ColorRGB colorb = color1;
-  ColorRGB colorc = color2;
-  if(b.y < a.y) { std::swap(a, b); std::swap(colora, colorb); }
-  if(c.y < a.y) { std::swap(a, c); std::swap(colora, colorc); }
-  if(c.y < b.y) { std::swap(b, c); std::swap(colorb, colorc); }
+  double v = std::floor(value0 * 65536.0 + 0.5) + (double)step * x;
+  return (int)std::min(2147483647.0, std::max(-2147483648.0, v));
+}
 
-  double stepxab = (b.x - a.x) / (b.y - a.y);
-  double stepxac = (c.x - a.x) / (c.y - a.y);
-  double stepxbc = (c.x - b.x) / (c.y - b.y);
-  
-  double ystart = a.y < 0.0 ? 0.0 : a.y;
-  double yend = c.y > h ? h : c.y;
-  
-  for(double y = (int)ystart; y < yend; y++) //it's important that the x and y of every triangle starts at same fractional part (without, there are ugly pixels on the side and seams between touching triangles are visible), hence the (int) conversion.
-  {
-    double x0, x1;
-    if(y < b.y)
+/*
+fills the spans of a triangle with a gradient between the colors of its 3 corners. The color is a linear
+function of the position, so per span only the color of its first pixel is computed, and gradientSpan
+adds the step per pixel in fixed point. The colors are sampled at the centers of the pixels.
+*/
+class GradientSpanFiller : public ISpanFiller
+{
+  private:
+    ADrawer2DBuffer::Target target;
+    int x0, y0;
+    double c0[4]; //the color at (x0, y0)
+    double dx[4]; //change of the color per pixel to the right
+    double dy[4]; //change of the color per pixel down
+    int step[4]; //dx in fixed point
+    int lo[4], hi[4]; //range of the corner colors, pixels of the anti-aliased border are a bit outside the triangle
+    BlendMode mode;
+    BlendSpanFunc blend;
+    std::vector<unsigned char> line; //the colors of the span, before blending
+    
+    void fillLine(int y, int start, int end)
     {
-      x0 = a.x + (y - a.y) * stepxab;
-      x1 = a.x + (y - a.y) * stepxac;
+      int first[4];
+      for(int c = 0; c < 4; c++) first[c] = spanStart(c0[c] + dx[c] * (0.5 - x0) + dy[c] * (y + 0.5 - y0), step[c], start);
+      line.resize(4 * (end - start));
+      gradientSpan(&line[0], end - start, first, step);
     }
-    else
+    
+  public:
+    GradientSpanFiller(const ADrawer2DBuffer::Target& target, int x0, int y0, int x1, int y1, int x2, int y2
+                     , const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2, const BlendMode& mode)
+    : target(target), x0(x0), y0(y0), mode(mode), blend(getBlendSpanFunc(mode))
     {
-      x0 = b.x + (y - b.y) * stepxbc;
-      x1 = a.x + (y - a.y) * stepxac;
+      const ColorRGB* colors[3] = { &color0, &color1, &color2 };
+      //the derivatives of the edge functions, divided by the area they add up to
+      double area = edgeFunction(x0, y0, x1, y1, x2, y2);
+      double ex[3] = { (double)(y1 - y2), (double)(y2 - y0), (double)(y0 - y1) };
+      double ey[3] = { (double)(x2 - x1), (double)(x0 - x2), (double)(x1 - x0) };
+      for(int c = 0; c < 4; c++)
+      {
+        int v[3];
+        for(int i = 0; i < 3; i++)
+        {
+          const ColorRGB& color = *colors[i];
+          int value = c == 0 ? color.r : (c == 1 ? color.g : (c == 2 ? color.b : color.a));
+          v[i] = value < 0 ? 0 : (value > 255 ? 255 : value);
+        }
+        c0[c] = v[0];
+        dx[c] = dy[c] = 0;
+        if(area != 0) for(int i = 0; i < 3; i++)
+        {
+          dx[c] += v[i] * ex[i] / area;
+          dy[c] += v[i] * ey[i] / area;
+        }
+        step[c] = toFixed(dx[c]);
+        lo[c] = std::min(v[0], std::min(v[1], v[2]));
+        hi[c] = std::max(v[0], std::max(v[1], v[2]));
+      }
     }
     
-    if(x1 < x0) std::swap(x0, x1);
-    if(x0 < 0.0) x0 = 0.0;
-    if(x1 > w) x1 = w;
-    x0 = (int)x0; //it's important that the x and y of every triangle starts at same fractional part (without, there are ugly pixels on the side and seams between touching triangles are visible), hence the (int) conversion.
-    
-    //instead of doing the barycentric calculation for every x, do it only for begin and end and then step linearly
-    double alpha, beta, gamma;
-    double alpha2, beta2, gamma2;
-    barycentric(alpha, beta, gamma, a, b, c,  Vector2(x0, y));
-    barycentric(alpha2, beta2, gamma2, a, b, c,  Vector2(x1, y));
-    double stepalphax = (alpha2 - alpha) / (x1 - x0);
-    double stepbetax = (beta2 - beta) / (x1 - x0);
-    double stepgammax = (gamma2 - gamma) / (x1 - x0);
+    virtual void fillSpan(int y, int start, int end)
+    {
+      fillLine(y, start, end);
+      if(mode.premultiplied) premultiplySpan(&line[0], &line[0], end - start);
+      blend(PixelSpan(target, start, y, end - start).rgba, &line[0], end - start, mode);
+    }
     
-    for(double x = (int)x0; x < x1; x++)
+    virtual void fillCoverage(int y, int start, int end, const unsigned char* coverage)
     {
-      if(alpha >= 0.0 && beta >= 0.0 && gamma >= 0.0) //pixel inside triangle
+      fillLine(y, start, end);
+      for(int i = 0; i < end - start; i++)
       {
-        ColorRGB color = alpha * colora + beta * colorb + gamma * colorc;
-        pset(buffer, w, (int)x, (int)y, color);
+        unsigned char* p = &line[4 * i];
+        for(int c = 0; c < 4; c++) p[c] = std::min(hi[c], std::max(lo[c], (int)p[c]));
+        p[3] = (p[3] * coverage[i] + 127) / 255;
       }
-      
-      alpha += stepalphax;
-      beta += stepbetax;
-      gamma += stepgammax;
+      if(mode.premultiplied) premultiplySpan(&line[0], &line[0], end - start);
+      blend(PixelSpan(target, start, y, end - start).rgba, &line[0], end - start, mode);
     }
-  }
-}
+};
 
-void ADrawer2DBuffer::drawTriangle(int x0, int y0, int x1, int y1, int x2, int y2, const ColorRGB& color, bool filled)
+/*
+A gradient over the rectangle (x0, y0)-(x1, y1) between the colors of its 4 corners: per row the colors
+of the left and right side are interpolated, and between those the color changes linearly.
+*/
+class BilinearGradient
 {
-  if(filled)
+  private:
+    int x0, y0, x1, y1;
+    double c[4][4]; //the colors of the corners: top left, top right, bottom left, bottom right
+    
+  public:
+    BilinearGradient(int x0, int y0, int x1, int y1, const ColorRGB& c00, const ColorRGB& c10, const ColorRGB& c01, const ColorRGB& c11)
+    : x0(x0), y0(y0), x1(x1), y1(y1)
+    {
+      const ColorRGB* colors[4] = { &c00, &c10, &c01, &c11 };
+      for(int i = 0; i < 4; i++)
+      {
+        const ColorRGB& color = *colors[i];
+        c[i][0] = std::min(255, std::max(0, color.r));
+        c[i][1] = std::min(255, std::max(0, color.g));
+        c[i][2] = std::min(255, std::max(0, color.b));
+        c[i][3] = std::min(255, std::max(0, color.a));
+      }
+    }
+    
+    //the n pixels of row y starting at column x, sampled at the centers of the pixels
+    void fill(unsigned char* out, int x, int y, size_t n) const
+    {
+      double v = (y + 0.5 - y0) / (y1 - y0);
+      double u = (0.5 - x0) / (double)(x1 - x0);
+      int first[4];
+      int step[4];
+      for(int i = 0; i < 4; i++)
+      {
+        double left = c[0][i] + (c[2][i] - c[0][i]) * v;
+        double right = c[1][i] + (c[3][i] - c[1][i]) * v;
+        step[i] = toFixed((right - left) / (x1 - x0));
+        first[i] = spanStart(left + (right - left) * u, step[i], x);
+      }
+      gradientSpan(out, n, first, step);
+    }
+};
+
+/*
+Adds a polygon with integer coordinates to the rasterizer. The coordinates of the drawer are
+those of the pixels, and the rasterizer has the center of pixel (x, y) at (x + 0.5, y + 0.5).
+*/
+void addPolygon(ScanlineRasterizer& rasterizer, const int* xy, size_t numpoints)
+{
+  if(numpoints == 0) return;
+  rasterizer.moveTo(xy[0] + 0.5, xy[1] + 0.5);
+  for(size_t i = 1; i < numpoints; i++) rasterizer.lineTo(xy[2 * i] + 0.5, xy[2 * i + 1] + 0.5);
+  rasterizer.close();
+}
+
+}
+
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+
+////////////////////////////////////////////////////////////////////////////////
+//DAMAGE REGION/////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+const size_t MAX_DAMAGE_RECTS = 16; //more rectangles are merged together
+
+double area(const ADrawer2DBuffer::Clip& r)
+{
+  return (double)(r.x1 - r.x0) * (r.y1 - r.y0);
+}
+
+ADrawer2DBuffer::Clip unite(const ADrawer2DBuffer::Clip& a, const ADrawer2DBuffer::Clip& b)
+{
+  ADrawer2DBuffer::Clip r;
+  r.x0 = std::min(a.x0, b.x0);
+  r.y0 = std::min(a.y0, b.y0);
+  r.x1 = std::max(a.x1, b.x1);
+  r.y1 = std::max(a.y1, b.y1);
+  return r;
+}
+
+bool contains(const ADrawer2DBuffer::Clip& a, const ADrawer2DBuffer::Clip& b)
+{
+  return b.x0 >= a.x0 && b.y0 >= a.y0 && b.x1 <= a.x1 && b.y1 <= a.y1;
+}
+
+//adds the non-empty rectangle r to the list, merging it with the others where that costs little area
+void addDamageRect(std::vector<ADrawer2DBuffer::Clip>& rects, ADrawer2DBuffer::Clip r)
+{
+  bool merged = true;
+  while(merged)
+  {
+    merged = false;
+    for(size_t i = 0; i < rects.size(); i++)
+    {
+      if(contains(rects[i], r)) return;
+      ADrawer2DBuffer::Clip u = unite(rects[i], r);
+      if(area(u) <= area(rects[i]) + area(r)) //the union isn't bigger than the two separately
+      {
+        r = u;
+        rects.erase(rects.begin() + i);
+        merged = true;
+        break;
+      }
+    }
+  }
+  
+  if(rects.size() >= MAX_DAMAGE_RECTS)
+  {
+    //merge with the rectangle that grows the least
+    size_t best = 0;
+    double bestgrowth = 0;
+    for(size_t i = 0; i < rects.size(); i++)
+    {
+      double growth = area(unite(rects[i], r)) - area(rects[i]);
+      if(i == 0 || growth < bestgrowth)
+      {
+        best = i;
+        bestgrowth = growth;
+      }
+    }
+    r = unite(rects[best], r);
+    rects.erase(rects.begin() + best);
+    addDamageRect(rects, r);
+    return;
+  }
+  
+  rects.push_back(r);
+}
+
+} //end of anonymous namespace
+
+void ADrawer2DBuffer::addDamage(int x0, int y0, int x1, int y1)
+{
+  if(!track_damage) return;
+  Clip r;
+  r.x0 = x0;
+  r.y0 = y0;
+  r.x1 = x1;
+  r.y1 = y1;
+  r.fit(clip.x0, clip.y0, clip.x1, clip.y1);
+  if(r.x0 >= r.x1 || r.y0 >= r.y1) return;
+  addDamageRect(damage, r);
+}
+
+void Drawer2DTexture::updateTexture()
+{
+  if(!texture) { damage.clear(); return; } //not attached to a texture yet
+  for(size_t i = 0; i < damage.size(); i++)
   {
-    //not so super great implementation for this plain-colored triangle, but will fit nicely in a drawGradientTriangle function later thanks to the barycentric coordinates
-    Vector2 a(x0, y0);
-    Vector2 b(x1, y1);
-    Vector2 c(x2, y2);
+    texture->updatePartial(damage[i].x0, damage[i].y0, damage[i].x1, damage[i].y1);
+  }
+  damage.clear();
+}
 
-    if(b.y < a.y) std::swap(a, b);
-    if(c.y < a.y) std::swap(a, c);
-    if(c.y < b.y) std::swap(b, c);
+////////////////////////////////////////////////////////////////////////////////
+//DEFERRED MODE/////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
 
-    double stepxab = (b.x - a.x) / (b.y - a.y);
-    double stepxac = (c.x - a.x) / (c.y - a.y);
-    double stepxbc = (c.x - b.x) / (c.y - b.y);
+/*
+The types of recorded commands. Only the drawing functions that don't call other drawing
+functions are recorded, e.g. drawQuad is recorded as the triangles or lines it draws.
+*/
+enum DrawCommandType
+{
+  DC_POINT,
+  DC_LINE,
+  DC_BEZIER,
+  DC_RECTANGLE, //filled
+  DC_TRIANGLE, //filled
+  DC_GRADIENT_TRIANGLE,
+  DC_GRADIENT_RECTANGLE,
+  DC_CIRCLE,
+  DC_ELLIPSE,
+  DC_POLYGON, //filled, stroked, or an outline of width 1
+  DC_TEXTURE,
+  DC_TEXTURE_SIZED,
+  DC_TEXTURE_REPEATED,
+  DC_TEXTURE_SIZED_REPEATED,
+  DC_TEXTURE_REPEATED_GRADIENT,
+  DC_SPRITE
+};
+
+struct DrawCommand
+{
+  DrawCommandType type;
+  int p[8]; //coordinates
+  int numpoints; //amount of coordinate pairs in p
+  ColorRGB color[4];
+  bool filled;
+  const ITexture* texture;
+  size_t sizex;
+  size_t sizey;
+  size_t first; //DC_POLYGON: index of its first point in Deferred::polygonpoints, p has its bounding box. DC_SPRITE: index in Deferred::sprites
+  size_t count; //DC_POLYGON: amount of points
+  
+  //the state of the drawer at the time of the call
+  ADrawer2DBuffer::Clip clip;
+  bool texture_alpha_as_opacity;
+  bool color_alpha_as_opacity;
+  double extra_opacity;
+  bool smoothing;
+  bool antialiasing;
+  bool premultiplied;
+  double linewidth;
+  LineJoin linejoin;
+  LineCap linecap;
+  
+  void setPoints(int x0, int y0) { p[0] = x0; p[1] = y0; numpoints = 1; }
+  void setPoints(int x0, int y0, int x1, int y1) { setPoints(x0, y0); p[2] = x1; p[3] = y1; numpoints = 2; }
+  void setPoints(int x0, int y0, int x1, int y1, int x2, int y2) { setPoints(x0, y0, x1, y1); p[4] = x2; p[5] = y2; numpoints = 3; }
+  void setPoints(int x0, int y0, int x1, int y1, int x2, int y2, int x3, int y3) { setPoints(x0, y0, x1, y1, x2, y2); p[6] = x3; p[7] = y3; numpoints = 4; }
+  void setColors(const ColorRGB& color0) { color[0] = color0; }
+  void setColors(const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2) { color[0] = color0; color[1] = color1; color[2] = color2; }
+  void setColors(const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2, const ColorRGB& color3) { setColors(color0, color1, color2); color[3] = color3; }
+  
+  //a rectangle that contains every pixel the command can touch, limited to its clip area
+  ADrawer2DBuffer::Clip getBounds() const
+  {
+    ADrawer2DBuffer::Clip b;
+    b.x0 = b.x1 = p[0];
+    b.y0 = b.y1 = p[1];
+    for(int i = 1; i < numpoints; i++)
+    {
+      b.x0 = std::min(b.x0, p[2 * i]);
+      b.y0 = std::min(b.y0, p[2 * i + 1]);
+      b.x1 = std::max(b.x1, p[2 * i]);
+      b.y1 = std::max(b.y1, p[2 * i + 1]);
+    }
+    b.x1++; //end coordinates are not inclusive
+    b.y1++;
+    
+    if(type == DC_CIRCLE || type == DC_ELLIPSE)
+    {
+      int rx = std::abs(p[2]);
+      int ry = std::abs(type == DC_CIRCLE ? p[2] : p[3]);
+      b.x0 = p[0] - rx;
+      b.y0 = p[1] - ry;
+      b.x1 = p[0] + rx + 1;
+      b.y1 = p[1] + ry + 1;
+    }
+    else if(type == DC_TEXTURE)
+    {
+      b.x1 = p[0] + texture->getU();
+      b.y1 = p[1] + texture->getV();
+    }
+    else if(type == DC_TEXTURE_SIZED)
+    {
+      b.x1 = p[0] + sizex;
+      b.y1 = p[1] + sizey;
+    }
+    
+    if(type == DC_LINE || type == DC_BEZIER || !filled)
+    {
+      int m = getStrokeMargin(linewidth, linejoin, linecap, antialiasing);
+      b.x0 -= m;
+      b.y0 -= m;
+      b.x1 += m;
+      b.y1 += m;
+    }
     
-    double ystart = a.y < 0.0 ? 0.0 : a.y;
-    double yend = c.y > h ? h : c.y;
+    b.fit(clip.x0, clip.y0, clip.x1, clip.y1);
+    return b;
+  }
+};
+
+} //end of anonymous namespace
+
+struct ADrawer2DBuffer::Deferred : public ThreadPool::Job
+{
+  ThreadPool pool;
+  int tilesize;
+  size_t numtilesx;
+  size_t numtilesy;
+  
+  std::vector<DrawCommand> commands;
+  std::vector<int> polygonpoints; //the points of the DC_POLYGON commands
+  std::vector<SpriteInstance> sprites; //the sprites of the DC_SPRITE commands
+  std::vector<std::vector<size_t> > tiles; //for every tile, the indices of the commands that touch it, in order
+  std::vector<size_t> nonempty; //the indices of the tiles that have commands
+  std::vector<Drawer2DBuffer*> workers; //one per thread of the pool
+  
+  Deferred(size_t numthreads, int tilesize)
+  : pool(numthreads)
+  , tilesize(tilesize)
+  , numtilesx(0)
+  , numtilesy(0)
+  {
+    for(size_t i = 0; i < pool.getNumThreads(); i++)
+    {
+      workers.push_back(new Drawer2DBuffer);
+      workers.back()->setTrackDamage(false); //the damage is tracked while recording
+    }
+  }
+  
+  ~Deferred()
+  {
+    for(size_t i = 0; i < workers.size(); i++) delete workers[i];
+  }
+  
+  DrawCommand& add(const ADrawer2DBuffer& drawer, DrawCommandType type)
+  {
+    commands.resize(commands.size() + 1);
+    DrawCommand& c = commands.back();
+    c.type = type;
+    c.numpoints = 0;
+    c.filled = true;
+    c.texture = 0;
+    c.sizex = c.sizey = 0;
+    c.first = c.count = 0;
+    c.clip = drawer.clip;
+    c.texture_alpha_as_opacity = drawer.texture_alpha_as_opacity;
+    c.color_alpha_as_opacity = drawer.color_alpha_as_opacity;
+    c.extra_opacity = drawer.extra_opacity;
+    c.smoothing = drawer.smoothing;
+    c.antialiasing = drawer.antialiasing;
+    c.premultiplied = drawer.premultiplied;
+    c.linewidth = drawer.linewidth;
+    c.linejoin = drawer.linejoin;
+    c.linecap = drawer.linecap;
+    return c;
+  }
+  
+  //draws all recorded commands on the buffer, and clears them
+  void flush(unsigned char* buffer, size_t w, size_t h, const ADrawer2DBuffer& drawer)
+  {
+    numtilesx = (w + tilesize - 1) / tilesize;
+    numtilesy = (h + tilesize - 1) / tilesize;
+    tiles.resize(numtilesx * numtilesy);
+    for(size_t i = 0; i < tiles.size(); i++) tiles[i].clear();
     
-    for(double y = (int)ystart; y < yend; y++) //it's important that the x and y of every triangle starts at same fractional part (without, there are ugly pixels on the side and seams between touching triangles are visible), hence the (int) conversion.
+    for(size_t i = 0; i < commands.size(); i++)
     {
-      double x0, x1;
-      if(y < b.y)
+      Clip b = commands[i].getBounds();
+      if(b.x0 >= b.x1 || b.y0 >= b.y1) continue;
+      for(int ty = b.y0 / tilesize; ty <= (b.y1 - 1) / tilesize; ty++)
+      for(int tx = b.x0 / tilesize; tx <= (b.x1 - 1) / tilesize; tx++)
       {
-        x0 = a.x + (y - a.y) * stepxab;
-        x1 = a.x + (y - a.y) * stepxac;
+        tiles[ty * numtilesx + tx].push_back(i);
       }
-      else
+    }
+    
+    nonempty.clear();
+    for(size_t i = 0; i < tiles.size(); i++) if(!tiles[i].empty()) nonempty.push_back(i);
+    
+    for(size_t i = 0; i < workers.size(); i++)
+    {
+      //the workers draw directly on the buffer, in its pixel format
+      workers[i]->setBuffer(buffer, w, h);
+      workers[i]->setPixelFormat(drawer.pixelbytes, drawer.pixelload, drawer.pixelstore);
+    }
+    pool.run(*this, nonempty.size());
+    
+    commands.clear();
+    polygonpoints.clear();
+    sprites.clear();
+  }
+  
+  //draws one tile
+  virtual void execute(size_t index, size_t thread)
+  {
+    size_t tile = nonempty[index];
+    int x0 = (tile % numtilesx) * tilesize;
+    int y0 = (tile / numtilesx) * tilesize;
+    Drawer2DBuffer& worker = *workers[thread];
+    const std::vector<size_t>& list = tiles[tile];
+    
+    for(size_t i = 0; i < list.size(); i++)
+    {
+      const DrawCommand& c = commands[list[i]];
+      worker.clip = c.clip;
+      worker.clip.fit(x0, y0, x0 + tilesize, y0 + tilesize);
+      worker.texture_alpha_as_opacity = c.texture_alpha_as_opacity;
+      worker.color_alpha_as_opacity = c.color_alpha_as_opacity;
+      worker.extra_opacity = c.extra_opacity;
+      worker.smoothing = c.smoothing;
+      worker.antialiasing = c.antialiasing;
+      worker.premultiplied = c.premultiplied;
+      worker.linewidth = c.linewidth;
+      worker.linejoin = c.linejoin;
+      worker.linecap = c.linecap;
+      draw(worker, c);
+    }
+  }
+  
+  void draw(ADrawer2DBuffer& drawer, const DrawCommand& c)
+  {
+    const int* p = c.p;
+    switch(c.type)
+    {
+      case DC_POINT: drawer.drawPoint(p[0], p[1], c.color[0]); break;
+      case DC_LINE: drawer.drawLine(p[0], p[1], p[2], p[3], c.color[0]); break;
+      case DC_BEZIER: drawer.drawBezier(p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7], c.color[0]); break;
+      case DC_RECTANGLE: drawer.drawRectangle(p[0], p[1], p[2], p[3], c.color[0], true); break;
+      case DC_TRIANGLE: drawer.drawTriangle(p[0], p[1], p[2], p[3], p[4], p[5], c.color[0], true); break;
+      case DC_GRADIENT_TRIANGLE: drawer.drawGradientTriangle(p[0], p[1], p[2], p[3], p[4], p[5], c.color[0], c.color[1], c.color[2]); break;
+      case DC_GRADIENT_RECTANGLE: drawer.drawGradientRectangle(p[0], p[1], p[2], p[3], c.color[0], c.color[1], c.color[2], c.color[3]); break;
+      case DC_CIRCLE: drawer.drawCircle(p[0], p[1], p[2], c.color[0], c.filled); break;
+      case DC_ELLIPSE: drawer.drawEllipseCentered(p[0], p[1], p[2], p[3], c.color[0], c.filled); break;
+      case DC_POLYGON: drawer.drawPolygon(&polygonpoints[c.first], c.count, c.color[0], c.filled); break;
+      case DC_TEXTURE: drawer.drawTexture(c.texture, p[0], p[1], c.color[0]); break;
+      case DC_TEXTURE_SIZED: drawer.drawTextureSized(c.texture, p[0], p[1], c.sizex, c.sizey, c.color[0]); break;
+      case DC_TEXTURE_REPEATED: drawer.drawTextureRepeated(c.texture, p[0], p[1], p[2], p[3], c.color[0]); break;
+      case DC_TEXTURE_SIZED_REPEATED: drawer.drawTextureSizedRepeated(c.texture, p[0], p[1], p[2], p[3], c.sizex, c.sizey, c.color[0]); break;
+      case DC_TEXTURE_REPEATED_GRADIENT: drawer.drawTextureRepeatedGradient(c.texture, p[0], p[1], p[2], p[3], c.color[0], c.color[1], c.color[2], c.color[3]); break;
+      case DC_SPRITE: drawer.drawTextures(&sprites[c.first], 1); break;
+    }
+  }
+};
+
+/*
+Iterates over the rectangles of the clip region that the bounds of a call touch, setting the clip area
+of the drawer to each of them (limited by the clip area that was active) for drawing the call again.
+The rectangles don't overlap, so every pixel is still drawn at most once.
+*/
+struct ADrawer2DBuffer::RegionLoop
+{
+  ADrawer2DBuffer& drawer;
+  Clip saved; //the clip area before the loop
+  Clip bounds;
+  size_t band;
+  size_t span;
+  
+  RegionLoop(ADrawer2DBuffer& drawer, int x0, int y0, int x1, int y1)
+  : drawer(drawer)
+  , saved(drawer.clip)
+  , span(0)
+  {
+    bounds.x0 = x0;
+    bounds.y0 = y0;
+    bounds.x1 = x1;
+    bounds.y1 = y1;
+    bounds.fit(saved.x0, saved.y0, saved.x1, saved.y1);
+    band = drawer.region->findBand(bounds.y0);
+    drawer.inregion = true;
+  }
+  
+  ~RegionLoop()
+  {
+    drawer.clip = saved;
+    drawer.inregion = false;
+  }
+  
+  //returns false if there are no rectangles left
+  bool next()
+  {
+    const ClipRegion& region = *drawer.region;
+    if(bounds.x0 >= bounds.x1 || bounds.y0 >= bounds.y1) return false;
+    for(; band < region.getNumBands() && region.getBand(band).y0 < bounds.y1; band++, span = 0)
+    {
+      const ClipRegion::Band& b = region.getBand(band);
+      const int* s = region.getSpans(b);
+      while(span < b.count)
       {
-        x0 = b.x + (y - b.y) * stepxbc;
-        x1 = a.x + (y - a.y) * stepxac;
+        Clip c = { s[2 * span], b.y0, s[2 * span + 1], b.y1 };
+        span++;
+        if(c.x0 >= bounds.x1 || c.x1 <= bounds.x0) continue;
+        c.fit(saved.x0, saved.y0, saved.x1, saved.y1);
+        if(c.x0 >= c.x1 || c.y0 >= c.y1) continue;
+        drawer.clip = c;
+        return true;
       }
-      
-      if(x1 < x0) std::swap(x0, x1);
-      if(x0 < 0.0) x0 = 0.0;
-      if(x1 > w) x1 = w;
-      x0 = (int)x0; //it's important that the x and y of every triangle starts at same fractional part (without, there are ugly pixels on the side and seams between touching triangles are visible), hence the (int) conversion.
-      
-      //instead of doing the barycentric calculation for every x, do it only for begin and end and then step linearly
-      double alpha, beta, gamma;
-      double alpha2, beta2, gamma2;
-      barycentric(alpha, beta, gamma, a, b, c,  Vector2(x0, y));
-      barycentric(alpha2, beta2, gamma2, a, b, c,  Vector2(x1, y));
-      double stepalphax = (alpha2 - alpha) / (x1 - x0);
-      double stepbetax = (beta2 - beta) / (x1 - x0);
-      double stepgammax = (gamma2 - gamma) / (x1 - x0);
-      
-      for(double x = (int)x0; x < x1; x++)
-      {
-        if(alpha >= 0.0 && beta >= 0.0 && gamma >= 0.0) //pixel inside triangle
-        {
-          pset(buffer, w, (int)x, (int)y, color);
-        }
-        
-        alpha += stepalphax;
-        beta += stepbetax;
-        gamma += stepgammax;
+    }
+    return false;
+  }
+};
+
+ADrawer2DBuffer::ADrawer2DBuffer()
+: buffer(0)
+, w(0)
+, h(0)
+, texture_alpha_as_opacity(true)
+, color_alpha_as_opacity(true)
+, extra_opacity(1.0)
+, smoothing(false)
+, antialiasing(false)
+, premultiplied(false)
+, linewidth(1.0)
+, linejoin(LJ_MITER)
+, linecap(LC_BUTT)
+, region(0)
+, inregion(false)
+, track_damage(true)
+, deferred(0)
+, recording(false)
+, pixelbytes(4)
+, pixelload(0)
+, pixelstore(0)
+{
+  TextureFactory<TextureBuffer> factory;
+}
+
+ADrawer2DBuffer::~ADrawer2DBuffer()
+{
+  delete deferred;
+}
+
+void ADrawer2DBuffer::setDeferred(bool enabled, size_t numthreads, int tilesize)
+{
+  if(recording)
+  {
+    recording = false;
+    deferred->flush(buffer, w, h, *this);
+  }
+  delete deferred;
+  deferred = enabled ? new Deferred(numthreads, tilesize < 8 ? 8 : tilesize) : 0;
+}
+
+void ADrawer2DBuffer::setPixelFormat(size_t bytes, PixelConvertFunc load, PixelConvertFunc store)
+{
+  pixelbytes = bytes;
+  pixelload = load;
+  pixelstore = store;
+}
+
+ADrawer2DBuffer::Target ADrawer2DBuffer::getTarget()
+{
+  Target target = { buffer, (int)w, pixelbytes, pixelload, pixelstore, &pixelrow };
+  return target;
+}
+
+void ADrawer2DBuffer::frameStart()
+{
+  damage.clear();
+  
+  if(deferred)
+  {
+    deferred->commands.clear();
+    deferred->polygonpoints.clear();
+    deferred->sprites.clear();
+    recording = true;
+  }
+}
+
+void ADrawer2DBuffer::frameEnd()
+{
+  if(recording)
+  {
+    recording = false;
+    deferred->flush(buffer, w, h, *this);
+  }
+}
+
+
+void ADrawer2DBuffer::setTextureAlphaAsOpacity(bool set)
+{
+  texture_alpha_as_opacity = set;
+}
+
+void ADrawer2DBuffer::setColorAlphaAsOpacity(bool set)
+{
+  color_alpha_as_opacity = set;
+}
+
+void ADrawer2DBuffer::setExtraOpacity(double opacity)
+{
+  extra_opacity = opacity;
+}
+
+void ADrawer2DBuffer::setSmoothing(bool set)
+{
+  smoothing = set;
+}
+
+void ADrawer2DBuffer::setAntiAliasing(bool set)
+{
+  antialiasing = set;
+}
+
+void ADrawer2DBuffer::setPremultipliedAlpha(bool set)
+{
+  premultiplied = set;
+}
+
+void ADrawer2DBuffer::setLineWidth(double width)
+{
+  linewidth = width;
+}
+
+void ADrawer2DBuffer::setLineJoin(LineJoin join)
+{
+  linejoin = join;
+}
+
+void ADrawer2DBuffer::setLineCap(LineCap cap)
+{
+  linecap = cap;
+}
+
+
+
+void ADrawer2DBuffer::pushScissor(int x0, int y0, int x1, int y1)
+{
+  clipstack.push_back(clip);
+  clip.x0 = x0;
+  clip.y0 = y0;
+  clip.x1 = x1;
+  clip.y1 = y1;
+  clip.fit(0, 0, w, h);
+}
+
+void ADrawer2DBuffer::pushSmallestScissor(int x0, int y0, int x1, int y1)
+{
+  int sx0 = x0;
+  int sy0 = y0;
+  int sx1 = x1;
+  int sy1 = y1;
+  
+  if(clip.x0 > sx0) sx0 = clip.x0;
+  if(clip.y0 >  sy0)  sy0 = clip.y0; 
+  if(clip.x1 < sx1) sx1 = clip.x1;
+  if(clip.y1 < sy1) sy1 = clip.y1;
+  
+  pushScissor(sx0,  sy0, sx1, sy1);
+}
+
+void ADrawer2DBuffer::pushScissorRegion(const ClipRegion& region)
+{
+  ClipRegion r = region;
+  r.intersect(clip.x0, clip.y0, clip.x1, clip.y1);
+  if(this->region) r.intersect(*this->region);
+  
+  clipstack.push_back(clip);
+  regions.push_back(r);
+  regionmarks.push_back(clipstack.size());
+  r.getBounds(clip.x0, clip.y0, clip.x1, clip.y1);
+  this->region = r.empty() || r.isRectangle() ? 0 : &regions.back(); //else the clip rectangle is enough
+}
+
+void ADrawer2DBuffer::popScissor()
+{
+  if(!regionmarks.empty() && regionmarks.back() == clipstack.size())
+  {
+    regionmarks.pop_back();
+    regions.pop_back();
+    region = 0;
+    //the region of an outer pushScissorRegion is used again, unless it was only a rectangle
+    if(!regions.empty() && !regions.back().empty() && !regions.back().isRectangle()) region = &regions.back();
+  }
+  clip = clipstack.back();
+  clip.fit(0, 0, w, h);
+  clipstack.pop_back();
+}
+
+void ADrawer2DBuffer::drawPoint(int x, int y, const ColorRGB& color)
+{
+  if(useRegionLoop(false))
+  {
+    for(RegionLoop r(*this, x, y, x + 1, y + 1); r.next();) drawPoint(x, y, color);
+    return;
+  }
+  
+  addDamage(x, y, x + 1, y + 1);
+  
+  if(recording)
+  {
+    DrawCommand& c = deferred->add(*this, DC_POINT);
+    c.setPoints(x, y);
+    c.setColors(color);
+    return;
+  }
+  
+  psetClipped(getTarget(), clip, x, y, SpanFill(color, getFillMode()));
+}
+
+void ADrawer2DBuffer::drawLine(int x0, int y0, int x1, int y1, const ColorRGB& color)
+{
+  int m = getStrokeMargin();
+  if(useRegionLoop(linewidth != 1.0))
+  {
+    for(RegionLoop r(*this, std::min(x0, x1) - m, std::min(y0, y1) - m, std::max(x0, x1) + 1 + m, std::max(y0, y1) + 1 + m); r.next();)
+    {
+      drawLine(x0, y0, x1, y1, color);
+    }
+    return;
+  }
+  
+  addDamage(std::min(x0, x1) - m, std::min(y0, y1) - m, std::max(x0, x1) + 1 + m, std::max(y0, y1) + 1 + m);
+  
+  if(recording)
+  {
+    DrawCommand& c = deferred->add(*this, DC_LINE);
+    c.setPoints(x0, y0, x1, y1);
+    c.setColors(color);
+    return;
+  }
+  
+  if(linewidth != 1.0)
+  {
+    double xy[4] = { x0 + 0.5, y0 + 0.5, x1 + 0.5, y1 + 0.5 };
+    stroke(xy, 2, false, color);
+  }
+  else if(antialiasing) drawLineWu(getTarget(), clip, x0, y0, x1, y1, SpanFill(color, getFillMode()));
+  else lpi::drawLine(getTarget(), clip, x0, y0, x1, y1, SpanFill(color, getFillMode()));
+}
+
+void ADrawer2DBuffer::drawBezier(int x0, int y0, int x1, int y1, int x2, int y2, int x3, int y3, const ColorRGB& color)
+{
+  int m = getStrokeMargin();
+  if(useRegionLoop(linewidth != 1.0 || antialiasing))
+  {
+    for(RegionLoop r(*this, std::min(std::min(x0, x1), std::min(x2, x3)) - m, std::min(std::min(y0, y1), std::min(y2, y3)) - m
+                          , std::max(std::max(x0, x1), std::max(x2, x3)) + 1 + m, std::max(std::max(y0, y1), std::max(y2, y3)) + 1 + m); r.next();)
+    {
+      drawBezier(x0, y0, x1, y1, x2, y2, x3, y3, color);
+    }
+    return;
+  }
+  
+  addDamage(std::min(std::min(x0, x1), std::min(x2, x3)) - m, std::min(std::min(y0, y1), std::min(y2, y3)) - m
+          , std::max(std::max(x0, x1), std::max(x2, x3)) + 1 + m, std::max(std::max(y0, y1), std::max(y2, y3)) + 1 + m);
+  
+  if(recording)
+  {
+    DrawCommand& c = deferred->add(*this, DC_BEZIER);
+    c.setPoints(x0, y0, x1, y1, x2, y2, x3, y3);
+    c.setColors(color);
+    return;
+  }
+  
+  polyline.clear();
+  flattenBezier(polyline, x0 + 0.5, y0 + 0.5, x1 + 0.5, y1 + 0.5, x2 + 0.5, y2 + 0.5, x3 + 0.5, y3 + 0.5);
+  size_t n = polyline.size() / 2;
+  if(linewidth != 1.0 || antialiasing) stroke(&polyline[0], n, false, color);
+  else
+  {
+    Target target = getTarget();
+    SpanFill fill(color, getFillMode());
+    for(size_t i = 0; i + 1 < n; i++)
+    {
+      lpi::drawLine(target, clip, (int)std::floor(polyline[2 * i]), (int)std::floor(polyline[2 * i + 1])
+                                   , (int)std::floor(polyline[2 * i + 2]), (int)std::floor(polyline[2 * i + 3]), fill, i + 2 == n);
+    }
+  }
+}
+
+void ADrawer2DBuffer::stroke(const double* xy, size_t numpoints, bool closed, const ColorRGB& color)
+{
+  rasterizer.addStroke(xy, numpoints, linewidth, linejoin, linecap, closed);
+  ColorSpanFiller filler(getTarget(), color, getFillMode());
+  fillRasterizer(filler);
+}
+
+int ADrawer2DBuffer::getStrokeMargin() const
+{
+  return lpi::getStrokeMargin(linewidth, linejoin, linecap, antialiasing);
+}
+
+    
+void ADrawer2DBuffer::drawRectangle(int x0, int y0, int x1, int y1, const ColorRGB& color, bool filled)
+{
+  if(filled)
+  {
+    if(useRegionLoop(false))
+    {
+      for(RegionLoop r(*this, x0, y0, x1, y1); r.next();) drawRectangle(x0, y0, x1, y1, color, true);
+      return;
+    }
+    
+    addDamage(x0, y0, x1, y1);
+    
+    if(recording)
+    {
+      DrawCommand& c = deferred->add(*this, DC_RECTANGLE);
+      c.setPoints(x0, y0, x1, y1);
+      c.setColors(color);
+      return;
+    }
+    
+    int sx0 = x0;
+    int sy0 = y0;
+    int sx1 = x1;
+    int sy1 = y1;
+    
+    if(clip.x0 > sx0) sx0 = clip.x0;
+    if(clip.y0 >  sy0)  sy0 = clip.y0; 
+    if(clip.x1 < sx1) sx1 = clip.x1;
+    if(clip.y1 < sy1) sy1 = clip.y1;
+    
+    if(sx0 >= sx1) return;
+    Target target = getTarget();
+    SpanFill fill(color, getFillMode());
+    for(int y = sy0; y < sy1; y++)
+    {
+      fill.fill(PixelSpan(target, sx0, y, sx1 - sx0).rgba, sx1 - sx0);
+    }
+  }
+  else if(linewidth != 1.0)
+  {
+    int xy[8] = { x0, y0, x1 - 1, y0, x1 - 1, y1 - 1, x0, y1 - 1 }; //with joins at the corners
+    drawPolygon(xy, 4, color, false);
+  }
+  else
+  {
+    drawLine(x0, y0, x1, y0, color);
+    drawLine(x0, y1 - 1, x1, y1 - 1, color);
+    drawLine(x0, y0, x0, y1, color);
+    drawLine(x1 - 1, y0, x1 - 1, y1, color);
+  }
+}
+
+//color0 is the top left corner, the others follow counterclockwise, like the points of drawGradientQuad
+void ADrawer2DBuffer::drawGradientRectangle(int x0, int y0, int x1, int y1, const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2, const ColorRGB& color3)
+{
+  if(useRegionLoop(false))
+  {
+    for(RegionLoop r(*this, x0, y0, x1, y1); r.next();) drawGradientRectangle(x0, y0, x1, y1, color0, color1, color2, color3);
+    return;
+  }
+  
+  addDamage(x0, y0, x1, y1);
+  
+  if(recording)
+  {
+    DrawCommand& c = deferred->add(*this, DC_GRADIENT_RECTANGLE);
+    c.setPoints(x0, y0, x1, y1);
+    c.setColors(color0, color1, color2, color3);
+    return;
+  }
+  
+  int sx0 = std::max(x0, clip.x0);
+  int sy0 = std::max(y0, clip.y0);
+  int sx1 = std::min(x1, clip.x1);
+  int sy1 = std::min(y1, clip.y1);
+  if(sx0 >= sx1 || sy0 >= sy1) return;
+  
+  BilinearGradient gradient(x0, y0, x1, y1, color0, color3, color1, color2);
+  BlendMode mode = getFillMode();
+  BlendSpanFunc blend = getBlendSpanFunc(mode);
+  size_t n = sx1 - sx0;
+  gradientline.resize(4 * n);
+  Target target = getTarget();
+  for(int y = sy0; y < sy1; y++)
+  {
+    gradient.fill(&gradientline[0], sx0, y, n);
+    if(mode.premultiplied) premultiplySpan(&gradientline[0], &gradientline[0], n);
+    blend(PixelSpan(target, sx0, y, n).rgba, &gradientline[0], n, mode);
+  }
+}
+
+void ADrawer2DBuffer::drawGradientTriangle(int x0, int y0, int x1, int y1, int x2, int y2, const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2)
+{
+  if(useRegionLoop(true))
+  {
+    for(RegionLoop r(*this, std::min(x0, std::min(x1, x2)), std::min(y0, std::min(y1, y2)), std::max(x0, std::max(x1, x2)) + 1, std::max(y0, std::max(y1, y2)) + 1); r.next();)
+    {
+      drawGradientTriangle(x0, y0, x1, y1, x2, y2, color0, color1, color2);
+    }
+    return;
+  }
+  
+  addDamage(std::min(x0, std::min(x1, x2)), std::min(y0, std::min(y1, y2)), std::max(x0, std::max(x1, x2)) + 1, std::max(y0, std::max(y1, y2)) + 1);
+  
+  if(recording)
+  {
+    DrawCommand& c = deferred->add(*this, DC_GRADIENT_TRIANGLE);
+    c.setPoints(x0, y0, x1, y1, x2, y2);
+    c.setColors(color0, color1, color2);
+    return;
+  }
+  
+  int xy[6] = { x0, y0, x1, y1, x2, y2 };
+  addPolygon(rasterizer, xy, 3);
+  GradientSpanFiller filler(getTarget(), x0, y0, x1, y1, x2, y2, color0, color1, color2, getFillMode());
+  fillRasterizer(filler);
+}
+
+void ADrawer2DBuffer::drawTriangle(int x0, int y0, int x1, int y1, int x2, int y2, const ColorRGB& color, bool filled)
+{
+  if(filled)
+  {
+    if(useRegionLoop(true))
+    {
+      for(RegionLoop r(*this, std::min(x0, std::min(x1, x2)), std::min(y0, std::min(y1, y2)), std::max(x0, std::max(x1, x2)) + 1, std::max(y0, std::max(y1, y2)) + 1); r.next();)
+      {
+        drawTriangle(x0, y0, x1, y1, x2, y2, color, true);
       }
+      return;
+    }
+    
+    addDamage(std::min(x0, std::min(x1, x2)), std::min(y0, std::min(y1, y2)), std::max(x0, std::max(x1, x2)) + 1, std::max(y0, std::max(y1, y2)) + 1);
+    
+    if(recording)
+    {
+      DrawCommand& c = deferred->add(*this, DC_TRIANGLE);
+      c.setPoints(x0, y0, x1, y1, x2, y2);
+      c.setColors(color);
+      return;
     }
+    
+    int xy[6] = { x0, y0, x1, y1, x2, y2 };
+    addPolygon(rasterizer, xy, 3);
+    ColorSpanFiller filler(getTarget(), color, getFillMode());
+    fillRasterizer(filler);
   }
   else
   {
-    drawLine(x0, y0, x1, y1, color);
-    drawLine(x1, y1, x2, y2, color);
-    drawLine(x2, y2, x0, y0, color);
+    int xy[6] = { x0, y0, x1, y1, x2, y2 };
+    drawPolygon(xy, 3, color, false);
   }
 }
 
 void ADrawer2DBuffer::drawQuad(int x0, int y0, int x1, int y1, int x2, int y2, int x3, int y3, const ColorRGB& color, bool filled)
 {
-  (void)x0; (void)y0; (void)x1; (void)y1; (void)x2; (void)y2; (void)x3; (void)y3; (void)color; (void)filled;
-  //TODO!
+  int xy[8] = { x0, y0, x1, y1, x2, y2, x3, y3 };
+  drawPolygon(xy, 4, color, filled);
+}
+
+void ADrawer2DBuffer::drawPolygon(const int* xy, size_t numpoints, const ColorRGB& color, bool filled)
+{
+  if(numpoints == 0) return;
+  
+  //borders with a width, or anti-aliased, are stroked as a whole so that the corners get joins and aren't drawn twice
+  bool stroked = !filled && (linewidth != 1.0 || antialiasing);
+  
+  int x0 = xy[0], y0 = xy[1], x1 = xy[0], y1 = xy[1]; //bounding box
+  for(size_t i = 1; i < numpoints; i++)
+  {
+    x0 = std::min(x0, xy[2 * i]);
+    y0 = std::min(y0, xy[2 * i + 1]);
+    x1 = std::max(x1, xy[2 * i]);
+    y1 = std::max(y1, xy[2 * i + 1]);
+  }
+  int m = filled ? 0 : getStrokeMargin();
+  if(useRegionLoop(filled || stroked))
+  {
+    for(RegionLoop r(*this, x0 - m, y0 - m, x1 + 1 + m, y1 + 1 + m); r.next();) drawPolygon(xy, numpoints, color, filled);
+    return;
+  }
+  
+  addDamage(x0 - m, y0 - m, x1 + 1 + m, y1 + 1 + m);
+  
+  if(recording)
+  {
+    DrawCommand& c = deferred->add(*this, DC_POLYGON);
+    c.setPoints(x0, y0, x1, y1);
+    c.setColors(color);
+    c.filled = filled;
+    c.first = deferred->polygonpoints.size();
+    c.count = numpoints;
+    deferred->polygonpoints.insert(deferred->polygonpoints.end(), xy, xy + 2 * numpoints);
+    return;
+  }
+  
   if(filled)
   {
-    //very lame temporary solution: draw it as some triangles (probably not always correct for non convex shapes!!)
-    int cx = (x0 + x1 + x2 + x3) / 4;
-    int cy = (y0 + y1 + y2 + y3) / 4;
-    drawTriangle(x0, y0, x1, y1, cx, cy, color, true);
-    drawTriangle(x1, y1, x2, y2, cx, cy, color, true);
-    drawTriangle(x2, y2, x3, y3, cx, cy, color, true);
-    drawTriangle(x3, y3, x0, y0, cx, cy, color, true);
+    addPolygon(rasterizer, xy, numpoints);
+    ColorSpanFiller filler(getTarget(), color, getFillMode());
+    fillRasterizer(filler);
+  }
+  else if(stroked)
+  {
+    polyline.resize(2 * numpoints);
+    for(size_t i = 0; i < 2 * numpoints; i++) polyline[i] = xy[i] + 0.5;
+    stroke(&polyline[0], numpoints, true, color);
   }
   else
   {
-    drawLine(x0, y0, x1, y1, color);
-    drawLine(x1, y1, x2, y2, color);
-    drawLine(x2, y2, x3, y3, color);
-    drawLine(x3, y3, x0, y0, color);
+    //every edge without its last point, which is the first point of the next edge, so that the corners aren't blended twice
+    Target target = getTarget();
+    SpanFill fill(color, getFillMode());
+    if(numpoints == 1) lpi::drawLine(target, clip, xy[0], xy[1], xy[0], xy[1], fill);
+    else for(size_t i = 0; i < numpoints; i++)
+    {
+      size_t j = (i + 1) % numpoints;
+      lpi::drawLine(target, clip, xy[2 * i], xy[2 * i + 1], xy[2 * j], xy[2 * j + 1], fill, false);
+    }
   }
 }
 
 void ADrawer2DBuffer::drawCircle(int x, int y, int radius, const ColorRGB& color, bool filled)
 {
-  filled ? drawDisk(buffer, w, h, x, y, radius, color) : drawCircleBorder(buffer, w, clip, x, y, radius, color);
+  int m = filled ? 0 : getStrokeMargin();
+  if(useRegionLoop(filled || linewidth != 1.0))
+  {
+    for(RegionLoop r(*this, x - std::abs(radius) - m, y - std::abs(radius) - m, x + std::abs(radius) + 1 + m, y + std::abs(radius) + 1 + m); r.next();)
+    {
+      drawCircle(x, y, radius, color, filled);
+    }
+    return;
+  }
+  
+  addDamage(x - std::abs(radius) - m, y - std::abs(radius) - m, x + std::abs(radius) + 1 + m, y + std::abs(radius) + 1 + m);
+  
+  if(recording)
+  {
+    DrawCommand& c = deferred->add(*this, DC_CIRCLE);
+    c.setPoints(x, y, radius, 0);
+    c.numpoints = 1; //the radius is not a point
+    c.setColors(color);
+    c.filled = filled;
+    return;
+  }
+  
+  if(filled)
+  {
+    //the radius is to the center of the outer pixels, so the border of the shape is half a pixel further
+    rasterizer.addEllipse(x + 0.5, y + 0.5, std::abs(radius) + 0.5, std::abs(radius) + 0.5);
+    ColorSpanFiller filler(getTarget(), color, getFillMode());
+    fillRasterizer(filler);
+  }
+  else if(linewidth != 1.0)
+  {
+    rasterizer.addEllipseBorder(x + 0.5, y + 0.5, std::abs(radius), std::abs(radius), linewidth);
+    ColorSpanFiller filler(getTarget(), color, getFillMode());
+    fillRasterizer(filler);
+  }
+  else if(antialiasing) drawEllipseWu(getTarget(), clip, x, y, radius, radius, SpanFill(color, getFillMode()));
+  else drawCircleBorder(getTarget(), clip, x, y, radius, SpanFill(color, getFillMode()));
 }
 
 void ADrawer2DBuffer::drawEllipseCentered(int x, int y, int radiusx, int radiusy, const ColorRGB& color, bool filled)
 {
-  filled ? drawFilledEllipse(buffer, w, h, x, y, radiusx, radiusy, color) : drawEllipseBorder(buffer, w, clip, x, y, radiusx, radiusy, color);
+  int m = filled ? 0 : getStrokeMargin();
+  if(useRegionLoop(filled || linewidth != 1.0))
+  {
+    for(RegionLoop r(*this, x - std::abs(radiusx) - m, y - std::abs(radiusy) - m, x + std::abs(radiusx) + 1 + m, y + std::abs(radiusy) + 1 + m); r.next();)
+    {
+      drawEllipseCentered(x, y, radiusx, radiusy, color, filled);
+    }
+    return;
+  }
+  
+  addDamage(x - std::abs(radiusx) - m, y - std::abs(radiusy) - m, x + std::abs(radiusx) + 1 + m, y + std::abs(radiusy) + 1 + m);
+  
+  if(recording)
+  {
+    DrawCommand& c = deferred->add(*this, DC_ELLIPSE);
+    c.setPoints(x, y, radiusx, radiusy);
+    c.numpoints = 1; //the radii are not a point
+    c.setColors(color);
+    c.filled = filled;
+    return;
+  }
+  
+  if(filled)
+  {
+    rasterizer.addEllipse(x + 0.5, y + 0.5, std::abs(radiusx) + 0.5, std::abs(radiusy) + 0.5);
+    ColorSpanFiller filler(getTarget(), color, getFillMode());
+    fillRasterizer(filler);
+  }
+  else if(linewidth != 1.0)
+  {
+    rasterizer.addEllipseBorder(x + 0.5, y + 0.5, std::abs(radiusx), std::abs(radiusy), linewidth);
+    ColorSpanFiller filler(getTarget(), color, getFillMode());
+    fillRasterizer(filler);
+  }
+  else if(antialiasing) drawEllipseWu(getTarget(), clip, x, y, radiusx, radiusy, SpanFill(color, getFillMode()));
+  else drawEllipseBorder(getTarget(), clip, x, y, radiusx, radiusy, SpanFill(color, getFillMode()));
+}
+
+BlendMode ADrawer2DBuffer::getFillMode() const
+{
+  return BlendMode(RGB_White, color_alpha_as_opacity, color_alpha_as_opacity, extra_opacity, premultiplied);
+}
+
+void ADrawer2DBuffer::fillRasterizer(ISpanFiller& filler)
+{
+  rasterizer.setAntiAliasing(antialiasing);
+  if(region && !inregion)
+  {
+    //rendered once over the bounds of the region instead of once per rectangle
+    RegionSpanFiller regionfiller(filler, *region);
+    rasterizer.render(regionfiller, clip.x0, clip.y0, clip.x1, clip.y1);
+  }
+  else rasterizer.render(filler, clip.x0, clip.y0, clip.x1, clip.y1);
+  rasterizer.clear();
 }
 
 void ADrawer2DBuffer::drawGradientQuad(int x0, int y0, int x1, int y1, int x2, int y2, int x3, int y3, const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2, const ColorRGB& color3)
@@ -698,12 +1591,15 @@ void ADrawer2DBuffer::drawGradientQuad(int x0, int y0, int x1, int y1, int x2, i
 
 bool ADrawer2DBuffer::supportsTexture(ITexture* texture)
 {
-  return dynamic_cast<TextureBuffer*>(texture);
+  int x, y;
+  return dynamic_cast<const TextureBuffer*>(getAtlasPage(texture, x, y));
 }
 
 ITexture* ADrawer2DBuffer::createTexture() const
 {
-  return new TextureBuffer();
+  TextureBuffer* t = new TextureBuffer();
+  t->setPremultiplied(premultiplied);
+  return t;
 }
 
 ITexture* ADrawer2DBuffer::createTexture(ITexture* texture) const
@@ -713,101 +1609,174 @@ ITexture* ADrawer2DBuffer::createTexture(ITexture* texture) const
                       , texture->getBuffer(), texture->getU2(), texture->getV2()
                       , AE_Nothing
                       , 0, 0, texture->getU(), texture->getV());
+  /*
+  t is still straight alpha, so makeTextureFromBuffer copied the pixels as they are: they're in
+  the alpha format of the source. Tag them as such without touching them, then convert them once,
+  only if this drawer uses the other format.
+  */
+  const bool source_premultiplied = isPremultiplied(texture);
+  t->setPremultiplied(source_premultiplied, false);
+  if(source_premultiplied != premultiplied) t->setPremultiplied(premultiplied, true);
   return t;
 }
 
+namespace
+{
+
 /*
-ob: output buffer (RGBA)
-oi: index in output buffer
-ib: input buffer (RGBA), this buffer is being blended over ob
-ii: index in input buffer
-colorMod: multiplied with output buffer
-texture_alpha_as_opacity: is the alpha channel of the input texture treated as opacity?
-extra_opacity: extra weighed average
+Blends spans of a texture over the buffer. Chooses the blend function once per draw call: if the
+texture is a TextureBuffer, its cached opacity is used so that opaque textures with white colorMod
+are copied. If the texture has straight alpha and the buffer premultiplied alpha or vice versa,
+the spans are converted first (not needed for opaque textures, those are the same in both formats).
+blendRow also uses the span index of the TextureBuffer, if it has one: when the alpha of the texture
+is used as opacity, transparent pixels leave the buffer as it is (except for the invisible color of
+pixels that have alpha 0 too) so they're skipped, and opaque pixels use the function for an opaque
+source, which is a copy if the colorMod is white.
 */
-static void blend(unsigned char* ob, size_t oi, const unsigned char* ib, size_t ii
-               , const ColorRGB& colorMod
-               , bool texture_alpha_as_opacity, bool color_alpha_as_opacity, double extra_opacity)
+class TextureBlender
 {
-  int r=0, g=0, b=0, a=0;
-
-  if(color_alpha_as_opacity)
-  {
-    if(texture_alpha_as_opacity)
+  private:
+    BlendMode mode;
+    BlendSpanFunc blend;
+    BlendSpanFunc blendopaque; //for the opaque spans of the span index
+    void (*convert)(unsigned char* out, const unsigned char* in, size_t n); //0 if the formats are the same
+    const TextureBuffer* spantexture; //the texture if its span index is used, 0 otherwise
+    std::vector<unsigned char> line;
+    
+  public:
+    TextureBlender()
+    : mode(RGB_White, true, true, 1.0)
+    , blend(0)
+    , blendopaque(0)
+    , convert(0)
+    , spantexture(0)
     {
-      int ri = (ib[ii + 0] * colorMod.r) / 255;
-      int gi = (ib[ii + 1] * colorMod.g) / 255;
-      int bi = (ib[ii + 2] * colorMod.b) / 255;
-      int ai = (ib[ii + 3] * colorMod.a) / 255;
-
-      int ro = ob[oi + 0];
-      int go = ob[oi + 1];
-      int bo = ob[oi + 2];
-      int ao = ob[oi + 3];
-
-      int o = 255 - ((255 - ai) * ao) / 255;
-      if(ai < ao) o = std::min(ai, o); //avoid color of fully transparent foreground leaking through
-      r = (ri * o + ro * (255 - o)) / 255;
-      g = (gi * o + go * (255 - o)) / 255;
-      b = (bi * o + bo * (255 - o)) / 255;
-      a = ai + ((255 - ai) * ao) / 255;
     }
-    else
+    
+    TextureBlender(const ITexture* texture, const BlendMode& mode)
+    : mode(mode)
     {
-      //TODO
+      set(texture, mode);
     }
-  }
-  else
-  {
-    if(texture_alpha_as_opacity)
+    
+    void set(const ITexture* texture, const BlendMode& mode)
     {
-      int ri = (ib[ii + 0] * colorMod.r) / 255;
-      int gi = (ib[ii + 1] * colorMod.g) / 255;
-      int bi = (ib[ii + 2] * colorMod.b) / 255;
-      int ai = ib[ii + 3];
+      this->mode = mode;
+      const TextureBuffer* t = dynamic_cast<const TextureBuffer*>(texture);
+      bool opaque = t && t->isOpaque();
+      blend = getBlendSpanFunc(mode, opaque);
+      bool premultiplied = t && t->isPremultiplied();
+      convert = 0;
+      if(!opaque && premultiplied != mode.premultiplied) convert = premultiplied ? unpremultiplySpan : premultiplySpan;
       
-      int ro = ob[oi + 0];
-      int go = ob[oi + 1];
-      int bo = ob[oi + 2];
-      int ao = ob[oi + 3];
-
-      int o = 255 - ((255 - ai) * ao) / 255;
-      if(ai < ao) o = std::min(ai, o); //avoid color of fully transparent foreground leaking through
-      o = (o * ai) / 255;
-      r = (ri * o + ro * (255 - o)) / 255;
-      g = (gi * o + go * (255 - o)) / 255;
-      b = (bi * o + bo * (255 - o)) / 255;
-      //alpha channel: the intention is: if ia is 0, the alpha channel must become oa. If ia is 255, the alpha channel must become colorMod.a. For values in between: not sure yet, TODO!
-      a = (colorMod.a * ai + ao * (255 - ai)) / 255;
+      spantexture = 0;
+      size_t count;
+      if(t && !opaque && mode.texture_alpha_as_opacity && t->getSpans(0, count))
+      {
+        spantexture = t;
+        blendopaque = getBlendSpanFunc(mode, true);
+      }
     }
-    else
+    
+    void operator()(unsigned char* out, const unsigned char* in, size_t n)
+    {
+      if(convert)
+      {
+        line.resize(4 * n);
+        convert(&line[0], in, n);
+        in = &line[0];
+      }
+      blend(out, in, n, mode);
+    }
+    
+    //blends the columns tx0 to tx1 of row ty of the texture, in points to column tx0 of that row
+    void blendRow(unsigned char* out, const unsigned char* in, size_t ty, int tx0, int tx1)
     {
-      r = ib[ii + 0];
-      g = ib[ii + 1];
-      b = ib[ii + 2];
-      a = ib[ii + 3];
+      //for a few pixels (e.g. a glyph in the page of an atlas) the spans cost more than they save
+      size_t count = 0;
+      const TextureBuffer::Span* spans = spantexture && tx1 - tx0 >= 16 ? spantexture->getSpans(ty, count) : 0;
+      if(!spans)
+      {
+        (*this)(out, in, tx1 - tx0);
+        return;
+      }
+      
+      //the first span that ends after tx0, found with a binary search: in the page of an atlas, the row has the spans of many textures
+      size_t lo = 0, hi = count;
+      while(lo < hi)
+      {
+        size_t mid = (lo + hi) / 2;
+        if(spans[mid].end <= tx0) lo = mid + 1;
+        else hi = mid;
+      }
+      int start = lo > 0 ? spans[lo - 1].end : 0;
+      for(size_t i = lo; i < count && start < tx1; i++)
+      {
+        int s = std::max(start, tx0);
+        int e = std::min(spans[i].end, tx1);
+        start = spans[i].end;
+        if(s >= e || spans[i].type == TextureBuffer::ST_TRANSPARENT) continue;
+        unsigned char* o = out + 4 * (s - tx0);
+        const unsigned char* p = in + 4 * (s - tx0);
+        if(spans[i].type == TextureBuffer::ST_OPAQUE) blendopaque(o, p, e - s, mode); //no conversion needed for opaque pixels
+        else (*this)(o, p, e - s);
+      }
     }
+};
+
+/*
+Builds the caches of the texture (the opacity and the span index) while recording in deferred
+mode, so that the threads only read them.
+*/
+void prepareTextureForThreads(const ITexture* texture)
+{
+  int x, y;
+  const TextureBuffer* t = dynamic_cast<const TextureBuffer*>(getAtlasPage(texture, x, y));
+  if(!t) return;
+  size_t count;
+  if(!t->isOpaque()) t->getSpans(0, count);
+  size_t u, v;
+  if(t->getUseMipmaps()) t->getMipmap(1, u, v);
+}
+
+/*
+An AtlasTexture is drawn as the part of its page with drawTextures, so that the blending uses the
+opacity, format and span index of the page.
+*/
+bool isAtlasTexture(const ITexture* texture)
+{
+  return dynamic_cast<const AtlasTexture*>(texture) != 0;
+}
+
+} //end of anonymous namespace
+
+void ADrawer2DBuffer::drawTexture(const ITexture* texture, int x, int y, const ColorRGB& colorMod)
+{
+  if(isAtlasTexture(texture))
+  {
+    SpriteInstance s(texture, x, y, colorMod);
+    drawTextures(&s, 1);
+    return;
   }
   
-  if(extra_opacity != 1.0)
+  if(useRegionLoop(false))
   {
-    int o = (int)(255 * extra_opacity);
-    ob[oi + 0] = (r * o + ob[oi + 0] * (255 - o)) / 255;
-    ob[oi + 1] = (g * o + ob[oi + 1] * (255 - o)) / 255;
-    ob[oi + 2] = (b * o + ob[oi + 2] * (255 - o)) / 255;
-    ob[oi + 3] = (a * o + ob[oi + 3] * (255 - o)) / 255;
+    for(RegionLoop r(*this, x, y, x + texture->getU(), y + texture->getV()); r.next();) drawTexture(texture, x, y, colorMod);
+    return;
   }
-  else
+  
+  addDamage(x, y, x + texture->getU(), y + texture->getV());
+  
+  if(recording)
   {
-    ob[oi + 0] = r;
-    ob[oi + 1] = g;
-    ob[oi + 2] = b;
-    ob[oi + 3] = a;
+    DrawCommand& c = deferred->add(*this, DC_TEXTURE);
+    c.setPoints(x, y);
+    c.setColors(colorMod);
+    c.texture = texture;
+    prepareTextureForThreads(texture);
+    return;
   }
-}
-    
-void ADrawer2DBuffer::drawTexture(const ITexture* texture, int x, int y, const ColorRGB& colorMod)
-{
+  
   const unsigned char* tb = texture->getBuffer();
   size_t tu = texture->getU();
   size_t tv = texture->getV();
@@ -822,84 +1791,459 @@ void ADrawer2DBuffer::drawTexture(const ITexture* texture, int x, int y, const C
   if(x + x1 > clip.x1) x1 = clip.x1 - x;
   if(y + y1 > clip.y1) y1 = clip.y1 - y;
   if(x0 >= x1 || y0 >= y1) return;
-  for(int tx = x0; tx < x1; tx++)
+  
+  BlendMode mode(colorMod, texture_alpha_as_opacity, color_alpha_as_opacity, extra_opacity, premultiplied);
+  TextureBlender blend(texture, mode);
+  
+  Target target = getTarget();
   for(int ty = y0; ty < y1; ty++)
   {
-    int bufferpos = (y + ty) * w * 4 + (x + tx) * 4;
-    int tbufferpos = ty * tu2 * 4 + tx * 4;
-    
-    blend(buffer, bufferpos, tb, tbufferpos, colorMod, texture_alpha_as_opacity, color_alpha_as_opacity, extra_opacity);
+    int tbufferpos = ty * tu2 * 4 + x0 * 4;
+    blend.blendRow(PixelSpan(target, x + x0, y + ty, x1 - x0).rgba, &tb[tbufferpos], ty, x0, x1);
   }
 }
 
 void ADrawer2DBuffer::drawTextureSized(const ITexture* texture, int x, int y, size_t sizex, size_t sizey, const ColorRGB& colorMod)
 {
-  (void)texture; (void)x; (void)y; (void)sizex; (void)sizey; (void)colorMod;
-  //TODO
+  if(isAtlasTexture(texture))
+  {
+    SpriteInstance s(texture, x, y, colorMod);
+    s.setSize(sizex, sizey);
+    drawTextures(&s, 1);
+    return;
+  }
+  
+  if(useRegionLoop(false))
+  {
+    for(RegionLoop r(*this, x, y, x + sizex, y + sizey); r.next();) drawTextureSized(texture, x, y, sizex, sizey, colorMod);
+    return;
+  }
+  
+  addDamage(x, y, x + sizex, y + sizey);
+  
+  if(recording)
+  {
+    DrawCommand& c = deferred->add(*this, DC_TEXTURE_SIZED);
+    c.setPoints(x, y);
+    c.setColors(colorMod);
+    c.texture = texture;
+    prepareTextureForThreads(texture);
+    c.sizex = sizex;
+    c.sizey = sizey;
+    return;
+  }
+  
+  if(sizex == texture->getU() && sizey == texture->getV()) drawTexture(texture, x, y, colorMod);
+  else drawTextureScaled(texture, 0, 0, texture->getU(), texture->getV(), x, y, x + sizex, y + sizey, x, y, sizex, sizey, false, colorMod);
 }
 
-void ADrawer2DBuffer::drawTextureRepeated(const ITexture* texture, int x0, int y0, int x1, int y1, const ColorRGB& colorMod)
+/*
+Blends one row of a repeated texture: the texture row tb (row ty, of width tu) is repeated
+over n pixels of the output, starting at texture column tx. For the span index, the row starts
+at column ox of the texture the blender uses (the page of an AtlasTexture).
+*/
+static void blendRepeatedRow(unsigned char* ob, const unsigned char* tb, size_t ty, int ox, size_t tu, size_t tx, size_t n, TextureBlender& blend)
 {
-  lpi::clipRect(x0, y0, x1, y1, x0, y0, x1, y1, clip.x0, clip.y0, clip.x1, clip.y1);
+  while(n > 0)
+  {
+    size_t amount = tu - tx;
+    if(amount > n) amount = n;
+    blend.blendRow(ob, tb + 4 * tx, ty, ox + tx, ox + tx + amount);
+    ob += 4 * amount;
+    n -= amount;
+    tx = 0;
+  }
+}
 
-  const unsigned char* tb = texture->getBuffer();
+/*
+Computes for one axis of a texture drawn scaled to the given size, for n output pixels starting at
+coordinate start, which texel they use: for nearest filtering the texel, for bilinear filtering the
+first of the two texels and the weight (0-255) of the second one. The pattern starts at origin and is
+repeated every size pixels, start must not be before origin if repeat is false.
+The positions of the centers of the output pixels are stepped in 16.16 fixed point.
+*/
+static void computeSamples(std::vector<int>& texel, std::vector<int>& weight, int start, size_t n, int origin
+                         , size_t size, size_t texsize, bool smooth, bool repeat)
+{
+  texel.resize(n);
+  weight.resize(n);
   
-    
-  for(int y = y0, ty = 0; y < y1; y++)
+  int d = (start - origin) % (int)size; //position in the pattern
+  if(d < 0) d += size;
+  
+  for(size_t i = 0; i < n; i++)
   {
-    for(int x = x0, tx = 0; x < x1; x++)
+    //16.16 fixed point texture position of the center of the pixel, computed per pixel instead of
+    //by adding a rounded step, so that the rounding errors don't add up (done with double: exact for these values)
+    int pos = (int)std::floor(((2.0 * d + 1.0) * texsize * 65536.0) / (2.0 * size)) - (smooth ? 32768 : 0);
+    int t = pos < 0 ? -1 : (pos >> 16);
+    int f = smooth ? ((pos & 65535) >> 8) : 0;
+    if(t < 0)
     {
-      int bufferpos = 4 * (y * w + x);
-      int tbufferpos = 4 * (ty * texture->getU2() + tx);
-      
+      //left of the center of the first texel: between the last and first texel if repeating, else clamped
+      if(repeat) t = texsize - 1;
+      else { t = 0; f = 0; }
+    }
+    else if(t >= (int)texsize - 1)
+    {
+      t = texsize - 1;
+      if(!repeat) f = 0;
+    }
+    texel[i] = t;
+    weight[i] = f;
+    
+    d++;
+    if(d == (int)size) d = 0;
+  }
+}
 
-      blend(buffer, bufferpos, tb, tbufferpos, colorMod, texture_alpha_as_opacity, color_alpha_as_opacity, extra_opacity);
+/*
+For a texture that is drawn smaller than the part u0-u1, v0-v1 of it: the smallest mipmap level in
+which the part is still at least sizex * sizey, so that the filtering skips no texels. The part
+must start and end at texels of the level (or end at the end of the texture). Changes the part
+and tu2 to those of the level and returns the buffer of the level at the start of the part.
+*/
+static const unsigned char* selectMipmap(const TextureBuffer* texture, int& u0, int& v0, size_t& tu, size_t& tv, size_t& tu2
+                                       , size_t sizex, size_t sizey)
+{
+  int u1 = u0 + tu;
+  int v1 = v0 + tv;
+  size_t level = 0;
+  size_t levels = texture->getNumMipmapLevels();
+  while(level + 1 < levels)
+  {
+    size_t l = level + 1;
+    int s = 1 << l;
+    if((tu >> l) < sizex || (tv >> l) < sizey) break;
+    if(u0 % s || v0 % s || (u1 % s && u1 != (int)texture->getU()) || (v1 % s && v1 != (int)texture->getV())) break;
+    level = l;
+  }
+  if(level == 0) return texture->getBuffer() + 4 * (v0 * tu2 + u0);
+  
+  size_t lu, lv;
+  const unsigned char* b = texture->getMipmap(level, lu, lv);
+  int s = 1 << level;
+  u0 /= s;
+  v0 /= s;
+  u1 = (u1 + s - 1) / s;
+  v1 = (v1 + s - 1) / s;
+  tu = u1 - u0;
+  tv = v1 - v0;
+  tu2 = lu;
+  return b + 4 * (v0 * lu + u0);
+}
 
-      tx++;
-      if(tx >= (int)texture->getU()) tx = 0;
+void ADrawer2DBuffer::drawTextureScaled(const ITexture* texture, int u0, int v0, int u1, int v1, int x0, int y0, int x1, int y1
+                                      , int px, int py, size_t sizex, size_t sizey, bool repeat, const ColorRGB& colorMod)
+{
+  //the part of the texture is used as if it's the whole texture
+  size_t tu = u1 - u0;
+  size_t tv = v1 - v0;
+  const ITexture* original = texture;
+  int ox, oy;
+  texture = getAtlasPage(texture, ox, oy);
+  u0 += ox;
+  v0 += oy;
+  size_t tu2 = texture->getU2();
+  if(sizex == 0 || sizey == 0 || tu == 0 || tv == 0) return;
+  
+  lpi::clipRect(x0, y0, x1, y1, x0, y0, x1, y1, clip.x0, clip.y0, clip.x1, clip.y1);
+  if(x0 >= x1 || y0 >= y1) return;
+  size_t n = x1 - x0;
+  
+  //scaled down: use a mipmap if the texture has them (not for atlas pages, their levels mix the neighbouring textures)
+  const unsigned char* tb;
+  const TextureBuffer* mipmapped = texture == original ? dynamic_cast<const TextureBuffer*>(texture) : 0;
+  if(mipmapped && mipmapped->getUseMipmaps() && sizex < tu && sizey < tv) tb = selectMipmap(mipmapped, u0, v0, tu, tv, tu2, sizex, sizey);
+  else tb = texture->getBuffer() + 4 * (v0 * tu2 + u0);
+  
+  std::vector<int>& columns = scalecolumns;
+  std::vector<int>& fx = scaleweightsx;
+  std::vector<int>& rows = scalerows;
+  std::vector<int>& fy = scaleweightsy;
+  computeSamples(columns, fx, x0, n, px, sizex, tu, smoothing, repeat);
+  computeSamples(rows, fy, y0, y1 - y0, py, sizey, tv, smoothing, repeat);
+  
+  BlendMode mode(colorMod, texture_alpha_as_opacity, color_alpha_as_opacity, extra_opacity, premultiplied);
+  TextureBlender blend(texture, mode);
+  
+  std::vector<unsigned char>& line = scaleline; //one row of the scaled texture, before blending
+  line.resize(4 * n);
+  Target target = getTarget();
+  
+  if(smoothing)
+  {
+    std::vector<unsigned short>& weights = scaleweights;
+    weights.resize(8 * n);
+    for(size_t i = 0; i < n; i++)
+    for(size_t c = 0; c < 4; c++)
+    {
+      weights[8 * i + c] = 256 - fx[i];
+      weights[8 * i + 4 + c] = fx[i];
+    }
+    
+    //only the texels between these columns are used
+    size_t cmin = *std::min_element(columns.begin(), columns.end());
+    size_t cmax = *std::max_element(columns.begin(), columns.end()) + 1;
+    if(cmax > tu - 1) cmax = tu - 1;
+    
+    std::vector<unsigned char>& lerped = scalelerped; //the vertical interpolation of two rows, plus the neighbour of the last texel
+    lerped.resize(4 * (tu + 1));
+    for(int y = y0; y < y1; y++)
+    {
+      int j = y - y0;
+      if(j == 0 || rows[j] != rows[j - 1] || fy[j] != fy[j - 1])
+      {
+        size_t next = rows[j] + 1 < (int)tv ? rows[j] + 1 : (repeat ? 0 : rows[j]);
+        const unsigned char* r0 = &tb[4 * tu2 * rows[j]];
+        const unsigned char* r1 = &tb[4 * tu2 * next];
+        lerpRows(&lerped[4 * cmin], r0 + 4 * cmin, r1 + 4 * cmin, cmax + 1 - cmin, fy[j]);
+        if(repeat) lerpRows(&lerped[4 * tu], r0, r1, 1, fy[j]);
+        else std::memcpy(&lerped[4 * tu], &lerped[4 * (tu - 1)], 4);
+        gatherBilinear(&line[0], &lerped[0], &columns[0], &weights[0], n);
+      }
+      blend(PixelSpan(target, x0, y, n).rgba, &line[0], n);
+    }
+  }
+  else
+  {
+    for(int y = y0; y < y1; y++)
+    {
+      int j = y - y0;
+      if(j == 0 || rows[j] != rows[j - 1]) gatherNearest(&line[0], &tb[4 * tu2 * rows[j]], &columns[0], n);
+      blend(PixelSpan(target, x0, y, n).rgba, &line[0], n);
     }
-    ty++;
-    if(ty >= (int)texture->getV()) ty = 0;
   }
 }
 
-void ADrawer2DBuffer::drawTextureSizedRepeated(const ITexture* texture, int x0, int y0, int x1, int y1, size_t sizex, size_t sizey, const ColorRGB& colorMod)
+void ADrawer2DBuffer::drawTextureRepeated(const ITexture* texture, int x0, int y0, int x1, int y1, const ColorRGB& colorMod)
 {
-  (void)sizex; (void)sizey; //TODO: use the size!!!
+  if(useRegionLoop(false))
+  {
+    for(RegionLoop r(*this, x0, y0, x1, y1); r.next();) drawTextureRepeated(texture, x0, y0, x1, y1, colorMod);
+    return;
+  }
   
+  addDamage(x0, y0, x1, y1);
+  
+  if(recording)
+  {
+    DrawCommand& c = deferred->add(*this, DC_TEXTURE_REPEATED);
+    c.setPoints(x0, y0, x1, y1);
+    c.setColors(colorMod);
+    c.texture = texture;
+    prepareTextureForThreads(texture);
+    return;
+  }
+  
+  //the pattern starts at the corner of the rectangle, also if that corner is clipped away
+  int px = x0;
+  int py = y0;
   lpi::clipRect(x0, y0, x1, y1, x0, y0, x1, y1, clip.x0, clip.y0, clip.x1, clip.y1);
+  if(x0 >= x1 || y0 >= y1 || texture->getU() == 0 || texture->getV() == 0) return;
 
-  const unsigned char* tb = texture->getBuffer();
-
+  size_t tu = texture->getU();
+  size_t tv = texture->getV();
+  int ox, oy;
+  texture = getAtlasPage(texture, ox, oy);
+  size_t tu2 = texture->getU2();
+  const unsigned char* tb = texture->getBuffer() + 4 * (oy * tu2 + ox);
+  
+  BlendMode mode(colorMod, texture_alpha_as_opacity, color_alpha_as_opacity, extra_opacity, premultiplied);
+  TextureBlender blend(texture, mode);
+    
+  size_t tx = (x0 - px) % tu;
+  Target target = getTarget();
+  size_t ty = (y0 - py) % tv;
+  for(int y = y0; y < y1; y++)
+  {
+    blendRepeatedRow(PixelSpan(target, x0, y, x1 - x0).rgba, &tb[4 * ty * tu2], oy + ty, ox, tu, tx, x1 - x0, blend);
+    ty++;
+    if(ty >= tv) ty = 0;
+  }
+}
 
-  for(int y = y0, ty = 0; y < y1; y++)
+void ADrawer2DBuffer::drawTextureSizedRepeated(const ITexture* texture, int x0, int y0, int x1, int y1, size_t sizex, size_t sizey, const ColorRGB& colorMod)
+{
+  if(useRegionLoop(false))
   {
-    for(int x = x0, tx = 0; x < x1; x++)
-    {
-      int bufferpos = 4 * (y * w + x);
-      int tbufferpos = 4 * (ty * texture->getU2() + tx);
-      
-      blend(buffer, bufferpos, tb, tbufferpos, colorMod, texture_alpha_as_opacity, color_alpha_as_opacity, extra_opacity);
+    for(RegionLoop r(*this, x0, y0, x1, y1); r.next();) drawTextureSizedRepeated(texture, x0, y0, x1, y1, sizex, sizey, colorMod);
+    return;
+  }
+  
+  addDamage(x0, y0, x1, y1);
+  
+  if(recording)
+  {
+    DrawCommand& c = deferred->add(*this, DC_TEXTURE_SIZED_REPEATED);
+    c.setPoints(x0, y0, x1, y1);
+    c.setColors(colorMod);
+    c.texture = texture;
+    prepareTextureForThreads(texture);
+    c.sizex = sizex;
+    c.sizey = sizey;
+    return;
+  }
   
+  if(sizex == texture->getU() && sizey == texture->getV()) drawTextureRepeated(texture, x0, y0, x1, y1, colorMod);
+  else drawTextureScaled(texture, 0, 0, texture->getU(), texture->getV(), x0, y0, x1, y1, x0, y0, sizex, sizey, true, colorMod);
+}
 
-      tx++;
-      if(tx >= (int)texture->getU()) tx = 0;
+void ADrawer2DBuffer::drawTextures(const SpriteInstance* sprites, size_t n)
+{
+  sprites = resolveAtlasSprites(atlassprites, sprites, n);
+  
+  if(useRegionLoop(false))
+  {
+    for(RegionLoop r(*this, clip.x0, clip.y0, clip.x1, clip.y1); r.next();) drawTextures(sprites, n);
+    return;
+  }
+  
+  sortSpritesByTexture(spriteorder, sprites, n);
+  
+  //the clip area and the settings are the same for the whole batch
+  const int cx0 = clip.x0, cy0 = clip.y0, cx1 = clip.x1, cy1 = clip.y1;
+  TextureBlender blend;
+  const ITexture* blendtexture = 0; //the texture and colorMod blend was set for
+  ColorRGB blendcolor;
+  Target target = getTarget();
+  
+  for(size_t i = 0; i < n; i++)
+  {
+    const SpriteInstance& s = sprites[spriteorder[i]];
+    const ITexture* texture = s.texture;
+    if(!texture || s.sizex == 0 || s.sizey == 0) continue;
+    if(s.u0 < 0 || s.v0 < 0 || s.u1 > (int)texture->getU() || s.v1 > (int)texture->getV() || s.u0 >= s.u1 || s.v0 >= s.v1) continue;
+    
+    addDamage(s.x, s.y, s.x + s.sizex, s.y + s.sizey);
+    
+    if(recording)
+    {
+      DrawCommand& c = deferred->add(*this, DC_SPRITE);
+      c.setPoints(s.x, s.y, s.x + s.sizex - 1, s.y + s.sizey - 1);
+      c.first = deferred->sprites.size();
+      deferred->sprites.push_back(s);
+      prepareTextureForThreads(texture);
+      continue;
+    }
+    
+    if(s.sizex != (size_t)(s.u1 - s.u0) || s.sizey != (size_t)(s.v1 - s.v0))
+    {
+      drawTextureScaled(texture, s.u0, s.v0, s.u1, s.v1, s.x, s.y, s.x + s.sizex, s.y + s.sizey, s.x, s.y, s.sizex, s.sizey, false, s.colorMod);
+      continue;
+    }
+    
+    int x0 = std::max(s.x, cx0);
+    int y0 = std::max(s.y, cy0);
+    int x1 = std::min(s.x + (int)s.sizex, cx1);
+    int y1 = std::min(s.y + (int)s.sizey, cy1);
+    if(x0 >= x1 || y0 >= y1) continue;
+    
+    if(texture != blendtexture || s.colorMod != blendcolor)
+    {
+      blend.set(texture, BlendMode(s.colorMod, texture_alpha_as_opacity, color_alpha_as_opacity, extra_opacity, premultiplied));
+      blendtexture = texture;
+      blendcolor = s.colorMod;
+    }
+    
+    const unsigned char* tb = texture->getBuffer();
+    size_t tu2 = texture->getU2();
+    for(int y = y0; y < y1; y++)
+    {
+      int ty = s.v0 + y - s.y;
+      int tx = s.u0 + x0 - s.x;
+      blend.blendRow(PixelSpan(target, x0, y, x1 - x0).rgba, &tb[4 * (ty * tu2 + tx)], ty, tx, tx + x1 - x0);
     }
-    ty++;
-    if(ty >= (int)texture->getV()) ty = 0;
   }
 }
 
 void ADrawer2DBuffer::drawTextureGradient(const ITexture* texture, int x, int y
                                         , const ColorRGB& color00, const ColorRGB& color01, const ColorRGB& color10, const ColorRGB& color11)
 {
-  drawTexture(texture, x, y, (color00+color01+color10+color11)/4);
+  if(color00 == color01 && color00 == color10 && color00 == color11) drawTexture(texture, x, y, color00);
+  else drawTextureRepeatedGradient(texture, x, y, x + texture->getU(), y + texture->getV(), color00, color01, color10, color11);
 }
 
+/*
+The colors are interpolated bilinearly over the rectangle (color10 is the top right corner, color01 the
+bottom left one) and the texture pixels are multiplied with them, like with the colorMod of drawTexture.
+The alpha of the colors is only used if the color alpha is used as opacity.
+*/
 void ADrawer2DBuffer::drawTextureRepeatedGradient(const ITexture* texture, int x0, int y0, int x1, int y1
                                                 , const ColorRGB& color00, const ColorRGB& color01, const ColorRGB& color10, const ColorRGB& color11)
 {
-  drawTextureRepeated(texture, x0, y0, x1, y1, (color00+color01+color10+color11)/4);
+  if(color00 == color01 && color00 == color10 && color00 == color11)
+  {
+    drawTextureRepeated(texture, x0, y0, x1, y1, color00);
+    return;
+  }
+  
+  if(useRegionLoop(false))
+  {
+    for(RegionLoop r(*this, x0, y0, x1, y1); r.next();) drawTextureRepeatedGradient(texture, x0, y0, x1, y1, color00, color01, color10, color11);
+    return;
+  }
+  
+  addDamage(x0, y0, x1, y1);
+  
+  if(recording)
+  {
+    DrawCommand& c = deferred->add(*this, DC_TEXTURE_REPEATED_GRADIENT);
+    c.setPoints(x0, y0, x1, y1);
+    c.setColors(color00, color01, color10, color11);
+    c.texture = texture;
+    prepareTextureForThreads(texture);
+    return;
+  }
+  
+  //the pattern and the gradient start at the corner of the rectangle, also if that corner is clipped away
+  int px = x0;
+  int py = y0;
+  ColorRGB c00 = color00, c01 = color01, c10 = color10, c11 = color11;
+  if(!color_alpha_as_opacity) c00.a = c01.a = c10.a = c11.a = 255;
+  BilinearGradient gradient(x0, y0, x1, y1, c00, c10, c01, c11);
+  lpi::clipRect(x0, y0, x1, y1, x0, y0, x1, y1, clip.x0, clip.y0, clip.x1, clip.y1);
+  if(x0 >= x1 || y0 >= y1 || texture->getU() == 0 || texture->getV() == 0) return;
+  
+  size_t tu = texture->getU();
+  size_t tv = texture->getV();
+  int ox, oy;
+  texture = getAtlasPage(texture, ox, oy);
+  size_t tu2 = texture->getU2();
+  const unsigned char* tb = texture->getBuffer() + 4 * (oy * tu2 + ox);
+  
+  //the texture is converted to the format of the buffer before multiplying it with the colors
+  const TextureBuffer* t = dynamic_cast<const TextureBuffer*>(texture);
+  void (*convert)(unsigned char* out, const unsigned char* in, size_t n) = 0;
+  if(t && !t->isOpaque() && t->isPremultiplied() != premultiplied) convert = premultiplied ? premultiplySpan : unpremultiplySpan;
+  
+  BlendMode mode(RGB_White, texture_alpha_as_opacity, color_alpha_as_opacity, extra_opacity, premultiplied);
+  BlendSpanFunc blend = getBlendSpanFunc(mode);
+  size_t n = x1 - x0;
+  gradientline.resize(8 * n);
+  unsigned char* colors = &gradientline[0];
+  unsigned char* pixels = &gradientline[4 * n];
+  
+  Target target = getTarget();
+  size_t ty = (y0 - py) % tv;
+  for(int y = y0; y < y1; y++)
+  {
+    const unsigned char* row = &tb[4 * ty * tu2];
+    for(size_t i = 0, tx = (x0 - px) % tu; i < n;)
+    {
+      size_t amount = std::min(tu - tx, n - i);
+      std::memcpy(pixels + 4 * i, row + 4 * tx, 4 * amount);
+      i += amount;
+      tx = 0;
+    }
+    if(convert) convert(pixels, pixels, n);
+    gradient.fill(colors, x0, y, n);
+    if(premultiplied) premultiplySpan(colors, colors, n);
+    modulateSpan(pixels, pixels, colors, n);
+    blend(PixelSpan(target, x0, y, n).rgba, pixels, n, mode);
+    ty++;
+    if(ty >= tv) ty = 0;
+  }
 }
 
 
@@ -20,8 +20,12 @@ along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licens
 
 #pragma once
 
+#include "lpi_blend.h"
+#include "lpi_region.h"
 #include "lpi_draw2d.h"
+#include "lpi_scanline.h"
 
+#include <cstring>
 #include <vector>
 
 namespace lpi
@@ -45,6 +49,22 @@ class ADrawer2DBuffer : public ADrawer2D //draws on a buffer
     bool texture_alpha_as_opacity;
     bool color_alpha_as_opacity;
     double extra_opacity;
+    bool smoothing;
+    bool antialiasing;
+    bool premultiplied;
+    double linewidth;
+    LineJoin linejoin;
+    LineCap linecap;
+    
+    ScanlineRasterizer rasterizer; //for the filled shapes, kept to reuse its memory
+    std::vector<double> polyline; //for the curves and stroked borders, kept to reuse its memory
+    std::vector<size_t> spriteorder; //for drawTextures, kept to reuse its memory
+    std::vector<SpriteInstance> atlassprites; //for drawTextures with AtlasTextures, kept to reuse its memory
+    std::vector<unsigned char> gradientline; //for the gradient rectangles and textures, kept to reuse its memory
+    //for drawTextureScaled, kept to reuse their memory: the texel and weight of every column and row, the filter weights and rows
+    std::vector<int> scalecolumns, scaleweightsx, scalerows, scaleweightsy;
+    std::vector<unsigned short> scaleweights;
+    std::vector<unsigned char> scaleline, scalelerped;
 
   public:
     
@@ -76,12 +96,80 @@ class ADrawer2DBuffer : public ADrawer2D //draws on a buffer
       }
     };
     
+    typedef void (*PixelConvertFunc)(unsigned char* out, const unsigned char* in, size_t n);
+    
+    /*
+    The buffer with its pixel format, as the drawing functions get it. They blend into RGBA spans of it,
+    with another pixel format than RGBA every span is converted into row before and back after blending.
+    */
+    struct Target
+    {
+      unsigned char* buffer;
+      int w;
+      size_t pixelbytes;
+      PixelConvertFunc load; //0 if the buffer is RGBA
+      PixelConvertFunc store;
+      std::vector<unsigned char>* row;
+    };
+    
   protected:
     
     //current clip area
     Clip clip;
     //clip stack
     std::vector<Clip> clipstack;
+    /*
+    The regions of pushScissorRegion, intersected with the clip area that was active, the last one
+    is used. regionmarks has the size of clipstack after each pushScissorRegion, so that popScissor
+    knows which pushes were regions.
+    */
+    std::vector<ClipRegion> regions;
+    std::vector<size_t> regionmarks;
+    const ClipRegion* region; //the active region, 0 if there's none or it's only the rectangle clip
+    bool inregion; //true while a call is drawn rectangle by rectangle of the region
+    
+    //the rectangles that were drawn on since the last frameStart or clearDamage, see getDamage
+    std::vector<Clip> damage;
+    bool track_damage;
+    
+    void addDamage(int x0, int y0, int x1, int y1); //end coordinates not inclusive, clipped to the current scissor
+    
+    /*
+    draws the part (u0, v0)-(u1, v1) of the texture scaled to sizex * sizey, in the rectangle (x0, y0)-(x1, y1).
+    The part starts at (px, py). If repeat is true it's repeated over the whole rectangle, otherwise it's drawn once.
+    */
+    void drawTextureScaled(const ITexture* texture, int u0, int v0, int u1, int v1, int x0, int y0, int x1, int y1
+                         , int px, int py, size_t sizex, size_t sizey, bool repeat, const ColorRGB& colorMod);
+    
+    void fillRasterizer(ISpanFiller& filler); //fills the shapes added to the rasterizer inside the clip area, and clears it
+    BlendMode getFillMode() const; //how the filled shapes are blended: with the color alpha as opacity or not, and the extra opacity
+    void stroke(const double* xy, size_t numpoints, bool closed, const ColorRGB& color); //a line with the line width, join and cap along the polyline
+    int getStrokeMargin() const; //how far outside the coordinates of a line its pixels can be
+    
+    /*
+    With a clip region, the calls are drawn once for every rectangle of the region, with that as the
+    clip area, except the ones that are only filled through fillRasterizer (rasterized), those cut
+    their spans to the region instead. In deferred mode every rectangle gets its own command.
+    */
+    bool useRegionLoop(bool rasterized) const { return region && !inregion && (recording || !rasterized); }
+    
+  private:
+  
+    struct RegionLoop; //sets the clip area to each rectangle of the region in turn
+    struct Deferred; //the recorded commands and the threads of the deferred mode, see setDeferred
+    Deferred* deferred;
+    bool recording; //true between frameStart and frameEnd if deferred mode is enabled
+    
+    //the pixel format of the buffer if it's not RGBA, see Drawer2DBufferFormat
+    size_t pixelbytes;
+    PixelConvertFunc pixelload; //0 if the buffer is RGBA
+    PixelConvertFunc pixelstore;
+    std::vector<unsigned char> pixelrow; //the RGBA copy of the span that is drawn, with another pixel format
+    
+    Target getTarget();
+    
+    ADrawer2DBuffer(const ADrawer2DBuffer&); //not copyable
+    ADrawer2DBuffer& operator=(const ADrawer2DBuffer&);
     
   protected:
   
@@ -94,15 +182,19 @@ class ADrawer2DBuffer : public ADrawer2D //draws on a buffer
       clip.y0 = 0;
       clip.x1 = w;
       clip.y1 = h;
+      damage.clear();
     }
     
     ADrawer2DBuffer();
     virtual ~ADrawer2DBuffer();
     
+    //for buffers that aren't RGBA: the size of a pixel, and the conversion of spans from and to RGBA
+    void setPixelFormat(size_t bytes, PixelConvertFunc load, PixelConvertFunc store);
+    
   public:
   
-    virtual void frameStart(){};
-    virtual void frameEnd(){};
+    virtual void frameStart();
+    virtual void frameEnd();
 
     virtual size_t getWidth() = 0;
     virtual size_t getHeight() = 0;
@@ -110,6 +202,11 @@ class ADrawer2DBuffer : public ADrawer2D //draws on a buffer
     virtual void pushScissor(int x0, int y0, int x1, int y1);
     virtual void pushSmallestScissor(int x0, int y0, int x1, int y1); //the result will be smaller than the given coordinates and the last active scissor
     virtual void popScissor(); //pops the last set scissor, bringing the previous one back (it works like a stack, "set" pushes, "reset" pops)
+    /*
+    Limits drawing to the region, intersected with the active scissor. The scissors pushed after it
+    stay limited to the region too, until it's popped with popScissor.
+    */
+    virtual void pushScissorRegion(const ClipRegion& region);
     
     virtual void drawPoint(int x, int y, const ColorRGB& color);
     virtual void drawLine(int x0, int y0, int x1, int y1, const ColorRGB& color);
@@ -120,6 +217,7 @@ class ADrawer2DBuffer : public ADrawer2D //draws on a buffer
     virtual void drawQuad(int x0, int y0, int x1, int y1, int x2, int y2, int x3, int y3, const ColorRGB& color, bool filled);
     virtual void drawCircle(int x, int y, int radius, const ColorRGB& color, bool filled);
     virtual void drawEllipseCentered(int x, int y, int radiusx, int radiusy, const ColorRGB& color, bool filled);
+    virtual void drawPolygon(const int* xy, size_t numpoints, const ColorRGB& color, bool filled);
     
     virtual void drawGradientRectangle(int x0, int y0, int x1, int y1, const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2, const ColorRGB& color3);
     virtual void drawGradientTriangle(int x0, int y0, int x1, int y1, int x2, int y2, const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2);
@@ -137,6 +235,7 @@ class ADrawer2DBuffer : public ADrawer2D //draws on a buffer
                                    , const ColorRGB& color00, const ColorRGB& color01, const ColorRGB& color10, const ColorRGB& color11);
     virtual void drawTextureRepeatedGradient(const ITexture* texture, int x0, int y0, int x1, int y1
                                            , const ColorRGB& color00, const ColorRGB& color01, const ColorRGB& color10, const ColorRGB& color11);
+    virtual void drawTextures(const SpriteInstance* sprites, size_t n);
 
     /*
     This sets whether you want the alpha channel of textures to be treated as opacity when drawing, or as literal.
@@ -150,6 +249,67 @@ class ADrawer2DBuffer : public ADrawer2D //draws on a buffer
     Works only for a few things, currently only for the texture drawing, rest is to do
     */
     void setExtraOpacity(double opacity);
+    
+    /*
+    Filtering of textures drawn with another size than their own (drawTextureSized and
+    drawTextureSizedRepeated): nearest neighbour if false (the default), bilinear if true.
+    This is the same as ScreenGL::enableSmoothing does for the OpenGL drawer.
+    */
+    void setSmoothing(bool set);
+    
+    /*
+    Anti-aliasing of the filled shapes (triangles, quads, polygons, circles and ellipses):
+    pixels on the border get the color with an opacity depending on how much of the pixel
+    is covered. Off by default.
+    */
+    void setAntiAliasing(bool set);
+    
+    /*
+    Lines, Bezier curves and the borders of the shapes that aren't filled: width in pixels (1 by default),
+    the join where two lines of a border or curve meet and the ends of lines (LJ_MITER and LC_BUTT by default).
+    Lines with width 1 are drawn with Bresenham's algorithm, or with anti-aliasing with Wu's algorithm
+    (curves and polygons as shapes, so that the joins aren't drawn twice), join and cap don't matter then.
+    Other widths are filled as shapes along the line, also anti-aliased if enabled.
+    */
+    void setLineWidth(double width);
+    void setLineJoin(LineJoin join);
+    void setLineCap(LineCap cap);
+    
+    /*
+    Premultiplied alpha: the buffer has the color channels multiplied with the alpha channel, off by
+    default. Blending over a premultiplied buffer is cheaper, and correct for translucent destination
+    pixels too. Textures that are TextureBuffers with the same setting are blended directly, others are
+    converted per drawn row, so load the textures with the format of the drawer (createTexture does that).
+    The colors given to the drawing functions always have straight alpha.
+    */
+    void setPremultipliedAlpha(bool set);
+    bool isPremultipliedAlpha() const { return premultiplied; }
+    
+    /*
+    Deferred mode: when enabled, the drawing commands given between frameStart and frameEnd
+    aren't drawn immediately, but recorded. frameEnd then divides the buffer in tiles of
+    tilesize * tilesize pixels, and draws the tiles in parallel with numthreads threads
+    (0 means one per processor). In every tile, the commands are drawn in the order they
+    were given, with the scissor and settings that were active at the time of the call,
+    so the result is the same as drawing immediately.
+    Until frameEnd, the contents of the buffer aren't updated yet, and the textures given
+    to the draw calls must stay alive and unchanged.
+    */
+    void setDeferred(bool enabled, size_t numthreads = 0, int tilesize = 64);
+    bool isDeferred() const { return deferred != 0; }
+    
+    /*
+    Damage region: the rectangles of the buffer that were drawn on since the last frameStart
+    or clearDamage, clipped to the scissor that was active. Use this to upload or present only
+    the part of the buffer that changed. Rectangles that overlap or touch are merged if that
+    doesn't add much area, and the amount of rectangles is kept small by merging them, so
+    a rectangle can contain some pixels that didn't change.
+    The rectangles are tracked per drawing call, so also in deferred mode, where they are
+    known before frameEnd draws them.
+    */
+    const std::vector<Clip>& getDamage() const { return damage; }
+    void clearDamage() { damage.clear(); }
+    void setTrackDamage(bool track) { track_damage = track; if(!track) damage.clear(); }
 
 };
 
@@ -168,6 +328,75 @@ class Drawer2DBuffer : public ADrawer2DBuffer
 };
 
 
+/*
+Pixel format policies for Drawer2DBufferFormat: the size of a pixel in bytes and the conversion
+of spans of pixels from and to RGBA (see the conversion functions in lpi_blend.h).
+*/
+struct PixelRGBA8888
+{
+  enum { BYTES = 4, NATIVE = 1 }; //the format the drawer works with, nothing to convert
+  static void load(unsigned char* rgba, const unsigned char* in, size_t n) { std::memcpy(rgba, in, 4 * n); }
+  static void store(unsigned char* out, const unsigned char* rgba, size_t n) { std::memcpy(out, rgba, 4 * n); }
+};
+
+struct PixelBGRA8888
+{
+  enum { BYTES = 4, NATIVE = 0 };
+  static void load(unsigned char* rgba, const unsigned char* in, size_t n) { swapRedBlue(rgba, in, n); }
+  static void store(unsigned char* out, const unsigned char* rgba, size_t n) { swapRedBlue(out, rgba, n); }
+};
+
+struct PixelRGB565
+{
+  enum { BYTES = 2, NATIVE = 0 };
+  static void load(unsigned char* rgba, const unsigned char* in, size_t n) { loadRGB565(rgba, in, n); }
+  static void store(unsigned char* out, const unsigned char* rgba, size_t n) { storeRGB565(out, rgba, n); }
+};
+
+struct PixelGrey8
+{
+  enum { BYTES = 1, NATIVE = 0 };
+  static void load(unsigned char* rgba, const unsigned char* in, size_t n) { loadGrey8(rgba, in, n); }
+  static void store(unsigned char* out, const unsigned char* rgba, size_t n) { storeGrey8(out, rgba, n); }
+};
+
+struct PixelA8
+{
+  enum { BYTES = 1, NATIVE = 0 };
+  static void load(unsigned char* rgba, const unsigned char* in, size_t n) { loadA8(rgba, in, n); }
+  static void store(unsigned char* out, const unsigned char* rgba, size_t n) { storeA8(out, rgba, n); }
+};
+
+/*
+Drawer2DBufferFormat: a Drawer2DBuffer for a buffer with the pixel format of the policy Format, e.g.
+PixelBGRA8888 for an SDL surface or PixelRGB565 for a framebuffer, so that the buffer can be shown
+without converting it.
+The blending itself still works on RGBA: every span that is drawn is converted from the format to RGBA
+in a row of the drawer, blended, and converted back right away. So only the pixels that are drawn on are
+converted and there's no RGBA copy of the buffer, but every span costs a load and a store more than with
+an RGBA buffer (every pixel, for points and lines without anti-aliasing). With a format that has less
+precision than RGBA, the result of every call is rounded to it, as if the format was blended directly.
+Immediate and deferred mode work as for Drawer2DBuffer.
+*/
+template<typename Format>
+class Drawer2DBufferFormat : public ADrawer2DBuffer
+{
+  public:
+    Drawer2DBufferFormat()
+    {
+      if(!Format::NATIVE) setPixelFormat(Format::BYTES, Format::load, Format::store);
+    }
+    
+    virtual size_t getWidth() { return w; }
+    virtual size_t getHeight() { return h; }
+    
+    //the buffer has w * h pixels of Format::BYTES bytes
+    void setBuffer(unsigned char* buffer, size_t w, size_t h)
+    {
+      setBufferInternal(buffer, w, h);
+    }
+};
+
 /*
 Drawer2DTexture: is an Drawer2DBuffer that uses the buffer of a texture as buffer
 */
@@ -177,9 +406,10 @@ class Drawer2DTexture : public ADrawer2DBuffer
   
     size_t u;
     size_t v;
+    ITexture* texture;
   
   public:
-    Drawer2DTexture(){}
+    Drawer2DTexture() : texture(0) {}
     Drawer2DTexture(ITexture* texture){setTexture(texture);}
 
     
@@ -191,7 +421,17 @@ class Drawer2DTexture : public ADrawer2DBuffer
       setBufferInternal(texture->getBuffer(), texture->getU2(), texture->getV2());
       w = texture->getU2();
       h = texture->getV2();
+      this->texture = texture;
+      premultiplied = isPremultiplied(texture); //the format of the buffer is that of the texture
+      damage.clear();
     }
+    
+    /*
+    Lets the texture know which parts were drawn on, with updatePartial for every rectangle of the
+    damage region instead of updating the whole texture, and clears the damage region.
+    In deferred mode, call this after frameEnd.
+    */
+    void updateTexture();
 };
 
 } //end of namespace lpi
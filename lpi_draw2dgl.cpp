@@ -18,10 +18,13 @@ You should have received a copy of the GNU General Public License
 along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+
 #include "lpi_draw2dgl.h"
+#include "lpi_atlas.h"
 #include "lpi_draw2d.h"
 #include "lpi_texture_gl.h"
 
+#include <algorithm>
 #include <vector>
 #include <GL/gl.h>
 
@@ -30,12 +33,19 @@ namespace lpi
 
 Drawer2DGL::Drawer2DGL(ScreenGL* screen)
 : screen(screen)
+, batchmode(BATCH_TRIANGLES)
+, batchtexture(0)
+, batchpart(0)
+, batchsmoothing(false)
+, drawcalls(0)
 {
   //TextureFactoryGL factory(screen->getGLContext());
 }
 
 Drawer2DGL::~Drawer2DGL()
 {
+  //what's left in the batch is not drawn, the OpenGL context may be gone already
+  if(screen->getGLContext()->getBatch() == this) screen->getGLContext()->setBatch(0);
 }
 
 namespace
@@ -54,26 +64,125 @@ int numSegmentsHelper(double radius)
 
 void Drawer2DGL::prepareDrawUntextured(bool filledGeometry)
 {
+  GLContext* context = screen->getGLContext();
+  context->flush();
   screen->set2DScreen(filledGeometry);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  glEnable(GL_BLEND);
-  glDisable(GL_TEXTURE_2D);
+  context->getState().blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  context->getState().enable(GL_BLEND);
+  context->getState().disable(GL_TEXTURE_2D);
   //screen->setOpenGLScissor(); //everything that draws something must always do this //TODO: investigate this statement
 }
 
 void Drawer2DGL::prepareDrawTextured()
 {
+  GLContext* context = screen->getGLContext();
+  context->flush();
   screen->set2DScreen(true);
-  glEnable(GL_TEXTURE_2D);
+  context->getState().enable(GL_TEXTURE_2D);
   //screen->setOpenGLScissor(); //everything that draws something must always do this //TODO: investigate that statement
 }
 
-void Drawer2DGL::drawLineInternal(int x0, int y0, int x1, int y1) //doesn't call "prepareDraw", to be used by other things that draw multiple lines
+////////////////////////////////////////////////////////////////////////////////
+
+void Drawer2DGL::flush()
+{
+  if(batchvertices.empty()) return;
+  
+  //the batch is taken out of the GLContext first, the texture functions below flush it too
+  GLContext* context = screen->getGLContext();
+  context->setBatch(0);
+  GLState& state = context->getState();
+  
+  bool textured = batchtexture != 0;
+  screen->set2DScreen(batchmode == BATCH_TRIANGLES); //lines and points are offset for exact pixels
+  state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  state.enable(GL_BLEND);
+  if(textured)
+  {
+    state.activeTexture(0);
+    state.enable(GL_TEXTURE_2D);
+    batchtexture->bind(batchsmoothing, batchpart);
+  }
+  else state.disable(GL_TEXTURE_2D);
+  
+  glEnableClientState(GL_VERTEX_ARRAY);
+  glEnableClientState(GL_COLOR_ARRAY);
+  if(textured) glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+  glVertexPointer(2, GL_FLOAT, 0, &batchvertices[0]);
+  glColorPointer(4, GL_UNSIGNED_BYTE, 0, &batchcolors[0]);
+  if(textured) glTexCoordPointer(2, GL_FLOAT, 0, &batchtexcoords[0]);
+  
+  GLenum mode = batchmode == BATCH_POINTS ? GL_POINTS : batchmode == BATCH_LINES ? GL_LINES : GL_TRIANGLES;
+  glDrawArrays(mode, 0, batchvertices.size() / 2);
+  drawcalls++;
+  
+  if(textured) glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+  glDisableClientState(GL_COLOR_ARRAY);
+  glDisableClientState(GL_VERTEX_ARRAY);
+  state.invalidateColor();
+  
+  batchvertices.clear();
+  batchtexcoords.clear();
+  batchcolors.clear();
+}
+
+void Drawer2DGL::beginBatch(BatchMode mode, const TextureGL* texture, size_t part, bool smoothing)
+{
+  GLContext* context = screen->getGLContext();
+  if(context->getBatch() != this) context->flush(); //another drawer has draws held back, they go first
+  
+  if(mode != batchmode || texture != batchtexture || part != batchpart || smoothing != batchsmoothing) flush();
+  
+  batchmode = mode;
+  batchtexture = texture;
+  batchpart = part;
+  batchsmoothing = smoothing;
+  context->setBatch(this);
+}
+
+void Drawer2DGL::addVertex(float x, float y, const ColorRGB& color)
+{
+  batchvertices.push_back(x);
+  batchvertices.push_back(y);
+  batchcolors.push_back(color.r);
+  batchcolors.push_back(color.g);
+  batchcolors.push_back(color.b);
+  batchcolors.push_back(color.a);
+}
+
+void Drawer2DGL::addVertex(float x, float y, float s, float t, const ColorRGB& color)
+{
+  addVertex(x, y, color);
+  batchtexcoords.push_back(s);
+  batchtexcoords.push_back(t);
+}
+
+void Drawer2DGL::addQuad(const float* vertices, const float* texcoords, const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2, const ColorRGB& color3)
+{
+  //the same two triangles GL_QUADS is split in, so that gradients look the same as before
+  static const int order[6] = { 0, 1, 2, 0, 2, 3 };
+  const ColorRGB* colors[4] = { &color0, &color1, &color2, &color3 };
+  for(int i = 0; i < 6; i++)
+  {
+    int j = order[i];
+    if(texcoords) addVertex(vertices[j * 2], vertices[j * 2 + 1], texcoords[j * 2], texcoords[j * 2 + 1], *colors[j]);
+    else addVertex(vertices[j * 2], vertices[j * 2 + 1], *colors[j]);
+  }
+}
+
+void Drawer2DGL::addTexturedQuad(const TextureGL* texture, size_t part, bool smoothing
+                               , float x0, float y0, float x1, float y1, float s0, float t0, float s1, float t1, const ColorRGB& color)
+{
+  beginBatch(BATCH_TRIANGLES, texture, part, smoothing);
+  const float vertices[8] = { x0, y0, x1, y0, x1, y1, x0, y1 };
+  const float texcoords[8] = { s0, t0, s1, t0, s1, t1, s0, t1 };
+  addQuad(vertices, texcoords, color, color, color, color);
+}
+
+void Drawer2DGL::drawLineInternal(int x0, int y0, int x1, int y1, const ColorRGB& color)
 {
-  glBegin(GL_LINES);
-    glVertex2f(x0, y0);
-    glVertex2f(x1, y1);
-  glEnd();
+  addVertex(x0, y0, color);
+  addVertex(x1, y1, color);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -88,28 +197,22 @@ void Drawer2DGL::drawLineInternal(int x0, int y0, int x1, int y1) //doesn't call
 void Drawer2DGL::frameStart()
 {
   screen->setOpenGLScissor();
+  drawcalls = 0;
+  screen->getGLContext()->getState().resetStats();
 }
 
 void Drawer2DGL::frameEnd()
 {
+  flush();
 }
 
 
 //Draw a rectangle with 4 different corner colors on screen from (x1, y1) to (x2, y2). The end coordinates should NOT be included
 void Drawer2DGL::drawGradientRectangle(int x0, int y0, int x1, int y1, const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2, const ColorRGB& color3)
 {
-  prepareDrawUntextured(true);
-  
-  glBegin(GL_QUADS);
-    glColor4ub(color1.r, color1.g, color1.b, color1.a);
-    glVertex2f(x1, y0);
-    glColor4ub(color0.r, color0.g, color0.b, color0.a);
-    glVertex2f(x0, y0);
-    glColor4ub(color2.r, color2.g, color2.b, color2.a);
-    glVertex2f(x0, y1);
-    glColor4ub(color3.r, color3.g, color3.b, color3.a);
-    glVertex2f(x1, y1);
-  glEnd();
+  beginBatch(BATCH_TRIANGLES);
+  const float vertices[8] = { (float)x1, (float)y0, (float)x0, (float)y0, (float)x0, (float)y1, (float)x1, (float)y1 };
+  addQuad(vertices, 0, color1, color0, color2, color3);
 }
 
 void Drawer2DGL::drawGradientDisk(int x, int y, double radius, const ColorRGB& color1, const ColorRGB& color2)
@@ -117,21 +220,29 @@ void Drawer2DGL::drawGradientDisk(int x, int y, double radius, const ColorRGB& c
   static const double pi = 3.141592653589793238;
   static const size_t numsegments = numSegmentsHelper(radius);
   
-  prepareDrawUntextured(true);
+  beginBatch(BATCH_TRIANGLES);
   
-  glBegin(GL_TRIANGLE_FAN);
-    glColor4ub(color1.r, color1.g, color1.b, color1.a);
-    glVertex2f(x, y);
-    glColor4ub(color2.r, color2.g, color2.b, color2.a);
-    double angle = 0;
-    for(size_t i = 0; i < numsegments; i++)
+  //the triangle fan as separate triangles
+  float px = x + radius, py = y;
+  double angle = 0;
+  for(size_t i = 0; i <= numsegments; i++)
+  {
+    float qx = x + radius, qy = y;
+    if(i < numsegments)
     {
-      
-      glVertex2f(x + std::cos(angle) * radius, y + std::sin(angle) * radius);
+      qx = x + std::cos(angle) * radius;
+      qy = y + std::sin(angle) * radius;
       angle += 2 * pi / numsegments;
     }
-    glVertex2f(x + radius, y);
-  glEnd();
+    if(i > 0)
+    {
+      addVertex(x, y, color1);
+      addVertex(px, py, color2);
+      addVertex(qx, qy, color2);
+    }
+    px = qx;
+    py = qy;
+  }
 }
 
 void Drawer2DGL::drawGradientEllipse(int x, int y, double radiusx, double radiusy, const ColorRGB& color1, const ColorRGB& color2)
@@ -139,34 +250,37 @@ void Drawer2DGL::drawGradientEllipse(int x, int y, double radiusx, double radius
   static const double pi = 3.141592653589793238;
   static const size_t numsegments = 32;
   
-  prepareDrawUntextured(true);
+  beginBatch(BATCH_TRIANGLES);
   
-  glBegin(GL_TRIANGLE_FAN);
-    glColor4ub(color1.r, color1.g, color1.b, color1.a);
-    glVertex2f(x, y);
-    glColor4ub(color2.r, color2.g, color2.b, color2.a);
-    double angle = 0;
-    for(size_t i = 0; i < numsegments; i++)
+  //the triangle fan as separate triangles
+  float px = x + radiusx, py = y;
+  double angle = 0;
+  for(size_t i = 0; i <= numsegments; i++)
+  {
+    float qx = x + radiusx, qy = y;
+    if(i < numsegments)
     {
-      
-      glVertex2f(x + std::cos(angle) * radiusx, y + std::sin(angle) * radiusy);
+      qx = x + std::cos(angle) * radiusx;
+      qy = y + std::sin(angle) * radiusy;
       angle += 2 * pi / numsegments;
     }
-    glVertex2f(x + radiusx, y);
-  glEnd();
+    if(i > 0)
+    {
+      addVertex(x, y, color1);
+      addVertex(px, py, color2);
+      addVertex(qx, qy, color2);
+    }
+    px = qx;
+    py = qy;
+  }
 }
 
 //Draw a gradient line from (x1, y1) to (x2, y2)
 void Drawer2DGL::gradientLine(int x1, int y1, int x2, int y2, const ColorRGB& color1, const ColorRGB& color2)
 {
-  prepareDrawUntextured(false);
-
-  glBegin(GL_LINES);
-    glColor4ub(color1.r, color1.g, color1.b, color1.a);
-    glVertex2f(x1, screen->screenHeight() - y1);
-    glColor4ub(color2.r, color2.g, color2.b, color2.a);
-    glVertex2f(x2, screen->screenHeight() - y2);
-  glEnd();
+  beginBatch(BATCH_LINES);
+  addVertex(x1, screen->screenHeight() - y1, color1);
+  addVertex(x2, screen->screenHeight() - y2, color2);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -188,6 +302,7 @@ size_t Drawer2DGL::getHeight()
   return screen->screenHeight();
 }
 
+//the screen flushes the batch before it changes the scissor
 void Drawer2DGL::pushScissor(int x0, int y0, int x1, int y1)
 {
   screen->setScissor(x0, y0, x1, y1);
@@ -205,32 +320,26 @@ void Drawer2DGL::popScissor()
 
 void Drawer2DGL::drawPoint(int x, int y, const ColorRGB& color)
 {
-  prepareDrawUntextured(false);
-
-  glColor4ub(color.r, color.g, color.b, color.a);
-
-  glBegin(GL_POINTS);
-    glVertex2d(x + 0.375, y + 0.375);
-  glEnd();
+  beginBatch(BATCH_POINTS);
+  addVertex(x + 0.375, y + 0.375, color);
 }
 
 void Drawer2DGL::drawLine(int x0, int y0, int x1, int y1, const ColorRGB& color)
 {
-  prepareDrawUntextured(false);
-  glColor4ub(color.r, color.g, color.b, color.a);
-  
-  drawLineInternal(x0, y0, x1, y1);
+  beginBatch(BATCH_LINES);
+  drawLineInternal(x0, y0, x1, y1, color);
 }
 
 void Drawer2DGL::recursive_bezier(double x0, double y0, //endpoint
                                   double x1, double y1, //handle
                                   double x2, double y2, //handle
                                   double x3, double y3, //endpoint
+                                  const ColorRGB& color,
                                   int n) //extra recursion test for safety
 {
   if(bezier_nearly_flat(x0, y0, x1, y1, x2, y2, x3, y3) || n > 20)
   {
-    drawLineInternal((int)x0, (int)y0, (int)x3, (int)y3);
+    drawLineInternal((int)x0, (int)y0, (int)x3, (int)y3, color);
   }
   else
   {
@@ -247,90 +356,70 @@ void Drawer2DGL::recursive_bezier(double x0, double y0, //endpoint
     double x0123 = (x012 + x123) / 2;
     double y0123 = (y012 + y123) / 2;
     
-    recursive_bezier(x0, y0, x01, y01, x012, y012, x0123, y0123, n + 1); 
-    recursive_bezier(x0123, y0123, x123, y123, x23, y23, x3, y3, n + 1);
+    recursive_bezier(x0, y0, x01, y01, x012, y012, x0123, y0123, color, n + 1); 
+    recursive_bezier(x0123, y0123, x123, y123, x23, y23, x3, y3, color, n + 1);
   }
 }
 
 void Drawer2DGL::drawBezier(int x0, int y0, int x1, int y1, int x2, int y2, int x3, int y3, const ColorRGB& color)
 {
-  prepareDrawUntextured(false);
-  glColor4ub(color.r, color.g, color.b, color.a);
-  
-  recursive_bezier(x0, y0, x1, y1, x2, y2, x3, y3, 0);
+  beginBatch(BATCH_LINES);
+  recursive_bezier(x0, y0, x1, y1, x2, y2, x3, y3, color, 0);
 }
 
     
 void Drawer2DGL::drawRectangle(int x0, int y0, int x1, int y1, const ColorRGB& color, bool filled)
 {
-  prepareDrawUntextured(filled);
-  glColor4ub(color.r, color.g, color.b, color.a);
-
   if(filled)
   {
-    glBegin(GL_QUADS);
-      glVertex2f(x1, y0);
-      glVertex2f(x0, y0);
-      glVertex2f(x0, y1);
-      glVertex2f(x1, y1);
-    glEnd();
+    beginBatch(BATCH_TRIANGLES);
+    const float vertices[8] = { (float)x1, (float)y0, (float)x0, (float)y0, (float)x0, (float)y1, (float)x1, (float)y1 };
+    addQuad(vertices, 0, color, color, color, color);
   }
   else
   {
-    glBegin(GL_LINE_LOOP);
-      glVertex2f(x0, y0);
-      glVertex2f(x1 - 1, y0);
-      glVertex2f(x1 - 1, y1 - 1);
-      glVertex2f(x0, y1 - 1);
-    glEnd();
+    //the line loop as separate lines
+    beginBatch(BATCH_LINES);
+    drawLineInternal(x0, y0, x1 - 1, y0, color);
+    drawLineInternal(x1 - 1, y0, x1 - 1, y1 - 1, color);
+    drawLineInternal(x1 - 1, y1 - 1, x0, y1 - 1, color);
+    drawLineInternal(x0, y1 - 1, x0, y0, color);
   }
 }
 
 void Drawer2DGL::drawTriangle(int x0, int y0, int x1, int y1, int x2, int y2, const ColorRGB& color, bool filled)
 {
-  prepareDrawUntextured(filled);
-  glColor4ub(color.r, color.g, color.b, color.a);
-
   if(filled)
   {
-    glBegin(GL_TRIANGLES);
-      glVertex2f(x0, y0);
-      glVertex2f(x1, y1);
-      glVertex2f(x2, y2);
-    glEnd();
+    beginBatch(BATCH_TRIANGLES);
+    addVertex(x0, y0, color);
+    addVertex(x1, y1, color);
+    addVertex(x2, y2, color);
   }
   else
   {
-    glBegin(GL_LINE_LOOP);
-      glVertex2f(x0, y0);
-      glVertex2f(x1, y1);
-      glVertex2f(x2, y2);
-    glEnd();
+    beginBatch(BATCH_LINES);
+    drawLineInternal(x0, y0, x1, y1, color);
+    drawLineInternal(x1, y1, x2, y2, color);
+    drawLineInternal(x2, y2, x0, y0, color);
   }
 }
 
 void Drawer2DGL::drawQuad(int x0, int y0, int x1, int y1, int x2, int y2, int x3, int y3, const ColorRGB& color, bool filled)
 {
-  prepareDrawUntextured(filled);
-  glColor4ub(color.r, color.g, color.b, color.a);
-
   if(filled)
   {
-    glBegin(GL_QUADS);
-      glVertex2f(x0, y0);
-      glVertex2f(x1, y1);
-      glVertex2f(x2, y2);
-      glVertex2f(x3, y3);
-    glEnd();
+    beginBatch(BATCH_TRIANGLES);
+    const float vertices[8] = { (float)x0, (float)y0, (float)x1, (float)y1, (float)x2, (float)y2, (float)x3, (float)y3 };
+    addQuad(vertices, 0, color, color, color, color);
   }
   else
   {
-    glBegin(GL_LINE_LOOP);
-      glVertex2f(x0, y0);
-      glVertex2f(x1, y1);
-      glVertex2f(x2, y2);
-      glVertex2f(x3, y3);
-    glEnd();
+    beginBatch(BATCH_LINES);
+    drawLineInternal(x0, y0, x1, y1, color);
+    drawLineInternal(x1, y1, x2, y2, color);
+    drawLineInternal(x2, y2, x3, y3, color);
+    drawLineInternal(x3, y3, x0, y0, color);
   }
 }
 
@@ -344,70 +433,52 @@ void Drawer2DGL::drawEllipseCentered(int x, int y, int radiusx, int radiusy, con
   static const double pi = 3.141592653589793238;
   static const size_t numsegments = 64;
   
-  prepareDrawUntextured(filled);
-  glColor4ub(color.r, color.g, color.b, color.a);
-
-  if(filled)
-  {
-    glBegin(GL_TRIANGLE_FAN);
-      glVertex2f(x, y);
-      double angle = 0;
-      for(size_t i = 0; i < numsegments; i++)
-      {
-        glVertex2f(x + std::cos(angle) * radiusx, y + std::sin(angle) * radiusy);
-        angle += 2 * pi / numsegments;
-      }
-      glVertex2f(x + radiusx, y);
-    glEnd();
-  }
-  else
+  beginBatch(filled ? BATCH_TRIANGLES : BATCH_LINES);
+  
+  //the triangle fan or line strip as separate triangles or lines
+  float px = x + radiusx, py = y;
+  double angle = 0;
+  for(size_t i = 0; i <= numsegments; i++)
   {
-    glBegin(GL_LINE_STRIP);
-      double angle = 0;
-      for(size_t i = 0; i < numsegments; i++)
-      {
-        glVertex2f(x + std::cos(angle) * radiusx, y + std::sin(angle) * radiusy);
-        angle += 2 * pi / numsegments;
-      }
-      glVertex2f(x + radiusx, y);
-    glEnd();
+    float qx = x + radiusx, qy = y;
+    if(i < numsegments)
+    {
+      qx = x + std::cos(angle) * radiusx;
+      qy = y + std::sin(angle) * radiusy;
+      angle += 2 * pi / numsegments;
+    }
+    if(i > 0)
+    {
+      if(filled) addVertex(x, y, color);
+      addVertex(px, py, color);
+      addVertex(qx, qy, color);
+    }
+    px = qx;
+    py = qy;
   }
 }
 
 void Drawer2DGL::drawGradientTriangle(int x0, int y0, int x1, int y1, int x2, int y2, const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2)
 {
-  prepareDrawUntextured(true);
-  
-  glBegin(GL_TRIANGLES);
-    glColor4ub(color0.r, color0.g, color0.b, color0.a);
-    glVertex2f(x0, y0);
-    glColor4ub(color1.r, color1.g, color1.b, color1.a);
-    glVertex2f(x1, y1);
-    glColor4ub(color2.r, color2.g, color2.b, color2.a);
-    glVertex2f(x2, y2);
-  glEnd();
+  beginBatch(BATCH_TRIANGLES);
+  addVertex(x0, y0, color0);
+  addVertex(x1, y1, color1);
+  addVertex(x2, y2, color2);
 }
 
 
 void Drawer2DGL::drawGradientQuad(int x0, int y0, int x1, int y1, int x2, int y2, int x3, int y3, const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2, const ColorRGB& color3)
 {
-  prepareDrawUntextured(true);
-  
-  glBegin(GL_QUADS);
-    glColor4ub(color0.r, color0.g, color0.b, color0.a);
-    glVertex2f(x0, y0);
-    glColor4ub(color1.r, color1.g, color1.b, color1.a);
-    glVertex2f(x1, y1);
-    glColor4ub(color2.r, color2.g, color2.b, color2.a);
-    glVertex2f(x2, y2);
-    glColor4ub(color3.r, color3.g, color3.b, color3.a);
-    glVertex2f(x3, y3);
-  glEnd();
+  beginBatch(BATCH_TRIANGLES);
+  //starting at the second corner, the quad is cut along the same diagonal as the GL_QUADS it used to be
+  const float vertices[8] = { (float)x1, (float)y1, (float)x2, (float)y2, (float)x3, (float)y3, (float)x0, (float)y0 };
+  addQuad(vertices, 0, color1, color2, color3, color0);
 }
 
 bool Drawer2DGL::supportsTexture(ITexture* texture)
 {
-  return dynamic_cast<TextureGL*>(texture);
+  int x, y;
+  return dynamic_cast<const TextureGL*>(getAtlasPage(texture, x, y));
 }
 
 ITexture* Drawer2DGL::createTexture() const
@@ -435,33 +506,31 @@ void Drawer2DGL::drawTextureSized(const ITexture* texture, int x, int y, size_t
 {
   if(sizex == 0 || sizey == 0) return;
   
+  if(dynamic_cast<const AtlasTexture*>(texture))
+  {
+    SpriteInstance s(texture, x, y, colorMod);
+    s.setSize(sizex, sizey);
+    drawTextures(&s, 1);
+    return;
+  }
+  
   const TextureGL* texturegl = dynamic_cast<const TextureGL*>(texture);
   if(!texturegl) return;
 
-  prepareDrawTextured();
   texturegl->updateForNewOpenGLContextIfNeeded();
-  glColor4ub(colorMod.r, colorMod.g, colorMod.b, colorMod.a);
   
   if(texturegl->getNumParts() == 1)
   {
-    texturegl->bind(screen->isSmoothingEnabled(), 0);
-
-    double u3 = (double)texturegl->getU() / (double)texturegl->getU2();
-    double v3 = (double)texturegl->getV() / (double)texturegl->getV2();
+    float u3 = (double)texturegl->getU() / (double)texturegl->getU2();
+    float v3 = (double)texturegl->getV() / (double)texturegl->getV2();
 
     //note how in the texture coordinates x and y are swapped because the texture buffers are 90 degrees rotated
-    glBegin(GL_QUADS);
-      glTexCoord2d(0.0, 0.0); glVertex2f(x +          0, y +          0);
-      glTexCoord2d(+u3, 0.0); glVertex2f(x + (int)sizex, y +          0);
-      glTexCoord2d(+u3, +v3); glVertex2f(x + (int)sizex, y + (int)sizey);
-      glTexCoord2d(0.0, +v3); glVertex2f(x +          0, y + (int)sizey);
-    glEnd();
+    addTexturedQuad(texturegl, 0, screen->isSmoothingEnabled(), x, y, x + (int)sizex, y + (int)sizey, 0.0, 0.0, u3, v3, colorMod);
   }
   else
   {
     for(size_t i = 0; i < texturegl->getNumParts(); i++)
     {
-      texturegl->bind(screen->isSmoothingEnabled(), i);
       const TextureGL::Part& part = texturegl->getPart(i);
       double u3 = (double)part.u / part.u2;
       double v3 = (double)part.v / part.v2;
@@ -475,13 +544,7 @@ void Drawer2DGL::drawTextureSized(const ITexture* texture, int x, int y, size_t
       double psizey = sizey * ((double)part.v / (double)texture->getV());
 
       //note how in the texture coordinates x and y are swapped because the texture buffers are 90 degrees rotated
-      glBegin(GL_QUADS);
-        glTexCoord2d(0.0, 0.0); glVertex2d(px +      0, py +      0);
-        glTexCoord2d(+u3, 0.0); glVertex2d(px + psizex, py +      0);
-        glTexCoord2d(+u3, +v3); glVertex2d(px + psizex, py + psizey);
-        glTexCoord2d(0.0, +v3); glVertex2d(px +      0, py + psizey);
-      glEnd();
-
+      addTexturedQuad(texturegl, i, screen->isSmoothingEnabled(), px, py, px + psizex, py + psizey, 0.0, 0.0, u3, v3, colorMod);
     }
   }
 }
@@ -490,14 +553,16 @@ void Drawer2DGL::drawTextureRepeated(const ITexture* texture, int x0, int y0, in
 {
   if(x0 == x1 || y0 == y1) return;
   
+  if(const AtlasTexture* atlastexture = dynamic_cast<const AtlasTexture*>(texture))
+  {
+    drawAtlasTextureRepeated(atlastexture, x0, y0, x1, y1, texture->getU(), texture->getV(), colorMod, colorMod, colorMod, colorMod);
+    return;
+  }
+  
   const TextureGL* texturegl = dynamic_cast<const TextureGL*>(texture);
   if(!texturegl) return;
   
-  prepareDrawTextured();
   texturegl->updateForNewOpenGLContextIfNeeded();
-
-  glColor4ub(colorMod.r, colorMod.g, colorMod.b, colorMod.a);
-  texturegl->bind(screen->isSmoothingEnabled(), 0);
   
   bool simple = true;
   if(x1 - x0 > (int)texture->getU() && texture->getU() != texture->getU2()) simple = false;
@@ -506,23 +571,17 @@ void Drawer2DGL::drawTextureRepeated(const ITexture* texture, int x0, int y0, in
   
   if(simple)
   {
-    double coorx = (double(x1 - x0) / texturegl->getU());
-    double coory = (double(y1 - y0) / texturegl->getV());
+    float coorx = (double(x1 - x0) / texturegl->getU());
+    float coory = (double(y1 - y0) / texturegl->getV());
 
     //note how in the texture coordinates x and y are swapped because the texture buffers are 90 degrees rotated
-    glBegin(GL_QUADS);
-      glTexCoord2d(0.0,       0.0); glVertex2f(x0, y0);
-      glTexCoord2d(0.0,    +coory); glVertex2f(x0, y1);
-      glTexCoord2d(+coorx, +coory); glVertex2f(x1, y1);
-      glTexCoord2d(+coorx,    0.0); glVertex2f(x1, y0);
-    glEnd();
+    addTexturedQuad(texturegl, 0, screen->isSmoothingEnabled(), x0, y0, x1, y1, 0.0, 0.0, coorx, coory, colorMod);
   }
   else if(texturegl->getNumParts() == 1) //need to tile manually, slow!!
   {
     int numx = (x1 - x0) / texture->getU();
     int numy = (y1 - y0) / texture->getV();
     
-    //TODO: make this more efficient, e.g. quadstrip...
     //TODO: also add the extra textures at the edge (I mean, now I only have the full tiles, at the sides are possibly also partial tiles)!!!!
     for(int x = 0; x < numx; x++)
     {
@@ -533,12 +592,7 @@ void Drawer2DGL::drawTextureRepeated(const ITexture* texture, int x0, int y0, in
         int xb1 = xb0 + texture->getU();
         int yb1 = yb0 + texture->getV();
         
-        glBegin(GL_QUADS);
-          glTexCoord2d(0.0, 0.0); glVertex2f(xb0, yb0);
-          glTexCoord2d(0.0, 1.0); glVertex2f(xb0, yb1);
-          glTexCoord2d(1.0, 1.0); glVertex2f(xb1, yb1);
-          glTexCoord2d(1.0, 0.0); glVertex2f(xb1, yb0);
-        glEnd();
+        addTexturedQuad(texturegl, 0, screen->isSmoothingEnabled(), xb0, yb0, xb1, yb1, 0.0, 0.0, 1.0, 1.0, colorMod);
       }
     }
   }
@@ -552,15 +606,17 @@ void Drawer2DGL::drawTextureSizedRepeated(const ITexture* texture, int x0, int y
 {
   if(x0 == x1 || y0 == y1) return;
 
+  if(const AtlasTexture* atlastexture = dynamic_cast<const AtlasTexture*>(texture))
+  {
+    drawAtlasTextureRepeated(atlastexture, x0, y0, x1, y1, sizex, sizey, colorMod, colorMod, colorMod, colorMod);
+    return;
+  }
+
   const TextureGL* texturegl = dynamic_cast<const TextureGL*>(texture);
   if(!texturegl) return;
 
-  prepareDrawTextured();
   texturegl->updateForNewOpenGLContextIfNeeded();
 
-  glColor4ub(colorMod.r, colorMod.g, colorMod.b, colorMod.a);
-  texturegl->bind(screen->isSmoothingEnabled(), 0);
-
   bool simple = true;
   if(x1 - x0 > (int)texture->getU() && texture->getU() != texture->getU2()) simple = false;
   if(y1 - y0 > (int)texture->getV() && texture->getV() != texture->getV2()) simple = false;
@@ -570,23 +626,17 @@ void Drawer2DGL::drawTextureSizedRepeated(const ITexture* texture, int x0, int y
   {
     double scalex = (double)texture->getU() / (double)sizex;
     double scaley = (double)texture->getV() / (double)sizey;
-    double coorx = ((double)(x1 - x0) / texturegl->getU()) * scalex;
-    double coory = ((double)(y1 - y0) / texturegl->getV()) * scaley;
+    float coorx = ((double)(x1 - x0) / texturegl->getU()) * scalex;
+    float coory = ((double)(y1 - y0) / texturegl->getV()) * scaley;
 
     //note how in the texture coordinates x and y are swapped because the texture buffers are 90 degrees rotated
-    glBegin(GL_QUADS);
-      glTexCoord2d(0.0,       0.0); glVertex2f(x0, y0);
-      glTexCoord2d(0.0,    +coory); glVertex2f(x0, y1);
-      glTexCoord2d(+coorx, +coory); glVertex2f(x1, y1);
-      glTexCoord2d(+coorx,    0.0); glVertex2f(x1, y0);
-    glEnd();
+    addTexturedQuad(texturegl, 0, screen->isSmoothingEnabled(), x0, y0, x1, y1, 0.0, 0.0, coorx, coory, colorMod);
   }
   else if(texturegl->getNumParts() == 1) //need to tile manually, slow!!
   {
     int numx = (x1 - x0) / texture->getU();
     int numy = (y1 - y0) / texture->getV();
 
-    //TODO: make this more efficient, e.g. quadstrip...
     //TODO: also add the extra textures at the edge (I mean, now I only have the full tiles, at the sides are possibly also partial tiles)!!!!
     //TODO: the scaling of sizex and sizey are ignored here, implement that too!!!!
     for(int x = 0; x < numx; x++)
@@ -598,12 +648,7 @@ void Drawer2DGL::drawTextureSizedRepeated(const ITexture* texture, int x0, int y
         int xb1 = xb0 + texture->getU();
         int yb1 = yb0 + texture->getV();
 
-        glBegin(GL_QUADS);
-          glTexCoord2d(0.0, 0.0); glVertex2f(xb0, yb0);
-          glTexCoord2d(0.0, 1.0); glVertex2f(xb0, yb1);
-          glTexCoord2d(1.0, 1.0); glVertex2f(xb1, yb1);
-          glTexCoord2d(1.0, 0.0); glVertex2f(xb1, yb0);
-        glEnd();
+        addTexturedQuad(texturegl, 0, screen->isSmoothingEnabled(), xb0, yb0, xb1, yb1, 0.0, 0.0, 1.0, 1.0, colorMod);
       }
     }
   }
@@ -620,29 +665,30 @@ void Drawer2DGL::drawTextureSizedRepeated(const ITexture* texture, int x0, int y
 void Drawer2DGL::drawTextureGradient(const ITexture* texture, int x, int y
                                    , const ColorRGB& color00, const ColorRGB& color01, const ColorRGB& color10, const ColorRGB& color11)
 {
+  if(const AtlasTexture* atlastexture = dynamic_cast<const AtlasTexture*>(texture))
+  {
+    drawAtlasTextureRepeated(atlastexture, x, y, x + texture->getU(), y + texture->getV(), texture->getU(), texture->getV(), color00, color01, color10, color11);
+    return;
+  }
+  
   const TextureGL* texturegl = dynamic_cast<const TextureGL*>(texture);
   if(!texturegl) return;
   
   int sizex = texture->getU();
   int sizey = texture->getV();
 
-  prepareDrawTextured();
   texturegl->updateForNewOpenGLContextIfNeeded();
   
   if(texturegl->getNumParts() == 1)
   {
-    texturegl->bind(screen->isSmoothingEnabled(), 0);
-
-    double u3 = (double)texturegl->getU() / (double)texturegl->getU2();
-    double v3 = (double)texturegl->getV() / (double)texturegl->getV2();
+    float u3 = (double)texturegl->getU() / (double)texturegl->getU2();
+    float v3 = (double)texturegl->getV() / (double)texturegl->getV2();
 
     //note how in the texture coordinates x and y are swapped because the texture buffers are 90 degrees rotated
-    glBegin(GL_QUADS);
-      glColor4ub(color00.r, color00.g, color00.b, color00.a); glTexCoord2d(0.0, 0.0); glVertex2d(x +          0, y +          0);
-      glColor4ub(color10.r, color10.g, color10.b, color10.a); glTexCoord2d(+u3, 0.0); glVertex2d(x + (int)sizex, y +          0);
-      glColor4ub(color11.r, color11.g, color11.b, color11.a); glTexCoord2d(+u3, +v3); glVertex2d(x + (int)sizex, y + (int)sizey);
-      glColor4ub(color01.r, color01.g, color01.b, color01.a); glTexCoord2d(0.0, +v3); glVertex2d(x +          0, y + (int)sizey);
-    glEnd();
+    beginBatch(BATCH_TRIANGLES, texturegl, 0, screen->isSmoothingEnabled());
+    const float vertices[8] = { (float)x, (float)y, (float)(x + sizex), (float)y, (float)(x + sizex), (float)(y + sizey), (float)x, (float)(y + sizey) };
+    const float texcoords[8] = { 0.0f, 0.0f, u3, 0.0f, u3, v3, 0.0f, v3 };
+    addQuad(vertices, texcoords, color00, color10, color11, color01);
   }
   else
   {
@@ -650,18 +696,32 @@ void Drawer2DGL::drawTextureGradient(const ITexture* texture, int x, int y
   }
 }
 
+namespace
+{
+
+//the bilinear interpolation of the corner colors, at fraction fx, fy of the rectangle
+ColorRGB interpolateCorners(const ColorRGB& color00, const ColorRGB& color01, const ColorRGB& color10, const ColorRGB& color11, double fx, double fy)
+{
+  return (color00 * (1.0-fx) + color10 * fx) * (1.0-fy) + (color01 * (1.0-fx) + color11 * fx) * fy;
+}
+
+} //end of anonymous namespace
+
 void Drawer2DGL::drawTextureRepeatedGradient(const ITexture* texture, int x0, int y0, int x1, int y1
                                            , const ColorRGB& color00, const ColorRGB& color01, const ColorRGB& color10, const ColorRGB& color11)
 {
   if(x0 == x1 || y0 == y1) return;
   
+  if(const AtlasTexture* atlastexture = dynamic_cast<const AtlasTexture*>(texture))
+  {
+    drawAtlasTextureRepeated(atlastexture, x0, y0, x1, y1, texture->getU(), texture->getV(), color00, color01, color10, color11);
+    return;
+  }
+  
   const TextureGL* texturegl = dynamic_cast<const TextureGL*>(texture);
   if(!texturegl) return;
   
-  prepareDrawTextured();
   texturegl->updateForNewOpenGLContextIfNeeded();
-
-  texturegl->bind(screen->isSmoothingEnabled(), 0);
   
   bool simple = true;
   if(x1 - x0 > (int)texture->getU() && texture->getU() != texture->getU2()) simple = false;
@@ -670,24 +730,22 @@ void Drawer2DGL::drawTextureRepeatedGradient(const ITexture* texture, int x0, in
   
   if(simple)
   {
-    double coorx = (double(x1 - x0) / texturegl->getU());
-    double coory = (double(y1 - y0) / texturegl->getV());
+    float coorx = (double(x1 - x0) / texturegl->getU());
+    float coory = (double(y1 - y0) / texturegl->getV());
 
     //note how in the texture coordinates x and y are swapped because the texture buffers are 90 degrees rotated
-    glBegin(GL_QUADS);
-      glColor4ub(color00.r, color00.g, color00.b, color00.a); glTexCoord2d(0.0,       0.0); glVertex2f(x0, y0);
-      glColor4ub(color01.r, color01.g, color01.b, color01.a); glTexCoord2d(0.0,    +coory); glVertex2f(x0, y1);
-      glColor4ub(color11.r, color11.g, color11.b, color11.a); glTexCoord2d(+coorx, +coory); glVertex2f(x1, y1);
-      glColor4ub(color10.r, color10.g, color10.b, color10.a); glTexCoord2d(+coorx,    0.0); glVertex2f(x1, y0);
-    glEnd();
+    beginBatch(BATCH_TRIANGLES, texturegl, 0, screen->isSmoothingEnabled());
+    const float vertices[8] = { (float)x0, (float)y0, (float)x0, (float)y1, (float)x1, (float)y1, (float)x1, (float)y0 };
+    const float texcoords[8] = { 0.0f, 0.0f, 0.0f, coory, coorx, coory, coorx, 0.0f };
+    addQuad(vertices, texcoords, color00, color01, color11, color10);
   }
   else if(texturegl->getNumParts() == 1) //need to tile manually, slow!!
   {
     int numx = (x1 - x0) / texture->getU();
     int numy = (y1 - y0) / texture->getV();
     
-    //TODO: make this more efficient, e.g. quadstrip...
     //TODO: also add the extra textures at the edge (I mean, now I only have the full tiles, at the sides are possibly also partial tiles)!!!!
+    beginBatch(BATCH_TRIANGLES, texturegl, 0, screen->isSmoothingEnabled());
     for(int x = 0; x < numx; x++)
     {
       for(int y = 0; y < numy; y++)
@@ -702,17 +760,14 @@ void Drawer2DGL::drawTextureRepeatedGradient(const ITexture* texture, int x0, in
         double xf1 = (xb1 - x0) / (double)(x1 - x0);
         double yf1 = (yb1 - y0) / (double)(y1 - y0);
         
-        ColorRGB c00 = (color00 * (1.0-xf0) + color10 * xf0) * (1.0-yf0) + (color01 * (1.0-xf0) + color11 * xf0) * yf0;
-        ColorRGB c01 = (color00 * (1.0-xf0) + color10 * xf0) * (1.0-yf1) + (color01 * (1.0-xf0) + color11 * xf0) * yf1;
-        ColorRGB c10 = (color00 * (1.0-xf1) + color10 * xf1) * (1.0-yf0) + (color01 * (1.0-xf1) + color11 * xf1) * yf0;
-        ColorRGB c11 = (color00 * (1.0-xf1) + color10 * xf1) * (1.0-yf1) + (color01 * (1.0-xf1) + color11 * xf1) * yf1;
+        ColorRGB c00 = interpolateCorners(color00, color01, color10, color11, xf0, yf0);
+        ColorRGB c01 = interpolateCorners(color00, color01, color10, color11, xf0, yf1);
+        ColorRGB c10 = interpolateCorners(color00, color01, color10, color11, xf1, yf0);
+        ColorRGB c11 = interpolateCorners(color00, color01, color10, color11, xf1, yf1);
         
-        glBegin(GL_QUADS);
-          glTexCoord2d(0.0, 0.0); glVertex2f(xb0, yb0);
-          glTexCoord2d(0.0, 1.0); glVertex2f(xb0, yb1);
-          glTexCoord2d(1.0, 1.0); glVertex2f(xb1, yb1);
-          glTexCoord2d(1.0, 0.0); glVertex2f(xb1, yb0);
-        glEnd();
+        const float vertices[8] = { (float)xb0, (float)yb0, (float)xb0, (float)yb1, (float)xb1, (float)yb1, (float)xb1, (float)yb0 };
+        const float texcoords[8] = { 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f };
+        addQuad(vertices, texcoords, c00, c01, c11, c10);
       }
     }
   }
@@ -722,7 +777,87 @@ void Drawer2DGL::drawTextureRepeatedGradient(const ITexture* texture, int x0, in
   }
 }
 
+void Drawer2DGL::drawAtlasTextureRepeated(const AtlasTexture* texture, int x0, int y0, int x1, int y1, size_t sizex, size_t sizey
+                                        , const ColorRGB& color00, const ColorRGB& color01, const ColorRGB& color10, const ColorRGB& color11)
+{
+  const TextureGL* page = dynamic_cast<const TextureGL*>(texture->getPage());
+  if(!page || page->getNumParts() != 1 || x0 >= x1 || y0 >= y1 || sizex == 0 || sizey == 0) return;
+  
+  page->updateForNewOpenGLContextIfNeeded();
+  beginBatch(BATCH_TRIANGLES, page, 0, screen->isSmoothingEnabled());
+  
+  //texture coordinates of the region in the page, and per pixel of the drawn tiles
+  double s0 = (double)texture->getX() / page->getU2();
+  double t0 = (double)texture->getY() / page->getV2();
+  double ds = (double)texture->getU() / sizex / page->getU2();
+  double dt = (double)texture->getV() / sizey / page->getV2();
+  
+  //one quad per tile, the tiles at the right and bottom side may be partial
+  for(int ty0 = y0; ty0 < y1; ty0 += sizey)
+  for(int tx0 = x0; tx0 < x1; tx0 += sizex)
+  {
+    int tx1 = std::min(tx0 + (int)sizex, x1);
+    int ty1 = std::min(ty0 + (int)sizey, y1);
+    double s1 = s0 + (tx1 - tx0) * ds;
+    double t1 = t0 + (ty1 - ty0) * dt;
+    double fx0 = (double)(tx0 - x0) / (x1 - x0), fx1 = (double)(tx1 - x0) / (x1 - x0);
+    double fy0 = (double)(ty0 - y0) / (y1 - y0), fy1 = (double)(ty1 - y0) / (y1 - y0);
+    ColorRGB c00 = interpolateCorners(color00, color01, color10, color11, fx0, fy0);
+    ColorRGB c01 = interpolateCorners(color00, color01, color10, color11, fx0, fy1);
+    ColorRGB c10 = interpolateCorners(color00, color01, color10, color11, fx1, fy0);
+    ColorRGB c11 = interpolateCorners(color00, color01, color10, color11, fx1, fy1);
+    
+    const float vertices[8] = { (float)tx0, (float)ty0, (float)tx1, (float)ty0, (float)tx1, (float)ty1, (float)tx0, (float)ty1 };
+    const float texcoords[8] = { (float)s0, (float)t0, (float)s1, (float)t0, (float)s1, (float)t1, (float)s0, (float)t1 };
+    addQuad(vertices, texcoords, c00, c10, c11, c01);
+  }
+}
 
+void Drawer2DGL::drawTextures(const SpriteInstance* sprites, size_t n)
+{
+  sprites = resolveAtlasSprites(atlassprites, sprites, n);
+  sortSpritesByTexture(spriteorder, sprites, n);
+  
+  //one batch per texture (or per part of a large texture)
+  size_t i = 0;
+  while(i < n)
+  {
+    const ITexture* texture = sprites[spriteorder[i]].texture;
+    size_t end = i + 1;
+    while(end < n && sprites[spriteorder[end]].texture == texture) end++;
+    
+    const TextureGL* texturegl = dynamic_cast<const TextureGL*>(texture);
+    if(texturegl)
+    {
+      texturegl->updateForNewOpenGLContextIfNeeded();
+      for(size_t p = 0; p < texturegl->getNumParts(); p++)
+      {
+        const TextureGL::Part& part = texturegl->getPart(p);
+        for(size_t j = i; j < end; j++)
+        {
+          //the part of the sprite that is in this part of the texture, if any
+          const SpriteInstance& s = sprites[spriteorder[j]];
+          if(s.sizex == 0 || s.sizey == 0 || s.u0 >= s.u1 || s.v0 >= s.v1) continue;
+          int u0 = std::max(s.u0, part.shiftx);
+          int v0 = std::max(s.v0, part.shifty);
+          int u1 = std::min(s.u1, part.shiftx + (int)part.u);
+          int v1 = std::min(s.v1, part.shifty + (int)part.v);
+          if(u0 >= u1 || v0 >= v1) continue;
+          
+          double zoomx = (double)s.sizex / (s.u1 - s.u0);
+          double zoomy = (double)s.sizey / (s.v1 - s.v0);
+          addTexturedQuad(texturegl, p, screen->isSmoothingEnabled()
+                        , s.x + (u0 - s.u0) * zoomx, s.y + (v0 - s.v0) * zoomy
+                        , s.x + (u1 - s.u0) * zoomx, s.y + (v1 - s.v0) * zoomy
+                        , (float)(u0 - part.shiftx) / part.u2, (float)(v0 - part.shifty) / part.v2
+                        , (float)(u1 - part.shiftx) / part.u2, (float)(v1 - part.shifty) / part.v2
+                        , s.colorMod);
+        }
+      }
+    }
+    i = end;
+  }
+}
 
 
 } //end of namespace lpi
@@ -35,20 +35,69 @@ namespace lpi
 {
 
 class InternalTextDrawer;
+class AtlasTexture;
+class TextureGL;
 
-class Drawer2DGL : public ADrawer2D
+/*
+Drawer2DGL doesn't draw every shape right away: the vertices go in a batch (vertex arrays in
+memory), that is drawn with one glDrawArrays when the state it needs changes (another texture,
+smoothing, or points, lines and filled shapes), when the scissor changes, and at frameEnd. Other
+code that changes OpenGL textures or state must call flush of the GLContext first, TextureGL and
+ScreenGL already do that.
+*/
+class Drawer2DGL : public ADrawer2D, public IGLBatch
 {
   private:
     ScreenGL* screen;
     
+    enum BatchMode
+    {
+      BATCH_POINTS,
+      BATCH_LINES,
+      BATCH_TRIANGLES //all filled shapes and textures, quads are two triangles
+    };
+    
+    //the batch, the vertices of the arrays are drawn in order with the state below
+    std::vector<float> batchvertices;
+    std::vector<float> batchtexcoords; //only for textured batches
+    std::vector<unsigned char> batchcolors;
+    BatchMode batchmode;
+    const TextureGL* batchtexture; //0 if untextured
+    size_t batchpart; //part of batchtexture
+    bool batchsmoothing;
+    size_t drawcalls; //since frameStart
+    
+    //for drawTextures, kept to reuse their memory
+    std::vector<size_t> spriteorder;
+    std::vector<SpriteInstance> atlassprites;
+    
   private:
-    void recursive_bezier(double x0, double y0, double x1, double y1, double x2, double y2, double x3, double y3, int n);
-    void drawLineInternal(int x0, int y0, int x1, int y1); //doesn't call "prepareDraw", to be used by other things that draw multiple lines
+    void recursive_bezier(double x0, double y0, double x1, double y1, double x2, double y2, double x3, double y3, const ColorRGB& color, int n);
+    void drawLineInternal(int x0, int y0, int x1, int y1, const ColorRGB& color); //adds a line to the batch, which must be BATCH_LINES already
+    
+    //flushes the batch if it has another state
+    void beginBatch(BatchMode mode, const TextureGL* texture = 0, size_t part = 0, bool smoothing = false);
+    void addVertex(float x, float y, const ColorRGB& color);
+    void addVertex(float x, float y, float s, float t, const ColorRGB& color);
+    //the corners of the quad in order around it, texcoords only for a textured batch (then 8 floats)
+    void addQuad(const float* vertices, const float* texcoords, const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2, const ColorRGB& color3);
+    //the repeated and gradient textures for an AtlasTexture: its region can't use GL_REPEAT, so the tiles are separate quads
+    void drawAtlasTextureRepeated(const AtlasTexture* texture, int x0, int y0, int x1, int y1, size_t sizex, size_t sizey
+                                , const ColorRGB& color00, const ColorRGB& color01, const ColorRGB& color10, const ColorRGB& color11);
     
   public:
   
+    //for code that draws with OpenGL itself: flushes the batch and sets the OpenGL state for such drawing
     void prepareDrawUntextured(bool filledGeometry);
     void prepareDrawTextured();
+    
+    virtual void flush(); //draws the batch now
+    size_t getNumDrawCalls() const { return drawcalls; } //glDrawArrays calls since frameStart
+    //the OpenGL state changes since frameStart are in getGLContext()->getState().getStats() of the screen
+    
+    //for drawing many quads of one texture part with little overhead, e.g. text. s and t are the texture coordinates of the part.
+    void addTexturedQuad(const TextureGL* texture, size_t part, bool smoothing
+                       , float x0, float y0, float x1, float y1, float s0, float t0, float s1, float t1, const ColorRGB& color);
 
   public:
     Drawer2DGL(ScreenGL* screen);
@@ -95,6 +144,7 @@ class Drawer2DGL : public ADrawer2D
                                    , const ColorRGB& color00, const ColorRGB& color01, const ColorRGB& color10, const ColorRGB& color11);
     virtual void drawTextureRepeatedGradient(const ITexture* texture, int x0, int y0, int x1, int y1
                                            , const ColorRGB& color00, const ColorRGB& color01, const ColorRGB& color10, const ColorRGB& color11);
+    virtual void drawTextures(const SpriteInstance* sprites, size_t n);
 
     
   public:
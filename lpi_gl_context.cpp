@@ -20,14 +20,264 @@ along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licens
 
 #include "lpi_gl_context.h"
 
+#include <GL/gl.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <vector>
 
 namespace lpi
 {
 
+GLState::GLState()
+{
+  invalidate();
+}
+
+void GLState::invalidate()
+{
+  unitknown = false;
+  for(size_t i = 0; i < NUMUNITS; i++) boundknown[i] = false;
+  blendknown = false;
+  enabled.clear();
+  scissorknown = false;
+  colorknown = false;
+  filters.clear();
+}
+
+void GLState::invalidateColor()
+{
+  colorknown = false;
+}
+
+bool GLState::change(bool same)
+{
+  if(same) stats.skipped++;
+  else stats.issued++;
+  return !same;
+}
+
+void GLState::resetStats()
+{
+  stats = Stats();
+}
+
+void GLState::activeTexture(size_t unit)
+{
+  if(unit >= NUMUNITS) return;
+  if(!change(unitknown && this->unit == unit)) return;
+#ifdef GL_VERSION_1_3
+  glActiveTexture(GL_TEXTURE0 + unit);
+#else
+  if(unit != 0) return; //there is only unit 0 without OpenGL 1.3, which needs no call
+#endif
+  this->unit = unit;
+  unitknown = true;
+}
+
+void GLState::bindTexture(unsigned texture)
+{
+  bool known = unitknown && boundknown[unit];
+  if(!change(known && bound[unit] == texture)) return;
+  glBindTexture(GL_TEXTURE_2D, texture);
+  if(unitknown)
+  {
+    bound[unit] = texture;
+    boundknown[unit] = true;
+  }
+}
+
+void GLState::setFilter(unsigned minfilter, unsigned magfilter)
+{
+  //without knowing which texture is bound, the filter can't be remembered
+  bool known = unitknown && boundknown[unit];
+  std::pair<unsigned, unsigned> filter(minfilter, magfilter);
+  if(known)
+  {
+    std::map<unsigned, std::pair<unsigned, unsigned> >::iterator it = filters.find(bound[unit]);
+    if(!change(it != filters.end() && it->second == filter)) return;
+  }
+  else change(false);
+  
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minfilter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magfilter);
+  if(known) filters[bound[unit]] = filter;
+}
+
+void GLState::deleteTexture(unsigned texture)
+{
+  glDeleteTextures(1, &texture);
+  filters.erase(texture);
+  //OpenGL binds 0 instead of a deleted texture
+  for(size_t i = 0; i < NUMUNITS; i++)
+  {
+    if(boundknown[i] && bound[i] == texture) bound[i] = 0;
+  }
+}
+
+void GLState::blendFunc(unsigned src, unsigned dst)
+{
+  if(!change(blendknown && blendsrc == src && blenddst == dst)) return;
+  glBlendFunc(src, dst);
+  blendsrc = src;
+  blenddst = dst;
+  blendknown = true;
+}
+
+void GLState::setEnabled(unsigned cap, bool enable)
+{
+  std::map<unsigned, bool>::iterator it = enabled.find(cap);
+  if(!change(it != enabled.end() && it->second == enable)) return;
+  if(enable) glEnable(cap);
+  else glDisable(cap);
+  enabled[cap] = enable;
+}
+
+void GLState::enable(unsigned cap)
+{
+  setEnabled(cap, true);
+}
+
+void GLState::disable(unsigned cap)
+{
+  setEnabled(cap, false);
+}
+
+void GLState::scissor(int x, int y, int width, int height)
+{
+  if(!change(scissorknown && scissorbox[0] == x && scissorbox[1] == y && scissorbox[2] == width && scissorbox[3] == height)) return;
+  glScissor(x, y, width, height);
+  scissorbox[0] = x;
+  scissorbox[1] = y;
+  scissorbox[2] = width;
+  scissorbox[3] = height;
+  scissorknown = true;
+}
+
+void GLState::setColor(unsigned char r, unsigned char g, unsigned char b, unsigned char a)
+{
+  if(!change(colorknown && color[0] == r && color[1] == g && color[2] == b && color[3] == a)) return;
+  glColor4ub(r, g, b, a);
+  color[0] = r;
+  color[1] = g;
+  color[2] = b;
+  color[3] = a;
+  colorknown = true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+namespace
+{
+
+struct MoreRecentlyUsed
+{
+  bool operator()(const IGLResource* a, const IGLResource* b) const { return a->getLastUsed() > b->getLastUsed(); }
+};
+
+} //end of anonymous namespace
+
+GLResidency::GLResidency(GLContext* context)
+: context(context)
+, frame(1)
+, budget(16 * 1024 * 1024)
+, cap(0)
+, drawuploaded(0)
+, drawuploads(0)
+{
+}
+
+void GLResidency::add(IGLResource* resource)
+{
+  resources.insert(resource);
+}
+
+void GLResidency::remove(IGLResource* resource)
+{
+  resources.erase(resource);
+}
+
+void GLResidency::addDrawUpload(size_t bytes)
+{
+  drawuploaded += bytes;
+  drawuploads++;
+}
+
+void GLResidency::nextFrame()
+{
+  frame++;
+  stats.drawuploaded = drawuploaded;
+  stats.drawuploads = drawuploads;
+  drawuploaded = 0;
+  drawuploads = 0;
+  update();
+}
+
+void GLResidency::update()
+{
+  stats.uploaded = 0;
+  stats.evicted = 0;
+  stats.resident = 0;
+  stats.pending = 0;
+  if(!context->isActive()) return;
+
+  std::vector<IGLResource*> resident;
+  std::vector<IGLResource*> pending;
+  for(std::set<IGLResource*>::iterator it = resources.begin(); it != resources.end(); ++it)
+  {
+    IGLResource* resource = *it;
+    if(resource->getVideoBytes() == 0) continue;
+    if(resource->isResident())
+    {
+      resident.push_back(resource);
+      stats.resident += resource->getVideoBytes();
+    }
+    else pending.push_back(resource);
+  }
+
+  //evict those that were drawn longest ago, but not what was drawn last frame, that's likely drawn again
+  if(cap > 0 && stats.resident > cap)
+  {
+    std::sort(resident.begin(), resident.end(), MoreRecentlyUsed());
+    for(size_t i = resident.size(); i > 0 && stats.resident > cap; i--)
+    {
+      IGLResource* resource = resident[i - 1];
+      if(resource->getLastUsed() + 1 >= frame) break;
+      if(!resource->canEvict()) continue;
+      stats.resident -= resource->getVideoBytes();
+      resource->evict();
+      stats.evicted++;
+    }
+  }
+
+  //upload the others, what was drawn most recently first
+  std::sort(pending.begin(), pending.end(), MoreRecentlyUsed());
+  for(size_t i = 0; i < pending.size(); i++)
+  {
+    IGLResource* resource = pending[i];
+    size_t bytes = resource->getVideoBytes();
+    bool fits = (cap == 0 || stats.resident + bytes <= cap) && (stats.uploaded == 0 || stats.uploaded + bytes <= budget);
+    if(fits)
+    {
+      resource->makeResident();
+      stats.uploaded += bytes;
+      stats.resident += bytes;
+    }
+    else stats.pending += bytes;
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
 GLContext::GLContext()
 : active(false)
 , index(-1)
+, batch(0)
+, residency(this)
+, npotsupported(false)
+, npotallowed(true)
 {
 }
 
@@ -49,11 +299,22 @@ void GLContext::onNewGLContext()
 {
   active = true;
   index++;
+  state.invalidate(); //a new context has the default state, not the one set in the previous
+  
+  const char* version = (const char*)glGetString(GL_VERSION);
+  const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+  int major = 0;
+  if(version) std::sscanf(version, "%d", &major);
+  npotsupported = major >= 2 || (extensions && std::strstr(extensions, "GL_ARB_texture_non_power_of_two"));
+  
+  //the textures of the previous context are gone: upload the most recently drawn ones now, within the budget, instead of all when drawn
+  residency.update();
 }
 
 void GLContext::onGLContextDestroyed()
 {
   active = false;
+  state.invalidate();
 }
 
 } //end of namespace lpi
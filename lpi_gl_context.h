@@ -20,12 +20,164 @@ along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licens
 
 #pragma once
 
+#include <cstddef>
+#include <map>
+#include <set>
+#include <utility>
+
 namespace lpi
 {
 
 /*
-This class contains nothing that depends on OpenGL libraries. And this most
-certainly cannot do things like drawing OpenGL objects or so.
+Something that holds back OpenGL draw calls to do many of them at once later, such as
+Drawer2DGL. Anything that changes what those draws depend on (textures, scissor, the
+screen...) calls GLContext::flush first, so that they're drawn as if they weren't held back.
+*/
+class IGLBatch
+{
+  public:
+    virtual ~IGLBatch(){}
+    virtual void flush() = 0; //does the held back draw calls now
+};
+
+/*
+Shadow copy of the OpenGL state that lpi sets, so that setting something to what it already is
+doesn't cost an OpenGL call. It only knows the changes that went through it: after code that
+changes this state with OpenGL itself (e.g. your own 3D drawing), call invalidate, then the next
+change of everything goes to OpenGL again. Nothing is known at the start either.
+
+The values are those of OpenGL (GLenum and GLuint are unsigned), so this header doesn't need the
+OpenGL headers. Texture units other than 0 need OpenGL 1.3.
+*/
+class GLState
+{
+  public:
+    struct Stats
+    {
+      size_t issued; //state changes that were given to OpenGL
+      size_t skipped; //state changes that were left out because the state already was like that
+      
+      Stats() : issued(0), skipped(0) {}
+    };
+    
+  private:
+    static const size_t NUMUNITS = 8;
+    
+    size_t unit; //the active texture unit
+    bool unitknown;
+    unsigned bound[NUMUNITS]; //the GL_TEXTURE_2D texture of each unit
+    bool boundknown[NUMUNITS];
+    unsigned blendsrc;
+    unsigned blenddst;
+    bool blendknown;
+    std::map<unsigned, bool> enabled; //capabilities that aren't in here are unknown
+    int scissorbox[4];
+    bool scissorknown;
+    unsigned char color[4];
+    bool colorknown;
+    std::map<unsigned, std::pair<unsigned, unsigned> > filters; //min and mag filter per texture
+    Stats stats;
+    
+    bool change(bool same); //counts the change, returns true if it must go to OpenGL
+    void setEnabled(unsigned cap, bool enable);
+    
+  public:
+    GLState();
+    
+    void invalidate(); //forget all state, call after changing it outside of this class
+    void invalidateColor(); //e.g. after glDrawArrays with a color array, which leaves the color undefined
+    
+    void activeTexture(size_t unit); //the unit that bindTexture and setFilter work on
+    void bindTexture(unsigned texture); //to GL_TEXTURE_2D
+    void setFilter(unsigned minfilter, unsigned magfilter); //of the texture that is bound now
+    void deleteTexture(unsigned texture); //also forgets its filter, and it's unbound wherever it was bound
+    void blendFunc(unsigned src, unsigned dst);
+    void enable(unsigned cap);
+    void disable(unsigned cap);
+    void scissor(int x, int y, int width, int height);
+    void setColor(unsigned char r, unsigned char g, unsigned char b, unsigned char a);
+    
+    const Stats& getStats() const { return stats; }
+    void resetStats(); //e.g. at the start of each frame, to get the changes per frame
+};
+
+/*
+Something that uses video memory of a GLContext and can be uploaded again from system memory,
+such as TextureGL. They're tracked by the GLResidency of the context.
+*/
+class IGLResource
+{
+  public:
+    virtual ~IGLResource(){}
+    virtual size_t getVideoBytes() const = 0; //the video memory it uses when it's resident
+    virtual size_t getLastUsed() const = 0; //the frame of the GLResidency in which it was last drawn
+    virtual bool isResident() const = 0; //whether it's uploaded to the current context
+    virtual bool canEvict() const = 0; //false if it can't be uploaded again after evicting it
+    virtual void makeResident() const = 0; //uploads it
+    virtual void evict() const = 0; //frees its video memory, it's uploaded again when it's needed
+};
+
+class GLContext;
+
+/*
+Keeps track of all IGLResources of a context, so that uploading them can be spread over frames.
+After the context is replaced, or for new resources, nextFrame uploads the ones that aren't
+resident, the most recently drawn first, until the upload budget of the frame is used. Those that
+are drawn before it got to them are uploaded when drawn, as always, so nothing is drawn wrong, but
+those uploads bypass the budget and the cap (Stats counts them as drawuploaded).
+GLContext::onNewGLContext does such a pass right away (see update), so that the textures drawn most
+recently are uploaded before the first frame in the new context draws them.
+With a video memory cap, nextFrame evicts the resources that were drawn longest ago (and not in
+the last frame) while the resident ones use more than the cap, and doesn't upload more than fits.
+*/
+class GLResidency
+{
+  public:
+    struct Stats
+    {
+      size_t uploaded; //bytes uploaded by the last nextFrame
+      size_t evicted; //resources evicted by the last nextFrame
+      size_t resident; //video memory of the resident resources after the last nextFrame
+      size_t pending; //video memory of the resources that aren't resident after the last nextFrame
+      size_t drawuploaded; //bytes uploaded because they were drawn while not resident, in the frame before the last nextFrame
+      size_t drawuploads; //the amount of resources uploaded like that
+      
+      Stats() : uploaded(0), evicted(0), resident(0), pending(0), drawuploaded(0), drawuploads(0) {}
+    };
+    
+  private:
+    GLContext* context;
+    std::set<IGLResource*> resources;
+    size_t frame;
+    size_t budget;
+    size_t cap;
+    Stats stats;
+    size_t drawuploaded; //in the current frame, given to stats by nextFrame
+    size_t drawuploads;
+    
+  public:
+    GLResidency(GLContext* context);
+    
+    void add(IGLResource* resource);
+    void remove(IGLResource* resource);
+    size_t getNumResources() const { return resources.size(); }
+    
+    size_t getFrame() const { return frame; } //what resources give as getLastUsed when they're drawn
+    void nextFrame(); //call once per frame, between two frames, ScreenGL::redraw does this
+    void update(); //the evicting and uploading of nextFrame, without starting a new frame, e.g. when the context is replaced
+    void addDrawUpload(size_t bytes); //for the resources: they were uploaded when drawn, outside of the budget
+    
+    void setUploadBudget(size_t bytes) { budget = bytes; } //bytes that nextFrame may upload, at least one resource is uploaded
+    size_t getUploadBudget() const { return budget; }
+    void setVideoMemoryCap(size_t bytes) { cap = bytes; } //0 for no cap
+    size_t getVideoMemoryCap() const { return cap; }
+    
+    const Stats& getStats() const { return stats; }
+};
+
+/*
+This class contains nothing that depends on OpenGL libraries, except for the state in
+GLState. And this most certainly cannot do things like drawing OpenGL objects or so.
 
 It is merely a class representing whether or not there is an OpenGL context active and
 if there is one active, it has a certain index associated with it, so that
@@ -36,6 +188,11 @@ class GLContext
   private:
     bool active;
     int index;
+    IGLBatch* batch;
+    GLState state;
+    GLResidency residency;
+    bool npotsupported; //found out by onNewGLContext
+    bool npotallowed; //set by the user, kept when the context is replaced
   public:
     GLContext();
     ~GLContext();
@@ -43,8 +200,27 @@ class GLContext
     bool isActive() const; //is there an OpenGL context active?
     int getID() const; //unique ID of the current OpenGL context (only valid if isActive() is true)
 
-    void onNewGLContext(); //call if a new context is made for the first time, or if one is replaced (then the previous is destroyed, no need to use onGLContextDestroyed in that case)
+    void onNewGLContext(); //call if a new context is made for the first time, or if one is replaced (then the previous is destroyed, no need to use onGLContextDestroyed in that case). It must be the current one.
     void onGLContextDestroyed(); //call if the GL context is destroyed and no new one is available instead.
+    
+    //the batch that has draw calls held back, at most one at a time: a new one must flush the previous one first
+    void setBatch(IGLBatch* batch) { this->batch = batch; }
+    IGLBatch* getBatch() const { return batch; }
+    void flush() { if(batch) batch->flush(); } //call before changing OpenGL state or textures that a batch may depend on
+    
+    GLState& getState() { return state; } //all OpenGL state changes of lpi go through here
+    
+    /*
+    Whether textures can have any size: if the context supports it (OpenGL 2.0 or
+    GL_ARB_texture_non_power_of_two, found out by onNewGLContext) and it's allowed. Otherwise
+    textures get a power of two size. Set allowed to false to use power of two sizes anyway, e.g.
+    for old hardware that claims OpenGL 2.0 but does them in software, this stays when the
+    context is replaced. Textures that already have their size keep it.
+    */
+    bool getNonPowerOfTwo() const { return npotsupported && npotallowed; }
+    void setNonPowerOfTwo(bool allowed) { npotallowed = allowed; }
+    
+    GLResidency& getResidency() { return residency; } //all textures of this context are in here
 };
 
 
@@ -21,6 +21,7 @@ along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licens
 
 #include "lpi_gui.h"
 #include "lpi_math.h"
+#include "lpi_region.h"
 
 #include <iostream>
 
@@ -690,6 +691,7 @@ void Label::drawLabel(IGUIDrawer& drawer, const Element* element) const
 
 AContainer::AContainer(AInternalContainer* ic)
 : elements(ic)
+, occlusion(false)
 {
   setEnabled(true);
   x0 = 0;
@@ -700,6 +702,7 @@ AContainer::AContainer(AInternalContainer* ic)
 
 AContainer::AContainer(AInternalContainer* ic, IGUIDrawer& drawer)
 : elements(ic)
+, occlusion(false)
 {
   setEnabled(true);
   
@@ -800,9 +803,38 @@ void AContainer::handleImpl(const IInput& input)
 
 void AContainer::drawElements(IGUIDrawer& drawer) const
 {
+  if(occlusion)
+  {
+    drawElementsVisible(drawer);
+    return;
+  }
+  
+  for(unsigned long i = 0; i < size(); i++)
+  {
+    elements->getElement(i)->draw(drawer);
+  }
+}
+
+void AContainer::drawElementsVisible(IGUIDrawer& drawer) const
+{
+  //from the top down, so that the area covered by the elements above each element is known
+  std::vector<ClipRegion> visible(size());
+  ClipRegion covered;
+  for(unsigned long i = size(); i > 0; i--)
+  {
+    const Element* element = elements->getElement(i - 1);
+    if(!element->isEnabled()) continue;
+    visible[i - 1].set(element->getX0(), element->getY0(), element->getX1(), element->getY1());
+    visible[i - 1].subtract(covered);
+    covered.unite(element->getX0(), element->getY0(), element->getX1(), element->getY1());
+  }
+  
   for(unsigned long i = 0; i < size(); i++)
   {
+    if(visible[i].empty()) continue;
+    drawer.pushScissorRegion(visible[i]);
     elements->getElement(i)->draw(drawer);
+    drawer.popScissor();
   }
 }
 
@@ -575,10 +575,12 @@ class AContainer : public Element
 {
   protected:
     AInternalContainer* elements;
+    bool occlusion; //see setOcclusionClipping
 
   protected:
     
     void drawElements(IGUIDrawer& drawer) const;
+    void drawElementsVisible(IGUIDrawer& drawer) const; //every element clipped to the part the elements above it don't cover
     void drawElementsPopup(IGUIDrawer& drawer) const;
     
   public:
@@ -594,6 +596,14 @@ class AContainer : public Element
     
     void bringToTop(Element* element); //precondition: element must already be in the list
     
+    /*
+    If enabled, every element is drawn only where the elements above it don't cover it (with a clip region,
+    see IDrawer2D::pushScissorRegion), so that the covered pixels aren't drawn for nothing. Only enable this
+    if the elements are opaque and draw nothing outside their rectangle, e.g. windows without shadows or
+    transparency. Off by default.
+    */
+    void setOcclusionClipping(bool set) { occlusion = set; }
+    
     void centerElement(Element* element); //TODO: remove this function from this class, if necessary put it somewhere else as utility function
 
     void putInside(unsigned long i);
@@ -721,6 +731,8 @@ class MainContainer : public IHoverManager, public ElementComposite
     
     void remove(Element* element) { e.remove(element); }
     
+    void setOcclusionClipping(bool set) { e.setOcclusionClipping(set); } //the windows and other elements are drawn only where they're visible, see AContainer::setOcclusionClipping
+    
     virtual const Element* hitTest(const IInput& input) const;
     
     Element* getElement(size_t i) const { return e.getElement(i); }
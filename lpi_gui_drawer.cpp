@@ -110,6 +110,11 @@ void AGUIDrawer::drawEllipseCentered(int x, int y, int radiusx, int radiusy, con
   getDrawer().drawEllipseCentered(x, y, radiusx, radiusy, color, filled);
 }
 
+void AGUIDrawer::drawPolygon(const int* xy, size_t numpoints, const ColorRGB& color, bool filled)
+{
+  getDrawer().drawPolygon(xy, numpoints, color, filled);
+}
+
 void AGUIDrawer::drawGradientRectangle(int x0, int y0, int x1, int y1, const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2, const ColorRGB& color3)
 {
   getDrawer().drawGradientRectangle(x0, y0, x1, y1, color0, color1, color2, color3);
@@ -140,6 +145,11 @@ void AGUIDrawer::popScissor()
   getDrawer().popScissor();
 }
 
+void AGUIDrawer::pushScissorRegion(const ClipRegion& region)
+{
+  getDrawer().pushScissorRegion(region);
+}
+
 bool AGUIDrawer::supportsTexture(ITexture* texture)
 {
   return getDrawer().supportsTexture(texture);
@@ -187,6 +197,11 @@ void AGUIDrawer::drawTextureRepeatedGradient(const ITexture* texture, int x0, in
   getDrawer().drawTextureRepeatedGradient(texture, x0, y0, x1, y1, color00, color01, color10, color11);
 }
 
+void AGUIDrawer::drawTextures(const SpriteInstance* sprites, size_t n)
+{
+  getDrawer().drawTextures(sprites, n);
+}
+
 
 void AGUIDrawer::calcTextRectSize(int& w, int& h, const std::string& text, const Font& font) const
 {
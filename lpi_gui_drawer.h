@@ -300,6 +300,7 @@ class AGUIDrawer : public IGUIDrawer //abstract GUI drawer which already wraps a
     virtual void drawTriangle(int x0, int y0, int x1, int y1, int x2, int y2, const ColorRGB& color, bool filled);
     virtual void drawQuad(int x0, int y0, int x1, int y1, int x2, int y2, int x3, int y3, const ColorRGB& color, bool filled);
     virtual void drawEllipseCentered(int x, int y, int radiusx, int radiusy, const ColorRGB& color, bool filled);
+    virtual void drawPolygon(const int* xy, size_t numpoints, const ColorRGB& color, bool filled);
     
     virtual void drawGradientRectangle(int x0, int y0, int x1, int y1, const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2, const ColorRGB& color3);
     virtual void drawGradientTriangle(int x0, int y0, int x1, int y1, int x2, int y2, const ColorRGB& color0, const ColorRGB& color1, const ColorRGB& color2);
@@ -317,10 +318,12 @@ class AGUIDrawer : public IGUIDrawer //abstract GUI drawer which already wraps a
                                    , const ColorRGB& color00, const ColorRGB& color01, const ColorRGB& color10, const ColorRGB& color11);
     virtual void drawTextureRepeatedGradient(const ITexture* texture, int x0, int y0, int x1, int y1
                                            , const ColorRGB& color00, const ColorRGB& color01, const ColorRGB& color10, const ColorRGB& color11);
+    virtual void drawTextures(const SpriteInstance* sprites, size_t n);
 
     virtual void pushScissor(int x0, int y0, int x1, int y1);
     virtual void pushSmallestScissor(int x0, int y0, int x1, int y1);
     virtual void popScissor();
+    virtual void pushScissorRegion(const ClipRegion& region);
     
     virtual void calcTextRectSize(int& w, int& h, const std::string& text, const Font& font = FONT_Default) const;
     virtual size_t calcTextPosToChar(int x, int y, const std::string& text, const Font& font = FONT_Default, const TextAlign& align = TextAlign(HA_LEFT, VA_TOP)) const;
@@ -45,8 +45,6 @@ class GUIDrawerGL : public AGUIDrawer
   
   protected:
   
-    virtual IDrawer2D& getDrawer() { return drawer; }
-    virtual const IDrawer2D& getDrawer() const { return drawer; }
     virtual ITextDrawer& getTextDrawer() { return textdrawer; }
     virtual const ITextDrawer& getTextDrawer() const { return textdrawer; }
     virtual IGUIPartDrawer& getGUIPartDrawer() { return guidrawer; }
@@ -55,6 +53,9 @@ class GUIDrawerGL : public AGUIDrawer
   public:
     GUIDrawerGL(ScreenGL* screen);
     
+    virtual IDrawer2D& getDrawer() { return drawer; }
+    virtual const IDrawer2D& getDrawer() const { return drawer; }
+    
     GuiSet& getInternal() { return guidrawer.getGUISet(); } //can be used to set font and such
     
     void loadGUITextures(const std::vector<unsigned char>& png); //optional. Built in textures are already loaded. This is for custom ones from external PNG. Requires PNG file exactly matching the built-in GUI.
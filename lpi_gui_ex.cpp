@@ -710,7 +710,7 @@ void Canvas::handleImpl(const IInput& input)
     {
       Drawer2DTexture drawer(canvas->texture);
       drawer.drawLine(oldMouseX, oldMouseY, drawx, drawy, drawColor);
-      canvas->texture->update();
+      drawer.updateTexture(); //uploads only the part around the line
     }
     oldMouseX = drawx;
     oldMouseY = drawy;
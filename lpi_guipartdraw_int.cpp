@@ -265,7 +265,7 @@ void GUIPartDrawerInternal::initBuiltInGuiTextures64(const ITextureFactory& fact
 
 void GUIPartDrawerInternal::initBuiltInGuiTextures(const ITextureFactory& factory, const std::vector<unsigned char>& png)
 {
-  (void)factory;
+  atlas.setFactory(&factory); //the factory given to the constructor may not exist anymore
   
   
   //these are normally defined as static const in headers, but if GUIDrawer is declared outside of any function, due to order of loading this may be called before ColorRGB's for this translation unit are initialized. So define copies here.
@@ -875,9 +875,10 @@ void BackRule::draw(IDrawer2D& drawer, int x, int y, int length, const ColorRGB&
 GUIPartDrawerInternal::GUIPartDrawerInternal(const ITextureFactory& factory, IDrawer2D* drawer, ITextDrawer* textdrawer)
 : drawer(drawer)
 , textdrawer(textdrawer)
+, atlas(&factory)
 {
   builtInTexture.resize(180);
-  for(size_t i = 0; i < builtInTexture.size(); i++) builtInTexture[i] = factory.createNewTexture();
+  for(size_t i = 0; i < builtInTexture.size(); i++) builtInTexture[i] = atlas.createNewTexture();
   initBuiltInGui(factory);
   initBuiltInIcons();
   guiset = &builtInGuiSet;
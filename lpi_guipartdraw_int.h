@@ -21,6 +21,7 @@ along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licens
 
 #pragma once
 
+#include "lpi_atlas.h"
 #include "lpi_gui_drawer.h"
 #include "lpi_draw2dgl.h"
 #include "lpi_gui_base.h"
@@ -216,6 +217,7 @@ class GUIPartDrawerInternal : public IGUIPartDrawer
     GuiSet* guiset;
     BuiltInIcons icons;
     
+    TextureAtlas atlas; //the built in GUI textures are packed in it, declared before them because it must outlive them
     std::vector<ITexture*> builtInTexture;
     BackPanel builtInPanel[16];
     BackRule builtInRule[5];
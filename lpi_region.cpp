@@ -0,0 +1,217 @@
+/*
+Copyright (c) 2005-2010 Lode Vandevenne
+All rights reserved.
+
+This file is part of Lode's Programming Interface.
+
+Lode's Programming Interface is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Lode's Programming Interface is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "lpi_region.h"
+
+#include <algorithm>
+
+namespace lpi
+{
+
+namespace
+{
+
+/*
+Appends the combination of the spans a (na spans) and b (nb spans) to out. The x0 and x1 values
+of a list are all different and increasing, and at each of them the list goes in or out. So the
+two lists are walked together like in a merge, and the result has a boundary wherever going in
+or out of a or b changes whether the point is in the result.
+*/
+void combineSpans(std::vector<int>& out, const int* a, size_t na, const int* b, size_t nb, int op)
+{
+  size_t ia = 0, ib = 0;
+  bool ina = false, inb = false, in = false;
+  na *= 2;
+  nb *= 2;
+  while(ia < na || ib < nb)
+  {
+    int x = (ib >= nb || (ia < na && a[ia] <= b[ib])) ? a[ia] : b[ib];
+    if(ia < na && a[ia] == x) { ina = !ina; ia++; }
+    if(ib < nb && b[ib] == x) { inb = !inb; ib++; }
+    
+    bool result;
+    if(op == 0) result = ina || inb; //the values of ClipRegion::Operation
+    else if(op == 1) result = ina && inb;
+    else result = ina && !inb;
+    
+    if(result != in)
+    {
+      out.push_back(x);
+      in = result;
+    }
+  }
+}
+
+} //end of anonymous namespace
+
+ClipRegion::ClipRegion()
+{
+}
+
+ClipRegion::ClipRegion(int x0, int y0, int x1, int y1)
+{
+  set(x0, y0, x1, y1);
+}
+
+void ClipRegion::clear()
+{
+  bands.clear();
+  spans.clear();
+}
+
+void ClipRegion::set(int x0, int y0, int x1, int y1)
+{
+  clear();
+  if(x0 >= x1 || y0 >= y1) return;
+  Band band = { y0, y1, 0, 1 };
+  bands.push_back(band);
+  spans.push_back(x0);
+  spans.push_back(x1);
+}
+
+void ClipRegion::getBounds(int& x0, int& y0, int& x1, int& y1) const
+{
+  x0 = y0 = x1 = y1 = 0;
+  if(bands.empty()) return;
+  y0 = bands.front().y0;
+  y1 = bands.back().y1;
+  x0 = spans[2 * bands[0].first];
+  x1 = spans[2 * (bands[0].first + bands[0].count) - 1];
+  for(size_t i = 1; i < bands.size(); i++)
+  {
+    x0 = std::min(x0, spans[2 * bands[i].first]);
+    x1 = std::max(x1, spans[2 * (bands[i].first + bands[i].count) - 1]);
+  }
+}
+
+bool ClipRegion::contains(int x, int y) const
+{
+  size_t i = findBand(y);
+  if(i >= bands.size() || bands[i].y0 > y) return false;
+  const int* s = getSpans(bands[i]);
+  for(size_t j = 0; j < bands[i].count; j++)
+  {
+    if(x < s[2 * j]) return false;
+    if(x < s[2 * j + 1]) return true;
+  }
+  return false;
+}
+
+size_t ClipRegion::findBand(int y, size_t hint) const
+{
+  if(hint < bands.size() && bands[hint].y0 <= y)
+  {
+    if(y < bands[hint].y1) return hint;
+    if(hint + 1 == bands.size() || y < bands[hint + 1].y1) return hint + 1;
+  }
+  
+  size_t lo = 0;
+  size_t hi = bands.size();
+  while(lo < hi)
+  {
+    size_t mid = (lo + hi) / 2;
+    if(bands[mid].y1 <= y) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+/*
+The rows where a band of either region starts or ends divide both regions in ranges of rows in
+which neither changes, the spans of the result are computed once for each such range.
+*/
+void ClipRegion::combine(const ClipRegion& other, Operation op)
+{
+  std::vector<int> ys;
+  for(size_t i = 0; i < bands.size(); i++) { ys.push_back(bands[i].y0); ys.push_back(bands[i].y1); }
+  for(size_t i = 0; i < other.bands.size(); i++) { ys.push_back(other.bands[i].y0); ys.push_back(other.bands[i].y1); }
+  std::sort(ys.begin(), ys.end());
+  ys.erase(std::unique(ys.begin(), ys.end()), ys.end());
+  
+  std::vector<Band> newbands;
+  std::vector<int> newspans;
+  size_t ia = 0;
+  size_t ib = 0;
+  for(size_t i = 0; i + 1 < ys.size(); i++)
+  {
+    int y0 = ys[i];
+    int y1 = ys[i + 1];
+    while(ia < bands.size() && bands[ia].y1 <= y0) ia++;
+    while(ib < other.bands.size() && other.bands[ib].y1 <= y0) ib++;
+    bool hasa = ia < bands.size() && bands[ia].y0 <= y0;
+    bool hasb = ib < other.bands.size() && other.bands[ib].y0 <= y0;
+    
+    size_t first = newspans.size() / 2;
+    combineSpans(newspans, hasa ? getSpans(bands[ia]) : 0, hasa ? bands[ia].count : 0
+                         , hasb ? other.getSpans(other.bands[ib]) : 0, hasb ? other.bands[ib].count : 0, op);
+    size_t count = newspans.size() / 2 - first;
+    if(count == 0) continue;
+    
+    if(!newbands.empty())
+    {
+      Band& last = newbands.back();
+      if(last.y1 == y0 && last.count == count
+      && std::equal(newspans.begin() + 2 * first, newspans.end(), newspans.begin() + 2 * last.first))
+      {
+        last.y1 = y1; //same spans as the band above, make that one higher instead
+        newspans.resize(2 * first);
+        continue;
+      }
+    }
+    
+    Band band = { y0, y1, first, count };
+    newbands.push_back(band);
+  }
+  
+  bands.swap(newbands);
+  spans.swap(newspans);
+}
+
+void ClipRegion::unite(const ClipRegion& other)
+{
+  combine(other, OP_UNITE);
+}
+
+void ClipRegion::intersect(const ClipRegion& other)
+{
+  combine(other, OP_INTERSECT);
+}
+
+void ClipRegion::subtract(const ClipRegion& other)
+{
+  combine(other, OP_SUBTRACT);
+}
+
+void ClipRegion::unite(int x0, int y0, int x1, int y1)
+{
+  combine(ClipRegion(x0, y0, x1, y1), OP_UNITE);
+}
+
+void ClipRegion::intersect(int x0, int y0, int x1, int y1)
+{
+  combine(ClipRegion(x0, y0, x1, y1), OP_INTERSECT);
+}
+
+void ClipRegion::subtract(int x0, int y0, int x1, int y1)
+{
+  combine(ClipRegion(x0, y0, x1, y1), OP_SUBTRACT);
+}
+
+} //namespace lpi
@@ -0,0 +1,97 @@
+/*
+Copyright (c) 2005-2010 Lode Vandevenne
+All rights reserved.
+
+This file is part of Lode's Programming Interface.
+
+Lode's Programming Interface is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Lode's Programming Interface is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/*
+lpi_region: clip regions made of rectangles, such as the part of a window that isn't covered
+by the windows above it. Used as clip area with IDrawer2D::pushScissorRegion.
+
+The region is stored as bands: a band is a range of rows that all have the same horizontal
+spans. The bands are sorted from top to bottom and don't overlap, the spans of a band are
+sorted from left to right and don't overlap or touch, and bands that touch vertically never
+have the same spans (they're merged then). So the same area always has the same bands, and a
+single rectangle is a single band with one span.
+End coordinates are not inclusive, like the scissor of the drawers.
+*/
+
+namespace lpi
+{
+
+class ClipRegion
+{
+  public:
+  
+    struct Band
+    {
+      int y0;
+      int y1;
+      size_t first; //index of the first span in the spans of the region
+      size_t count; //amount of spans
+    };
+    
+    ClipRegion(); //empty
+    ClipRegion(int x0, int y0, int x1, int y1); //one rectangle
+    
+    void clear();
+    void set(int x0, int y0, int x1, int y1);
+    
+    bool empty() const { return bands.empty(); }
+    bool isRectangle() const { return bands.size() == 1 && bands[0].count == 1; }
+    void getBounds(int& x0, int& y0, int& x1, int& y1) const; //all 0 if empty
+    bool contains(int x, int y) const;
+    
+    void unite(const ClipRegion& other);
+    void intersect(const ClipRegion& other);
+    void subtract(const ClipRegion& other); //removes the area of other from this
+    void unite(int x0, int y0, int x1, int y1);
+    void intersect(int x0, int y0, int x1, int y1);
+    void subtract(int x0, int y0, int x1, int y1);
+    
+    size_t getNumBands() const { return bands.size(); }
+    const Band& getBand(size_t i) const { return bands[i]; }
+    //the spans of a band, 2 * band.count values: x0 and x1 of every span
+    const int* getSpans(const Band& band) const { return &spans[2 * band.first]; }
+    /*
+    Returns the first band that ends below row y, that is the band that contains row y or else the
+    first band below it, or getNumBands() if there is none. hint: the result of the previous call,
+    if the rows are asked from top to bottom finding the band then doesn't need a search.
+    */
+    size_t findBand(int y, size_t hint = 0) const;
+    
+  private:
+  
+    enum Operation
+    {
+      OP_UNITE,
+      OP_INTERSECT,
+      OP_SUBTRACT
+    };
+    
+    std::vector<Band> bands;
+    std::vector<int> spans; //x0 and x1 of all spans of all bands
+    
+    void combine(const ClipRegion& other, Operation op);
+};
+
+} //namespace lpi
@@ -0,0 +1,554 @@
+/*
+Copyright (c) 2005-2010 Lode Vandevenne
+All rights reserved.
+
+This file is part of Lode's Programming Interface.
+
+Lode's Programming Interface is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Lode's Programming Interface is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "lpi_scanline.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace lpi
+{
+
+namespace
+{
+
+static const double pi = 3.141592653589793238;
+
+static const int FIX = 16; //subpixel precision of the coordinates
+static const int AA = 4; //anti-aliasing samples per pixel in each direction
+
+//rounded down, also for negative a
+inline int floorDiv(int a, int b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+inline int ceilDiv(int a, int b)
+{
+  return -floorDiv(-a, b);
+}
+
+inline int toFixed(double v)
+{
+  return (int)std::floor(v * FIX + 0.5);
+}
+
+//enough vertices to keep the distance between the segments and the ellipse below 1/16th pixel
+int getEllipseVertices(double radiusx, double radiusy)
+{
+  double r = std::max(std::fabs(radiusx), std::fabs(radiusy));
+  int n = (int)std::ceil(pi * std::sqrt(8.0 * r));
+  return n < 8 ? 8 : n;
+}
+
+} //end of anonymous namespace
+
+void flattenBezier(std::vector<double>& xy, double x0, double y0, double x1, double y1
+                 , double x2, double y2, double x3, double y3, double tolerance)
+{
+  if(xy.empty())
+  {
+    xy.push_back(x0);
+    xy.push_back(y0);
+  }
+  
+  /*
+  The distance between the curve and n segments of equal steps of t is at most 3/4 * d / n^2,
+  with d the length of the largest second difference of the control points (Wang's formula).
+  */
+  double d0 = std::sqrt((x0 - 2 * x1 + x2) * (x0 - 2 * x1 + x2) + (y0 - 2 * y1 + y2) * (y0 - 2 * y1 + y2));
+  double d1 = std::sqrt((x1 - 2 * x2 + x3) * (x1 - 2 * x2 + x3) + (y1 - 2 * y2 + y3) * (y1 - 2 * y2 + y3));
+  double segments = std::ceil(std::sqrt(0.75 * std::max(d0, d1) / tolerance));
+  int n = segments >= 1 ? (segments < 1024 ? (int)segments : 1024) : 1; //the test also catches NaN
+  
+  //the polynomial a * t^3 + b * t^2 + c * t + (x0, y0), evaluated with forward differences
+  double h = 1.0 / n;
+  double ax = -x0 + 3 * x1 - 3 * x2 + x3, ay = -y0 + 3 * y1 - 3 * y2 + y3;
+  double bx = 3 * x0 - 6 * x1 + 3 * x2, by = 3 * y0 - 6 * y1 + 3 * y2;
+  double cx = 3 * (x1 - x0), cy = 3 * (y1 - y0);
+  double x = x0, y = y0;
+  double dx = (ax * h + bx) * h * h + cx * h, dy = (ay * h + by) * h * h + cy * h;
+  double ddx = (6 * ax * h + 2 * bx) * h * h, ddy = (6 * ay * h + 2 * by) * h * h;
+  double dddx = 6 * ax * h * h * h, dddy = 6 * ay * h * h * h;
+  for(int i = 1; i < n; i++)
+  {
+    x += dx;
+    y += dy;
+    dx += ddx;
+    dy += ddy;
+    ddx += dddx;
+    ddy += dddy;
+    xy.push_back(x);
+    xy.push_back(y);
+  }
+  xy.push_back(x3); //exactly, without the rounding errors of the steps
+  xy.push_back(y3);
+}
+
+ScanlineRasterizer::ScanlineRasterizer()
+: antialiasing(false)
+, fillrule(FR_NON_ZERO)
+, open(false)
+, startx(0)
+, starty(0)
+, lastx(0)
+, lasty(0)
+{
+}
+
+void ScanlineRasterizer::clear()
+{
+  edges.clear();
+  open = false;
+}
+
+void ScanlineRasterizer::addEdge(int x0, int y0, int x1, int y1)
+{
+  if(y0 == y1) return; //horizontal edges never cross a sample row
+
+  Edge e;
+  e.dir = y0 < y1 ? 1 : -1;
+  if(y0 > y1)
+  {
+    std::swap(x0, x1);
+    std::swap(y0, y1);
+  }
+  e.x0 = x0;
+  e.y0 = y0;
+  e.x1 = x1;
+  e.y1 = y1;
+  e.first = e.end = 0; //depend on the sample rows, computed by render
+  edges.push_back(e);
+}
+
+void ScanlineRasterizer::moveTo(double x, double y)
+{
+  close();
+  startx = lastx = toFixed(x);
+  starty = lasty = toFixed(y);
+  open = true;
+}
+
+void ScanlineRasterizer::lineTo(double x, double y)
+{
+  if(!open)
+  {
+    moveTo(x, y);
+    return;
+  }
+  int fx = toFixed(x);
+  int fy = toFixed(y);
+  addEdge(lastx, lasty, fx, fy);
+  lastx = fx;
+  lasty = fy;
+}
+
+void ScanlineRasterizer::close()
+{
+  if(!open) return;
+  addEdge(lastx, lasty, startx, starty);
+  lastx = startx;
+  lasty = starty;
+  open = false;
+}
+
+void ScanlineRasterizer::addPolygon(const double* xy, size_t numpoints)
+{
+  if(numpoints == 0) return;
+  moveTo(xy[0], xy[1]);
+  for(size_t i = 1; i < numpoints; i++) lineTo(xy[2 * i], xy[2 * i + 1]);
+  close();
+}
+
+void ScanlineRasterizer::addEllipse(double cx, double cy, double radiusx, double radiusy)
+{
+  radiusx = std::fabs(radiusx);
+  radiusy = std::fabs(radiusy);
+  int n = getEllipseVertices(radiusx, radiusy);
+
+  moveTo(cx + radiusx, cy);
+  for(int i = 1; i < n; i++)
+  {
+    double angle = (2.0 * pi * i) / n;
+    lineTo(cx + radiusx * std::cos(angle), cy + radiusy * std::sin(angle));
+  }
+  close();
+}
+
+void ScanlineRasterizer::addEllipseBorder(double cx, double cy, double radiusx, double radiusy, double width)
+{
+  double h = width / 2;
+  if(!(h > 0)) return;
+  radiusx = std::fabs(radiusx);
+  radiusy = std::fabs(radiusy);
+  addEllipse(cx, cy, radiusx + h, radiusy + h);
+  if(radiusx <= h || radiusy <= h) return; //no hole
+  
+  //the hole goes the other way around, so that the non-zero and even-odd fill rules both leave it empty
+  int n = getEllipseVertices(radiusx + h, radiusy + h);
+  moveTo(cx + radiusx - h, cy);
+  for(int i = 1; i < n; i++)
+  {
+    double angle = (-2.0 * pi * i) / n;
+    lineTo(cx + (radiusx - h) * std::cos(angle), cy + (radiusy - h) * std::sin(angle));
+  }
+  close();
+}
+
+void ScanlineRasterizer::addConvex(const double* xy, size_t numpoints)
+{
+  double area = 0; //twice the signed area, positive in the orientation of addEllipse
+  for(size_t i = 0; i < numpoints; i++)
+  {
+    size_t j = (i + 1) % numpoints;
+    area += xy[2 * i] * xy[2 * j + 1] - xy[2 * j] * xy[2 * i + 1];
+  }
+  if(area == 0) return;
+  for(size_t k = 0; k < numpoints; k++)
+  {
+    size_t i = area > 0 ? k : numpoints - 1 - k;
+    if(k == 0) moveTo(xy[2 * i], xy[2 * i + 1]);
+    else lineTo(xy[2 * i], xy[2 * i + 1]);
+  }
+  close();
+}
+
+void ScanlineRasterizer::addStroke(const double* xy, size_t numpoints, double width, LineJoin join, LineCap cap, bool closed)
+{
+  double h = width / 2;
+  if(!(h > 0)) return;
+  close();
+  
+  //without repeated points, those have no direction
+  points.clear();
+  for(size_t i = 0; i < numpoints; i++)
+  {
+    size_t m = points.size();
+    if(m > 0 && points[m - 2] == xy[2 * i] && points[m - 1] == xy[2 * i + 1]) continue;
+    points.push_back(xy[2 * i]);
+    points.push_back(xy[2 * i + 1]);
+  }
+  size_t m = points.size() / 2;
+  if(closed && m > 1 && points[0] == points[2 * m - 2] && points[1] == points[2 * m - 1]) m--;
+  if(m == 0) return;
+  
+  if(m == 1) //a dot, only visible with caps
+  {
+    double x = points[0], y = points[1];
+    if(closed) return;
+    if(cap == LC_ROUND) addEllipse(x, y, h, h);
+    else if(cap == LC_SQUARE)
+    {
+      double quad[8] = { x - h, y - h, x + h, y - h, x + h, y + h, x - h, y + h };
+      addConvex(quad, 4);
+    }
+    return;
+  }
+  
+  //the segments, as rectangles
+  size_t numsegments = closed ? m : m - 1;
+  for(size_t s = 0; s < numsegments; s++)
+  {
+    double ax = points[2 * s], ay = points[2 * s + 1];
+    double bx = points[2 * ((s + 1) % m)], by = points[2 * ((s + 1) % m) + 1];
+    double len = std::sqrt((bx - ax) * (bx - ax) + (by - ay) * (by - ay));
+    double ux = (bx - ax) / len, uy = (by - ay) / len;
+    if(!closed && cap == LC_SQUARE)
+    {
+      if(s == 0) { ax -= ux * h; ay -= uy * h; }
+      if(s + 1 == numsegments) { bx += ux * h; by += uy * h; }
+    }
+    double nx = -uy * h, ny = ux * h;
+    double quad[8] = { ax + nx, ay + ny, bx + nx, by + ny, bx - nx, by - ny, ax - nx, ay - ny };
+    addConvex(quad, 4);
+  }
+  
+  //the joins fill the gap at the outer side of the corners
+  for(size_t i = closed ? 0 : 1; i < (closed ? m : m - 1); i++)
+  {
+    double px = points[2 * i], py = points[2 * i + 1];
+    if(join == LJ_ROUND)
+    {
+      addEllipse(px, py, h, h);
+      continue;
+    }
+    
+    size_t prev = (i + m - 1) % m, next = (i + 1) % m;
+    double d0x = px - points[2 * prev], d0y = py - points[2 * prev + 1];
+    double d1x = points[2 * next] - px, d1y = points[2 * next + 1] - py;
+    double l0 = std::sqrt(d0x * d0x + d0y * d0y), l1 = std::sqrt(d1x * d1x + d1y * d1y);
+    double cross = d0x * d1y - d0y * d1x;
+    if(cross == 0) continue; //straight on, or turning back, where only a round join would add something
+    
+    double s = cross > 0 ? h : -h; //the normals, of length h, point to the outer side
+    double n0x = d0y / l0 * s, n0y = -d0x / l0 * s;
+    double n1x = d1y / l1 * s, n1y = -d1x / l1 * s;
+    
+    //v is the middle of the bevel, the miter point is in the same direction at distance h * h / |v|
+    double vx = (n0x + n1x) / 2, vy = (n0y + n1y) / 2;
+    double v2 = vx * vx + vy * vy;
+    if(join == LJ_MITER && h * h < STROKE_MITER_LIMIT * STROKE_MITER_LIMIT * v2)
+    {
+      double f = h * h / v2;
+      double quad[8] = { px, py, px + n0x, py + n0y, px + vx * f, py + vy * f, px + n1x, py + n1y };
+      addConvex(quad, 4);
+    }
+    else
+    {
+      double triangle[6] = { px, py, px + n0x, py + n0y, px + n1x, py + n1y };
+      addConvex(triangle, 3);
+    }
+  }
+  
+  if(!closed && cap == LC_ROUND)
+  {
+    addEllipse(points[0], points[1], h, h);
+    addEllipse(points[2 * m - 2], points[2 * m - 1], h, h);
+  }
+}
+
+/*
+Computes where the active edges cross sample row "row", with scale samples per pixel.
+The position of a crossing is given as the index of the first sample at its right, a sample exactly
+on the edge counts as at the right. This is computed exactly: doubles are used because the products
+can be too big for an int, but they're exact integers and the result is rounded correctly.
+*/
+void ScanlineRasterizer::computeCrossings(int row, int scale)
+{
+  int step = FIX / scale;
+  int offset = step / 2; //the samples are in the centers of their area
+  int y = row * step + offset;
+
+  crossings.resize(active.size());
+  for(size_t i = 0; i < active.size(); i++)
+  {
+    const Edge& e = edges[active[i]];
+    double dy = e.y1 - e.y0;
+    double num = (double)(e.x0 - offset) * dy + (double)(y - e.y0) * (e.x1 - e.x0);
+    crossings[i].x = (int)std::ceil(num / (dy * step));
+    crossings[i].dir = e.dir;
+  }
+
+  //the order of the edges changes only where they cross each other, so insertion sort is fast here
+  for(size_t i = 1; i < crossings.size(); i++)
+  {
+    Crossing c = crossings[i];
+    size_t edge = active[i];
+    size_t j = i;
+    while(j > 0 && c < crossings[j - 1])
+    {
+      crossings[j] = crossings[j - 1];
+      active[j] = active[j - 1];
+      j--;
+    }
+    crossings[j] = c;
+    active[j] = edge;
+  }
+}
+
+namespace
+{
+
+//the edge table is sorted on the first row the edges cross
+struct EdgeFirstLess
+{
+  template<typename E>
+  bool operator()(const E& a, const E& b) const { return a.first < b.first; }
+};
+
+} //end of anonymous namespace
+
+namespace
+{
+
+//gives ranges of pixels of a row with their amount of covered samples, from left to right, as spans to a filler
+class RowEmitter
+{
+  private:
+    ISpanFiller& filler;
+    int y;
+    int x0; //x coordinate of coverage[0]
+    std::vector<unsigned char>& coverage;
+    bool pending; //whether there's a span that isn't given to the filler yet
+    bool full; //whether the pending span is completely covered
+    int start;
+    int end;
+
+  public:
+    RowEmitter(ISpanFiller& filler, int y, int x0, std::vector<unsigned char>& coverage)
+    : filler(filler), y(y), x0(x0), coverage(coverage), pending(false), full(false), start(0), end(0)
+    {
+    }
+
+    void flush()
+    {
+      if(!pending) return;
+      if(full) filler.fillSpan(y, start, end);
+      else filler.fillCoverage(y, start, end, &coverage[start - x0]);
+      pending = false;
+    }
+
+    //pixels p0 to p1 (not inclusive) of which total samples out of AA * AA are covered
+    void emit(int p0, int p1, int total)
+    {
+      if(total == 0)
+      {
+        flush();
+        return;
+      }
+      bool isfull = total == AA * AA;
+      if(pending && (isfull != full || p0 != end)) flush();
+      if(!pending)
+      {
+        pending = true;
+        full = isfull;
+        start = p0;
+      }
+      end = p1;
+      if(!isfull)
+      {
+        unsigned char c = (total * 255 + AA * AA / 2) / (AA * AA);
+        for(int p = p0; p < p1; p++) coverage[p - x0] = c;
+      }
+    }
+};
+
+} //end of anonymous namespace
+
+void ScanlineRasterizer::render(ISpanFiller& filler, int clipx0, int clipy0, int clipx1, int clipy1)
+{
+  close();
+  if(edges.empty() || clipx0 >= clipx1 || clipy0 >= clipy1) return;
+
+  int scale = antialiasing ? AA : 1;
+  int step = FIX / scale;
+  int offset = step / 2;
+
+  int firstrow = 0, endrow = 0;
+  for(size_t i = 0; i < edges.size(); i++)
+  {
+    Edge& e = edges[i];
+    e.first = ceilDiv(e.y0 - offset, step);
+    e.end = ceilDiv(e.y1 - offset, step);
+    if(i == 0 || e.first < firstrow) firstrow = e.first;
+    if(i == 0 || e.end > endrow) endrow = e.end;
+  }
+  std::sort(edges.begin(), edges.end(), EdgeFirstLess());
+
+  //pixel rows
+  int py0 = std::max(floorDiv(firstrow, scale), clipy0);
+  int py1 = std::min(ceilDiv(endrow, scale), clipy1);
+
+  //sample columns inside the clip area
+  int sx0 = clipx0 * scale;
+  int sx1 = clipx1 * scale;
+
+  if(antialiasing)
+  {
+    cover.assign(clipx1 - clipx0 + 1, 0);
+    full.assign(clipx1 - clipx0 + 1, 0);
+    coverage.resize(clipx1 - clipx0);
+  }
+
+  active.clear();
+  size_t next = 0; //the next edge of the edge table that has to be added to the active edge list
+
+  for(int py = py0; py < py1; py++)
+  {
+    touched.clear(); //anti-aliasing: the pixels where cover or full was changed in this row
+
+    for(int row = py * scale; row < (py + 1) * scale; row++)
+    {
+      //update the active edge list
+      while(next < edges.size() && edges[next].first <= row) active.push_back(next++);
+      size_t j = 0;
+      for(size_t i = 0; i < active.size(); i++)
+      {
+        if(edges[active[i]].end > row) active[j++] = active[i];
+      }
+      active.resize(j);
+      if(active.empty()) continue;
+
+      computeCrossings(row, scale);
+
+      int winding = 0;
+      int spanstart = 0;
+      for(size_t i = 0; i < crossings.size(); i++)
+      {
+        bool before = fillrule == FR_NON_ZERO ? winding != 0 : (winding & 1) != 0;
+        winding += crossings[i].dir;
+        bool after = fillrule == FR_NON_ZERO ? winding != 0 : (winding & 1) != 0;
+        if(!before && after) spanstart = crossings[i].x;
+        else if(before && !after)
+        {
+          int a = std::max(spanstart, sx0);
+          int b = std::min(crossings[i].x, sx1);
+          if(a >= b) continue;
+
+          if(!antialiasing)
+          {
+            filler.fillSpan(py, a, b);
+            continue;
+          }
+
+          //count the covered samples per pixel. Pixels of which all 4 samples of this row are covered are
+          //only marked at the start and end of the range, so long spans cost no more than short ones.
+          int pa = floorDiv(a, AA);
+          int pb = floorDiv(b, AA);
+          touched.push_back(pa);
+          if(pa == pb) cover[pa - clipx0] += b - a;
+          else
+          {
+            cover[pa - clipx0] += AA * (pa + 1) - a;
+            full[pa + 1 - clipx0] += AA;
+            full[pb - clipx0] -= AA;
+            cover[pb - clipx0] += b - AA * pb;
+            touched.push_back(pa + 1);
+            touched.push_back(pb);
+          }
+        }
+      }
+    }
+
+    if(!antialiasing || touched.empty()) continue;
+
+    /*
+    Give the pixels of the row to the filler, runs of completely covered pixels as spans. Between
+    the touched pixels, the amount of covered samples is the same for every pixel, so only the
+    touched pixels are visited, also if the shape is wide (e.g. a curve that comes back).
+    */
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+    RowEmitter emitter(filler, py, clipx0, coverage);
+    int run = 0;
+    for(size_t k = 0; k < touched.size(); k++)
+    {
+      int p = touched[k];
+      if(k > 0 && touched[k - 1] + 1 < p) emitter.emit(touched[k - 1] + 1, p, run);
+      int i = p - clipx0;
+      run += full[i];
+      if(p < clipx1) emitter.emit(p, p + 1, cover[i] + run);
+      cover[i] = full[i] = 0;
+    }
+    emitter.flush();
+  }
+}
+
+} //namespace lpi
@@ -0,0 +1,166 @@
+/*
+Copyright (c) 2005-2010 Lode Vandevenne
+All rights reserved.
+
+This file is part of Lode's Programming Interface.
+
+Lode's Programming Interface is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Lode's Programming Interface is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+/*
+lpi_scanline: scanline polygon rasterizer, used by ADrawer2DBuffer to fill triangles,
+quads, polygons and ellipses.
+
+The edges are kept in an edge table sorted on their top, and while going down the rows
+an active edge list holds the edges that cross the current row. The pixels of a row that
+are inside the polygon are given as horizontal spans to an ISpanFiller.
+
+Pixel (x, y) is the square from (x, y) to (x + 1, y + 1), so its center is at (x + 0.5, y + 0.5).
+Without anti-aliasing, a pixel is inside if its center is. With anti-aliasing, 4x4 samples
+per pixel are used and pixels on the border get a coverage in range 0-255.
+Samples exactly on an edge are inside for left and top edges only, so polygons that share
+an edge don't draw its pixels twice.
+
+Coordinates are rounded to 1/16th of a pixel, and everything after that is exact, so
+which pixels are drawn doesn't depend on the clip rectangle.
+
+Lines with a width are drawn by adding their outline with addStroke: every segment, join
+and cap is added as a separate convex polygon, all with the same orientation, so that the
+non-zero fill rule fills their union and overlapping parts aren't drawn twice.
+*/
+
+namespace lpi
+{
+
+//receives the spans of a polygon, row by row from top to bottom, with the x coordinates of the spans increasing
+class ISpanFiller
+{
+  public:
+    virtual ~ISpanFiller(){}
+
+    //pixels x0 to x1 (not inclusive) of row y are completely inside
+    virtual void fillSpan(int y, int x0, int x1) = 0;
+    //pixels x0 to x1 (not inclusive) of row y are partially inside, coverage has the coverage of each pixel (1-254)
+    virtual void fillCoverage(int y, int x0, int x1, const unsigned char* coverage) = 0;
+};
+
+//the shape where two segments of a stroked line meet
+enum LineJoin
+{
+  LJ_MITER, //the outer borders are extended until they meet, or beveled if that's more than STROKE_MITER_LIMIT times the half width away
+  LJ_ROUND, //a circle around the point
+  LJ_BEVEL //the outer corners are connected with a straight line
+};
+
+//the shape of the ends of a stroked line that isn't closed
+enum LineCap
+{
+  LC_BUTT, //ends exactly at the end point
+  LC_SQUARE, //extended by half the width
+  LC_ROUND //a half circle around the end point
+};
+
+const double STROKE_MITER_LIMIT = 4.0;
+
+/*
+Appends a cubic Bezier curve from (x0, y0) to (x3, y3) with handles (x1, y1) and (x2, y2)
+to the polyline xy (x and y coordinates of the points after each other), as line segments
+that are at most tolerance away from the curve. (x0, y0) is appended only if xy is empty,
+otherwise it must be the last point of xy already, so that curves can be chained.
+The amount of segments depends on how much the curve bends, and they're computed
+iteratively, with forward differencing.
+*/
+void flattenBezier(std::vector<double>& xy, double x0, double y0, double x1, double y1
+                 , double x2, double y2, double x3, double y3, double tolerance = 0.25);
+
+class ScanlineRasterizer
+{
+  public:
+
+    enum FillRule
+    {
+      FR_NON_ZERO, //inside if the edges around it wind around it (default)
+      FR_EVEN_ODD //inside if a ray from it crosses an odd amount of edges
+    };
+
+    ScanlineRasterizer();
+
+    void clear(); //removes all edges, the settings stay
+    void setAntiAliasing(bool set) { antialiasing = set; }
+    void setFillRule(FillRule rule) { fillrule = rule; }
+
+    //outlines, they're closed automatically
+    void moveTo(double x, double y);
+    void lineTo(double x, double y);
+    void close();
+
+    void addPolygon(const double* xy, size_t numpoints); //xy has 2 * numpoints coordinates
+    void addEllipse(double cx, double cy, double radiusx, double radiusy); //as a polygon with enough vertices to look round
+    //the border of an ellipse with a width: the ellipse with the radii increased by half the width minus the one with them decreased by it
+    void addEllipseBorder(double cx, double cy, double radiusx, double radiusy, double width);
+    
+    /*
+    Adds the outline of a line of the given width along the polyline xy (numpoints points). With
+    closed, the last point is connected to the first one and there are no caps. Only works with
+    the fill rule FR_NON_ZERO.
+    */
+    void addStroke(const double* xy, size_t numpoints, double width, LineJoin join, LineCap cap, bool closed);
+
+    //gives all spans inside the clip rectangle (x1 and y1 not inclusive) to filler
+    void render(ISpanFiller& filler, int clipx0, int clipy0, int clipx1, int clipy1);
+
+  private:
+
+    struct Edge
+    {
+      int x0, y0, x1, y1; //in 1/16th pixels, y0 < y1
+      int dir; //1 if going down, -1 if going up
+      int first; //the first sample row the edge crosses
+      int end; //the first sample row below the edge
+    };
+
+    struct Crossing
+    {
+      int x; //index of the first sample to the right of the crossing
+      int dir;
+      bool operator<(const Crossing& other) const { return x < other.x; }
+    };
+
+    bool antialiasing;
+    FillRule fillrule;
+
+    std::vector<Edge> edges; //the edge table
+    std::vector<size_t> active; //the active edge list: indices in edges
+    std::vector<Crossing> crossings;
+    std::vector<int> cover; //anti-aliasing: amount of covered samples per pixel of the current row
+    std::vector<int> full; //anti-aliasing: start (+) and end (-) of the pixels with all samples of a sample row covered
+    std::vector<unsigned char> coverage;
+    std::vector<int> touched; //anti-aliasing: the pixels of the current row where cover or full changed
+    std::vector<double> points; //for addStroke, kept to reuse its memory
+
+    bool open; //whether there is an unclosed outline
+    int startx, starty; //start of the current outline
+    int lastx, lasty; //last point of the current outline
+
+    void addEdge(int x0, int y0, int x1, int y1);
+    void addConvex(const double* xy, size_t numpoints); //adds the polygon with the same orientation as addEllipse
+    void computeCrossings(int row, int scale);
+};
+
+} //namespace lpi
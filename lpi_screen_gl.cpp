@@ -20,6 +20,7 @@ along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licens
 
 #include "lpi_screen_gl.h"
 #include "lpi_os.h"
+#include "lpi_texture.h"
 
 #include <GL/gl.h>
 #include <iostream>
@@ -95,6 +96,7 @@ ScreenGL::ScreenGL(int width, int height, bool fullscreen, bool enable_fsaa, boo
 ScreenGL::~ScreenGL()
 {
   if(print_debug_messages) std::cout << "info: Quitting SDL" << std::endl;
+  shutdownImageAlphaThreads();
   SDL_Quit();
   if(print_debug_messages) std::cout << "info: SDL Quit" << std::endl;
 }
@@ -162,6 +164,7 @@ bool ScreenGL::setVideoMode(int width, int height, bool fullscreen, bool enable_
 
 void ScreenGL::changeResolution(int width, int height, bool fullscreen, bool enable_fsaa, bool resizable, const char* text, bool print_debug_messages)
 {
+  context.flush();
   w = width;
   h = height;
   
@@ -194,6 +197,7 @@ void ScreenGL::unlock()
 //clear the screen to given color again
 void ScreenGL::cls(const ColorRGB& color)
 {
+  context.flush();
   glClearColor(color.r / 255.0, color.g / 255.0, color.b / 255.0, 0);  //the clear color
   glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
 }
@@ -201,7 +205,9 @@ void ScreenGL::cls(const ColorRGB& color)
 //make the content that you drew to the backbuffer visible by swapping the buffers
 void ScreenGL::redraw()
 {
+  context.flush();
   SDL_GL_SwapBuffers();
+  context.getResidency().nextFrame(); //uploads and evicts textures between the frames, within its budget
 }
 
 int ScreenGL::screenWidth()
@@ -238,6 +244,9 @@ void ScreenGL::set2DScreen(int w, int h, bool filledGeometry)
     if(screenMode == 1) { glTranslated(TWIDDLEX, TWIDDLEY, 0); screenMode = 0; return; }
     screenMode = 0;
   }
+  
+  //drawing in 3D is done with OpenGL itself, so the state that the context remembers may be wrong now
+  context.getState().invalidate();
 
   //the official code for "Setting Your Raster Position to a Pixel Location" (i.e. set up an oldskool 2D screen)
   glViewport(0, 0, w, h);
@@ -305,11 +314,12 @@ void ScreenGL::initGL()
   //glShadeModel(GL_FLAT); //shading, don't do the GL_FLAT thing or gradient rectangles don't work anymore
   //glCullFace(GL_BACK); //culling
   //glFrontFace(GL_CCW);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  glEnable(GL_BLEND);
-  glDisable(GL_ALPHA_TEST);
+  GLState& state = context.getState();
+  state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  state.enable(GL_BLEND);
+  state.disable(GL_ALPHA_TEST);
   
-  glEnable(GL_SCISSOR_TEST); //scissoring is used to, for example, not draw parts of textures that are scrolled away, and is always enabled (but by default the scissor area is as big as the screen)
+  state.enable(GL_SCISSOR_TEST); //scissoring is used to, for example, not draw parts of textures that are scrolled away, and is always enabled (but by default the scissor area is as big as the screen)
   
   GLint array[4];
   glGetIntegerv(GL_VIEWPORT, array); //get viewport size from OpenGL
@@ -344,6 +354,7 @@ void ScreenGL::set2DScreen(bool filledGeometry)
 
 void ScreenGL::set3DScreen(double near, double far)
 {
+  context.flush(); //the 2D batch must be drawn with the 2D screen
   if(screenMode == 2) return;
   
   GLint array[4];
@@ -354,23 +365,23 @@ void ScreenGL::set3DScreen(double near, double far)
 void ScreenGL::enableOneSided()
 {
    glCullFace(GL_BACK);
-   glEnable(GL_CULL_FACE);
+   context.getState().enable(GL_CULL_FACE);
 }
 
 void ScreenGL::enableTwoSided()
 {
-  glDisable(GL_CULL_FACE);
+  context.getState().disable(GL_CULL_FACE);
 }
 
 
 void ScreenGL::enableZBuffer()
 {
-  glEnable(GL_DEPTH_TEST);
+  context.getState().enable(GL_DEPTH_TEST);
 }
 
 void ScreenGL::disableZBuffer()
 {
-  glDisable(GL_DEPTH_TEST);
+  context.getState().disable(GL_DEPTH_TEST);
 }
 
 bool ScreenGL::onScreen(int x, int y)
@@ -418,9 +429,10 @@ void ScreenGL::setSmallestScissor(int left, int top, int right, int bottom)
 //uses the extern scissor area variables to set the scissoring area of OpenGL
 void ScreenGL::setOpenGLScissor()
 {
+  context.flush(); //what is batched was drawn with the previous scissor
   GLint array[4];
   glGetIntegerv(GL_VIEWPORT, array); //array[3] contains the height in pixels of the viewport
-  glScissor(clipLeft.back(), array[3] - clipBottom.back(), clipRight.back() - clipLeft.back(), clipBottom.back() - clipTop.back());
+  context.getState().scissor(clipLeft.back(), array[3] - clipBottom.back(), clipRight.back() - clipLeft.back(), clipBottom.back() - clipTop.back());
 }
 
 //reset the scissor area back to the previous coordinates before your last setScissor call (works like a stack)
@@ -48,7 +48,7 @@ void TextDrawerGL::drawText(const std::string& text, int x, int y, const Font& f
 
 namespace
 {
-void drawFontTexture(int n, int x, int y, TextureGL* texture)
+void drawFontTexture(Drawer2DGL* drawer, int n, int x, int y, const TextureGL* texture, const ColorRGB& color)
 {
   int u = texture->getU() / 16;
   int v = texture->getV() / 16;
@@ -62,24 +62,15 @@ void drawFontTexture(int n, int x, int y, TextureGL* texture)
   float v1 = (n / 16 + 1) * v3;
 
   //note how in the texture coordinates x and y are swapped because the texture buffers are 90 degrees rotated
-  glTexCoord2f(u0, v0); glVertex2i(x + 0, y + 0);
-  glTexCoord2f(u1, v0); glVertex2i(x + u, y + 0);
-  glTexCoord2f(u1, v1); glVertex2i(x + u, y + v);
-  glTexCoord2f(u0, v1); glVertex2i(x + 0, y + v);
-  
+  drawer->addTexturedQuad(texture, 0, false, x, y, x + u, y + v, u0, v0, u1, v1, color);
 }
 
-//glBegin(GL_QUADS) must already have been called before using this function, as well as binding the texture
-void renderText(TextureGL* texturegl
+//the glyphs go in the batch of the drawer, so a whole GUI of text is drawn with few draw calls
+void renderText(Drawer2DGL* drawer, const TextureGL* texturegl
               , const std::string& text, int x, int y
               , int sw, int sh, const ColorRGB& color
               , unsigned long forceLength)
 {
-
-  //TODO: use VBO's
-
-  glColor4ub(color.r, color.g, color.b, color.a);
-  
   unsigned long pos = 0;
   int drawX = x;
   int drawY = y;
@@ -100,7 +91,7 @@ void renderText(TextureGL* texturegl
     }
     else
     {
-      drawFontTexture(text[pos], drawX, drawY, texturegl);
+      drawFontTexture(drawer, text[pos], drawX, drawY, texturegl, color);
       drawX += sw;
     }
     pos++;
@@ -123,25 +114,19 @@ void TextDrawerGL::printText(const std::string& text, int x, int y, const Font&
   const InternalGlyphs::Glyphs* glyphs = getGlyphsForFont(font);
   TextureGL* texturegl = dynamic_cast<TextureGL*>(glyphs->texture[0]);
   
-  drawer->prepareDrawTextured();
   texturegl->updateForNewOpenGLContextIfNeeded();
-  texturegl->bind(false, 0);
-  
-  glBegin(GL_QUADS);
   
   if(font.shadow)
   {
-    renderText(texturegl, text, x + 1, y + 1, glyphs->width, glyphs->height, font.shadowColor, forceLength);
+    renderText(drawer, texturegl, text, x + 1, y + 1, glyphs->width, glyphs->height, font.shadowColor, forceLength);
   }
   
-  renderText(texturegl, text, x, y, glyphs->width, glyphs->height, font.color, forceLength);
+  renderText(drawer, texturegl, text, x, y, glyphs->width, glyphs->height, font.color, forceLength);
   
   if(font.bold) //bold
   {
-    renderText(texturegl, text, x + 1, y, glyphs->width, glyphs->height, font.color, forceLength);
+    renderText(drawer, texturegl, text, x + 1, y, glyphs->width, glyphs->height, font.color, forceLength);
   }
-  
-  glEnd();
 }
 
 void TextDrawerGL::calcTextRectSize(int& w, int& h, const std::string& text, const Font& font) const
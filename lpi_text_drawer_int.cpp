@@ -51,25 +51,25 @@ void InternalTextDrawer::drawText(const std::string& text, int x, int y, const F
   print(text, x, y, font);
 }
 
-void InternalTextDrawer::drawLetter(unsigned char n, int x, int y, const InternalGlyphs::Glyphs* glyphs, const Font& font)
+void InternalTextDrawer::addLetter(unsigned char n, int x, int y, const InternalGlyphs::Glyphs* glyphs, const Font& font)
 {
   //int italic = 0; //todo: this doesn't work anymore, no function to draw skewed texture available currently!!
   
   //draw the background, using the "completely filled" letter: ascii char 219
   /*if(font->background)
   {
-    drawer->drawTexture(glyphs->texture[219], x, y, font.backgroundColor);
+    letters.push_back(SpriteInstance(glyphs->texture[219], x, y, font.backgroundColor));
   }*/
   if(font.shadow)
   {
-    drawer->drawTexture(glyphs->texture[n], x + 1, y + 1, font.shadowColor);
+    letters.push_back(SpriteInstance(glyphs->texture[n], x + 1, y + 1, font.shadowColor));
   }
   
-  drawer->drawTexture(glyphs->texture[n], x, y, font.color);
+  letters.push_back(SpriteInstance(glyphs->texture[n], x, y, font.color));
   
   if(font.bold) //bold
   {
-    drawer->drawTexture(glyphs->texture[n], x + 1, y, font.color);
+    letters.push_back(SpriteInstance(glyphs->texture[n], x + 1, y, font.color));
   }
 }
 
@@ -84,9 +84,11 @@ const InternalGlyphs::Glyphs* InternalTextDrawer::getGlyphsForFont(const Font& f
 
 //Draws a string of text, and uses some of the ascii control characters, e.g. newline
 //Other control characters (ascii value < 32) are ignored and have no effect.
+//The glyphs are all drawn together with drawTextures, in the same order as drawing them one by one.
 void InternalTextDrawer::printText(const std::string& text, int x, int y, const Font& font, unsigned long forceLength)
 {
   const InternalGlyphs::Glyphs* glyphs = getGlyphsForFont(font);
+  letters.clear();
   unsigned long pos = 0;
   int drawX = x;
   int drawY = y;
@@ -96,7 +98,7 @@ void InternalTextDrawer::printText(const std::string& text, int x, int y, const
      symbol = text[pos];
      if(symbol > 31 || symbol < 0) //it's a signed char, below 0 are the ones above 128
      {
-       drawLetter(text[pos], drawX, drawY, glyphs, font);
+       addLetter(text[pos], drawX, drawY, glyphs, font);
        drawX += glyphs->width;
      }
      else
@@ -112,6 +114,8 @@ void InternalTextDrawer::printText(const std::string& text, int x, int y, const
      }
      pos++;
   }
+  
+  if(!letters.empty()) drawer->drawTextures(&letters[0], letters.size());
 }
 
 
@@ -390,6 +394,7 @@ void InternalTextDrawer::calcTextCharToPos(int& x, int& y, size_t index, const s
 }
 
 InternalGlyphs::InternalGlyphs(const ITextureFactory* factory, bool allInOneBigTexture)
+: atlas(factory)
 {
   initBuiltInFontTextures(factory, allInOneBigTexture);
 }
@@ -546,10 +551,11 @@ void InternalGlyphs::initBuiltInFontTextures(const ITextureFactory* factory, boo
   }
   else
   {
-    loadTexturesFromBase64PNG(glyphs8x8.texture, factory, getBuiltIn8x8FontTexture(), 8, 8, AE_BlackKey);
-    loadTexturesFromBase64PNG(glyphs7x9.texture, factory, getBuiltIn7x9FontTexture(), 7, 9, AE_BlackKey);
-    loadTexturesFromBase64PNG(glyphs6x6.texture, factory, getBuiltIn6x6FontTexture(), 6, 6, AE_BlackKey);
-    loadTexturesFromBase64PNG(glyphs4x5.texture, factory, getBuiltIn4x5FontTexture(), 4, 5, AE_BlackKey);
+    //all the glyphs of the 4 typefaces fit in one page of the atlas
+    loadTexturesFromBase64PNG(glyphs8x8.texture, &atlas, getBuiltIn8x8FontTexture(), 8, 8, AE_BlackKey);
+    loadTexturesFromBase64PNG(glyphs7x9.texture, &atlas, getBuiltIn7x9FontTexture(), 7, 9, AE_BlackKey);
+    loadTexturesFromBase64PNG(glyphs6x6.texture, &atlas, getBuiltIn6x6FontTexture(), 6, 6, AE_BlackKey);
+    loadTexturesFromBase64PNG(glyphs4x5.texture, &atlas, getBuiltIn4x5FontTexture(), 4, 5, AE_BlackKey);
   }
 }
 
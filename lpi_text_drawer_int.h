@@ -20,6 +20,7 @@ along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licens
 
 #pragma once
 
+#include "lpi_atlas.h"
 #include "lpi_texture.h"
 #include "lpi_color.h"
 #include "lpi_font.h"
@@ -64,9 +65,14 @@ InternalGlyphs: internal lpi bitmap typefaces
 Uses a texture to describe each glyph of vareous internally defined LPI typefaces (lpi8, lpi6, lpi4)
 Currently not extendable to support other typefaces.
 Needs an ITextureFactory to create the textures of the correct type for that what suits your need.
+The glyphs are packed in a TextureAtlas made with that factory, so that drawing text uses only one
+texture, unless allInOneBigTexture is used (then each typeface is one texture of 16x16 glyphs).
 */
 class InternalGlyphs
 {
+  private:
+    TextureAtlas atlas; //declared before the glyphs, it must outlive them
+  
   public:
     struct Glyphs
     {
@@ -100,7 +106,9 @@ class InternalTextDrawer : public ITextDrawer //uses InternalGlyphs
   IDrawer2D* drawer;
   InternalGlyphs glyphs;
   
-  void drawLetter(unsigned char n, int x, int y, const InternalGlyphs::Glyphs* glyphs, const Font& font);
+  std::vector<SpriteInstance> letters; //the glyphs of printText, drawn with one drawTextures call, kept to reuse its memory
+  
+  void addLetter(unsigned char n, int x, int y, const InternalGlyphs::Glyphs* glyphs, const Font& font);
   
   const InternalGlyphs::Glyphs* getGlyphsForFont(const Font& font) const;
   
@@ -22,8 +22,12 @@ along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licens
 
 #include "lodepng.h"
 #include "lpi_base64.h"
+#include "lpi_blend.h"
+#include "lpi_thread.h"
 
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 
 namespace lpi
@@ -37,6 +41,29 @@ ITexture::~ITexture()
 {
 }
 
+const ITexture* ITexture::getStorage(int& x, int& y) const
+{
+  x = 0;
+  y = 0;
+  return this;
+}
+
+namespace
+{
+
+//the loading functions get straight alpha, textures with premultiplied alpha convert it once here
+void premultiplyLoadedTexture(ITexture* texture)
+{
+  if(!isPremultiplied(texture)) return;
+  for(size_t y = 0; y < texture->getV(); y++)
+  {
+    unsigned char* row = &texture->getBuffer()[4 * texture->getU2() * y];
+    premultiplySpan(row, row, texture->getU());
+  }
+}
+
+} //end of anonymous namespace
+
 void loadTextures(std::vector<unsigned char>& buffer, std::vector<ITexture*>& textures, const ITextureFactory* factory, int widths, int heights, int w, int h, const AlphaEffect& effect)
 {
   int numx, numy;
@@ -142,6 +169,276 @@ void loadTextures(const std::string& filename, std::vector<HTexture>& textures,
 ////////////////////////////////////////////////////////////////////////////////
 //****************************************************************************//
 
+namespace
+{
+
+//(255 * d) / m is (d * reciprocal[m]) >> 16 for 0 <= d <= m <= 255, exact (the error stays below 1 / m), and fits in 32 bits
+struct SaturationTable
+{
+  unsigned int reciprocal[256];
+  
+  SaturationTable()
+  {
+    reciprocal[0] = 0; //saturation 0 for black
+    for(unsigned int m = 1; m < 256; m++) reciprocal[m] = (255u * 65536u + m - 1) / m;
+  }
+};
+
+const SaturationTable saturationtable;
+
+/*
+An AlphaEffect decoded once for a whole image, instead of per pixel. Where the alpha depends on
+one channel it comes from a table that includes the inversion of &64, the other styles compute it
+without branches, and the color keys are compared with the SIMD kernels of lpi_blend. apply does
+one row of pixels at a time, so that the passes of the modifiers find the row in the cache.
+*/
+class AlphaKernel
+{
+  private:
+    enum Source
+    {
+      S_NONE, //the alpha stays as it is (apart from the modifiers)
+      S_TABLE, //table[channel]
+      S_KEY, //keyalpha for the key color, otheralpha for the other pixels
+      S_AVERAGE2, //average of channel and channel2
+      S_BRIGHTNESS,
+      S_LIGHTNESS,
+      S_DARKNESS,
+      S_VALUE,
+      S_SATURATION,
+      S_MODULATED
+    };
+    
+    Source source;
+    int channel;
+    int channel2;
+    int invert; //255 if the computed alpha must be inverted (XOR with it), 0 otherwise
+    unsigned char table[256];
+    unsigned short modulation[256]; //for S_MODULATED: 2 * |c - 128|
+    int keyalpha;
+    int otheralpha;
+    
+    bool validkey; //false if the alphaColor is out of range, then no pixel has it
+    unsigned char key[3];
+    bool makekeyinvisible; //&128
+    bool setcolor; //&256
+    unsigned char color[3];
+    bool setvalue; //&512
+    int value; //the HSV value of alphaColor
+    bool shadow128; //&1024
+    bool shadow64; //&2048
+    
+  public:
+    AlphaKernel(const AlphaEffect& effect);
+    void apply(unsigned char* pixels, size_t n) const;
+};
+
+AlphaKernel::AlphaKernel(const AlphaEffect& effect)
+: source(S_NONE)
+, channel(3)
+, channel2(3)
+, invert((effect.style & 64) ? 255 : 0)
+, keyalpha(0)
+, otheralpha(-1)
+{
+  const ColorRGB& c = effect.alphaColor;
+  validkey = c.r >= 0 && c.r <= 255 && c.g >= 0 && c.g <= 255 && c.b >= 0 && c.b <= 255;
+  key[0] = color[0] = (unsigned char)c.r;
+  key[1] = color[1] = (unsigned char)c.g;
+  key[2] = color[2] = (unsigned char)c.b;
+  makekeyinvisible = (effect.style & 128) != 0 && validkey;
+  setcolor = (effect.style & 256) != 0;
+  setvalue = (effect.style & 512) != 0;
+  value = setvalue ? RGBtoHSV(c).v : 0;
+  shadow128 = (effect.style & 1024) != 0;
+  shadow64 = (effect.style & 2048) != 0;
+  
+  int a = effect.alpha;
+  switch(effect.style & 63)
+  {
+    case 1: source = S_TABLE; for(int i = 0; i < 256; i++) table[i] = a; break;
+    case 2: source = S_KEY; keyalpha = 255; otheralpha = a; break;
+    case 3: source = S_KEY; keyalpha = a; otheralpha = 255; break;
+    case 4: source = S_BRIGHTNESS; break;
+    case 5: source = S_LIGHTNESS; break;
+    case 6: source = S_DARKNESS; break;
+    case 7: source = S_VALUE; break;
+    case 8: source = S_SATURATION; break;
+    case 9: case 10: case 11:
+      source = S_TABLE;
+      channel = (effect.style & 63) - 9;
+      for(int i = 0; i < 256; i++) table[i] = i;
+      break;
+    case 12: source = S_AVERAGE2; channel = 1; channel2 = 2; break;
+    case 13: source = S_AVERAGE2; channel = 0; channel2 = 2; break;
+    case 14: source = S_AVERAGE2; channel = 0; channel2 = 1; break;
+    //15-18 change the alpha channel itself, dividing through 0 leaves it at 255
+    case 15: source = S_TABLE; for(int i = 0; i < 256; i++) table[i] = a == 0 ? 255 : i / a; break;
+    case 16: source = S_TABLE; for(int i = 0; i < 256; i++) table[i] = std::min(255, i * a); break;
+    case 17: source = S_TABLE; for(int i = 0; i < 256; i++) table[i] = std::max(0, i - a); break;
+    case 18: source = S_TABLE; for(int i = 0; i < 256; i++) table[i] = std::min(255, i + a); break;
+    case 19: case 20:
+      source = S_MODULATED;
+      if((effect.style & 63) == 20) invert ^= 255;
+      for(int i = 0; i < 256; i++) modulation[i] = 2 * std::abs(i - 128);
+      break;
+    default:
+      //only the inversion of the current alpha
+      if(invert)
+      {
+        source = S_TABLE;
+        for(int i = 0; i < 256; i++) table[i] = i;
+      }
+      break;
+  }
+  
+  //the inversion is done beforehand where possible
+  if(source == S_TABLE)
+  {
+    for(int i = 0; i < 256; i++) table[i] ^= invert;
+    invert = 0;
+  }
+  else if(source == S_KEY)
+  {
+    keyalpha ^= invert;
+    otheralpha ^= invert;
+    invert = 0;
+    if(!validkey)
+    {
+      source = S_TABLE;
+      for(int i = 0; i < 256; i++) table[i] = otheralpha;
+    }
+  }
+}
+
+void AlphaKernel::apply(unsigned char* pixels, size_t n) const
+{
+  unsigned char* p = pixels;
+  switch(source)
+  {
+    case S_NONE: break;
+    case S_TABLE: for(size_t i = 0; i < n; i++) p[4 * i + 3] = table[p[4 * i + channel]]; break;
+    case S_KEY: setAlphaOfColorKey(pixels, n, key, keyalpha, otheralpha); break;
+    case S_AVERAGE2: for(size_t i = 0; i < n; i++) p[4 * i + 3] = ((p[4 * i + channel] + p[4 * i + channel2]) >> 1) ^ invert; break;
+    case S_BRIGHTNESS:
+      //x / 3 is (x * 21846) >> 16 for x up to 768
+      for(size_t i = 0; i < n; i++) p[4 * i + 3] = (((p[4 * i + 0] + p[4 * i + 1] + p[4 * i + 2]) * 21846) >> 16) ^ invert;
+      break;
+    case S_LIGHTNESS:
+      for(size_t i = 0; i < n; i++)
+      {
+        int r = p[4 * i + 0], g = p[4 * i + 1], b = p[4 * i + 2];
+        int minc = r < g ? r : g;
+        minc = b < minc ? b : minc;
+        int maxc = r > g ? r : g;
+        maxc = b > maxc ? b : maxc;
+        p[4 * i + 3] = ((minc + maxc) >> 1) ^ invert;
+      }
+      break;
+    case S_DARKNESS:
+      for(size_t i = 0; i < n; i++) p[4 * i + 3] = std::min(p[4 * i + 0], std::min(p[4 * i + 1], p[4 * i + 2])) ^ invert;
+      break;
+    case S_VALUE:
+      for(size_t i = 0; i < n; i++) p[4 * i + 3] = std::max(p[4 * i + 0], std::max(p[4 * i + 1], p[4 * i + 2])) ^ invert;
+      break;
+    case S_SATURATION:
+      for(size_t i = 0; i < n; i++)
+      {
+        int r = p[4 * i + 0], g = p[4 * i + 1], b = p[4 * i + 2];
+        //written as selects, so that they compile to conditional moves instead of branches
+        int minc = r < g ? r : g;
+        minc = b < minc ? b : minc;
+        int maxc = r > g ? r : g;
+        maxc = b > maxc ? b : maxc;
+        p[4 * i + 3] = (int)(((unsigned)(maxc - minc) * saturationtable.reciprocal[maxc]) >> 16) ^ invert;
+      }
+      break;
+    case S_MODULATED:
+      for(size_t i = 0; i < n; i++)
+      {
+        int sum = modulation[p[4 * i + 0]] + modulation[p[4 * i + 1]] + modulation[p[4 * i + 2]];
+        p[4 * i + 3] = std::min(255, (sum * 21846) >> 16) ^ invert;
+      }
+      break;
+  }
+  
+  if(makekeyinvisible) setAlphaOfColorKey(pixels, n, key, 0);
+  
+  if(setcolor)
+  for(size_t i = 0; i < n; i++)
+  {
+    p[4 * i + 0] = color[0];
+    p[4 * i + 1] = color[1];
+    p[4 * i + 2] = color[2];
+  }
+  
+  if(setvalue)
+  {
+    //neighbouring pixels often have the same color, the conversion is only done when it changes
+    int last = -1;
+    ColorRGB result;
+    for(size_t i = 0; i < n; i++)
+    {
+      int rgb = p[4 * i + 0] | (p[4 * i + 1] << 8) | (p[4 * i + 2] << 16);
+      if(rgb != last)
+      {
+        ColorHSV hsv = RGBtoHSV(ColorRGB(p[4 * i + 0], p[4 * i + 1], p[4 * i + 2]));
+        result = HSVtoRGB(ColorHSV(hsv.h, hsv.s, value));
+        last = rgb;
+      }
+      p[4 * i + 0] = result.r;
+      p[4 * i + 1] = result.g;
+      p[4 * i + 2] = result.b;
+    }
+  }
+  
+  if(shadow128)
+  {
+    static const unsigned char magenta[3] = { 128, 0, 128 }, shadow[4] = { 0, 0, 0, 128 };
+    replaceColorKey(pixels, n, magenta, shadow);
+  }
+  if(shadow64)
+  {
+    static const unsigned char magenta[3] = { 192, 0, 192 }, shadow[4] = { 0, 0, 0, 64 };
+    replaceColorKey(pixels, n, magenta, shadow);
+  }
+}
+
+/*
+Large images are done in strips of rows by the threads of this pool. It's made the first time it's
+needed and deleted by shutdownImageAlphaThreads, not by a static destructor, which would run after
+SDL_Quit.
+*/
+ThreadMutex alphapoolmutex; //one image at a time
+ThreadPool* alphapool = 0;
+
+class AlphaJob : public ThreadPool::Job
+{
+  private:
+    const AlphaKernel& kernel;
+    unsigned char* image;
+    size_t pitch;
+    int x0, y0, y1;
+    size_t n; //pixels per row
+    int rows; //rows per strip
+  
+  public:
+    AlphaJob(const AlphaKernel& kernel, unsigned char* image, size_t pitch, int x0, int y0, int y1, size_t n, int rows)
+    : kernel(kernel), image(image), pitch(pitch), x0(x0), y0(y0), y1(y1), n(n), rows(rows)
+    {
+    }
+    
+    virtual void execute(size_t index, size_t thread)
+    {
+      (void)thread;
+      int begin = y0 + index * rows;
+      int end = std::min(y1, begin + rows);
+      for(int y = begin; y < end; y++) kernel.apply(&image[4 * (pitch * y + x0)], n);
+    }
+};
+
+} //end of anonymous namespace
+
 /*
 The function createImageAlpha takes an image buffer and gives it an alpha channel.
 For example, it can give an image an alpha channel to make darker pixels more
@@ -221,316 +518,34 @@ EXAMPLE: style 68 (4 | 64) makes alphachannel depend on brightness, and makes ke
 */
 void createImageAlpha(unsigned char* image, int w, int h, const AlphaEffect& effect)
 {
-  if(effect.style == 0) return; //no effect to be done, just return instead of going through the loop
-  
-  if((effect.style & 63) > 0)
-  switch(effect.style & 63) //&63 to filter out the extra modifiers: those are handled later on
-  {
-    case 1:
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      image[index + 3] = effect.alpha;
-    }
-    break;
-    case 2:
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      int r = image[index + 0];
-      int g = image[index + 1];
-      int b = image[index + 2];
-      bool alphaPixel = (r == effect.alphaColor.r && g == effect.alphaColor.g && b == effect.alphaColor.b);
-      if(!alphaPixel) image[index + 3] = effect.alpha;
-      else image[index + 3] = 255;
-    }
-    break;
-    case 3:
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      int r = image[index + 0];
-      int g = image[index + 1];
-      int b = image[index + 2];
-      bool alphaPixel = (r == effect.alphaColor.r && g == effect.alphaColor.g && b == effect.alphaColor.b);
-      if(!alphaPixel) image[index + 3] = 255;
-      else image[index + 3] = effect.alpha;
-    }
-    break;
-    case 4:
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      int r = image[index + 0];
-      int g = image[index + 1];
-      int b = image[index + 2];
-      int alpha = (r + g + b) / 3;
-      if(alpha < 0) alpha = 0; if(alpha > 255) alpha = 255;
-      image[index + 3] = alpha;
-    }
-    break;
-    case 5:
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      int r = image[index + 0];
-      int g = image[index + 1];
-      int b = image[index + 2];
-      int minc = r; if(g < minc) minc = g; if(b < minc) minc = b;
-      int maxc = r; if(g > maxc) maxc = g; if(b > maxc) maxc = b;
-
-      image[index + 3] = (minc + maxc) / 2;
-    }
-    break;
-    case 6:
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      int r = image[index + 0];
-      int g = image[index + 1];
-      int b = image[index + 2];
-      int minc = r; if(g < minc) minc = g; if(b < minc) minc = b;
-
-      image[index + 3] = minc;
-    }
-    break;
-    case 7:
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      int r = image[index + 0];
-      int g = image[index + 1];
-      int b = image[index + 2];
-      int maxc = r; if(g > maxc) maxc = g; if(b > maxc) maxc = b;
+  createImageAlpha(image, w, 0, 0, w, h, effect);
+}
 
-      image[index + 3] = maxc;
-    }
-    break;
-    case 8: //saturation of the HSV model
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      int r = image[index + 0];
-      int g = image[index + 1];
-      int b = image[index + 2];
-      int minc = r; if(g < minc) minc = g; if(b < minc) minc = b;
-      int maxc = r; if(g > maxc) maxc = g; if(b > maxc) maxc = b;
-
-      if(maxc == 0) image[index + 3] = 0;
-      else image[index + 3] = (255 * (maxc - minc)) / maxc;
-    }
-    break;
-    case 9:
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      int r = image[index + 0];
-      image[index + 3] = r;
-    }
-    break;
-    case 10:
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      int g = image[index + 1];
-      image[index + 3] = g;
-    }
-    break;
-    case 11:
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      int b = image[index + 2];
-      image[index + 3] = b;
-    }
-    break;
-    case 12:
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      int g = image[index + 1];
-      int b = image[index + 2];
-      image[index + 3] = (g + b) / 2;
-    }
-    break;
-    case 13:
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      int r = image[index + 0];
-      int b = image[index + 2];
-      image[index + 3] = (r + b) / 2;
-    }
-    break;
-    case 14:
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      int r = image[index + 0];
-      int g = image[index + 1];
-      image[index + 3] = (r + g) / 2;
-    }
-    break;
-    case 15:
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      image[index + 3] /= effect.alpha;
-    }
-    break;
-    case 16:
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      
-      int temp = image[index + 3] * effect.alpha;
-      if(temp > 255) temp = 255;
-      image[index + 3] = temp;
-    }
-    break;
-    case 17:
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      
-      int temp = image[index + 3] - effect.alpha;
-      if(temp < 0) temp = 0;
-      image[index + 3] = temp;
-    }
-    break;
-    case 18:
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      
-      int temp = image[index + 3] + effect.alpha;
-      if(temp > 255) temp = 255;
-      image[index + 3] = temp;
-    }
-    break;
-    case 19: //modulated
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      int r = image[index + 0];
-      int g = image[index + 1];
-      int b = image[index + 2];
-      int alpha = (2 * abs(r - 128)
-            + 2 * abs(g - 128)
-            + 2 * abs(b - 128)) / 3;
-      if(alpha < 0) alpha = 0; if(alpha > 255) alpha = 255;
-      image[index + 3] = alpha;
-    }
-    break;
-    case 20: //inverse modulated
-    for(int x = 0; x < w; x++)
-    for(int y = 0; y < h; y++)
-    {
-      int index = h * 4 * x + 4 * y;
-      int r = image[index + 0];
-      int g = image[index + 1];
-      int b = image[index + 2];
-      int alpha = (2 * abs(r - 128)
-            + 2 * abs(g - 128)
-            + 2 * abs(b - 128)) / 3;
-      if(alpha < 0) alpha = 0; if(alpha > 255) alpha = 255;
-      image[index + 3] = 255 - alpha;
-    }
-    break;
-    default:
-    break;
-  }
-  
-  if(effect.style & 64)
-  for(int x = 0; x < w; x++)
-  for(int y = 0; y < h; y++)
-  {
-    int index = h * 4 * x + 4 * y; 
-    image[index + 3] = 255 - image[index + 3];
-  }
+void createImageAlpha(unsigned char* image, size_t pitch, int x0, int y0, int x1, int y1, const AlphaEffect& effect)
+{
+  if(effect.style == 0 || x0 >= x1 || y0 >= y1) return; //no effect to be done, just return instead of going through the loop
   
-  if(effect.style & 128)
-  for(int x = 0; x < w; x++)
-  for(int y = 0; y < h; y++)
+  AlphaKernel kernel(effect);
+  size_t n = x1 - x0;
+  if(n * (y1 - y0) < 131072)
   {
-    int index = h * 4 * x + 4 * y; 
-    int r = image[index + 0];
-    int g = image[index + 1];
-    int b = image[index + 2];
-    bool alphaPixel = (r == effect.alphaColor.r && g == effect.alphaColor.g && b == effect.alphaColor.b);
-    if(alphaPixel) image[index + 3] = 0;
+    for(int y = y0; y < y1; y++) kernel.apply(&image[4 * (pitch * y + x0)], n);
+    return;
   }
   
-  if(effect.style & 256)
-  for(int x = 0; x < w; x++)
-  for(int y = 0; y < h; y++)
-  {
-    int index = h * 4 * x + 4 * y; 
-    image[index + 0] = effect.alphaColor.r;
-    image[index + 1] = effect.alphaColor.g;
-    image[index + 2] = effect.alphaColor.b;
-  }
-
-  if(effect.style & 512)
-  for(int x = 0; x < w; x++)
-  for(int y = 0; y < h; y++)
-  {
-    int index = h * 4 * x + 4 * y; 
-    int r = image[index + 0];
-    int g = image[index + 1];
-    int b = image[index + 2];
-    ColorRGB pixelRGB = ColorRGB(r, g, b);
-    ColorHSV pixelHSV = RGBtoHSV(pixelRGB);
-    ColorHSV alphaHSV = RGBtoHSV(effect.alphaColor);
-    ColorRGB HpSpVa = HSVtoRGB(ColorHSV(pixelHSV.h, pixelHSV.s, alphaHSV.v));
-    
-    image[index + 0] = HpSpVa.r;
-    image[index + 1] = HpSpVa.g;
-    image[index + 2] = HpSpVa.b;
-  }
+  //large images, e.g. sprite sheets, in strips of about 32768 pixels on all processors
+  int rows = std::max(1, (int)(32768 / n));
+  ThreadLock lock(alphapoolmutex);
+  if(!alphapool) alphapool = new ThreadPool;
+  AlphaJob job(kernel, image, pitch, x0, y0, y1, n, rows);
+  alphapool->run(job, (y1 - y0 + rows - 1) / rows);
+}
 
-  if(effect.style & 1024 || effect.style & 2048)
-  for(int x = 0; x < w; x++)
-  for(int y = 0; y < h; y++)
-  {
-    int index = h * 4 * x + 4 * y; 
-    int r = image[index + 0];
-    int g = image[index + 1];
-    int b = image[index + 2];
-    if(effect.style & 1024 && r == 128 && g == 0 && b == 128)
-    {
-      image[index + 0] = 0;
-      image[index + 1] = 0;
-      image[index + 2] = 0;
-      image[index + 3] = 128;
-    }
-    if(effect.style & 2048 && r == 192 && g == 0 && b == 192)
-    {
-      image[index + 0] = 0;
-      image[index + 1] = 0;
-      image[index + 2] = 0;
-      image[index + 3] = 64;
-    }
-  }
+void shutdownImageAlphaThreads()
+{
+  ThreadLock lock(alphapoolmutex);
+  delete alphapool;
+  alphapool = 0;
 }
 
 AlphaEffect::AlphaEffect(int style, unsigned char alpha, const ColorRGB& alphaColor)
@@ -560,6 +575,8 @@ void loadTextureFromBase64PNG(ITexture* texture, const std::string& base64, cons
   createImageAlpha(pixels.empty() ? 0 : &pixels[0], pngdec.getWidth(), pngdec.getHeight(), effect);
   texture->setSize(pngdec.getWidth(), pngdec.getHeight());
   setAlignedBuffer(texture, pixels.empty() ? 0 : &pixels[0]);
+  premultiplyLoadedTexture(texture);
+  texture->update();
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -583,6 +600,7 @@ void makeTextureSolid(ITexture* texture, const ColorRGB& color, size_t w, size_t
     tbuffer[4 * u2 * y + 4 * x + 3] = color.a;
   }
 
+  premultiplyLoadedTexture(texture);
   texture->update();
 }
 
@@ -615,6 +633,7 @@ void makeTextureFromBuffer(ITexture* texture, unsigned char* buffer, size_t w, s
   }
   
   applyAlphaEffect(texture, effect);
+  premultiplyLoadedTexture(texture);
   texture->update();
 }
 
@@ -700,7 +719,8 @@ void makeTextureAlphaFromPNGFile(ITexture* texture, const std::string& filename,
 //Create an alpha channel for the texture with the wanted effect
 void applyAlphaEffect(ITexture* texture, const AlphaEffect& effect)
 {
-  createImageAlpha(texture->getBuffer(), texture->getU2(), texture->getV2(), effect);
+  //only the part u * v of the buffer: the rows of an AtlasTexture are part of the rows of its page, the pixels after them aren't its own
+  createImageAlpha(texture->getBuffer(), texture->getU2(), 0, 0, texture->getU(), texture->getV(), effect);
   texture->update();
 }
 
@@ -775,17 +795,21 @@ void setPixel(ITexture* texture, int x, int y, const ColorRGB& color)
   buffer[y * u2 * 4 + x * 4 + 1] = color.g;
   buffer[y * u2 * 4 + x * 4 + 2] = color.b;
   buffer[y * u2 * 4 + x * 4 + 3] = color.a;
+  if(isPremultiplied(texture)) premultiplySpan(&buffer[y * u2 * 4 + x * 4], &buffer[y * u2 * 4 + x * 4], 1);
 }
 
 ColorRGB getPixel(const ITexture* texture, int x, int y)
 {
   ColorRGB result;
+  unsigned char pixel[4];
   const unsigned char* buffer = texture->getBuffer();
   size_t u2 = texture->getU2();
-  result.r = buffer[y * u2 * 4 + x * 4 + 0];
-  result.g = buffer[y * u2 * 4 + x * 4 + 1];
-  result.b = buffer[y * u2 * 4 + x * 4 + 2];
-  result.a = buffer[y * u2 * 4 + x * 4 + 3];
+  if(isPremultiplied(texture)) unpremultiplySpan(pixel, &buffer[y * u2 * 4 + x * 4], 1);
+  else for(size_t c = 0; c < 4; c++) pixel[c] = buffer[y * u2 * 4 + x * 4 + c];
+  result.r = pixel[0];
+  result.g = pixel[1];
+  result.b = pixel[2];
+  result.a = pixel[3];
   return result;
 }
 
@@ -840,14 +864,34 @@ HTexture::~HTexture()
 TextureBuffer::TextureBuffer()
 : u(0)
 , v(0)
+, opaque(-1)
+, premultiplied(false)
+, usespans(true)
+, spansbuilt(-1)
+, usemipmaps(false)
+, gammamipmaps(false)
+, mipx0(0)
+, mipy0(0)
+, mipx1(0)
+, mipy1(0)
 {
 }
 
+void TextureBuffer::invalidateCaches()
+{
+  opaque = -1;
+  spansbuilt = -1;
+  spans.clear();
+  rowspans.clear();
+}
+
 void TextureBuffer::setSize(size_t u, size_t v)
 {
   buffer.resize(u * v * 4);
   this->u = u;
   this->v = v;
+  invalidateCaches();
+  mipmaps.clear(); //other sizes, they're all made again
 }
 
 size_t TextureBuffer::getU() const
@@ -882,18 +926,212 @@ const unsigned char* TextureBuffer::getBuffer() const
 
 void TextureBuffer::update()
 {
-  //nothing to do :)
+  invalidateCaches();
+  mipx0 = 0;
+  mipy0 = 0;
+  mipx1 = u;
+  mipy1 = v;
 }
 
 void TextureBuffer::updatePartial(int x0, int y0, int x1, int y1)
 {
-  //standard way to suppress the warnings
-  (void)x0;
-  (void)y0;
-  (void)x1;
-  (void)y1;
+  invalidateCaches();
   
-  //nothing to do :)
+  //only this part of the mipmaps has to be made again
+  if(x0 < 0) x0 = 0;
+  if(y0 < 0) y0 = 0;
+  if(x1 > (int)u) x1 = u;
+  if(y1 > (int)v) y1 = v;
+  if(x0 >= x1 || y0 >= y1) return;
+  if(mipx0 >= mipx1 || mipy0 >= mipy1)
+  {
+    mipx0 = x0;
+    mipy0 = y0;
+    mipx1 = x1;
+    mipy1 = y1;
+  }
+  else
+  {
+    mipx0 = std::min(mipx0, x0);
+    mipy0 = std::min(mipy0, y0);
+    mipx1 = std::max(mipx1, x1);
+    mipy1 = std::max(mipy1, y1);
+  }
+}
+
+bool TextureBuffer::isOpaque() const
+{
+  if(opaque < 0)
+  {
+    opaque = 1;
+    for(size_t i = 3; i < buffer.size(); i += 4)
+    {
+      if(buffer[i] != 255)
+      {
+        opaque = 0;
+        break;
+      }
+    }
+  }
+  return opaque == 1;
+}
+
+const TextureBuffer::Span* TextureBuffer::getSpans(size_t y, size_t& count) const
+{
+  if(spansbuilt < 0)
+  {
+    spansbuilt = 0;
+    if(usespans && u > 0 && v > 0)
+    {
+      rowspans.resize(v + 1);
+      for(size_t ty = 0; ty < v; ty++)
+      {
+        rowspans[ty] = spans.size();
+        const unsigned char* row = &buffer[4 * u * ty];
+        for(size_t x = 0; x < u; x++)
+        {
+          int a = row[4 * x + 3];
+          SpanType type = a == 0 ? ST_TRANSPARENT : (a == 255 ? ST_OPAQUE : ST_TRANSLUCENT);
+          if(spans.size() > rowspans[ty] && spans.back().type == type) spans.back().end++;
+          else
+          {
+            Span span;
+            span.end = x + 1;
+            span.type = type;
+            spans.push_back(span);
+          }
+        }
+      }
+      rowspans[v] = spans.size();
+      
+      //with less than 16 pixels per span on average, the overhead per span is more than what is saved
+      if(spans.size() * 16 <= u * v) spansbuilt = 1;
+      else
+      {
+        std::vector<Span>().swap(spans);
+        std::vector<size_t>().swap(rowspans);
+      }
+    }
+  }
+  if(spansbuilt == 0 || y >= v)
+  {
+    count = 0;
+    return 0;
+  }
+  count = rowspans[y + 1] - rowspans[y];
+  return &spans[rowspans[y]];
+}
+
+void TextureBuffer::setUseSpanIndex(bool use)
+{
+  usespans = use;
+  invalidateCaches();
+}
+
+void TextureBuffer::setUseMipmaps(bool use, bool gamma)
+{
+  if(use == usemipmaps && gamma == gammamipmaps) return;
+  usemipmaps = use;
+  gammamipmaps = gamma;
+  std::vector<MipLevel>().swap(mipmaps);
+}
+
+size_t TextureBuffer::getNumMipmapLevels() const
+{
+  if(!usemipmaps || u == 0 || v == 0) return 1;
+  size_t levels = 1;
+  for(size_t lu = u, lv = v; lu > 1 || lv > 1; levels++)
+  {
+    lu = (lu + 1) / 2;
+    lv = (lv + 1) / 2;
+  }
+  return levels;
+}
+
+const unsigned char* TextureBuffer::getMipmap(size_t level, size_t& u, size_t& v) const
+{
+  if(level == 0)
+  {
+    u = this->u;
+    v = this->v;
+    return getBuffer();
+  }
+  if(!usemipmaps || this->u == 0 || this->v == 0) return 0;
+  if(mipmaps.empty() || (mipx0 < mipx1 && mipy0 < mipy1)) buildMipmaps();
+  if(level > mipmaps.size()) return 0;
+  const MipLevel& m = mipmaps[level - 1];
+  u = m.u;
+  v = m.v;
+  return &m.buffer[0];
+}
+
+void TextureBuffer::buildMipmaps() const
+{
+  int x0 = mipx0, y0 = mipy0, x1 = mipx1, y1 = mipy1;
+  if(mipmaps.empty())
+  {
+    //the sizes are rounded up, the last pixel of an odd row or column is averaged with itself
+    for(size_t lu = u, lv = v; lu > 1 || lv > 1;)
+    {
+      lu = (lu + 1) / 2;
+      lv = (lv + 1) / 2;
+      mipmaps.push_back(MipLevel());
+      mipmaps.back().u = lu;
+      mipmaps.back().v = lv;
+      mipmaps.back().buffer.resize(4 * lu * lv);
+    }
+    x0 = 0;
+    y0 = 0;
+    x1 = u;
+    y1 = v;
+  }
+  mipx0 = mipy0 = mipx1 = mipy1 = 0;
+  
+  bool straight = !premultiplied && !isOpaque();
+  const unsigned char* in = &buffer[0];
+  size_t iu = u;
+  size_t iv = v;
+  for(size_t l = 0; l < mipmaps.size() && x0 < x1 && y0 < y1; l++)
+  {
+    //the changed part of this level
+    x0 /= 2;
+    y0 /= 2;
+    x1 = (x1 + 1) / 2;
+    y1 = (y1 + 1) / 2;
+    MipLevel& m = mipmaps[l];
+    int pairs = std::min(x1, (int)(iu / 2)); //the pixels that have two columns
+    for(int y = y0; y < y1; y++)
+    {
+      const unsigned char* row0 = &in[4 * iu * (2 * y)];
+      const unsigned char* row1 = 2 * y + 1 < (int)iv ? row0 + 4 * iu : row0;
+      unsigned char* out = &m.buffer[4 * m.u * y];
+      if(pairs > x0) downsample2x2(out + 4 * x0, row0 + 8 * x0, row1 + 8 * x0, pairs - x0, straight, gammamipmaps);
+      if(x1 > pairs)
+      {
+        unsigned char last0[8], last1[8];
+        std::memcpy(last0, row0 + 8 * pairs, 4);
+        std::memcpy(last0 + 4, row0 + 8 * pairs, 4);
+        std::memcpy(last1, row1 + 8 * pairs, 4);
+        std::memcpy(last1 + 4, row1 + 8 * pairs, 4);
+        downsample2x2(out + 4 * pairs, last0, last1, 1, straight, gammamipmaps);
+      }
+    }
+    in = &m.buffer[0];
+    iu = m.u;
+    iv = m.v;
+  }
+}
+
+void TextureBuffer::setPremultiplied(bool set, bool convert)
+{
+  if(set == premultiplied) return;
+  premultiplied = set;
+  //the mipmaps are averaged differently now
+  mipmaps.clear();
+  //the opacity doesn't change, so no update needed
+  if(!convert || buffer.empty()) return;
+  if(set) premultiplySpan(&buffer[0], &buffer[0], u * v);
+  else unpremultiplySpan(&buffer[0], &buffer[0], u * v);
 }
 
 void copyTexture(ITexture* dest, const ITexture* source)
@@ -911,7 +1149,23 @@ void copyTexture(ITexture* dest, const ITexture* source)
     size_t indexb = y * u2b * 4 + x * 4 + c;
     dest->getBuffer()[indexb] = source->getBuffer()[index];
   }
+  if(isPremultiplied(dest) != isPremultiplied(source))
+  {
+    for(size_t y = 0; y < v; y++)
+    {
+      unsigned char* row = &dest->getBuffer()[y * u2b * 4];
+      if(isPremultiplied(dest)) premultiplySpan(row, row, u);
+      else unpremultiplySpan(row, row, u);
+    }
+  }
   dest->update();
 }
 
+bool isPremultiplied(const ITexture* texture)
+{
+  int x, y;
+  const TextureBuffer* t = texture ? dynamic_cast<const TextureBuffer*>(texture->getStorage(x, y)) : 0;
+  return t && t->isPremultiplied();
+}
+
 } //namespace lpi
@@ -83,6 +83,13 @@ class ITexture
   x1 and y1 are the end coordinates of the rectangular area and are *not* inclusive.
   */
   virtual void updatePartial(int x0, int y0, int x1, int y1) = 0;
+  
+  /*
+  Returns the texture that really has the pixels of this one, and sets x and y to the position of
+  this one in it. That's the texture itself at 0, 0, except for textures that are a part of a
+  larger one, like the regions of a texture atlas.
+  */
+  virtual const ITexture* getStorage(int& x, int& y) const;
 };
 
 /*
@@ -130,10 +137,50 @@ can contain the complete data but doesn't have any dependencies.
 */
 class TextureBuffer : public ITexture
 {
+  public:
+  
+    enum SpanType
+    {
+      ST_TRANSPARENT, //alpha 0
+      ST_OPAQUE, //alpha 255
+      ST_TRANSLUCENT //anything in between
+    };
+    
+    //a run of pixels of a row with the same type, from the end of the previous span of the row (or 0) to end
+    struct Span
+    {
+      int end; //not inclusive
+      SpanType type;
+    };
+  
   private:
     std::vector<unsigned char> buffer;
     size_t u;
     size_t v;
+    
+    mutable int opaque; //cached result of isOpaque: -1 = unknown, 0 = no, 1 = yes
+    bool premultiplied;
+    
+    //the span index, see getSpans
+    bool usespans;
+    mutable int spansbuilt; //-1 = unknown, 0 = not worth it, 1 = built
+    mutable std::vector<Span> spans;
+    mutable std::vector<size_t> rowspans; //index in spans of the first span of each row, plus the end
+    
+    //the mipmaps, see getMipmap
+    struct MipLevel
+    {
+      size_t u;
+      size_t v;
+      std::vector<unsigned char> buffer;
+    };
+    bool usemipmaps;
+    bool gammamipmaps;
+    mutable std::vector<MipLevel> mipmaps; //level 1 and the smaller ones, empty if not built
+    mutable int mipx0, mipy0, mipx1, mipy1; //the part of the buffer that changed since the mipmaps were built
+    
+    void invalidateCaches();
+    void buildMipmaps() const; //builds them, or rebuilds the changed part
 
   public:
 
@@ -151,6 +198,60 @@ class TextureBuffer : public ITexture
 
     virtual void update();
     virtual void updatePartial(int x0, int y0, int x1, int y1);
+    
+    /*
+    returns true if all pixels have alpha 255. The result is computed the first time it's
+    needed and cached until setSize, update or updatePartial is called, so as for any texture,
+    call update after changing the buffer.
+    */
+    bool isOpaque() const;
+    
+    /*
+    Premultiplied alpha, off by default: the buffer has the color channels already multiplied
+    with the alpha channel. An ADrawer2DBuffer blends such textures with less operations, and
+    the bilinear filtering of scaled draws doesn't mix in the color of transparent pixels.
+    setPremultiplied converts the current contents, unless convert is false (if the buffer
+    already has the new format). Set it before loading the texture: the functions below that
+    load or set colors (makeTextureFromBuffer, loadTextures, setPixel, ...) take straight alpha
+    and convert it once, so that drawing doesn't have to.
+    */
+    void setPremultiplied(bool set, bool convert = true);
+    bool isPremultiplied() const { return premultiplied; }
+    
+    /*
+    The span index: per row, the runs of fully transparent, opaque and translucent pixels,
+    so that ADrawer2DBuffer can skip the transparent pixels and copy the opaque ones instead
+    of blending every pixel, e.g. for glyphs and GUI parts. Like isOpaque, it's built the first
+    time it's needed and cached until setSize, update or updatePartial is called.
+    getSpans returns the spans of row y and sets count to their amount, or returns 0 if
+    there's no index: if disabled with setUseSpanIndex, or if the runs are so short (e.g.
+    small glyphs, or noise in the alpha channel) that using them would be slower than blending every pixel.
+    */
+    const Span* getSpans(size_t y, size_t& count) const;
+    void setUseSpanIndex(bool use); //enabled by default
+    
+    /*
+    Mipmaps, off by default: the texture halved in size again and again down to 1x1, each pixel
+    the average of 2x2 pixels of the previous level. ADrawer2DBuffer draws a texture that is
+    scaled down with the level closest to the drawn size, which doesn't alias and reads less
+    memory. gamma: average as linear light instead of sRGB values (slower to build: the other
+    averages use SSE2 where available, this one is always scalar because it needs table lookups).
+    The levels are built the first time they're needed, after update they're built again, but
+    after updatePartial only the part that changed is.
+    getMipmap returns the buffer of the level (0 is the texture itself) and sets u and v to its
+    size, the rows of the buffer are u pixels long. It returns 0 if the level doesn't exist.
+    */
+    void setUseMipmaps(bool use, bool gamma = false);
+    bool getUseMipmaps() const { return usemipmaps; }
+    size_t getNumMipmapLevels() const; //including level 0, 1 if mipmaps are off
+    const unsigned char* getMipmap(size_t level, size_t& u, size_t& v) const;
+};
+
+//a TextureBuffer with premultiplied alpha, e.g. to load textures with TextureFactory<TextureBufferPremultiplied>
+class TextureBufferPremultiplied : public TextureBuffer
+{
+  public:
+    TextureBufferPremultiplied() { setPremultiplied(true); }
 };
 
 /*
@@ -206,6 +307,14 @@ static const AlphaEffect AE_IModulated(20, 255, RGB_White); //Inverse Modulated
 static const AlphaEffect AE_Saturation(8, 255, RGB_White); //Saturation to alpha
 
 void createImageAlpha(unsigned char* image, int w, int h, const AlphaEffect& effect);
+//the same in place on the part x0-x1, y0-y1 of an image with rows of pitch pixels (e.g. getU2() of a texture)
+void createImageAlpha(unsigned char* image, size_t pitch, int x0, int y0, int x1, int y1, const AlphaEffect& effect);
+/*
+createImageAlpha does large images in parallel, with threads that are started the first time it
+needs them. This stops them: call it before SDL_Quit, if createImageAlpha may have used them (the
+destructor of ScreenGL does). They're started again if needed after this.
+*/
+void shutdownImageAlphaThreads();
 
 ///utility functions
 
@@ -243,5 +352,7 @@ ColorRGB getPixel(const ITexture* texture, int x, int y);
 
 void copyTexture(ITexture* dest, const ITexture* source);
 
+bool isPremultiplied(const ITexture* texture); //true if the texture is a TextureBuffer with premultiplied alpha
+
 } //namespace lpi
 
@@ -0,0 +1,297 @@
+/*
+Copyright (c) 2005-2010 Lode Vandevenne
+All rights reserved.
+
+This file is part of Lode's Programming Interface.
+
+Lode's Programming Interface is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Lode's Programming Interface is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "lpi_texture_cache.h"
+
+#include <sstream>
+
+namespace lpi
+{
+
+namespace
+{
+  //the alpha effect is part of the key, the same image with another effect is another texture
+  std::string makeEffectKey(const AlphaEffect& effect)
+  {
+    std::ostringstream ss;
+    ss << effect.style << ',' << (int)effect.alpha << ','
+       << effect.alphaColor.r << ',' << effect.alphaColor.g << ',' << effect.alphaColor.b << ',' << effect.alphaColor.a;
+    return ss.str();
+  }
+
+  //two different 32-bit hashes (FNV-1a and djb2) and the length, so that two images having the same key is practically impossible
+  std::string makeContentKey(const std::string& data)
+  {
+    unsigned long fnv = 2166136261ul;
+    unsigned long djb = 5381ul;
+    for(size_t i = 0; i < data.size(); i++)
+    {
+      unsigned char c = data[i];
+      fnv = ((fnv ^ c) * 16777619ul) & 0xfffffffful;
+      djb = ((djb << 5) + djb + c) & 0xfffffffful;
+    }
+    std::ostringstream ss;
+    ss << std::hex << fnv << '-' << djb << '-' << std::dec << data.size();
+    return ss.str();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//TextureCache::Handle//////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+TextureCache::Handle::Handle()
+: cache(0)
+, entry(0)
+{
+}
+
+TextureCache::Handle::Handle(TextureCache* cache, Entry* entry)
+: cache(cache)
+, entry(entry)
+{
+}
+
+TextureCache::Handle::Handle(const Handle& other)
+: cache(0)
+, entry(0)
+{
+  if(other.entry)
+  {
+    ThreadLock lock(other.cache->mutex);
+    other.cache->acquire(other.entry);
+    cache = other.cache;
+    entry = other.entry;
+  }
+}
+
+TextureCache::Handle::~Handle()
+{
+  reset();
+}
+
+TextureCache::Handle& TextureCache::Handle::operator=(const Handle& other)
+{
+  if(entry == other.entry) return *this;
+  Handle copy(other);
+  reset();
+  cache = copy.cache;
+  entry = copy.entry;
+  copy.entry = 0;
+  return *this;
+}
+
+const std::string& TextureCache::Handle::getKey() const
+{
+  static const std::string none;
+  return entry ? entry->key : none;
+}
+
+void TextureCache::Handle::reset()
+{
+  if(entry) cache->release(entry);
+  cache = 0;
+  entry = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//TextureCache//////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+TextureCache::TextureCache(const ITextureFactory* factory, size_t budget, bool gpucopy)
+: factory(factory)
+, budget(budget)
+, gpucopy(gpucopy)
+{
+}
+
+TextureCache::~TextureCache()
+{
+  for(std::map<std::string, Entry*>::iterator it = entries.begin(); it != entries.end(); ++it)
+  {
+    delete it->second->texture;
+    delete it->second;
+  }
+}
+
+size_t TextureCache::getTextureBytes(const ITexture* texture) const
+{
+  size_t bytes = 4 * texture->getU2() * texture->getV2();
+  return gpucopy ? 2 * bytes : bytes;
+}
+
+void TextureCache::acquire(Entry* entry)
+{
+  if(entry->refcount == 0)
+  {
+    unused.erase(entry->unused);
+    stats.used++;
+  }
+  entry->refcount++;
+}
+
+void TextureCache::release(Entry* entry)
+{
+  ThreadLock lock(mutex);
+  entry->refcount--;
+  if(entry->refcount == 0)
+  {
+    unused.push_front(entry);
+    entry->unused = unused.begin();
+    stats.used--;
+    trimLocked(budget);
+  }
+}
+
+void TextureCache::evict(Entry* entry)
+{
+  unused.erase(entry->unused);
+  entries.erase(entry->key);
+  stats.bytes -= entry->bytes;
+  stats.entries--;
+  stats.evictions++;
+  delete entry->texture;
+  delete entry;
+}
+
+void TextureCache::trimLocked(size_t budget)
+{
+  while(stats.bytes > budget && !unused.empty()) evict(unused.back());
+}
+
+TextureCache::Entry* TextureCache::insertLocked(const std::string& key, ITexture* texture)
+{
+  std::map<std::string, Entry*>::iterator it = entries.find(key);
+  if(it != entries.end())
+  {
+    //another thread loaded the same texture at the same time
+    delete texture;
+    acquire(it->second);
+    return it->second;
+  }
+
+  Entry* entry = new Entry;
+  entry->key = key;
+  entry->texture = texture;
+  entry->bytes = getTextureBytes(texture);
+  entry->refcount = 1;
+  entries[key] = entry;
+  stats.entries++;
+  stats.used++;
+  stats.bytes += entry->bytes;
+  //the new texture has a handle, so this only evicts others
+  trimLocked(budget);
+  return entry;
+}
+
+TextureCache::Handle TextureCache::lookup(const std::string& key)
+{
+  Entry* entry = 0;
+  {
+    ThreadLock lock(mutex);
+    std::map<std::string, Entry*>::iterator it = entries.find(key);
+    if(it == entries.end())
+    {
+      stats.misses++;
+      return Handle();
+    }
+    stats.hits++;
+    entry = it->second;
+    acquire(entry);
+  }
+  return Handle(this, entry);
+}
+
+TextureCache::Handle TextureCache::find(const std::string& key)
+{
+  return lookup(key);
+}
+
+TextureCache::Handle TextureCache::insert(const std::string& key, ITexture* texture)
+{
+  Entry* entry = 0;
+  {
+    ThreadLock lock(mutex);
+    entry = insertLocked(key, texture);
+  }
+  return Handle(this, entry);
+}
+
+TextureCache::Handle TextureCache::load(const std::string& filename, const AlphaEffect& effect)
+{
+  std::string key = "file:" + filename + ":" + makeEffectKey(effect);
+  Handle result = lookup(key);
+  if(!result.empty()) return result;
+
+  //decoding is done without the lock, so that other threads can use the cache in the meantime
+  ITexture* texture = factory->createNewTexture();
+  makeTextureFromPNGFile(texture, filename, effect);
+  if(texture->getU() == 0 || texture->getV() == 0)
+  {
+    delete texture;
+    return Handle();
+  }
+  return insert(key, texture);
+}
+
+TextureCache::Handle TextureCache::loadBase64PNG(const std::string& base64, const AlphaEffect& effect)
+{
+  std::string key = "base64:" + makeContentKey(base64) + ":" + makeEffectKey(effect);
+  Handle result = lookup(key);
+  if(!result.empty()) return result;
+
+  ITexture* texture = factory->createNewTexture();
+  loadTextureFromBase64PNG(texture, base64, effect);
+  if(texture->getU() == 0 || texture->getV() == 0)
+  {
+    delete texture;
+    return Handle();
+  }
+  return insert(key, texture);
+}
+
+void TextureCache::setBudget(size_t budget)
+{
+  ThreadLock lock(mutex);
+  this->budget = budget;
+  trimLocked(budget);
+}
+
+void TextureCache::clear()
+{
+  ThreadLock lock(mutex);
+  trimLocked(0);
+}
+
+TextureCache::Stats TextureCache::getStats() const
+{
+  ThreadLock lock(mutex);
+  return stats;
+}
+
+void TextureCache::resetStats()
+{
+  ThreadLock lock(mutex);
+  stats.hits = 0;
+  stats.misses = 0;
+  stats.evictions = 0;
+}
+
+} //namespace lpi
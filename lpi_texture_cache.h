@@ -0,0 +1,152 @@
+/*
+Copyright (c) 2005-2010 Lode Vandevenne
+All rights reserved.
+
+This file is part of Lode's Programming Interface.
+
+Lode's Programming Interface is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Lode's Programming Interface is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "lpi_texture.h"
+#include "lpi_thread.h"
+
+#include <list>
+#include <map>
+#include <string>
+
+/*
+lpi_texture_cache: loads every image only once, and keeps the textures around as long as they're
+used or as long as there's room for them.
+
+The textures are shared through TextureCache::Handle, which counts references like a shared
+pointer: copy it as much as needed, the texture stays alive as long as one handle to it exists.
+When the last handle is gone the texture stays in the cache, so that loading the same image again
+is a hit, until the memory of all textures goes over the budget: then the textures that nobody
+uses anymore are deleted, the one that was used longest ago first.
+
+All functions of the cache and the handles may be called from any thread. Loading and evicting
+creates and deletes textures in the calling thread though, so a cache of OpenGL textures should
+only be used from the thread of the OpenGL context.
+*/
+
+namespace lpi
+{
+
+class TextureCache
+{
+  private:
+
+    struct Entry
+    {
+      std::string key;
+      ITexture* texture;
+      size_t bytes;
+      size_t refcount; //amount of handles
+      std::list<Entry*>::iterator unused; //position in unused, only valid if refcount is 0
+    };
+
+  public:
+
+    class Handle
+    {
+      private:
+        TextureCache* cache;
+        Entry* entry;
+
+        friend class TextureCache;
+        Handle(TextureCache* cache, Entry* entry); //the reference must already be counted
+
+      public:
+        Handle(); //empty handle
+        Handle(const Handle& other);
+        ~Handle();
+        Handle& operator=(const Handle& other);
+
+        bool empty() const { return entry == 0; }
+        ITexture* get() const { return entry ? entry->texture : 0; } //0 for an empty handle
+        ITexture* operator->() const { return entry->texture; }
+        const std::string& getKey() const; //the key of the texture in the cache
+        void reset(); //makes the handle empty
+    };
+
+    struct Stats
+    {
+      size_t hits; //requests for a texture that was in the cache
+      size_t misses; //requests for a texture that had to be loaded
+      size_t evictions; //textures deleted to stay within the budget or by clear
+      size_t entries; //textures now in the cache
+      size_t used; //textures now in the cache that have handles
+      size_t bytes; //memory of the textures now in the cache
+
+      Stats() : hits(0), misses(0), evictions(0), entries(0), used(0), bytes(0) {}
+    };
+
+  private:
+
+    const ITextureFactory* factory;
+    size_t budget;
+    bool gpucopy;
+
+    std::map<std::string, Entry*> entries;
+    std::list<Entry*> unused; //entries with refcount 0, the most recently used first
+    Stats stats;
+    mutable ThreadMutex mutex;
+
+    void acquire(Entry* entry); //with the mutex locked
+    void release(Entry* entry);
+    void evict(Entry* entry); //with the mutex locked
+    void trimLocked(size_t budget);
+    Entry* insertLocked(const std::string& key, ITexture* texture); //returns the entry with its reference counted
+    Handle lookup(const std::string& key); //with hit or miss counted, an empty handle on a miss
+
+    TextureCache(const TextureCache&); //not copyable
+    TextureCache& operator=(const TextureCache&);
+
+  public:
+
+    /*
+    factory: creates the textures that load makes. budget: the memory in bytes that the textures
+    may use, textures with handles are never evicted though, so they can use more. gpucopy: set
+    this if the textures of the factory also have a copy in video memory (e.g. TextureGL), then
+    each texture counts twice.
+    */
+    TextureCache(const ITextureFactory* factory, size_t budget = 64 * 1024 * 1024, bool gpucopy = false);
+    ~TextureCache(); //deletes all textures, there may be no handles left
+
+    //the texture of the PNG file, with the alpha effect applied. An empty handle if it can't be loaded.
+    Handle load(const std::string& filename, const AlphaEffect& effect = AE_Nothing);
+    //the texture of a base64 encoded PNG, e.g. one that is embedded in the program, keyed by a hash of its contents
+    Handle loadBase64PNG(const std::string& base64, const AlphaEffect& effect = AE_Nothing);
+
+    /*
+    For textures that are made some other way: find returns the texture with the key, or an empty
+    handle. insert puts a texture in the cache, which owns it from then on. If there already is
+    a texture with that key, the given one is deleted and the existing one is returned.
+    */
+    Handle find(const std::string& key);
+    Handle insert(const std::string& key, ITexture* texture);
+
+    void setBudget(size_t budget); //evicts right away if the textures are over the new budget
+    size_t getBudget() const { return budget; }
+    void clear(); //evicts all textures that have no handles
+
+    Stats getStats() const;
+    void resetStats(); //sets hits, misses and evictions to 0
+
+    size_t getTextureBytes(const ITexture* texture) const; //the memory a texture is counted for
+};
+
+} //namespace lpi
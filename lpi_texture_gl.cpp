@@ -24,11 +24,80 @@ along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licens
 #include "lpi_base64.h"
 
 #include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <string>
 
 namespace lpi
 {
 
+namespace
+{
+
+//pixel buffer objects aren't in OpenGL 1.1, so the functions are gotten at run time
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_WRITE_ONLY
+#define GL_WRITE_ONLY 0x88B9
+#endif
+
+struct PixelBufferFunctions
+{
+  typedef void (APIENTRY *GenBuffers)(GLsizei n, GLuint* buffers);
+  typedef void (APIENTRY *DeleteBuffers)(GLsizei n, const GLuint* buffers);
+  typedef void (APIENTRY *BindBuffer)(GLenum target, GLuint buffer);
+  typedef void (APIENTRY *BufferData)(GLenum target, ptrdiff_t size, const void* data, GLenum usage);
+  typedef void* (APIENTRY *MapBuffer)(GLenum target, GLenum access);
+  typedef GLboolean (APIENTRY *UnmapBuffer)(GLenum target);
+
+  GenBuffers genBuffers;
+  DeleteBuffers deleteBuffers;
+  BindBuffer bindBuffer;
+  BufferData bufferData;
+  MapBuffer mapBuffer;
+  UnmapBuffer unmapBuffer;
+  bool supported;
+  int context_id; //the context the functions were gotten for, -1 if none yet
+};
+
+PixelBufferFunctions pbf = { 0, 0, 0, 0, 0, 0, false, -1 };
+
+//the functions for the current context, 0 if it doesn't support pixel buffer objects
+const PixelBufferFunctions* getPixelBufferFunctions(const GLContext* context)
+{
+  if(pbf.context_id != context->getID())
+  {
+    pbf.context_id = context->getID();
+
+    const char* version = (const char*)glGetString(GL_VERSION);
+    const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+    int major = 0, minor = 0;
+    if(version) std::sscanf(version, "%d.%d", &major, &minor);
+    pbf.supported = major > 2 || (major == 2 && minor >= 1);
+    bool arb = !pbf.supported && extensions && std::strstr(extensions, "GL_ARB_pixel_buffer_object");
+
+    std::string s = arb ? "ARB" : ""; //the extension has the same functions with this suffix
+    pbf.genBuffers = (PixelBufferFunctions::GenBuffers)SDL_GL_GetProcAddress(("glGenBuffers" + s).c_str());
+    pbf.deleteBuffers = (PixelBufferFunctions::DeleteBuffers)SDL_GL_GetProcAddress(("glDeleteBuffers" + s).c_str());
+    pbf.bindBuffer = (PixelBufferFunctions::BindBuffer)SDL_GL_GetProcAddress(("glBindBuffer" + s).c_str());
+    pbf.bufferData = (PixelBufferFunctions::BufferData)SDL_GL_GetProcAddress(("glBufferData" + s).c_str());
+    pbf.mapBuffer = (PixelBufferFunctions::MapBuffer)SDL_GL_GetProcAddress(("glMapBuffer" + s).c_str());
+    pbf.unmapBuffer = (PixelBufferFunctions::UnmapBuffer)SDL_GL_GetProcAddress(("glUnmapBuffer" + s).c_str());
+
+    pbf.supported = (pbf.supported || arb) && pbf.genBuffers && pbf.deleteBuffers && pbf.bindBuffer
+                 && pbf.bufferData && pbf.mapBuffer && pbf.unmapBuffer;
+  }
+  return pbf.supported ? &pbf : 0;
+}
+
+} //end of anonymous namespace
+
 TextureGL::Part::Part(GLContext* context)
 : generated_id(-1)
 , context(context)
@@ -37,7 +106,7 @@ TextureGL::Part::Part(GLContext* context)
 
 TextureGL::Part::~Part()
 {
-  if(context->isActive() && context->getID() == generated_id) glDeleteTextures(1, &texture);
+  if(context->isActive() && context->getID() == generated_id) context->getState().deleteTexture(texture);
 }
 
 TextureGL::TextureGL(GLContext* context)
@@ -46,29 +115,52 @@ TextureGL::TextureGL(GLContext* context)
 , u2(0)
 , v2(0)
 , context(context)
+, usepixelbuffers(false)
+, pixelbuffers_id(-1)
+, pixelbufferindex(0)
+, lastused(context->getResidency().getFrame())
 {
+  context->getResidency().add(this);
 }
 
 TextureGL::~TextureGL()
 {
+  context->flush(); //batched draws may still use this texture
+  context->getResidency().remove(this);
+  
+  if(pixelbuffers_id >= 0 && context->isActive() && context->getID() == pixelbuffers_id)
+  {
+    if(const PixelBufferFunctions* f = getPixelBufferFunctions(context)) f->deleteBuffers(2, pixelbuffers);
+  }
 }
 
 //make memory for the buffer of the texture
 void TextureGL::makeBuffer()
 {
+  context->flush(); //batched draws may still use the parts
+  dirty.clear(); //the new parts are uploaded completely
+  
   if(u == 0 && v == 0)
   {
     parts.clear();
   }
   else if(u <= MAXX && v <= MAXY)
   {
-    //find first larger power of two of width and store it in u2
-    u2 = 1;
-    while(u2 < u) u2 *= 2;
-    
-    //find first larger power of two of height and store it in v2
-    v2 = 1;
-    while(v2 < v) v2 *= 2;
+    if(context->getNonPowerOfTwo())
+    {
+      u2 = u;
+      v2 = v;
+    }
+    else
+    {
+      //find first larger power of two of width and store it in u2
+      u2 = 1;
+      while(u2 < u) u2 *= 2;
+      
+      //find first larger power of two of height and store it in v2
+      v2 = 1;
+      while(v2 < v) v2 *= 2;
+    }
     
     parts.clear(); //always clear before resizing, a Part can't be correctly copied
     parts.push_back(Part(context));
@@ -84,6 +176,7 @@ void TextureGL::makeBuffer()
   {
     size_t partsx = (u + MAXX - 1) / MAXX; //num parts in x direction
     size_t partsy = (v + MAXY - 1) / MAXY; //num parts in y direction
+    bool npot = context->getNonPowerOfTwo(); //then the last parts have the exact size of what's left
 
     parts.clear(); //always clear before resizing, a Part can't be correctly copied
     for(size_t i = 0; i < partsx * partsy; i++) parts.push_back(Part(context));
@@ -99,156 +192,332 @@ void TextureGL::makeBuffer()
       if(x == partsx - 1) part.u = (u % MAXX == 0) ? MAXX : u % MAXX;
       part.v = MAXY;
       if(y == partsy - 1) part.v = (v % MAXY == 0) ? MAXY : v % MAXY;
-      part.u2 = MAXX;
-      part.v2 = MAXY;
+      part.u2 = npot ? part.u : MAXX;
+      part.v2 = npot ? part.v : MAXY;
     }
     
-    u2 = partsx * MAXX;
-    v2 = partsy * MAXY;
+    u2 = npot ? u : partsx * MAXX;
+    v2 = npot ? v : partsy * MAXY;
   }
   
   buffer.resize(4 * u2 * v2);
 }
 
-void TextureGL::uploadPartial(int x0, int y0, int x1, int y1)
+namespace
 {
-  if(parts.empty()) return;
-  
-  //if(x0 < 0 || x0 > (int)u || y0 < 0 || y0 > (int)v || x1 < 0 || x1 > (int)u || y1 < 0 || y1 > (int)v) std::cout<<"panic!"<<std::endl;
-  
-  if(x0 < 0) x0 = 0; if(x0 > (int)u) x0 = u;
-  if(y0 < 0) y0 = 0; if(y0 > (int)v) y0 = v;
-  if(x1 < 0) x1 = 0; if(x1 > (int)u) x1 = u;
-  if(y1 < 0) y1 = 0; if(y1 > (int)v) y1 = v;
 
-  if(x0 == x1 || y0 == y1) return;
-  
-  for(size_t i = 0; i < parts.size(); i++)
+const size_t MAX_DIRTY_RECTS = 8; //more rectangles are merged together
+const double UPLOAD_CALL_COST = 1024; //the cost of an extra glTexSubImage2D, in pixels that could be uploaded instead
+
+double area(int x0, int y0, int x1, int y1)
+{
+  return (double)(x1 - x0) * (y1 - y0);
+}
+
+} //end of anonymous namespace
+
+void TextureGL::markChanged(int x0, int y0, int x1, int y1)
+{
+  x0 = std::min(std::max(x0, 0), (int)u2);
+  y0 = std::min(std::max(y0, 0), (int)v2);
+  x1 = std::min(std::max(x1, 0), (int)u2);
+  y1 = std::min(std::max(y1, 0), (int)v2);
+  if(x0 >= x1 || y0 >= y1) return;
+  if(buffer.empty()) return; //released, there's nothing to upload
+
+  //what is batched with this texture must still show the old contents, what is drawn after this uploads the changes first
+  if(dirty.empty()) context->flush();
+
+  //merge with the rectangles for which one upload costs less than two
+  Rect r = { x0, y0, x1, y1 };
+  bool merged = true;
+  while(merged)
   {
-    if(parts[i].generated_id < 0)
+    merged = false;
+    for(size_t i = 0; i < dirty.size(); i++)
     {
-      upload();
-      return;
+      const Rect& d = dirty[i];
+      if(r.x0 >= d.x0 && r.y0 >= d.y0 && r.x1 <= d.x1 && r.y1 <= d.y1) return;
+      Rect m = { std::min(r.x0, d.x0), std::min(r.y0, d.y0), std::max(r.x1, d.x1), std::max(r.y1, d.y1) };
+      if(area(m.x0, m.y0, m.x1, m.y1) <= area(r.x0, r.y0, r.x1, r.y1) + area(d.x0, d.y0, d.x1, d.y1) + UPLOAD_CALL_COST)
+      {
+        r = m;
+        dirty.erase(dirty.begin() + i);
+        merged = true;
+        break;
+      }
     }
   }
- 
-  if(u <= MAXX && v <= MAXY)
-  {
-    bind(false, 0);
-      
-    //indicate how we'll read from buffer
-    glPixelStorei( GL_UNPACK_ROW_LENGTH, u2);
-    glPixelStorei( GL_UNPACK_SKIP_PIXELS, x0);
-    glPixelStorei( GL_UNPACK_SKIP_ROWS, y0);
-
-    glTexSubImage2D(GL_TEXTURE_2D, 0, x0, y0, x1 - x0, y1 - y0, GL_RGBA, GL_UNSIGNED_BYTE, &buffer[0] );
 
-  }
-  else
+  if(dirty.size() >= MAX_DIRTY_RECTS)
   {
-    for(size_t i = 0; i < parts.size(); i++)
+    //merge everything, at this point it's likely a lot of the texture changed anyway
+    for(size_t i = 0; i < dirty.size(); i++)
     {
-      Part& part = parts[i];
-      
-      
-      bool xoverlap = true;
-      if(x1 <= part.shiftx || x0 >= (int)(part.shiftx + part.u)) xoverlap = false;
-      bool yoverlap = true;
-      if(y1 <= part.shifty || y0 >= (int)(part.shifty + part.v)) yoverlap = false;
-      if(xoverlap && yoverlap)
-      {
-        bind(false, i);
-        
-        int px0 = x0 - part.shiftx; if(px0 < 0) px0 = 0; /*if(px0 > (int)part.u) px0 = part.u;*/
-        int py0 = y0 - part.shifty; if(py0 < 0) py0 = 0; /*if(py0 > (int)part.v) py0 = part.v;*/
-        int px1 = x1 - part.shiftx; /*if(px1 < 0) px1 = 0;*/ if(px1 > (int)part.u) px1 = part.u;
-        int py1 = y1 - part.shifty; /*if(py1 < 0) py1 = 0;*/ if(py1 > (int)part.v) py1 = part.v;
-        
-        //indicate how we'll read from buffer
-        glPixelStorei( GL_UNPACK_ROW_LENGTH, u2);
-        glPixelStorei( GL_UNPACK_SKIP_PIXELS, part.shiftx + px0);
-        glPixelStorei( GL_UNPACK_SKIP_ROWS, part.shifty + py0);
-        
-        glTexSubImage2D(GL_TEXTURE_2D, 0, px0, py0, px1 - px0, py1 - py0, GL_RGBA, GL_UNSIGNED_BYTE, &buffer[0] );
-        
-      }
+      r.x0 = std::min(r.x0, dirty[i].x0);
+      r.y0 = std::min(r.y0, dirty[i].y0);
+      r.x1 = std::max(r.x1, dirty[i].x1);
+      r.y1 = std::max(r.y1, dirty[i].y1);
     }
+    dirty.clear();
   }
-  
+
+  dirty.push_back(r);
+}
+
+void TextureGL::uploadChanges() const
+{
+  if(dirty.empty() || parts.empty()) return;
+  if(!context->isActive()) return;
+
+  //the first upload makes the OpenGL textures of all parts, and that needs all of the buffer
+  if(parts[0].generated_id < 0)
+  {
+    upload();
+    return;
+  }
+
+  if(!usepixelbuffers || !uploadRectsPixelBuffer(dirty)) uploadRects(dirty);
+
+  dirty.clear();
+
   //set back to default so that the rest behaves normally
   glPixelStorei( GL_UNPACK_ROW_LENGTH, 0);
   glPixelStorei( GL_UNPACK_SKIP_PIXELS, 0);
   glPixelStorei( GL_UNPACK_SKIP_ROWS, 0);
-
 }
 
-//This generates the OpenGL texture so that OpenGL can use it, also use after changing the texture buffer
-void TextureGL::upload() const
+void TextureGL::uploadRects(const std::vector<Rect>& rects) const
 {
-  if(!context->isActive()) return;
-  
-  if(parts.empty()) return;
-  
   for(size_t i = 0; i < parts.size(); i++)
   {
     Part& part = parts[i];
-    if(part.generated_id < 0)
+    bool bound = false;
+
+    for(size_t j = 0; j < rects.size(); j++)
     {
-      glGenTextures(1, &part.texture);
-      part.generated_id = context->getID();
+      //the rectangle in coordinates of the part
+      int px0 = std::max(rects[j].x0 - part.shiftx, 0);
+      int py0 = std::max(rects[j].y0 - part.shifty, 0);
+      int px1 = std::min(rects[j].x1 - part.shiftx, (int)part.u2);
+      int py1 = std::min(rects[j].y1 - part.shifty, (int)part.v2);
+      if(px0 >= px1 || py0 >= py1) continue;
+
+      if(!bound) bindPart(i);
+      bound = true;
+
+      //indicate how we'll read from buffer
+      glPixelStorei( GL_UNPACK_ROW_LENGTH, u2);
+      glPixelStorei( GL_UNPACK_SKIP_PIXELS, part.shiftx + px0);
+      glPixelStorei( GL_UNPACK_SKIP_ROWS, part.shifty + py0);
+
+      glTexSubImage2D(GL_TEXTURE_2D, 0, px0, py0, px1 - px0, py1 - py0, GL_RGBA, GL_UNSIGNED_BYTE, &buffer[0] );
     }
   }
-  
-  if(u <= MAXX && v <= MAXY)
+}
+
+bool TextureGL::uploadRectsPixelBuffer(const std::vector<Rect>& rects) const
+{
+  const PixelBufferFunctions* f = getPixelBufferFunctions(context);
+  if(!f) return false;
+
+  if(pixelbuffers_id != context->getID())
   {
-    bind(false, 0);
-    glTexImage2D(GL_TEXTURE_2D, 0, 4, u2, v2, 0, GL_RGBA, GL_UNSIGNED_BYTE, &buffer[0]);
+    f->genBuffers(2, pixelbuffers);
+    pixelbuffers_id = context->getID();
   }
-  else
+
+  //all the pieces are packed one after the other in the pixel buffer, without the rest of the rows
+  size_t size = 0;
+  for(size_t i = 0; i < rects.size(); i++) size += 4 * (rects[i].x1 - rects[i].x0) * (rects[i].y1 - rects[i].y0);
+
+  f->bindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelbuffers[pixelbufferindex]);
+  pixelbufferindex = 1 - pixelbufferindex;
+  f->bufferData(GL_PIXEL_UNPACK_BUFFER, size, 0, GL_STREAM_DRAW); //without the old contents, so there's no waiting for the previous upload from it
+  unsigned char* mapped = (unsigned char*)f->mapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+  if(!mapped)
+  {
+    f->bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    return false;
+  }
+
+  size_t pos = 0;
+  for(size_t i = 0; i < rects.size(); i++)
+  {
+    const Rect& r = rects[i];
+    size_t rowsize = 4 * (r.x1 - r.x0);
+    for(int y = r.y0; y < r.y1; y++)
+    {
+      std::copy(&buffer[4 * (y * u2 + r.x0)], &buffer[4 * (y * u2 + r.x0)] + rowsize, mapped + pos);
+      pos += rowsize;
+    }
+  }
+  f->unmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+  //the same pieces of the parts as uploadRects, but from the pixel buffer
+  pos = 0;
+  for(size_t j = 0; j < rects.size(); j++)
   {
+    const Rect& r = rects[j];
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, r.x1 - r.x0);
     for(size_t i = 0; i < parts.size(); i++)
     {
       Part& part = parts[i];
-
-      bind(false, i);
-      glPixelStorei( GL_UNPACK_ROW_LENGTH, u2);
-      glPixelStorei( GL_UNPACK_SKIP_PIXELS, part.shiftx);
-      glPixelStorei( GL_UNPACK_SKIP_ROWS, part.shifty);
-      glTexImage2D(GL_TEXTURE_2D, 0, 4, part.u2, part.v2, 0, GL_RGBA, GL_UNSIGNED_BYTE, &buffer[0]);
+      int px0 = std::max(r.x0 - part.shiftx, 0);
+      int py0 = std::max(r.y0 - part.shifty, 0);
+      int px1 = std::min(r.x1 - part.shiftx, (int)part.u2);
+      int py1 = std::min(r.y1 - part.shifty, (int)part.v2);
+      if(px0 >= px1 || py0 >= py1) continue;
+
+      bindPart(i);
+      glPixelStorei( GL_UNPACK_SKIP_PIXELS, part.shiftx + px0 - r.x0);
+      glPixelStorei( GL_UNPACK_SKIP_ROWS, part.shifty + py0 - r.y0);
+      glTexSubImage2D(GL_TEXTURE_2D, 0, px0, py0, px1 - px0, py1 - py0, GL_RGBA, GL_UNSIGNED_BYTE, (const void*)pos);
     }
-    //set back to default so that the rest behaves normally
-    glPixelStorei( GL_UNPACK_ROW_LENGTH, 0);
-    glPixelStorei( GL_UNPACK_SKIP_PIXELS, 0);
-    glPixelStorei( GL_UNPACK_SKIP_ROWS, 0);
+    pos += 4 * (r.x1 - r.x0) * (r.y1 - r.y0);
   }
+
+  f->bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  return true;
 }
 
-void TextureGL::reupload() const
+void TextureGL::uploadPart(size_t index) const
 {
-  parts.clear();
-  upload();
+  Part& part = parts[index];
+  bool generate = part.generated_id < 0;
+  if(generate)
+  {
+    glGenTextures(1, &part.texture);
+    part.generated_id = context->getID();
+  }
+
+  bindPart(index);
+  if(generate) context->getState().setFilter(GL_NEAREST, GL_NEAREST); //not the default with mipmaps, which this texture doesn't have
+  glPixelStorei( GL_UNPACK_ROW_LENGTH, u2);
+  glPixelStorei( GL_UNPACK_SKIP_PIXELS, part.shiftx);
+  glPixelStorei( GL_UNPACK_SKIP_ROWS, part.shifty);
+  //without buffer (see releaseBuffer) the texture gets its size but no contents
+  glTexImage2D(GL_TEXTURE_2D, 0, 4, part.u2, part.v2, 0, GL_RGBA, GL_UNSIGNED_BYTE, buffer.empty() ? 0 : &buffer[0]);
 }
 
-//make this the selected one for drawing
-void TextureGL::bind(bool smoothing, size_t index) const
+bool TextureGL::releaseBuffer()
 {
-  glBindTexture(GL_TEXTURE_2D, parts[index].texture);
+  if(buffer.empty()) return true;
+  if(!context->isActive()) return false;
   
-  if(smoothing) //todo: remove this from the "bind" function, do it in generate or separatly instead
+  if(parts[0].generated_id >= 0 && parts[0].generated_id != context->getID()) reupload();
+  else uploadChanges();
+  std::vector<unsigned char>().swap(buffer);
+  return true;
+}
+
+size_t TextureGL::getVideoMemory() const
+{
+  size_t result = 0;
+  for(size_t i = 0; i < parts.size(); i++) result += 4 * parts[i].u2 * parts[i].v2;
+  return result;
+}
+
+size_t TextureGL::getMemorySaved() const
+{
+  //the size that makeBuffer gives without non power of two support, in both memories
+  size_t pu2 = 1, pv2 = 1;
+  if(u <= MAXX && v <= MAXY)
   {
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    while(pu2 < u) pu2 *= 2;
+    while(pv2 < v) pv2 *= 2;
   }
   else
   {
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    pu2 = ((u + MAXX - 1) / MAXX) * MAXX;
+    pv2 = ((v + MAXY - 1) / MAXY) * MAXY;
   }
+  if(u == 0 || v == 0) pu2 = pv2 = 0;
+  
+  return 2 * 4 * pu2 * pv2 - getVideoMemory() - getSystemMemory();
+}
+
+//This generates the OpenGL texture so that OpenGL can use it, also use after changing the texture buffer
+void TextureGL::upload() const
+{
+  if(!context->isActive()) return;
+
+  if(parts.empty()) return;
+
+  context->flush(); //batched draws must still show the old contents
+
+  for(size_t i = 0; i < parts.size(); i++) uploadPart(i);
+  dirty.clear();
+
+  //set back to default so that the rest behaves normally
+  glPixelStorei( GL_UNPACK_ROW_LENGTH, 0);
+  glPixelStorei( GL_UNPACK_SKIP_PIXELS, 0);
+  glPixelStorei( GL_UNPACK_SKIP_ROWS, 0);
+}
+
+void TextureGL::reupload() const
+{
+  context->flush();
+  //the OpenGL textures were destroyed with the previous context, so new ones are generated
+  for(size_t i = 0; i < parts.size(); i++) parts[i].generated_id = -1;
+  upload();
+}
+
+void TextureGL::bindPart(size_t index) const
+{
+  context->getState().bindTexture(parts[index].texture);
+}
+
+bool TextureGL::isResident() const
+{
+  return context->isActive() && !parts.empty() && parts[0].generated_id == context->getID();
+}
+
+void TextureGL::makeResident() const
+{
+  if(parts.empty() || !context->isActive()) return;
+  //like updateForNewOpenGLContextIfNeeded, but without counting as drawn
+  if(parts[0].generated_id >= 0 && parts[0].generated_id != context->getID()) reupload();
+  else uploadChanges();
+}
+
+void TextureGL::evict() const
+{
+  if(buffer.empty() || parts.empty()) return; //it couldn't be uploaded again
+  
+  context->flush(); //batched draws may still use the parts
+  for(size_t i = 0; i < parts.size(); i++)
+  {
+    Part& part = parts[i];
+    if(part.generated_id >= 0 && context->isActive() && context->getID() == part.generated_id) context->getState().deleteTexture(part.texture);
+    part.generated_id = -1;
+  }
+  
+  //the next upload generates the parts again with all of the buffer
+  dirty.clear();
+  Rect all = { 0, 0, (int)u2, (int)v2 };
+  dirty.push_back(all);
+}
+
+//make this the selected one for drawing
+void TextureGL::bind(bool smoothing, size_t index) const
+{
+  lastused = context->getResidency().getFrame();
+  if(!isResident()) context->getResidency().addDrawUpload(getVideoMemory()); //evicted or new: uploaded now, outside of the budget
+  uploadChanges();
+
+  //through the state of the context, so binding the same texture with the same filter again is free
+  GLState& state = context->getState();
+  state.bindTexture(parts[index].texture);
+
+  if(smoothing) state.setFilter(GL_LINEAR, GL_LINEAR);
+  else state.setFilter(GL_NEAREST, GL_NEAREST);
 }
 
 void TextureGL::getTextAlignedBuffer(std::vector<unsigned char>& out)
 {
   out.clear();
+  if(buffer.empty()) return; //released, the pixels are only in video memory
   for(size_t y = 0; y < v; y++)
   {
     out.insert(out.end(), buffer.begin() + 4 * y * u2, buffer.begin() + 4 * y * u2 + 4 * u);
@@ -257,6 +526,7 @@ void TextureGL::getTextAlignedBuffer(std::vector<unsigned char>& out)
 
 void TextureGL::setTextAlignedBuffer(const std::vector<unsigned char>& in)
 {
+  if(buffer.empty()) return; //released, like update it does nothing then
   for(size_t y = 0; y < v; y++)
   {
     std::copy(in.begin() + 4 * y * u, in.begin() + 4 * y * u + 4 * u, buffer.begin() + 4 * y * u2);
@@ -269,12 +539,16 @@ bool TextureGL::updateForNewOpenGLContextIfNeeded() const
 
   if(!context->isActive()) return false;
 
-  if(parts[0].generated_id != context->getID())
+  lastused = context->getResidency().getFrame(); //this is called when the texture is drawn
+  if(!isResident()) context->getResidency().addDrawUpload(getVideoMemory()); //uploaded now, outside of the budget
+  
+  if(parts[0].generated_id >= 0 && parts[0].generated_id != context->getID())
   {
     reupload();
     return true;
   }
 
+  uploadChanges();
   return false;
 }
 
@@ -33,7 +33,7 @@ namespace lpi
 {
 
 //TODO: graphics cards can't handle textures larger than ... * ... So divide a large texture into multiple 512*512 parts.
-class TextureGL : public ITexture
+class TextureGL : public ITexture, public IGLResource
 {
   /*
   Important:
@@ -50,7 +50,7 @@ class TextureGL : public ITexture
       GLuint texture; //the unique OpenGL texture "name" to identify ourselves
       size_t u;
       size_t v;
-      //width and height as powers of two (this will be the actual size of the buffer, because OpenGL only supports such textures)
+      //width and height of the OpenGL texture: powers of two, unless the context supports any size
       size_t u2;
       size_t v2;
       
@@ -69,7 +69,7 @@ class TextureGL : public ITexture
     //width and height of the texture
     size_t u;
     size_t v;
-    //width and height as powers of two (this will be the actual size of the buffer, because OpenGL only supports such textures)
+    //width and height of the buffer: powers of two (or multiples of MAXX and MAXY if there are multiple parts), unless the context supports any size, then u and v
     size_t u2;
     size_t v2;
     
@@ -77,6 +77,24 @@ class TextureGL : public ITexture
     
     GLContext* context;
     
+    struct Rect
+    {
+      int x0;
+      int y0;
+      int x1; //not inclusive
+      int y1;
+    };
+    
+    mutable std::vector<Rect> dirty; //the parts of the buffer that changed since they were uploaded, coalesced
+    
+    //the two pixel buffer objects that uploads alternate between, if enabled
+    bool usepixelbuffers;
+    mutable GLuint pixelbuffers[2];
+    mutable int pixelbuffers_id; //-1 if not generated, id of GL context otherwise
+    mutable size_t pixelbufferindex;
+    
+    mutable size_t lastused; //frame of the GLResidency of the context
+    
     
   public:
 
@@ -91,24 +109,62 @@ class TextureGL : public ITexture
     //width and height of the texture
     virtual size_t getU() const {return u;}
     virtual size_t getV() const {return v;}
-    //width and height as powers of two (this will be the actual size of the buffer, because OpenGL only supports such textures)
+    //width and height of the buffer, see u2 and v2
     virtual size_t getU2() const {return u2;}
     virtual size_t getV2() const {return v2;}
     
-    virtual void update() { upload(); }
-    virtual void updatePartial(int x0, int y0, int x1, int y1) { uploadPartial(x0, y0, x1, y1); }
+    /*
+    update and updatePartial don't upload right away: the changed rectangles are remembered and
+    merged, and uploaded together the next time the texture is drawn or bound, so changing the
+    buffer many times between two draws only uploads once. Call uploadChanges to do it earlier.
+    */
+    virtual void update() { markChanged(0, 0, u2, v2); }
+    virtual void updatePartial(int x0, int y0, int x1, int y1) { markChanged(x0, y0, x1, y1); }
+    void uploadChanges() const;
+    
+    /*
+    For textures that change every frame, such as video or a canvas: upload through two pixel
+    buffer objects used in turn, so that the copy to video memory doesn't have to wait until
+    OpenGL is done with the previous one. Needs OpenGL 2.1 or GL_ARB_pixel_buffer_object,
+    otherwise this does nothing.
+    */
+    void setUsePixelBuffers(bool use) { usepixelbuffers = use; }
+    bool getUsePixelBuffers() const { return usepixelbuffers; }
     
+    //0 after releaseBuffer
     virtual unsigned char* getBuffer()
     {
-      return &buffer[0];
+      return buffer.empty() ? 0 : &buffer[0];
     }
     
     virtual const unsigned char* getBuffer() const
     {
-      return &buffer[0];
+      return buffer.empty() ? 0 : &buffer[0];
     }
     
-    void bind(bool smoothing, size_t index) const; //set this texture for OpenGL
+    /*
+    For textures that are uploaded once and never change: uploads the changes now and frees the
+    buffer, so that the texture only uses video memory. After this, getBuffer returns 0 and update
+    and updatePartial do nothing, until setSize makes a new buffer. The texture can't be uploaded
+    again either, so if the OpenGL context is replaced, it has the right size but no contents.
+    Returns false, keeping the buffer, if there's no OpenGL context to upload to.
+    */
+    bool releaseBuffer();
+    
+    //the memory the texture uses in bytes, the saved memory is compared to a power of two size in both video and system memory
+    size_t getVideoMemory() const;
+    size_t getSystemMemory() const { return buffer.size(); }
+    size_t getMemorySaved() const;
+    
+    //for the GLResidency of the context, which tracks all textures
+    virtual size_t getVideoBytes() const { return getVideoMemory(); }
+    virtual size_t getLastUsed() const { return lastused; }
+    virtual bool isResident() const;
+    virtual bool canEvict() const { return !buffer.empty(); }
+    virtual void makeResident() const;
+    virtual void evict() const;
+    
+    void bind(bool smoothing, size_t index) const; //set this texture for OpenGL, with the changes uploaded first
     
     size_t getNumParts() const { return parts.size(); }
     const Part& getPart(size_t i) const { return parts[i]; }
@@ -116,7 +172,8 @@ class TextureGL : public ITexture
     /*
     updateForNewOpenGLContextIfNeeded: If the GL context changed (previous destroyed, new one created),
     the texture needs to be reuploaded. If this function is called, the texture will detect that it
-    has been destroyed by checking the context member.
+    has been destroyed by checking the context member. Otherwise it uploads the changes, so call it
+    before drawing.
     */
     bool updateForNewOpenGLContextIfNeeded() const;
     
@@ -124,11 +181,15 @@ class TextureGL : public ITexture
     
     void makeBuffer(); //creates memory for the buffer
 
-    void uploadPartial(int x0, int y0, int x1, int y1); //todo: make use of this for efficiency
+    void markChanged(int x0, int y0, int x1, int y1);
+    void bindPart(size_t index) const;
+    void uploadPart(size_t index) const; //the whole part, generates its OpenGL texture if needed
+    void uploadRects(const std::vector<Rect>& rects) const; //parts of the texture, with glTexSubImage2D
+    bool uploadRectsPixelBuffer(const std::vector<Rect>& rects) const; //false if pixel buffer objects aren't supported
     void upload() const; //sets the texture to openGL with correct datatype and such. Everytime something changes in the data in the buffer, upload it again to let the videocard/API know the changes. Also, use upload AFTER a screen is already set! And when the screen changes resolution, everything has to be uploaded again.
     void reupload() const; //call this after you changed the screen (causing the textures to be erased from the video card)
     
-    //get/set buffer that has the (possible non power of two) size of the wanted image (u * v RGBA pixels)
+    //get/set buffer that has the (possible non power of two) size of the wanted image (u * v RGBA pixels), empty and ignored after releaseBuffer
     void getTextAlignedBuffer(std::vector<unsigned char>& out);
     void setTextAlignedBuffer(const std::vector<unsigned char>& in);
 };
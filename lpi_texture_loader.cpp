@@ -0,0 +1,364 @@
+/*
+Copyright (c) 2005-2010 Lode Vandevenne
+All rights reserved.
+
+This file is part of Lode's Programming Interface.
+
+Lode's Programming Interface is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Lode's Programming Interface is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "lpi_texture_loader.h"
+
+#include "lpi_file.h"
+#include "lpi_imageformats.h"
+#include "lpi_time.h"
+
+#include <algorithm>
+
+namespace lpi
+{
+
+////////////////////////////////////////////////////////////////////////////////
+//TextureLoader::Handle/////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+TextureLoader::Handle::Handle()
+: loader(0)
+, request(0)
+{
+}
+
+TextureLoader::Handle::Handle(TextureLoader* loader, Request* request)
+: loader(loader)
+, request(request)
+{
+}
+
+TextureLoader::Handle::Handle(const Handle& other)
+: loader(other.loader)
+, request(other.request)
+{
+  if(request)
+  {
+    ThreadLock lock(loader->mutex);
+    request->references++;
+    request->handles++;
+  }
+}
+
+TextureLoader::Handle::~Handle()
+{
+  if(request)
+  {
+    ThreadLock lock(loader->mutex);
+    request->handles--;
+    //nobody is interested in the result anymore
+    if(request->handles == 0) loader->cancelLocked(request);
+    loader->release(request);
+  }
+}
+
+TextureLoader::Handle& TextureLoader::Handle::operator=(const Handle& other)
+{
+  if(request == other.request) return *this;
+  Handle copy(other);
+  std::swap(loader, copy.loader);
+  std::swap(request, copy.request);
+  return *this;
+}
+
+TextureLoader::Status TextureLoader::Handle::getStatus() const
+{
+  if(!request) return TL_CANCELED;
+  ThreadLock lock(loader->mutex);
+  return request->status;
+}
+
+bool TextureLoader::Handle::isFinished() const
+{
+  Status status = getStatus();
+  return status == TL_DONE || status == TL_FAILED || status == TL_CANCELED;
+}
+
+std::string TextureLoader::Handle::getError() const
+{
+  if(!request) return "";
+  ThreadLock lock(loader->mutex);
+  return request->error;
+}
+
+bool TextureLoader::Handle::takeTextures(std::vector<ITexture*>& textures)
+{
+  if(!request) return false;
+  ThreadLock lock(loader->mutex);
+  if(request->status != TL_DONE) return false;
+  textures.insert(textures.end(), request->textures.begin(), request->textures.end());
+  request->textures.clear();
+  return true;
+}
+
+void TextureLoader::Handle::cancel()
+{
+  if(!request) return;
+  ThreadLock lock(loader->mutex);
+  loader->cancelLocked(request);
+}
+
+void TextureLoader::Handle::setPriority(int priority)
+{
+  if(!request) return;
+  ThreadLock lock(loader->mutex);
+  request->priority = priority;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//TextureLoader/////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////
+
+TextureLoader::TextureLoader(const ITextureFactory* factory, size_t numthreads)
+: factory(factory)
+, wake(SDL_CreateCond())
+, quit(false)
+, sequence(0)
+, loading(0)
+{
+  if(numthreads == 0) numthreads = getNumProcessors() > 1 ? getNumProcessors() - 1 : 1;
+  for(size_t i = 0; i < numthreads; i++)
+  {
+    SDL_Thread* thread = SDL_CreateThread(&TextureLoader::workerMain, this);
+    if(!thread) break;
+    threads.push_back(thread);
+  }
+}
+
+TextureLoader::~TextureLoader()
+{
+  mutex.lock();
+  quit = true;
+  SDL_CondBroadcast(wake);
+  mutex.unlock();
+
+  for(size_t i = 0; i < threads.size(); i++) SDL_WaitThread(threads[i], 0);
+  SDL_DestroyCond(wake);
+
+  //the workers are gone, so only the queues have references left
+  while(!queued.empty()) cancelLocked(queued.back());
+  while(!decoded.empty()) cancelLocked(decoded.back());
+}
+
+TextureLoader::Handle TextureLoader::load(const std::string& filename, const AlphaEffect& effect, int widths, int heights, int priority)
+{
+  Request* request = new Request(filename, effect);
+  request->widths = widths;
+  request->heights = heights;
+  request->priority = priority;
+  request->status = TL_QUEUED;
+  request->references = 2; //the handle and the queue
+  request->handles = 1;
+  request->w = 0;
+  request->h = 0;
+  request->next = 0;
+  request->making = false;
+
+  ThreadLock lock(mutex);
+  request->sequence = sequence++;
+  queued.push_back(request);
+  SDL_CondSignal(wake);
+  return Handle(this, request);
+}
+
+size_t TextureLoader::findFirst(const std::vector<Request*>& requests)
+{
+  size_t best = 0;
+  for(size_t i = 1; i < requests.size(); i++)
+  {
+    const Request& a = *requests[i];
+    const Request& b = *requests[best];
+    if(a.priority > b.priority || (a.priority == b.priority && a.sequence < b.sequence)) best = i;
+  }
+  return best;
+}
+
+void TextureLoader::remove(std::vector<Request*>& requests, Request* request)
+{
+  for(size_t i = 0; i < requests.size(); i++)
+  {
+    if(requests[i] == request)
+    {
+      requests.erase(requests.begin() + i);
+      return;
+    }
+  }
+}
+
+void TextureLoader::release(Request* request)
+{
+  request->references--;
+  if(request->references > 0) return;
+  for(size_t i = 0; i < request->textures.size(); i++) delete request->textures[i];
+  delete request;
+}
+
+void TextureLoader::cancelLocked(Request* request)
+{
+  switch(request->status)
+  {
+    case TL_QUEUED:
+      remove(queued, request);
+      request->status = TL_CANCELED;
+      release(request); //the reference of the queue
+      break;
+    case TL_LOADING:
+      request->status = TL_CANCELED; //the worker throws the result away
+      break;
+    case TL_DECODED:
+      remove(decoded, request);
+      request->status = TL_CANCELED;
+      for(size_t i = 0; i < request->textures.size(); i++) delete request->textures[i];
+      request->textures.clear();
+      if(!request->making) std::vector<unsigned char>().swap(request->image); //else pump frees it when the texture is made
+      release(request);
+      break;
+    default: break; //finished already
+  }
+}
+
+int TextureLoader::workerMain(void* data)
+{
+  ((TextureLoader*)data)->work();
+  return 0;
+}
+
+void TextureLoader::work()
+{
+  mutex.lock();
+  for(;;)
+  {
+    while(queued.empty() && !quit) SDL_CondWait(wake, mutex.getSDLMutex());
+    if(quit) break;
+
+    size_t index = findFirst(queued);
+    Request* request = queued[index];
+    queued.erase(queued.begin() + index);
+    request->status = TL_LOADING; //the reference of the queue is now the one of this worker
+    loading++;
+    mutex.unlock();
+
+    //the filename and effect don't change anymore, and the rest isn't used by others while loading
+    std::string error;
+    std::vector<unsigned char> image;
+    int w = 0, h = 0;
+    std::vector<unsigned char> file;
+    loadFile(file, request->filename);
+    ImageFormat format = file.empty() ? IF_INVALID : findImageFormat(&file[0], file.size());
+    if(file.empty()) error = "can't read " + request->filename;
+    else if(format == IF_INVALID) error = "unknown image format in " + request->filename;
+    else if(!decodeImageFile(error, image, w, h, &file[0], file.size(), format) && error.empty()) error = "can't decode " + request->filename;
+    else if(!image.empty()) createImageAlpha(&image[0], w, h, request->effect);
+
+    mutex.lock();
+    loading--;
+    if(request->status == TL_CANCELED) release(request);
+    else if(!error.empty())
+    {
+      request->error = error;
+      request->status = TL_FAILED;
+      release(request);
+    }
+    else
+    {
+      request->image.swap(image);
+      request->w = w;
+      request->h = h;
+      request->status = TL_DECODED;
+      decoded.push_back(request);
+    }
+  }
+  mutex.unlock();
+}
+
+size_t TextureLoader::pump(double budget)
+{
+  Uint32 start = getTicks();
+  size_t made = 0;
+
+  mutex.lock();
+  while(!decoded.empty())
+  {
+    Request* request = decoded[findFirst(decoded)];
+
+    //the pieces, in the same order as loadTextures
+    int widths = request->widths;
+    int heights = request->heights;
+    if(widths <= 0 || heights <= 0)
+    {
+      widths = request->w;
+      heights = request->h;
+    }
+    size_t numx = widths > 0 ? request->w / widths : 0;
+    size_t numy = heights > 0 ? request->h / heights : 0;
+
+    if(request->next < numx * numy)
+    {
+      int x = request->next % numx;
+      int y = request->next / numx;
+      
+      /*
+      The texture is made without the mutex, so that the workers and the handles don't wait for the
+      factory (e.g. an upload to OpenGL). The extra reference keeps the request, and making keeps its
+      image, if it's canceled in the meantime. Only pump advances a decoded request, so the piece is
+      still the next one after locking again.
+      */
+      request->references++;
+      request->making = true;
+      mutex.unlock();
+      ITexture* texture = factory->createNewTexture();
+      makeTextureFromBuffer(texture, &request->image[0], request->w, request->h, AE_Nothing, x * widths, y * heights, (x + 1) * widths, (y + 1) * heights);
+      mutex.lock();
+      request->making = false;
+      
+      if(request->status == TL_CANCELED)
+      {
+        delete texture;
+        std::vector<unsigned char>().swap(request->image);
+        release(request);
+        continue;
+      }
+      request->textures.push_back(texture);
+      request->next++;
+      made++;
+      release(request); //the one of the list of decoded requests is still there
+    }
+
+    if(request->next >= numx * numy)
+    {
+      remove(decoded, request);
+      std::vector<unsigned char>().swap(request->image);
+      request->status = TL_DONE;
+      release(request);
+    }
+
+    if(made > 0 && getTicks() - start >= budget) break;
+  }
+  mutex.unlock();
+  return made;
+}
+
+size_t TextureLoader::getNumPending() const
+{
+  ThreadLock lock(mutex);
+  return queued.size() + loading + decoded.size();
+}
+
+} //namespace lpi
@@ -0,0 +1,168 @@
+/*
+Copyright (c) 2005-2010 Lode Vandevenne
+All rights reserved.
+
+This file is part of Lode's Programming Interface.
+
+Lode's Programming Interface is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Lode's Programming Interface is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include "lpi_texture.h"
+#include "lpi_thread.h"
+
+#include <SDL/SDL.h>
+
+#include <string>
+#include <vector>
+
+/*
+lpi_texture_loader: loads textures in the background, so that loading a level doesn't freeze the
+program.
+
+The work is split in two:
+-worker threads read the file, decode it (PNG, BMP, TGA or JPEG, see lpi_imageformats) and apply
+ the alpha effect
+-the main thread calls pump every frame, which makes the textures with the factory from the decoded
+ images (e.g. uploads them to OpenGL), but only until the given time is used up, so that the frame
+ rate stays smooth. The factory is only used there, so it may make textures that can only be made
+ in the thread of the OpenGL context.
+
+load returns a Handle to follow the request. The requests with the highest priority are decoded and
+made first. A request is canceled with cancel, or when the last handle to it is gone before it's done.
+*/
+
+namespace lpi
+{
+
+class TextureLoader
+{
+  public:
+
+    enum Status
+    {
+      TL_QUEUED, //waiting for a worker
+      TL_LOADING, //being read and decoded by a worker
+      TL_DECODED, //waiting for pump to make the textures
+      TL_DONE, //the textures are made
+      TL_FAILED, //the file couldn't be read or decoded, see getError
+      TL_CANCELED
+    };
+
+  private:
+
+    struct Request
+    {
+      std::string filename;
+      AlphaEffect effect;
+      int widths; //size of the textures the image is cut in, see loadTextures
+      int heights;
+      int priority;
+      size_t sequence; //order of the requests, the older one goes first if the priority is the same
+
+      Status status;
+      size_t references; //the handles, and the queue or the worker that has it
+      size_t handles;
+      std::string error;
+      std::vector<unsigned char> image; //the decoded image, with the alpha effect
+      int w;
+      int h;
+      size_t next; //the next texture pump makes
+      bool making; //pump is making a texture of image without the mutex locked
+      std::vector<ITexture*> textures;
+
+      Request(const std::string& filename, const AlphaEffect& effect) : filename(filename), effect(effect) {}
+    };
+
+  public:
+
+    class Handle
+    {
+      private:
+        TextureLoader* loader;
+        Request* request;
+
+        friend class TextureLoader;
+        Handle(TextureLoader* loader, Request* request); //the reference must already be counted
+
+      public:
+        Handle(); //empty handle
+        Handle(const Handle& other);
+        ~Handle();
+        Handle& operator=(const Handle& other);
+
+        bool empty() const { return request == 0; }
+        Status getStatus() const;
+        bool isFinished() const; //done, failed or canceled: nothing will change anymore
+        std::string getError() const;
+
+        /*
+        When the status is TL_DONE, appends the textures to textures, in the order of loadTextures,
+        and returns true. From then on the caller owns them, they're not given a second time. The
+        textures that are never taken are deleted with the request.
+        */
+        bool takeTextures(std::vector<ITexture*>& textures);
+
+        void cancel();
+        void setPriority(int priority);
+    };
+
+  private:
+
+    const ITextureFactory* factory;
+    std::vector<SDL_Thread*> threads;
+    mutable ThreadMutex mutex;
+    SDL_cond* wake; //signals the workers that there's a request or that they have to quit
+    bool quit;
+    size_t sequence;
+    size_t loading; //requests that a worker is decoding
+
+    std::vector<Request*> queued;
+    std::vector<Request*> decoded;
+
+    static int workerMain(void* data);
+    void work();
+
+    static size_t findFirst(const std::vector<Request*>& requests); //index of the most urgent request
+    static void remove(std::vector<Request*>& requests, Request* request);
+    void release(Request* request); //with the mutex locked
+    void cancelLocked(Request* request);
+
+    TextureLoader(const TextureLoader&); //not copyable
+    TextureLoader& operator=(const TextureLoader&);
+
+  public:
+
+    /*
+    factory: makes the textures in pump. numthreads: the amount of worker threads, 0 means one less
+    than the amount of processors (at least 1), leaving one for the main thread.
+    */
+    TextureLoader(const ITextureFactory* factory, size_t numthreads = 0);
+    ~TextureLoader(); //cancels all requests, there may be no handles left
+
+    //the textures of the image file cut in pieces of widths * heights, or one texture if those are 0, like loadTextures
+    Handle load(const std::string& filename, const AlphaEffect& effect = AE_Nothing, int widths = 0, int heights = 0, int priority = 0);
+
+    /*
+    Call regularly from the main thread: makes textures of the decoded images until budget
+    milliseconds are used, at least one texture per call if there is one to make. Returns the
+    amount of textures made.
+    */
+    size_t pump(double budget);
+
+    size_t getNumPending() const; //requests that aren't finished yet
+};
+
+} //namespace lpi
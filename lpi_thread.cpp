@@ -0,0 +1,180 @@
+/*
+Copyright (c) 2005-2010 Lode Vandevenne
+All rights reserved.
+
+This file is part of Lode's Programming Interface.
+
+Lode's Programming Interface is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Lode's Programming Interface is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "lpi_thread.h"
+
+#include "lpi_os.h"
+
+#if defined(LPI_OS_WINDOWS)
+#include <windows.h>
+#elif defined(LPI_OS_LINUX) || defined(LPI_OS_MACOSX)
+#include <unistd.h>
+#endif
+
+namespace lpi
+{
+
+size_t getNumProcessors()
+{
+  long result = 1;
+#if defined(LPI_OS_WINDOWS)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  result = info.dwNumberOfProcessors;
+#elif defined(LPI_OS_LINUX) || defined(LPI_OS_MACOSX)
+  result = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return result < 1 ? 1 : (size_t)result;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ThreadMutex::ThreadMutex()
+: mutex(SDL_CreateMutex())
+{
+}
+
+ThreadMutex::~ThreadMutex()
+{
+  SDL_DestroyMutex(mutex);
+}
+
+void ThreadMutex::lock()
+{
+  SDL_mutexP(mutex);
+}
+
+void ThreadMutex::unlock()
+{
+  SDL_mutexV(mutex);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+ThreadPool::ThreadPool(size_t numthreads)
+: mutex(SDL_CreateMutex())
+, wake(SDL_CreateCond())
+, done(SDL_CreateCond())
+, job(0)
+, count(0)
+, next(0)
+, busy(0)
+, generation(0)
+, quit(false)
+{
+  if(numthreads == 0) numthreads = getNumProcessors();
+  
+  //the calling thread of run is thread 0, so one less extra thread is needed
+  workerinfo.resize(numthreads - 1);
+  for(size_t i = 0; i < workerinfo.size(); i++)
+  {
+    workerinfo[i].pool = this;
+    workerinfo[i].thread = i + 1;
+    SDL_Thread* thread = SDL_CreateThread(&ThreadPool::workerMain, &workerinfo[i]);
+    if(!thread) break; //then the pool just has less threads
+    threads.push_back(thread);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  SDL_mutexP(mutex);
+  quit = true;
+  SDL_CondBroadcast(wake);
+  SDL_mutexV(mutex);
+  
+  for(size_t i = 0; i < threads.size(); i++) SDL_WaitThread(threads[i], 0);
+  
+  SDL_DestroyCond(done);
+  SDL_DestroyCond(wake);
+  SDL_DestroyMutex(mutex);
+}
+
+int ThreadPool::workerMain(void* data)
+{
+  WorkerInfo* info = (WorkerInfo*)data;
+  ThreadPool& pool = *info->pool;
+  size_t seen = 0; //the generation of the last job this worker did
+  
+  SDL_mutexP(pool.mutex);
+  for(;;)
+  {
+    while(pool.generation == seen && !pool.quit) SDL_CondWait(pool.wake, pool.mutex);
+    if(pool.quit) break;
+    seen = pool.generation;
+    SDL_mutexV(pool.mutex);
+    
+    pool.work(info->thread);
+    
+    SDL_mutexP(pool.mutex);
+    pool.busy--;
+    if(pool.busy == 0) SDL_CondSignal(pool.done);
+  }
+  SDL_mutexV(pool.mutex);
+  
+  return 0;
+}
+
+//takes pieces of the current job until there are none left
+void ThreadPool::work(size_t thread)
+{
+  for(;;)
+  {
+    SDL_mutexP(mutex);
+    if(next >= count)
+    {
+      SDL_mutexV(mutex);
+      return;
+    }
+    size_t index = next++;
+    SDL_mutexV(mutex);
+    
+    job->execute(index, thread);
+  }
+}
+
+void ThreadPool::run(Job& job, size_t count)
+{
+  if(count == 0) return;
+  
+  if(threads.empty() || count == 1)
+  {
+    for(size_t i = 0; i < count; i++) job.execute(i, 0);
+    return;
+  }
+  
+  SDL_mutexP(mutex);
+  this->job = &job;
+  this->count = count;
+  next = 0;
+  busy = threads.size();
+  generation++;
+  SDL_CondBroadcast(wake);
+  SDL_mutexV(mutex);
+  
+  work(0);
+  
+  SDL_mutexP(mutex);
+  while(busy > 0) SDL_CondWait(done, mutex);
+  this->job = 0;
+  SDL_mutexV(mutex);
+}
+
+} //namespace lpi
@@ -0,0 +1,131 @@
+/*
+Copyright (c) 2005-2010 Lode Vandevenne
+All rights reserved.
+
+This file is part of Lode's Programming Interface.
+
+Lode's Programming Interface is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+Lode's Programming Interface is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with Lode's Programming Interface.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma once
+
+#include <SDL/SDL.h>
+
+#include <cstddef>
+#include <vector>
+
+/*
+lpi_thread: small helpers for multithreading on top of the SDL threads: a mutex
+with a destructor, and a pool of worker threads that can split a job in pieces.
+*/
+
+namespace lpi
+{
+
+size_t getNumProcessors(); //the amount of logical processors, at least 1
+
+//SDL mutex that is created in the constructor and destroyed in the destructor
+class ThreadMutex
+{
+  private:
+    SDL_mutex* mutex;
+    
+    ThreadMutex(const ThreadMutex&); //not copyable
+    ThreadMutex& operator=(const ThreadMutex&);
+    
+  public:
+    ThreadMutex();
+    ~ThreadMutex();
+    
+    void lock();
+    void unlock();
+    
+    SDL_mutex* getSDLMutex() { return mutex; } //e.g. for SDL_CondWait
+};
+
+//locks the mutex in the constructor and unlocks it in the destructor, no matter where you leave the scope
+class ThreadLock
+{
+  private:
+    ThreadMutex& mutex;
+    
+    ThreadLock(const ThreadLock&);
+    ThreadLock& operator=(const ThreadLock&);
+    
+  public:
+    ThreadLock(ThreadMutex& mutex) : mutex(mutex) { mutex.lock(); }
+    ~ThreadLock() { mutex.unlock(); }
+};
+
+/*
+ThreadPool: a fixed amount of threads that wait for jobs. A job is split in a
+number of pieces, and each thread takes the next piece as soon as it's done with
+the previous one, so pieces that take a different amount of time are spread well.
+The thread that calls run works along, and run returns when all pieces are done.
+*/
+class ThreadPool
+{
+  public:
+  
+    class Job
+    {
+      public:
+        virtual ~Job(){}
+        /*
+        Called once for every index in range 0 to count - 1 given to run, from any thread
+        of the pool. thread is in range 0 to getNumThreads() - 1 and identifies the thread
+        that calls it, so that each thread can have its own data.
+        */
+        virtual void execute(size_t index, size_t thread) = 0;
+    };
+  
+  private:
+  
+    std::vector<SDL_Thread*> threads;
+    SDL_mutex* mutex;
+    SDL_cond* wake; //signals the workers that there's a new job or that they have to quit
+    SDL_cond* done; //signals run that all workers are done
+    
+    Job* job;
+    size_t count; //amount of pieces of the current job
+    size_t next; //next piece to execute
+    size_t busy; //amount of workers that didn't finish the current job yet
+    size_t generation; //increased for every job, so that the workers know there's a new one
+    bool quit;
+    
+    struct WorkerInfo
+    {
+      ThreadPool* pool;
+      size_t thread;
+    };
+    std::vector<WorkerInfo> workerinfo;
+    
+    static int workerMain(void* data);
+    void work(size_t thread);
+    
+    ThreadPool(const ThreadPool&); //not copyable
+    ThreadPool& operator=(const ThreadPool&);
+    
+  public:
+  
+    ThreadPool(size_t numthreads = 0); //numthreads includes the thread that calls run. 0 means getNumProcessors()
+    ~ThreadPool();
+    
+    size_t getNumThreads() const { return threads.size() + 1; }
+    
+    //executes the job for every index in range 0 to count - 1, and returns when all are done.
+    void run(Job& job, size_t count);
+};
+
+} //namespace lpi